@@ -0,0 +1,455 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "Benchmark.h"
+#include "..\\..\\AMD_SDK\\inc\\AMD_SDK.h"
+#include "CPUSort.h"
+#include "CPUParticleSimulation.h"
+#include "ParticleTrace.h"
+#include "Terrain.h"
+#include <algorithm>
+#include <random>
+
+
+// The name each stage has in the JSON output and the path of its timer
+static const char* g_StageNames[ Benchmark::NumStages ] = { "emit", "simulate", "upload", "sort", "coarse_cull", "fine_cull", "render", "total" };
+static const wchar_t* g_StageTimers[ Benchmark::NumStages ] = { L"Scene|Emission", L"Scene|Simulation", L"Scene|Upload", L"Scene|Sort", L"Scene|CoarseCulling", L"Scene|Culling", L"Scene|Render", L"Scene" };
+
+// Timed runs of each sort in the sort benchmark
+static const int g_SortBenchmarkRuns = 20;
+
+
+// Write a string to the JSON file as UTF-8, escaping the characters JSON requires
+static void WriteJSONString( FILE* fp, const wchar_t* string )
+{
+	char utf8[ MAX_PATH * 4 ];
+	if ( !WideCharToMultiByte( CP_UTF8, 0, string, -1, utf8, sizeof( utf8 ), nullptr, nullptr ) )
+	{
+		utf8[ 0 ] = 0;
+	}
+
+	fputc( '"', fp );
+	for ( const char* c = utf8; *c; c++ )
+	{
+		if ( *c == '"' || *c == '\\' )
+		{
+			fputc( '\\', fp );
+			fputc( *c, fp );
+		}
+		else if ( (unsigned char)*c < 0x20 )
+		{
+			fprintf( fp, "\\u%04x", *c );
+		}
+		else
+		{
+			fputc( *c, fp );
+		}
+	}
+	fputc( '"', fp );
+}
+
+
+static double ElapsedMilliseconds( const LARGE_INTEGER& start, const LARGE_INTEGER& end, const LARGE_INTEGER& frequency )
+{
+	return 1000.0 * (double)( end.QuadPart - start.QuadPart ) / (double)frequency.QuadPart;
+}
+
+
+// Write min/mean/median/p95/max of a set of times in milliseconds
+static void WriteJSONStatistics( FILE* fp, const char* name, const std::vector<double>& times )
+{
+	std::vector<double> sorted( times );
+	std::sort( sorted.begin(), sorted.end() );
+
+	double sum = 0.0;
+	for ( size_t i = 0; i < sorted.size(); i++ )
+	{
+		sum += sorted[ i ];
+	}
+
+	size_t count = sorted.size();
+	double mean = count ? sum / count : 0.0;
+	double minimum = count ? sorted.front() : 0.0;
+	double maximum = count ? sorted.back() : 0.0;
+	double median = count ? sorted[ count / 2 ] : 0.0;
+	double p95 = count ? sorted[ std::min( count - 1, ( count * 95 ) / 100 ) ] : 0.0;
+
+	fprintf( fp, "\"%s\": { \"min\": %.4f, \"mean\": %.4f, \"median\": %.4f, \"p95\": %.4f, \"max\": %.4f }", name, minimum, mean, median, p95, maximum );
+}
+
+
+Benchmark::Benchmark() :
+	m_UseCPUSystem( false ),
+	m_WarmupFrames( 10 ),
+	m_NumFrames( 0 ),
+	m_SortBenchmarkItems( 0 ),
+	m_ValidateFormat( false ),
+	m_Headless( false )
+{
+	m_TracePath[ 0 ] = 0;
+	wcscpy_s( m_OutputPath, L"benchmark.json" );
+}
+
+
+bool Benchmark::ParseCommandLine( int argc, wchar_t** argv )
+{
+	bool enabled = false;
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		const wchar_t* arg = argv[ i ];
+		if ( arg[ 0 ] != L'-' && arg[ 0 ] != L'/' )
+			continue;
+
+		arg++;
+		if ( _wcsnicmp( arg, L"benchmark:", 10 ) == 0 )
+		{
+			wcscpy_s( m_TracePath, arg + 10 );
+			enabled = true;
+		}
+		else if ( _wcsnicmp( arg, L"backend:", 8 ) == 0 )
+		{
+			m_UseCPUSystem = _wcsicmp( arg + 8, L"cpu" ) == 0;
+		}
+		else if ( _wcsnicmp( arg, L"warmup:", 7 ) == 0 )
+		{
+			m_WarmupFrames = std::max( 0, _wtoi( arg + 7 ) );
+		}
+		else if ( _wcsnicmp( arg, L"sortbenchmark:", 14 ) == 0 )
+		{
+			m_SortBenchmarkItems = std::max( 0, _wtoi( arg + 14 ) );
+		}
+		else if ( _wcsicmp( arg, L"validateformat" ) == 0 )
+		{
+			m_ValidateFormat = true;
+		}
+		else if ( _wcsicmp( arg, L"headless" ) == 0 )
+		{
+			m_Headless = true;
+		}
+		else if ( _wcsnicmp( arg, L"out:", 4 ) == 0 )
+		{
+			wcscpy_s( m_OutputPath, arg + 4 );
+		}
+	}
+
+	return enabled;
+}
+
+
+void Benchmark::RecordFrame( int frameIndex )
+{
+	if ( frameIndex < m_WarmupFrames )
+		return;
+
+	m_NumFrames++;
+
+	for ( int i = 0; i < NumStages; i++ )
+	{
+		// The CPU timers are zeroed every frame so a stage that didn't run this frame reads zero. Leave it out rather than averaging in zeros
+		double cpuTime = TIMER_GetTime( Cpu, g_StageTimers[ i ] );
+		if ( cpuTime <= 0.0 )
+			continue;
+
+		m_Stages[ i ].m_Cpu.push_back( cpuTime * 1000.0 );
+		m_Stages[ i ].m_Gpu.push_back( TIMER_WaitForGpuAndGetTime( g_StageTimers[ i ] ) * 1000.0 );
+	}
+}
+
+
+bool Benchmark::WriteResults( const wchar_t* deviceName, int maxParticles ) const
+{
+	FILE* fp = nullptr;
+	_wfopen_s( &fp, m_OutputPath, L"wt" );
+	if ( !fp )
+		return false;
+
+	fprintf( fp, "{\n" );
+	fprintf( fp, "  \"trace\": " );
+	WriteJSONString( fp, m_TracePath );
+	fprintf( fp, ",\n  \"device\": " );
+	WriteJSONString( fp, deviceName );
+	fprintf( fp, ",\n  \"backend\": \"%s\",\n", m_UseCPUSystem ? "cpu" : "gpu" );
+	fprintf( fp, "  \"max_particles\": %d,\n", maxParticles );
+	fprintf( fp, "  \"warmup_frames\": %d,\n", m_WarmupFrames );
+	fprintf( fp, "  \"frames\": %d,\n", m_NumFrames );
+	fprintf( fp, "  \"stages\": {\n" );
+
+	bool first = true;
+	for ( int i = 0; i < NumStages; i++ )
+	{
+		const StageTimes& stage = m_Stages[ i ];
+		if ( stage.m_Cpu.empty() )
+			continue;
+
+		fprintf( fp, "%s    \"%s\": {\n", first ? "" : ",\n", g_StageNames[ i ] );
+		fprintf( fp, "      \"frames\": %d,\n      ", (int)stage.m_Cpu.size() );
+		WriteJSONStatistics( fp, "cpu_ms", stage.m_Cpu );
+
+		// A headless run has no GPU times
+		if ( !stage.m_Gpu.empty() )
+		{
+			fprintf( fp, ",\n      " );
+			WriteJSONStatistics( fp, "gpu_ms", stage.m_Gpu );
+		}
+		fprintf( fp, "\n    }" );
+		first = false;
+	}
+
+	fprintf( fp, "\n  }\n}\n" );
+
+	bool ok = ferror( fp ) == 0;
+	fclose( fp );
+	return ok;
+}
+
+
+bool Benchmark::RunHeadlessBenchmark( int maxParticles, IParticleSystem::Layout layout )
+{
+	ParticleTraceReader reader;
+	ParticleTraceFrame frame;
+	if ( !reader.Open( m_TracePath ) || !reader.ReadFrame( 0, frame ) )
+	{
+		DXUTTRACE( L"Failed to load the particle trace %s\n", m_TracePath );
+		return false;
+	}
+
+	// Only the CPU simulation can run without a device
+	m_UseCPUSystem = true;
+
+	JobSystem jobSystem;
+	jobSystem.Init();
+
+	CPUParticleSimulation simulation;
+	simulation.Init( maxParticles, &jobSystem, layout );
+
+	EmitterTable emitterTable;
+	int scene = frame.m_Scene;
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency( &frequency );
+
+	// The same stages in the same order as CPUParticleSystem::Render, minus the upload and rendering
+	bool ok = true;
+	for ( int i = 0; i < reader.GetNumFrames() && ok; i++ )
+	{
+		ok = reader.ReadFrame( i, frame );
+		if ( !ok )
+			break;
+
+		// Switching scene in the sample resets the particle system so do the same here
+		if ( frame.m_Scene != scene )
+		{
+			scene = frame.m_Scene;
+			simulation.Reset();
+		}
+
+		if ( !frame.m_EmitterProperties.empty() )
+		{
+			emitterTable.Set( 0, (int)frame.m_EmitterProperties.size(), &frame.m_EmitterProperties[ 0 ] );
+		}
+
+		const IParticleSystem::EmitterParams* emitters = frame.m_Emitters.empty() ? nullptr : &frame.m_Emitters[ 0 ];
+		bool sort = ( frame.m_Flags & IParticleSystem::PF_Sort ) != 0;
+
+		LARGE_INTEGER start, emitted, simulated, sorted;
+		QueryPerformanceCounter( &start );
+		simulation.Emit( (int)frame.m_Emitters.size(), emitters, frame.m_Constants );
+		QueryPerformanceCounter( &emitted );
+		simulation.Simulate( frame.m_FrameTime, frame.m_Constants, emitterTable );
+		QueryPerformanceCounter( &simulated );
+		if ( sort )
+		{
+			simulation.Sort();
+		}
+		QueryPerformanceCounter( &sorted );
+
+		if ( i < m_WarmupFrames )
+			continue;
+
+		m_NumFrames++;
+		m_Stages[ Stage_Emit ].m_Cpu.push_back( ElapsedMilliseconds( start, emitted, frequency ) );
+		m_Stages[ Stage_Simulate ].m_Cpu.push_back( ElapsedMilliseconds( emitted, simulated, frequency ) );
+		if ( sort )
+		{
+			m_Stages[ Stage_Sort ].m_Cpu.push_back( ElapsedMilliseconds( simulated, sorted, frequency ) );
+		}
+		m_Stages[ Stage_Total ].m_Cpu.push_back( ElapsedMilliseconds( start, sorted, frequency ) );
+	}
+
+	if ( !ok )
+	{
+		DXUTTRACE( L"The particle trace %s is corrupt\n", m_TracePath );
+	}
+
+	simulation.Release();
+	jobSystem.Release();
+
+	return ok && WriteResults( L"None (headless)", maxParticles );
+}
+
+
+// Time a sort over a fresh copy of the input on every run. Returns false if any run didn't match the reference order
+static bool TimeSort( const std::vector<CPUSortLib::Item>& input, const std::vector<CPUSortLib::Item>& reference, int warmupRuns, std::vector<double>& times, const std::function<void( CPUSortLib::Item* items, unsigned int count )>& sort )
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency( &frequency );
+
+	std::vector<CPUSortLib::Item> items( input.size() );
+	bool matches = true;
+
+	for ( int run = 0; run < warmupRuns + g_SortBenchmarkRuns; run++ )
+	{
+		items = input;
+
+		LARGE_INTEGER start, end;
+		QueryPerformanceCounter( &start );
+		sort( items.data(), (unsigned int)items.size() );
+		QueryPerformanceCounter( &end );
+
+		if ( run >= warmupRuns )
+		{
+			times.push_back( 1000.0 * (double)( end.QuadPart - start.QuadPart ) / (double)frequency.QuadPart );
+		}
+
+		// QuickDepthSort isn't stable so only the distances are compared
+		for ( size_t i = 0; i < items.size(); i++ )
+		{
+			matches = matches && items[ i ].distance == reference[ i ].distance;
+		}
+	}
+
+	return matches;
+}
+
+
+bool Benchmark::RunSortBenchmark() const
+{
+	const unsigned int numItems = (unsigned int)m_SortBenchmarkItems;
+
+	// Distances spread over the scene like the alive list sees, with a fixed seed so every run sorts the same data
+	std::vector<CPUSortLib::Item> input( numItems );
+	std::mt19937 generator( 1234 );
+	std::uniform_real_distribution<float> distribution( 0.0f, 500.0f );
+	for ( unsigned int i = 0; i < numItems; i++ )
+	{
+		input[ i ].distance = distribution( generator );
+		input[ i ].index = (float)i;
+	}
+
+	std::vector<CPUSortLib::Item> reference( input );
+	std::stable_sort( reference.begin(), reference.end(), []( const CPUSortLib::Item& a, const CPUSortLib::Item& b ) { return a.distance < b.distance; } );
+
+	FILE* fp = nullptr;
+	_wfopen_s( &fp, m_OutputPath, L"wt" );
+	if ( !fp )
+		return false;
+
+	bool allMatch = true;
+
+	fprintf( fp, "{\n" );
+	fprintf( fp, "  \"items\": %u,\n", numItems );
+	fprintf( fp, "  \"warmup_runs\": %d,\n", m_WarmupFrames );
+	fprintf( fp, "  \"runs\": %d,\n", g_SortBenchmarkRuns );
+	fprintf( fp, "  \"sorts\": {\n" );
+
+	// The radix sort at 1, 2, 4... threads up to one per hardware thread
+	int maxThreads = std::max( 1, (int)std::thread::hardware_concurrency() );
+	for ( int numThreads = 1; ; numThreads = std::min( numThreads * 2, maxThreads ) )
+	{
+		JobSystem jobSystem;
+		jobSystem.Init( numThreads );
+
+		CPUSortLib sortLib;
+		sortLib.init( &jobSystem );
+
+		std::vector<double> times;
+		bool matches = TimeSort( input, reference, m_WarmupFrames, times, [&]( CPUSortLib::Item* items, unsigned int count ) { sortLib.run( numItems, items, count ); } );
+
+		// The radix sort is stable so has to match the reference exactly, index included
+		std::vector<CPUSortLib::Item> items( input );
+		sortLib.run( numItems, items.data(), numItems );
+		for ( unsigned int i = 0; i < numItems; i++ )
+		{
+			matches = matches && items[ i ].index == reference[ i ].index;
+		}
+
+		sortLib.release();
+		jobSystem.Release();
+
+		fprintf( fp, "    \"cpu_radix_%d\": {\n", numThreads );
+		fprintf( fp, "      \"threads\": %d,\n      \"matches_reference\": %s,\n      ", numThreads, matches ? "true" : "false" );
+		WriteJSONStatistics( fp, "cpu_ms", times );
+		fprintf( fp, "\n    },\n" );
+		allMatch = allMatch && matches;
+
+		if ( numThreads == maxThreads )
+			break;
+	}
+
+	std::vector<double> times;
+	bool matches = TimeSort( input, reference, m_WarmupFrames, times, []( CPUSortLib::Item* items, unsigned int count )
+	{
+		std::sort( items, items + count, []( const CPUSortLib::Item& a, const CPUSortLib::Item& b ) { return a.distance < b.distance; } );
+	} );
+
+	fprintf( fp, "    \"std_sort\": {\n" );
+	fprintf( fp, "      \"threads\": 1,\n      \"matches_reference\": %s,\n      ", matches ? "true" : "false" );
+	WriteJSONStatistics( fp, "cpu_ms", times );
+	fprintf( fp, "\n    },\n" );
+	allMatch = allMatch && matches;
+
+	// QuickDepthSort works on separate index and depth arrays so the split is part of what it costs
+	std::vector<int> indices( numItems );
+	std::vector<float> depths( numItems );
+	times.clear();
+	matches = TimeSort( input, reference, m_WarmupFrames, times, [&]( CPUSortLib::Item* items, unsigned int count )
+	{
+		for ( unsigned int i = 0; i < count; i++ )
+		{
+			indices[ i ] = (int)items[ i ].index;
+			depths[ i ] = items[ i ].distance;
+		}
+
+		if ( count > 1 )
+		{
+			QuickDepthSort( indices.data(), depths.data(), 0, (int)count - 1 );
+		}
+
+		for ( unsigned int i = 0; i < count; i++ )
+		{
+			items[ i ].distance = depths[ i ];
+			items[ i ].index = (float)indices[ i ];
+		}
+	} );
+
+	fprintf( fp, "    \"quick_depth_sort\": {\n" );
+	fprintf( fp, "      \"threads\": 1,\n      \"matches_reference\": %s,\n      ", matches ? "true" : "false" );
+	WriteJSONStatistics( fp, "cpu_ms", times );
+	fprintf( fp, "\n    }\n" );
+	allMatch = allMatch && matches;
+
+	fprintf( fp, "  }\n}\n" );
+
+	bool ok = ferror( fp ) == 0;
+	fclose( fp );
+	return ok && allMatch;
+}
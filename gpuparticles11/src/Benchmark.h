@@ -0,0 +1,100 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+
+#include "..\\..\\DXUT\\Core\\DXUT.h"
+#include "ParticleSystem.h"
+#include <vector>
+
+
+// Times each stage of the particle pipeline while a recorded trace is replayed and writes the statistics out as JSON. The stages
+// are read from the AMD_SDK timer tree so this relies on both particle systems marking them up with AMDProfileEvent
+class Benchmark
+{
+public:
+
+	// The timed stages. Everything apart from the total is a child of the "Scene" timer
+	enum Stage
+	{
+		Stage_Emit,
+		Stage_Simulate,
+		Stage_Upload,
+		Stage_Sort,
+		Stage_CoarseCull,
+		Stage_FineCull,
+		Stage_Render,
+		Stage_Total,
+		NumStages
+	};
+
+	Benchmark();
+
+	// Parse -benchmark:<trace> -backend:<gpu|cpu> -headless -warmup:<frames> -sortbenchmark:<items> -validateformat -out:<file>. Returns
+	// true if -benchmark was given
+	bool ParseCommandLine( int argc, wchar_t** argv );
+
+	const wchar_t*	GetTracePath() const { return m_TracePath; }
+	bool			UseCPUSystem() const { return m_UseCPUSystem; }
+	int				GetWarmupFrames() const { return m_WarmupFrames; }
+	int				GetSortBenchmarkItems() const { return m_SortBenchmarkItems; }
+	bool			ValidateFormat() const { return m_ValidateFormat; }
+	bool			IsHeadless() const { return m_Headless; }
+
+	// Read the timers for the frame that has just been rendered. This stalls until the GPU has finished the frame so the times 
+	// aren't skewed by other frames in flight. Warmup frames are skipped
+	void RecordFrame( int frameIndex );
+
+	// Write the statistics of every recorded frame to the -out file
+	bool WriteResults( const wchar_t* deviceName, int maxParticles ) const;
+
+	// Replay the trace through the CPU simulation alone and write the emit, simulate and sort times to the -out file. Nothing is drawn 
+	// so this doesn't need a device, for machines without a usable GPU. The trace's emitters are simulated in a pool of maxParticles
+	bool RunHeadlessBenchmark( int maxParticles, IParticleSystem::Layout layout );
+
+	// Time CPUSortLib at each thread count against std::sort and QuickDepthSort on the same random distances and write the results
+	// to the -out file. The warmup count is used as the number of untimed runs. Doesn't need a device
+	bool RunSortBenchmark() const;
+
+private:
+
+	struct StageTimes
+	{
+		std::vector<double>	m_Cpu;
+		std::vector<double>	m_Gpu;
+	};
+
+	wchar_t			m_TracePath[ MAX_PATH ];
+	wchar_t			m_OutputPath[ MAX_PATH ];
+	bool			m_UseCPUSystem;
+	int				m_WarmupFrames;
+	int				m_NumFrames;
+	int				m_SortBenchmarkItems;
+	bool			m_ValidateFormat;
+	bool			m_Headless;
+
+	StageTimes		m_Stages[ NumStages ];
+};
+
+
+#endif
@@ -0,0 +1,809 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "CPUParticleSimulation.h"
+#include "Shaders/Random.h"
+#include <algorithm>
+
+
+#pragma warning( disable : 4100 ) // disable unreference formal parameter warnings for /W4 builds
+
+
+// Number of particles handed to a thread at a time. Big enough to amortize the scheduling, small enough to balance across cores
+static const int g_SimulationChunkSize = 4096;
+
+// Emission is much cheaper per particle so use bigger chunks
+static const int g_EmissionChunkSize = 16384;
+
+// Particles simulated together by SimulateRangeSoA, one per SIMD lane
+static const int g_SimulationLanes = 4;
+
+
+// Random vector in [-1, 1) from the generator shared with CS_Emit, so a given key gives the same values on the CPU and GPU
+static inline DirectX::XMVECTOR RandomVector3( RandomUInt3 key )
+{
+	RandomUInt3 r = RandomPCG3D( key );
+	return DirectX::XMVectorSet( RandomToSignedFloat( r.x ), RandomToSignedFloat( r.y ), RandomToSignedFloat( r.z ), 0.0f );
+}
+
+
+// Load a float4 element of four particles and transpose them, so each row holds one component of every particle
+static inline DirectX::XMMATRIX LoadTransposed( const float* stream, const int* index )
+{
+	return DirectX::XMMatrixTranspose( DirectX::XMMATRIX(
+		DirectX::XMLoadFloat4( (const DirectX::XMFLOAT4*)( stream + 4 * index[ 0 ] ) ),
+		DirectX::XMLoadFloat4( (const DirectX::XMFLOAT4*)( stream + 4 * index[ 1 ] ) ),
+		DirectX::XMLoadFloat4( (const DirectX::XMFLOAT4*)( stream + 4 * index[ 2 ] ) ),
+		DirectX::XMLoadFloat4( (const DirectX::XMFLOAT4*)( stream + 4 * index[ 3 ] ) ) ) );
+}
+
+
+// The inverse of LoadTransposed. Only the first numLanes particles are written
+static inline void StoreTransposed( float* stream, const int* index, int numLanes, DirectX::FXMVECTOR x, DirectX::FXMVECTOR y, DirectX::FXMVECTOR z, DirectX::CXMVECTOR w )
+{
+	DirectX::XMMATRIX rows = DirectX::XMMatrixTranspose( DirectX::XMMATRIX( x, y, z, w ) );
+	for ( int k = 0; k < numLanes; k++ )
+	{
+		DirectX::XMStoreFloat4( (DirectX::XMFLOAT4*)( stream + 4 * index[ k ] ), rows.r[ k ] );
+	}
+}
+
+
+// Gather one float of four particles from a stream whose elements are stride floats apart
+static inline DirectX::XMVECTOR Gather( const float* stream, int stride, const int* index )
+{
+	return DirectX::XMVectorSet( stream[ stride * index[ 0 ] ], stream[ stride * index[ 1 ] ], stream[ stride * index[ 2 ] ], stream[ stride * index[ 3 ] ] );
+}
+
+
+static inline void StoreLanes( float* lanes, DirectX::FXMVECTOR v )
+{
+	DirectX::XMStoreFloat4( (DirectX::XMFLOAT4*)lanes, v );
+}
+
+
+// One component of XMVector3TransformNormal for four particles. The column holds the replicated matrix elements of that component
+static inline DirectX::XMVECTOR TransformNormalComponent( DirectX::FXMVECTOR x, DirectX::FXMVECTOR y, DirectX::FXMVECTOR z, const DirectX::XMVECTOR* column )
+{
+	return DirectX::XMVectorMultiplyAdd( x, column[ 0 ], DirectX::XMVectorMultiplyAdd( y, column[ 1 ], DirectX::XMVectorMultiply( z, column[ 2 ] ) ) );
+}
+
+
+// One component of XMVector3Transform for four particles
+static inline DirectX::XMVECTOR TransformComponent( DirectX::FXMVECTOR x, DirectX::FXMVECTOR y, DirectX::FXMVECTOR z, const DirectX::XMVECTOR* column )
+{
+	return DirectX::XMVectorMultiplyAdd( x, column[ 0 ], DirectX::XMVectorMultiplyAdd( y, column[ 1 ], DirectX::XMVectorMultiplyAdd( z, column[ 2 ], column[ 3 ] ) ) );
+}
+
+
+static inline UINT WriteEmitterProperties( UINT emitterIndex, UINT textureIndex, bool isStreakEmitter )
+{
+	UINT properties = emitterIndex & 0xffff;
+
+	properties |= textureIndex << 16;
+
+	if ( isStreakEmitter )
+	{
+		properties |= 1 << 24;
+	}
+
+	return properties;
+}
+
+
+CPUParticleSimulation::CPUParticleSimulation() :
+	m_MaxParticles( 0 ),
+	m_pJobSystem( nullptr ),
+	m_Layout( IParticleSystem::Layout_AoS ),
+	m_pParticleData( nullptr ),
+	m_pViewSpacePositions( nullptr ),
+	m_pMaxRadius( nullptr ),
+	m_pDeadList( nullptr ),
+	m_NumDead( 0 ),
+	m_pAliveList( nullptr ),
+	m_NumAlive( 0 ),
+	m_pAliveScratch( nullptr ),
+	m_pDeadScratch( nullptr ),
+	m_EmitFrame( 0 )
+{
+}
+
+
+CPUParticleSimulation::~CPUParticleSimulation()
+{
+	Release();
+}
+
+
+void CPUParticleSimulation::Init( int maxParticles, JobSystem* jobSystem, IParticleSystem::Layout layout )
+{
+	Release();
+
+	m_MaxParticles = maxParticles;
+	m_pJobSystem = jobSystem;
+	m_Layout = layout;
+	m_SortLib.init( jobSystem );
+
+	// 16 byte alignment so the SIMD loads and stores never straddle cache lines
+	m_pParticleData = _aligned_malloc( GetParticleDataSize(), 16 );
+	m_pViewSpacePositions = (DirectX::XMFLOAT4*)_aligned_malloc( sizeof( DirectX::XMFLOAT4 ) * maxParticles, 16 );
+	m_pMaxRadius = (float*)_aligned_malloc( sizeof( float ) * maxParticles, 16 );
+
+	m_pDeadList = new UINT[ maxParticles ];
+	m_pDeadScratch = new UINT[ maxParticles ];
+	m_pAliveList = new CPUAliveIndex[ maxParticles ];
+	m_pAliveScratch = new CPUAliveIndex[ maxParticles ];
+
+	int numChunks = ( maxParticles + g_SimulationChunkSize - 1 ) / g_SimulationChunkSize;
+	m_ChunkAliveCounts.resize( numChunks );
+	m_ChunkDeadCounts.resize( numChunks );
+
+	Reset();
+}
+
+
+void CPUParticleSimulation::Release()
+{
+	_aligned_free( m_pParticleData );
+	_aligned_free( m_pViewSpacePositions );
+	_aligned_free( m_pMaxRadius );
+	m_pParticleData = nullptr;
+	m_pViewSpacePositions = nullptr;
+	m_pMaxRadius = nullptr;
+
+	delete[] m_pDeadList;
+	delete[] m_pDeadScratch;
+	delete[] m_pAliveList;
+	delete[] m_pAliveScratch;
+	m_pDeadList = nullptr;
+	m_pDeadScratch = nullptr;
+	m_pAliveList = nullptr;
+	m_pAliveScratch = nullptr;
+
+	m_ChunkAliveCounts.clear();
+	m_ChunkDeadCounts.clear();
+	m_SortLib.release();
+
+	m_MaxParticles = 0;
+	m_NumDead = 0;
+	m_NumAlive = 0;
+}
+
+
+// Equivalent of InitDeadList.hlsl and CS_Reset
+void CPUParticleSimulation::Reset()
+{
+	BYTE* data = (BYTE*)m_pParticleData;
+	UINT* deadList = m_pDeadList;
+
+	// Zero is a dead particle in every layout so clear the whole block without caring about the layout
+	int dataSize = (int)GetParticleDataSize();
+	m_pJobSystem->ParallelFor( dataSize, g_SimulationChunkSize * 64, [=]( int begin, int end )
+	{
+		memset( data + begin, 0, end - begin );
+	} );
+
+	m_pJobSystem->ParallelFor( m_MaxParticles, g_SimulationChunkSize, [=]( int begin, int end )
+	{
+		for ( int i = begin; i < end; i++ )
+		{
+			deadList[ i ] = (UINT)i;
+		}
+	} );
+
+	m_NumDead = m_MaxParticles;
+	m_NumAlive = 0;
+	m_EmitFrame = 0;
+}
+
+
+// Copy the first numParticles particles of the alive list into consecutive slots of the new storage
+template<class Storage>
+static void MigrateParticles( Storage dst, Storage src, const CPUAliveIndex* aliveList, int numParticles, JobSystem* jobSystem )
+{
+	jobSystem->ParallelFor( numParticles, g_SimulationChunkSize, [&]( int begin, int end )
+	{
+		CPUParticlePartA pa;
+		CPUParticlePartB pb;
+		for ( int i = begin; i < end; i++ )
+		{
+			src.Load( (int)aliveList[ i ].m_Index, pa, pb );
+			dst.Store( i, pa, pb );
+		}
+	} );
+}
+
+
+void CPUParticleSimulation::Resize( int maxParticles )
+{
+	if ( maxParticles == m_MaxParticles )
+		return;
+
+	// Hang on to the old particles and alive list while the pool is reallocated
+	void* oldParticleData = m_pParticleData;
+	CPUAliveIndex* oldAliveList = m_pAliveList;
+	int oldMaxParticles = m_MaxParticles;
+	int numToMigrate = std::min( m_NumAlive, maxParticles );
+	m_pParticleData = nullptr;
+	m_pAliveList = nullptr;
+
+	// The emission random numbers are keyed by frame, so resizing mustn't restart the count like a reset does
+	UINT emitFrame = m_EmitFrame;
+
+	Init( maxParticles, m_pJobSystem, m_Layout );
+	m_EmitFrame = emitFrame;
+
+	switch ( m_Layout )
+	{
+		case IParticleSystem::Layout_SoA:		MigrateParticles( SoAParticleStorage( m_pParticleData, m_MaxParticles ), SoAParticleStorage( oldParticleData, oldMaxParticles ), oldAliveList, numToMigrate, m_pJobSystem ); break;
+		case IParticleSystem::Layout_Compact:	MigrateParticles( CompactParticleStorage( m_pParticleData, m_MaxParticles ), CompactParticleStorage( oldParticleData, oldMaxParticles ), oldAliveList, numToMigrate, m_pJobSystem ); break;
+		default:								MigrateParticles( AoSParticleStorage( m_pParticleData, m_MaxParticles ), AoSParticleStorage( oldParticleData, oldMaxParticles ), oldAliveList, numToMigrate, m_pJobSystem ); break;
+	}
+
+	// The migrated particles keep their sort order. Everything after them is free
+	for ( int i = 0; i < numToMigrate; i++ )
+	{
+		m_pAliveList[ i ].m_Distance = oldAliveList[ i ].m_Distance;
+		m_pAliveList[ i ].m_Index = (float)i;
+	}
+	m_NumAlive = numToMigrate;
+
+	m_NumDead = m_MaxParticles - numToMigrate;
+	for ( int i = 0; i < m_NumDead; i++ )
+	{
+		m_pDeadList[ i ] = (UINT)( m_MaxParticles - 1 - i );
+	}
+
+	_aligned_free( oldParticleData );
+	delete[] oldAliveList;
+}
+
+
+size_t CPUParticleSimulation::GetParticleDataSize() const
+{
+	switch ( m_Layout )
+	{
+		case IParticleSystem::Layout_SoA:		return SoAParticleStorage::GetSize( m_MaxParticles );
+		case IParticleSystem::Layout_Compact:	return CompactParticleStorage::GetSize( m_MaxParticles );
+		default:								return AoSParticleStorage::GetSize( m_MaxParticles );
+	}
+}
+
+
+void CPUParticleSimulation::LoadParticle( int index, CPUParticlePartA& pa, CPUParticlePartB& pb ) const
+{
+	switch ( m_Layout )
+	{
+		case IParticleSystem::Layout_SoA:		SoAParticleStorage( m_pParticleData, m_MaxParticles ).Load( index, pa, pb ); break;
+		case IParticleSystem::Layout_Compact:	CompactParticleStorage( m_pParticleData, m_MaxParticles ).Load( index, pa, pb ); break;
+		default:								AoSParticleStorage( m_pParticleData, m_MaxParticles ).Load( index, pa, pb ); break;
+	}
+}
+
+
+void CPUParticleSimulation::Emit( int numEmitters, const IParticleSystem::EmitterParams* emitters, const PER_FRAME_CONSTANT_BUFFER& constants )
+{
+	switch ( m_Layout )
+	{
+		case IParticleSystem::Layout_SoA:		EmitParticles( SoAParticleStorage( m_pParticleData, m_MaxParticles ), numEmitters, emitters ); break;
+		case IParticleSystem::Layout_Compact:	EmitParticles( CompactParticleStorage( m_pParticleData, m_MaxParticles ), numEmitters, emitters ); break;
+		default:								EmitParticles( AoSParticleStorage( m_pParticleData, m_MaxParticles ), numEmitters, emitters ); break;
+	}
+}
+
+
+// Equivalent of CS_Emit in ParticleEmit.hlsl. All the emitters are emitted in one pass over the total number of new particles, with each 
+// emitter owning a contiguous range given by the running total of the particle counts. Particles are taken off the top of the dead list 
+// in emitter order and added to the end of the alive list so they are picked up by the simulation
+template<class Storage>
+void CPUParticleSimulation::EmitParticles( Storage storage, int numEmitters, const IParticleSystem::EmitterParams* emitters )
+{
+	// Work out each emitter's range. Once the dead list runs out the remaining emitters get nothing, same as emitting them one by one
+	m_EmissionBatch.clear();
+	int numToEmit = 0;
+	for ( int i = 0; i < numEmitters && numToEmit < m_NumDead; i++ )
+	{
+		const IParticleSystem::EmitterParams& emitter = emitters[ i ];
+		if ( emitter.m_NumToEmit <= 0 )
+			continue;
+
+		EmissionRange range;
+		range.m_pEmitter = &emitter;
+		range.m_FirstParticle = numToEmit;
+		range.m_EmitterIndex = (UINT)i;
+		range.m_Properties = WriteEmitterProperties( (UINT)i, (UINT)emitter.m_TextureIndex, emitter.m_Streaks );
+		range.m_VelocityMagnitude = DirectX::XMVectorGetX( DirectX::XMVector3Length( emitter.m_Velocity ) );
+		m_EmissionBatch.push_back( range );
+
+		numToEmit = std::min( numToEmit + emitter.m_NumToEmit, m_NumDead );
+	}
+
+	UINT emitFrame = m_EmitFrame++;
+
+	if ( numToEmit == 0 )
+		return;
+
+	const UINT* deadListTop = m_pDeadList + m_NumDead - 1;
+	CPUAliveIndex* newAlive = m_pAliveList + m_NumAlive;
+	const std::vector<EmissionRange>& batch = m_EmissionBatch;
+
+	m_pJobSystem->ParallelFor( numToEmit, g_EmissionChunkSize, [&]( int begin, int end )
+	{
+		// Find the emitter owning the first particle of this chunk, then walk forward through the emitters
+		int e = (int)( std::upper_bound( batch.begin(), batch.end(), begin, []( int particle, const EmissionRange& range ) { return particle < range.m_FirstParticle; } ) - batch.begin() ) - 1;
+
+		for ( int k = begin; k < end; k++ )
+		{
+			while ( e + 1 < (int)batch.size() && k >= batch[ e + 1 ].m_FirstParticle )
+			{
+				e++;
+			}
+
+			const EmissionRange& range = batch[ e ];
+			const IParticleSystem::EmitterParams& emitter = *range.m_pEmitter;
+
+			UINT index = *( deadListTop - k );
+
+			// The same key as CS_Emit: the emitter, the frame and the particle's index within the emitter
+			UINT emitterParticle = (UINT)( k - range.m_FirstParticle );
+			DirectX::XMVECTOR randomValues0 = RandomVector3( RandomEmissionKey( range.m_EmitterIndex, emitFrame, emitterParticle, 0 ) );
+			DirectX::XMVECTOR randomValues1 = RandomVector3( RandomEmissionKey( range.m_EmitterIndex, emitFrame, emitterParticle, 1 ) );
+
+			CPUParticlePartA pa;
+			CPUParticlePartB pb;
+			memset( &pa, 0, sizeof( pa ) );
+
+			DirectX::XMVECTOR position = DirectX::XMVectorMultiplyAdd( randomValues0, emitter.m_PositionVariance, emitter.m_Position );
+			DirectX::XMVECTOR velocity = DirectX::XMVectorMultiplyAdd( randomValues1, DirectX::XMVectorReplicate( range.m_VelocityMagnitude * emitter.m_VelocityVariance ), emitter.m_Velocity );
+
+			pa.m_EmitterProperties = range.m_Properties;
+
+			DirectX::XMStoreFloat3( &pb.m_Position, position );
+			DirectX::XMStoreFloat3( &pb.m_Velocity, velocity );
+			pb.m_Mass = emitter.m_Mass;
+			pb.m_Lifespan = emitter.m_ParticleLifeSpan;
+			pb.m_Age = emitter.m_ParticleLifeSpan;
+			pb.m_DistanceToEye = 0.0f;
+			pb.m_StartSize = emitter.m_StartSize;
+			pb.m_EndSize = emitter.m_EndSize;
+
+			storage.Store( index, pa, pb );
+
+			newAlive[ k ].m_Distance = 0.0f;
+			newAlive[ k ].m_Index = (float)index;
+		}
+	} );
+
+	m_NumDead -= numToEmit;
+	m_NumAlive += numToEmit;
+}
+
+
+// Equivalent of CS_Simulate in ParticleSimulation.hlsl, minus the depth buffer collisions which need the GPU depth buffer. Like the GPU
+// system only the particles on the alive list are visited, which at this point holds last frame's survivors and the newly emitted particles
+void CPUParticleSimulation::Simulate( float frameTime, const PER_FRAME_CONSTANT_BUFFER& constants, const EmitterTable& emitterTable )
+{
+	int numChunks = ( m_NumAlive + g_SimulationChunkSize - 1 ) / g_SimulationChunkSize;
+
+	// Simulate each chunk of the alive list independently. Alive and dead particles are written compactly into the scratch lists at the chunk's offset
+	m_pJobSystem->ParallelFor( m_NumAlive, g_SimulationChunkSize, [&]( int begin, int end )
+	{
+		int chunk = begin / g_SimulationChunkSize;
+
+		switch ( m_Layout )
+		{
+			case IParticleSystem::Layout_SoA:		SimulateRangeSoA( SoAParticleStorage( m_pParticleData, m_MaxParticles ), begin, end, chunk, frameTime, constants, emitterTable ); break;
+			case IParticleSystem::Layout_Compact:	SimulateRange( CompactParticleStorage( m_pParticleData, m_MaxParticles ), begin, end, chunk, frameTime, constants, emitterTable ); break;
+			default:								SimulateRange( AoSParticleStorage( m_pParticleData, m_MaxParticles ), begin, end, chunk, frameTime, constants, emitterTable ); break;
+		}
+	} );
+
+	// Work out where each chunk's lists go in the final lists. Newly dead particles are appended to the dead list
+	std::vector<int> aliveOffsets( numChunks );
+	std::vector<int> deadOffsets( numChunks );
+	int numAlive = 0;
+	int numDead = m_NumDead;
+	for ( int i = 0; i < numChunks; i++ )
+	{
+		aliveOffsets[ i ] = numAlive;
+		deadOffsets[ i ] = numDead;
+		numAlive += m_ChunkAliveCounts[ i ];
+		numDead += m_ChunkDeadCounts[ i ];
+	}
+
+	// Merge the lists
+	m_pJobSystem->ParallelFor( numChunks, 1, [&]( int begin, int end )
+	{
+		for ( int i = begin; i < end; i++ )
+		{
+			int chunkStart = i * g_SimulationChunkSize;
+			memcpy( m_pAliveList + aliveOffsets[ i ], m_pAliveScratch + chunkStart, sizeof( CPUAliveIndex ) * m_ChunkAliveCounts[ i ] );
+			memcpy( m_pDeadList + deadOffsets[ i ], m_pDeadScratch + chunkStart, sizeof( UINT ) * m_ChunkDeadCounts[ i ] );
+		}
+	} );
+
+	m_NumAlive = numAlive;
+	m_NumDead = numDead;
+}
+
+
+template<class Storage>
+void CPUParticleSimulation::SimulateRange( Storage storage, int begin, int end, int chunk, float frameTime, const PER_FRAME_CONSTANT_BUFFER& constants, const EmitterTable& emitterTable )
+{
+	// The constants are stored transposed for HLSL so undo that here
+	const DirectX::XMMATRIX mView = DirectX::XMMatrixTranspose( constants.m_View );
+
+	const DirectX::XMVECTOR vFrameTime = DirectX::XMVectorReplicate( frameTime );
+	const DirectX::XMVECTOR vGravity = DirectX::XMVectorSet( 0.0f, -9.81f, 0.0f, 0.0f );
+
+	// Apply a little bit of a wind force
+	const DirectX::XMVECTOR vWind = DirectX::XMVectorScale( DirectX::XMVector3Normalize( DirectX::XMVectorSet( 1.0f, 1.0f, 0.0f, 0.0f ) ), 0.1f * frameTime );
+
+	const DirectX::XMVECTOR vEye = constants.m_EyePosition;
+	const DirectX::XMVECTOR vSunDirectionXZ = DirectX::XMVectorSwizzle<0, 2, 0, 2>( constants.m_SunDirection );
+	const DirectX::XMVECTOR vSleepColor = DirectX::XMVectorSet( 1.0f, 0.0f, 1.0f, 0.0f );
+
+	CPUAliveIndex* aliveScratch = m_pAliveScratch + chunk * g_SimulationChunkSize;
+	UINT* deadScratch = m_pDeadScratch + chunk * g_SimulationChunkSize;
+	int numAlive = 0;
+	int numDead = 0;
+
+	for ( int j = begin; j < end; j++ )
+	{
+		// The index of the particle in the pool
+		int i = (int)m_pAliveList[ j ].m_Index;
+
+		CPUParticlePartA pa;
+		CPUParticlePartB pb;
+		storage.Load( i, pa, pb );
+
+		// Extract the individual emitter properties from the particle
+		UINT emitterIndex = pa.m_EmitterProperties & 0xffff;
+		bool streaks = ( ( pa.m_EmitterProperties >> 24 ) & 0x01 ) ? true : false;
+
+		// Age the particle by counting down from Lifespan to zero
+		pb.m_Age -= frameTime;
+
+		// Update the rotation
+		pa.m_Rotation += 0.24f * frameTime;
+
+		DirectX::XMVECTOR vVelocity = DirectX::XMLoadFloat3( &pb.m_Velocity );
+		DirectX::XMVECTOR vNewPosition = DirectX::XMLoadFloat3( &pb.m_Position );
+
+		// Apply force due to gravity and wind
+		if ( pa.m_IsSleeping == 0 )
+		{
+			vVelocity = DirectX::XMVectorMultiplyAdd( DirectX::XMVectorScale( vGravity, pb.m_Mass ), vFrameTime, vVelocity );
+			vVelocity = DirectX::XMVectorAdd( vVelocity, vWind );
+
+			// Calculate the new position of the particle
+			vNewPosition = DirectX::XMVectorMultiplyAdd( vVelocity, vFrameTime, vNewPosition );
+		}
+
+		// Calculate the normalized age
+		float fScaledLife = 1.0f - std::min( std::max( pb.m_Age / pb.m_Lifespan, 0.0f ), 1.0f );
+
+		// Calculate the size of the particle based on age
+		float radius = pb.m_StartSize + ( pb.m_EndSize - pb.m_StartSize ) * fScaledLife;
+
+		// Put particle to sleep if the velocity is small
+		if ( constants.m_EnableSleepState && pa.m_CollisionCount > 10 && DirectX::XMVectorGetX( DirectX::XMVector3Length( vVelocity ) ) < 0.01f )
+		{
+			pa.m_IsSleeping = 1;
+		}
+
+		// If the position is below the floor, let's kill it now rather than wait for it to retire
+		bool killParticle = DirectX::XMVectorGetY( vNewPosition ) < -10.0f;
+
+		// Write the new position
+		DirectX::XMStoreFloat3( &pb.m_Position, vNewPosition );
+		DirectX::XMStoreFloat3( &pb.m_Velocity, vVelocity );
+
+		// Calculate the the distance to the eye for sorting
+		pb.m_DistanceToEye = DirectX::XMVectorGetX( DirectX::XMVector3Length( DirectX::XMVectorSubtract( vNewPosition, vEye ) ) );
+
+		// The opacity is a function of the age, the color is lerped based on the age
+		float alpha = 1.0f - std::min( std::max( fScaledLife - 0.8f, 0.0f ), 1.0f ) / 0.2f;
+		const IParticleSystem::EmitterProperties& emitterProperties = emitterTable.Get( (int)emitterIndex );
+		DirectX::XMVECTOR vColor = DirectX::XMVectorLerp( DirectX::XMLoadFloat4( &emitterProperties.m_StartColor ), DirectX::XMLoadFloat4( &emitterProperties.m_EndColor ), std::min( 5.0f * fScaledLife, 1.0f ) );
+
+		if ( constants.m_ShowSleepingParticles && pa.m_IsSleeping == 1 )
+		{
+			vColor = vSleepColor;
+		}
+
+		vColor = DirectX::XMVectorSetW( vColor, pb.m_Age <= 0.0f ? 0.0f : alpha );
+		DirectX::XMStoreFloat4( &pa.m_TintAndAlpha, vColor );
+
+		// The emitter-based lighting models the emitter as a vertical cylinder
+		DirectX::XMVECTOR vToEmitterXZ = DirectX::XMVectorSwizzle<0, 2, 0, 2>( DirectX::XMVectorSubtract( vNewPosition, DirectX::XMLoadFloat4( &emitterProperties.m_LightingCenter ) ) );
+		DirectX::XMVECTOR vEmitterNormal = DirectX::XMVector2Normalize( vToEmitterXZ );
+
+		// Generate the lighting term for the emitter
+		float emitterNdotL = DirectX::XMVectorGetX( DirectX::XMVector2Dot( vSunDirectionXZ, vEmitterNormal ) ) + 0.5f;
+		pa.m_EmitterNdotL = std::min( std::max( emitterNdotL, 0.0f ), 1.0f );
+
+		// Transform the velocity into view space
+		DirectX::XMStoreFloat2( &pa.m_VelocityXY, DirectX::XMVector3TransformNormal( vVelocity, mView ) );
+
+		// Pack the view spaced position and radius
+		DirectX::XMVECTOR vViewSpacePosition = DirectX::XMVector3Transform( vNewPosition, mView );
+		DirectX::XMStoreFloat4( &m_pViewSpacePositions[ i ], DirectX::XMVectorSetW( vViewSpacePosition, radius ) );
+
+		// For streaked particles (the sparks), calculate the the max radius in XY
+		if ( streaks )
+		{
+			float velocityLength = DirectX::XMVectorGetX( DirectX::XMVector2Length( DirectX::XMLoadFloat2( &pa.m_VelocityXY ) ) );
+			float minRadius = radius * std::max( 1.0f, 0.1f * velocityLength );
+			m_pMaxRadius[ i ] = std::max( radius, minRadius );
+		}
+		else
+		{
+			// Not a streaked particle so will have rotation. When rotating, the particle has a max radius of the centre to the corner = sqrt( r^2 + r^2 )
+			m_pMaxRadius[ i ] = 1.41f * radius;
+		}
+
+		if ( pb.m_Age <= 0.0f || killParticle )
+		{
+			// Dead particles are added to the dead list for recycling
+			pb.m_Age = -1.0f;
+			deadScratch[ numDead++ ] = (UINT)i;
+		}
+		else
+		{
+			// Alive particles are added to the alive list
+			aliveScratch[ numAlive ].m_Distance = pb.m_DistanceToEye;
+			aliveScratch[ numAlive ].m_Index = (float)i;
+			numAlive++;
+		}
+
+		storage.StoreSimulated( i, pa, pb );
+	}
+
+	m_ChunkAliveCounts[ chunk ] = numAlive;
+	m_ChunkDeadCounts[ chunk ] = numDead;
+}
+
+
+// SimulateRange for the SoA layout with four particles per iteration, one per SIMD lane. The streams are gathered and transposed so
+// each vector holds one attribute of the four particles, which turns the per-particle math into straight vector math. The emitter
+// table lookups and the alive and dead lists are still handled a lane at a time. The results match SimulateRange apart from the 
+// order of some floating point operations
+void CPUParticleSimulation::SimulateRangeSoA( SoAParticleStorage storage, int begin, int end, int chunk, float frameTime, const PER_FRAME_CONSTANT_BUFFER& constants, const EmitterTable& emitterTable )
+{
+	float* positions = (float*)storage.GetStream( SOA_STREAM_POSITION );
+	float* velocities = (float*)storage.GetStream( SOA_STREAM_VELOCITY );
+	float* ages = (float*)storage.GetStream( SOA_STREAM_AGE );
+	const float* sizes = (const float*)storage.GetStream( SOA_STREAM_SIZE );
+	float* tints = (float*)storage.GetStream( SOA_STREAM_TINT );
+	float* renders = (float*)storage.GetStream( SOA_STREAM_RENDER );
+	const UINT* properties = (const UINT*)storage.GetStream( SOA_STREAM_PROPERTIES );
+	UINT* collisions = (UINT*)storage.GetStream( SOA_STREAM_COLLISION );
+
+	// The constants are stored transposed for HLSL so undo that here, then replicate each element of the view matrix's first three columns
+	DirectX::XMFLOAT4X4 view;
+	DirectX::XMStoreFloat4x4( &view, DirectX::XMMatrixTranspose( constants.m_View ) );
+	DirectX::XMVECTOR vViewColumns[ 3 ][ 4 ];
+	for ( int c = 0; c < 3; c++ )
+	{
+		for ( int r = 0; r < 4; r++ )
+		{
+			vViewColumns[ c ][ r ] = DirectX::XMVectorReplicate( view.m[ r ][ c ] );
+		}
+	}
+
+	const DirectX::XMVECTOR vZero = DirectX::XMVectorZero();
+	const DirectX::XMVECTOR vOne = DirectX::XMVectorSplatOne();
+	const DirectX::XMVECTOR vFrameTime = DirectX::XMVectorReplicate( frameTime );
+	const DirectX::XMVECTOR vRotation = DirectX::XMVectorReplicate( 0.24f * frameTime );
+
+	// Apply a little bit of a wind force. It has no z component
+	const DirectX::XMVECTOR vWind = DirectX::XMVectorScale( DirectX::XMVector3Normalize( DirectX::XMVectorSet( 1.0f, 1.0f, 0.0f, 0.0f ) ), 0.1f * frameTime );
+	const DirectX::XMVECTOR vWindX = DirectX::XMVectorSplatX( vWind );
+	const DirectX::XMVECTOR vWindY = DirectX::XMVectorSplatY( vWind );
+
+	const DirectX::XMVECTOR vEyeX = DirectX::XMVectorSplatX( constants.m_EyePosition );
+	const DirectX::XMVECTOR vEyeY = DirectX::XMVectorSplatY( constants.m_EyePosition );
+	const DirectX::XMVECTOR vEyeZ = DirectX::XMVectorSplatZ( constants.m_EyePosition );
+	const DirectX::XMVECTOR vSunX = DirectX::XMVectorSplatX( constants.m_SunDirection );
+	const DirectX::XMVECTOR vSunZ = DirectX::XMVectorSplatZ( constants.m_SunDirection );
+	const DirectX::XMVECTOR vSleepColor = DirectX::XMVectorSet( 1.0f, 0.0f, 1.0f, 0.0f );
+
+	CPUAliveIndex* aliveScratch = m_pAliveScratch + chunk * g_SimulationChunkSize;
+	UINT* deadScratch = m_pDeadScratch + chunk * g_SimulationChunkSize;
+	int numAlive = 0;
+	int numDead = 0;
+
+	for ( int j = begin; j < end; j += g_SimulationLanes )
+	{
+		int numLanes = std::min( g_SimulationLanes, end - j );
+
+		// The indices of the particles in the pool. Spare lanes at the end of the range repeat the first particle and are never written back
+		int index[ g_SimulationLanes ];
+		UINT isSleeping[ g_SimulationLanes ];
+		UINT collisionCount[ g_SimulationLanes ];
+		for ( int k = 0; k < g_SimulationLanes; k++ )
+		{
+			index[ k ] = (int)m_pAliveList[ k < numLanes ? j + k : j ].m_Index;
+			isSleeping[ k ] = collisions[ 2 * index[ k ] ];
+			collisionCount[ k ] = collisions[ 2 * index[ k ] + 1 ];
+		}
+
+		DirectX::XMMATRIX position = LoadTransposed( positions, index );
+		DirectX::XMMATRIX velocity = LoadTransposed( velocities, index );
+		DirectX::XMVECTOR vMass = position.r[ 3 ];
+		DirectX::XMVECTOR vLifespan = velocity.r[ 3 ];
+
+		// Age the particles by counting down from Lifespan to zero
+		DirectX::XMVECTOR vAge = DirectX::XMVectorSubtract( Gather( ages, 2, index ), vFrameTime );
+
+		// Update the rotation
+		DirectX::XMVECTOR vRotationAngle = DirectX::XMVectorAdd( Gather( renders + 3, 4, index ), vRotation );
+
+		// Apply force due to gravity and wind and calculate the new position, unless the particle is asleep
+		DirectX::XMVECTOR vAwakeVelocityX = DirectX::XMVectorAdd( velocity.r[ 0 ], vWindX );
+		DirectX::XMVECTOR vAwakeVelocityY = DirectX::XMVectorAdd( DirectX::XMVectorMultiplyAdd( DirectX::XMVectorScale( vMass, -9.81f ), vFrameTime, velocity.r[ 1 ] ), vWindY );
+		DirectX::XMVECTOR vAwakeVelocityZ = velocity.r[ 2 ];
+
+		DirectX::XMVECTOR vAsleep = DirectX::XMVectorSelectControl( isSleeping[ 0 ] ? 1 : 0, isSleeping[ 1 ] ? 1 : 0, isSleeping[ 2 ] ? 1 : 0, isSleeping[ 3 ] ? 1 : 0 );
+		DirectX::XMVECTOR vVelocityX = DirectX::XMVectorSelect( vAwakeVelocityX, velocity.r[ 0 ], vAsleep );
+		DirectX::XMVECTOR vVelocityY = DirectX::XMVectorSelect( vAwakeVelocityY, velocity.r[ 1 ], vAsleep );
+		DirectX::XMVECTOR vVelocityZ = DirectX::XMVectorSelect( vAwakeVelocityZ, velocity.r[ 2 ], vAsleep );
+		DirectX::XMVECTOR vPositionX = DirectX::XMVectorSelect( DirectX::XMVectorMultiplyAdd( vAwakeVelocityX, vFrameTime, position.r[ 0 ] ), position.r[ 0 ], vAsleep );
+		DirectX::XMVECTOR vPositionY = DirectX::XMVectorSelect( DirectX::XMVectorMultiplyAdd( vAwakeVelocityY, vFrameTime, position.r[ 1 ] ), position.r[ 1 ], vAsleep );
+		DirectX::XMVECTOR vPositionZ = DirectX::XMVectorSelect( DirectX::XMVectorMultiplyAdd( vAwakeVelocityZ, vFrameTime, position.r[ 2 ] ), position.r[ 2 ], vAsleep );
+
+		// Calculate the normalized age
+		DirectX::XMVECTOR vScaledLife = DirectX::XMVectorSubtract( vOne, DirectX::XMVectorSaturate( DirectX::XMVectorDivide( vAge, vLifespan ) ) );
+
+		// Calculate the size of the particle based on age
+		DirectX::XMVECTOR vStartSize = Gather( sizes, 2, index );
+		DirectX::XMVECTOR vRadius = DirectX::XMVectorMultiplyAdd( DirectX::XMVectorSubtract( Gather( sizes + 1, 2, index ), vStartSize ), vScaledLife, vStartSize );
+
+		DirectX::XMVECTOR vSpeed = DirectX::XMVectorSqrt( DirectX::XMVectorMultiplyAdd( vVelocityX, vVelocityX, DirectX::XMVectorMultiplyAdd( vVelocityY, vVelocityY, DirectX::XMVectorMultiply( vVelocityZ, vVelocityZ ) ) ) );
+
+		// Calculate the distance to the eye for sorting
+		DirectX::XMVECTOR vToEyeX = DirectX::XMVectorSubtract( vPositionX, vEyeX );
+		DirectX::XMVECTOR vToEyeY = DirectX::XMVectorSubtract( vPositionY, vEyeY );
+		DirectX::XMVECTOR vToEyeZ = DirectX::XMVectorSubtract( vPositionZ, vEyeZ );
+		DirectX::XMVECTOR vDistanceToEye = DirectX::XMVectorSqrt( DirectX::XMVectorMultiplyAdd( vToEyeX, vToEyeX, DirectX::XMVectorMultiplyAdd( vToEyeY, vToEyeY, DirectX::XMVectorMultiply( vToEyeZ, vToEyeZ ) ) ) );
+
+		// The opacity is a function of the age, the color is lerped based on the age
+		DirectX::XMVECTOR vAlpha = DirectX::XMVectorSubtract( vOne, DirectX::XMVectorDivide( DirectX::XMVectorSaturate( DirectX::XMVectorSubtract( vScaledLife, DirectX::XMVectorReplicate( 0.8f ) ) ), DirectX::XMVectorReplicate( 0.2f ) ) );
+		DirectX::XMVECTOR vColorLerp = DirectX::XMVectorMin( DirectX::XMVectorScale( vScaledLife, 5.0f ), vOne );
+
+		float age[ g_SimulationLanes ], speed[ g_SimulationLanes ], alpha[ g_SimulationLanes ], colorLerp[ g_SimulationLanes ];
+		StoreLanes( age, vAge );
+		StoreLanes( speed, vSpeed );
+		StoreLanes( alpha, vAlpha );
+		StoreLanes( colorLerp, vColorLerp );
+
+		// The emitter properties are looked up a particle at a time
+		float lightingCenterX[ g_SimulationLanes ], lightingCenterZ[ g_SimulationLanes ];
+		UINT streaks[ g_SimulationLanes ];
+		for ( int k = 0; k < g_SimulationLanes; k++ )
+		{
+			UINT particleProperties = properties[ index[ k ] ];
+			streaks[ k ] = ( particleProperties >> 24 ) & 0x01;
+
+			// Put particle to sleep if the velocity is small
+			if ( constants.m_EnableSleepState && collisionCount[ k ] > 10 && speed[ k ] < 0.01f )
+			{
+				isSleeping[ k ] = 1;
+			}
+
+			const IParticleSystem::EmitterProperties& emitterProperties = emitterTable.Get( (int)( particleProperties & 0xffff ) );
+			DirectX::XMVECTOR vColor = DirectX::XMVectorLerp( DirectX::XMLoadFloat4( &emitterProperties.m_StartColor ), DirectX::XMLoadFloat4( &emitterProperties.m_EndColor ), colorLerp[ k ] );
+
+			if ( constants.m_ShowSleepingParticles && isSleeping[ k ] == 1 )
+			{
+				vColor = vSleepColor;
+			}
+
+			if ( k < numLanes )
+			{
+				vColor = DirectX::XMVectorSetW( vColor, age[ k ] <= 0.0f ? 0.0f : alpha[ k ] );
+				DirectX::XMStoreFloat4( (DirectX::XMFLOAT4*)( tints + 4 * index[ k ] ), vColor );
+			}
+
+			lightingCenterX[ k ] = emitterProperties.m_LightingCenter.x;
+			lightingCenterZ[ k ] = emitterProperties.m_LightingCenter.z;
+		}
+
+		// The emitter-based lighting models the emitter as a vertical cylinder
+		DirectX::XMVECTOR vToEmitterX = DirectX::XMVectorSubtract( vPositionX, DirectX::XMLoadFloat4( (const DirectX::XMFLOAT4*)lightingCenterX ) );
+		DirectX::XMVECTOR vToEmitterZ = DirectX::XMVectorSubtract( vPositionZ, DirectX::XMLoadFloat4( (const DirectX::XMFLOAT4*)lightingCenterZ ) );
+		DirectX::XMVECTOR vToEmitterLength = DirectX::XMVectorSqrt( DirectX::XMVectorMultiplyAdd( vToEmitterX, vToEmitterX, DirectX::XMVectorMultiply( vToEmitterZ, vToEmitterZ ) ) );
+
+		// Like XMVector2Normalize, a zero length vector stays zero
+		DirectX::XMVECTOR vOnEmitter = DirectX::XMVectorEqual( vToEmitterLength, vZero );
+		DirectX::XMVECTOR vEmitterNormalX = DirectX::XMVectorSelect( DirectX::XMVectorDivide( vToEmitterX, vToEmitterLength ), vZero, vOnEmitter );
+		DirectX::XMVECTOR vEmitterNormalZ = DirectX::XMVectorSelect( DirectX::XMVectorDivide( vToEmitterZ, vToEmitterLength ), vZero, vOnEmitter );
+
+		// Generate the lighting term for the emitter
+		DirectX::XMVECTOR vEmitterNdotL = DirectX::XMVectorSaturate( DirectX::XMVectorMultiplyAdd( vSunX, vEmitterNormalX, DirectX::XMVectorMultiplyAdd( vSunZ, vEmitterNormalZ, DirectX::XMVectorReplicate( 0.5f ) ) ) );
+
+		// Transform the velocity and position into view space
+		DirectX::XMVECTOR vViewVelocityX = TransformNormalComponent( vVelocityX, vVelocityY, vVelocityZ, vViewColumns[ 0 ] );
+		DirectX::XMVECTOR vViewVelocityY = TransformNormalComponent( vVelocityX, vVelocityY, vVelocityZ, vViewColumns[ 1 ] );
+		DirectX::XMVECTOR vViewPositionX = TransformComponent( vPositionX, vPositionY, vPositionZ, vViewColumns[ 0 ] );
+		DirectX::XMVECTOR vViewPositionY = TransformComponent( vPositionX, vPositionY, vPositionZ, vViewColumns[ 1 ] );
+		DirectX::XMVECTOR vViewPositionZ = TransformComponent( vPositionX, vPositionY, vPositionZ, vViewColumns[ 2 ] );
+
+		// For streaked particles (the sparks), calculate the max radius in XY. Otherwise the particle has rotation so the max radius 
+		// is from the centre to the corner = sqrt( r^2 + r^2 )
+		DirectX::XMVECTOR vViewVelocityLength = DirectX::XMVectorSqrt( DirectX::XMVectorMultiplyAdd( vViewVelocityX, vViewVelocityX, DirectX::XMVectorMultiply( vViewVelocityY, vViewVelocityY ) ) );
+		DirectX::XMVECTOR vMinRadius = DirectX::XMVectorMultiply( vRadius, DirectX::XMVectorMax( vOne, DirectX::XMVectorScale( vViewVelocityLength, 0.1f ) ) );
+		DirectX::XMVECTOR vStreaks = DirectX::XMVectorSelectControl( streaks[ 0 ], streaks[ 1 ], streaks[ 2 ], streaks[ 3 ] );
+		DirectX::XMVECTOR vMaxRadius = DirectX::XMVectorSelect( DirectX::XMVectorScale( vRadius, 1.41f ), DirectX::XMVectorMax( vRadius, vMinRadius ), vStreaks );
+
+		// Write the streams the simulation changes. The mass and lifespan are written back unchanged alongside the position and velocity
+		StoreTransposed( positions, index, numLanes, vPositionX, vPositionY, vPositionZ, vMass );
+		StoreTransposed( velocities, index, numLanes, vVelocityX, vVelocityY, vVelocityZ, vLifespan );
+		StoreTransposed( renders, index, numLanes, vViewVelocityX, vViewVelocityY, vEmitterNdotL, vRotationAngle );
+
+		// Pack the view spaced position and radius
+		DirectX::XMMATRIX viewSpacePositions = DirectX::XMMatrixTranspose( DirectX::XMMATRIX( vViewPositionX, vViewPositionY, vViewPositionZ, vRadius ) );
+
+		float positionY[ g_SimulationLanes ], distanceToEye[ g_SimulationLanes ], maxRadius[ g_SimulationLanes ];
+		StoreLanes( positionY, vPositionY );
+		StoreLanes( distanceToEye, vDistanceToEye );
+		StoreLanes( maxRadius, vMaxRadius );
+
+		for ( int k = 0; k < numLanes; k++ )
+		{
+			int i = index[ k ];
+
+			DirectX::XMStoreFloat4( &m_pViewSpacePositions[ i ], viewSpacePositions.r[ k ] );
+			m_pMaxRadius[ i ] = maxRadius[ k ];
+
+			collisions[ 2 * i ] = isSleeping[ k ];
+			ages[ 2 * i + 1 ] = distanceToEye[ k ];
+
+			// If the position is below the floor, let's kill it now rather than wait for it to retire
+			if ( age[ k ] <= 0.0f || positionY[ k ] < -10.0f )
+			{
+				// Dead particles are added to the dead list for recycling
+				ages[ 2 * i ] = -1.0f;
+				deadScratch[ numDead++ ] = (UINT)i;
+			}
+			else
+			{
+				// Alive particles are added to the alive list
+				ages[ 2 * i ] = age[ k ];
+				aliveScratch[ numAlive ].m_Distance = distanceToEye[ k ];
+				aliveScratch[ numAlive ].m_Index = (float)i;
+				numAlive++;
+			}
+		}
+	}
+
+	m_ChunkAliveCounts[ chunk ] = numAlive;
+	m_ChunkDeadCounts[ chunk ] = numDead;
+}
+
+
+void CPUParticleSimulation::Sort()
+{
+	static_assert( sizeof( CPUAliveIndex ) == sizeof( CPUSortLib::Item ), "The alive list is sorted in place as CPUSortLib items" );
+
+	m_SortLib.run( (unsigned int)m_MaxParticles, (CPUSortLib::Item*)m_pAliveList, (unsigned int)m_NumAlive );
+}
@@ -0,0 +1,322 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __CPU_PARTICLE_SIMULATION_H__
+#define __CPU_PARTICLE_SIMULATION_H__
+
+
+#include "ParticleSystem.h"
+#include "ParticleFormat.h"
+#include "JobSystem.h"
+#include "CPUSort.h"
+#include "EmitterTable.h"
+
+
+// An entry in the alive list. Same layout as the float2 alive index buffer used by SortLib
+struct CPUAliveIndex
+{
+	float				m_Distance;
+	float				m_Index;
+};
+
+
+// Accessors for the particle layouts. These address exactly the same bytes as the HLSL accessors in Shaders/ParticleStorage.h so
+// the CPU simulation doubles as a reference for the GPU one and its particle data can be uploaded as-is.
+
+// Two arrays of structures, the rendering half followed by the simulation half
+class AoSParticleStorage
+{
+public:
+
+	AoSParticleStorage( void* data, int maxParticles ) :
+		m_pParticlesA( (CPUParticlePartA*)data ),
+		m_pParticlesB( (CPUParticlePartB*)( (BYTE*)data + sizeof( CPUParticlePartA ) * maxParticles ) )
+	{
+	}
+
+	static size_t	GetSize( int maxParticles ) { return ( sizeof( CPUParticlePartA ) + sizeof( CPUParticlePartB ) ) * maxParticles; }
+
+	void			Load( int index, CPUParticlePartA& pa, CPUParticlePartB& pb ) const
+	{
+		pa = m_pParticlesA[ index ];
+		pb = m_pParticlesB[ index ];
+	}
+
+	void			Store( int index, const CPUParticlePartA& pa, const CPUParticlePartB& pb )
+	{
+		m_pParticlesA[ index ] = pa;
+		m_pParticlesB[ index ] = pb;
+	}
+
+	void			StoreSimulated( int index, const CPUParticlePartA& pa, const CPUParticlePartB& pb ) { Store( index, pa, pb ); }
+
+	// Copy the part of a particle the render shaders read
+	void			CopyRenderData( int dstIndex, const AoSParticleStorage& src, int srcIndex ) { m_pParticlesA[ dstIndex ] = src.m_pParticlesA[ srcIndex ]; }
+
+private:
+
+	CPUParticlePartA*	m_pParticlesA;
+	CPUParticlePartB*	m_pParticlesB;
+};
+
+
+// A structure of arrays with the streams at the SOA_STREAM offsets in ShaderConstants.h
+class SoAParticleStorage
+{
+public:
+
+	SoAParticleStorage( void* data, int maxParticles ) :
+		m_pData( (BYTE*)data ),
+		m_MaxParticles( maxParticles )
+	{
+	}
+
+	static size_t	GetSize( int maxParticles ) { return SOA_PARTICLE_SIZE * (size_t)maxParticles; }
+
+	void			Load( int index, CPUParticlePartA& pa, CPUParticlePartB& pb ) const
+	{
+		const float* position = GetElement<float>( SOA_STREAM_POSITION, 16, index );
+		pb.m_Position = DirectX::XMFLOAT3( position );
+		pb.m_Mass = position[ 3 ];
+
+		const float* velocity = GetElement<float>( SOA_STREAM_VELOCITY, 16, index );
+		pb.m_Velocity = DirectX::XMFLOAT3( velocity );
+		pb.m_Lifespan = velocity[ 3 ];
+
+		const float* age = GetElement<float>( SOA_STREAM_AGE, 8, index );
+		pb.m_Age = age[ 0 ];
+		pb.m_DistanceToEye = age[ 1 ];
+
+		const float* size = GetElement<float>( SOA_STREAM_SIZE, 8, index );
+		pb.m_StartSize = size[ 0 ];
+		pb.m_EndSize = size[ 1 ];
+
+		pa.m_TintAndAlpha = DirectX::XMFLOAT4( GetElement<float>( SOA_STREAM_TINT, 16, index ) );
+
+		const float* render = GetElement<float>( SOA_STREAM_RENDER, 16, index );
+		pa.m_VelocityXY = DirectX::XMFLOAT2( render );
+		pa.m_EmitterNdotL = render[ 2 ];
+		pa.m_Rotation = render[ 3 ];
+
+		pa.m_EmitterProperties = GetElement<UINT>( SOA_STREAM_PROPERTIES, 4, index )[ 0 ];
+
+		const UINT* collision = GetElement<UINT>( SOA_STREAM_COLLISION, 8, index );
+		pa.m_IsSleeping = collision[ 0 ];
+		pa.m_CollisionCount = collision[ 1 ];
+		pa.m_pads[ 0 ] = 0.0f;
+	}
+
+	void			Store( int index, const CPUParticlePartA& pa, const CPUParticlePartB& pb )
+	{
+		StoreSimulated( index, pa, pb );
+
+		GetElement<float>( SOA_STREAM_POSITION, 16, index )[ 3 ] = pb.m_Mass;
+		GetElement<float>( SOA_STREAM_VELOCITY, 16, index )[ 3 ] = pb.m_Lifespan;
+
+		float* size = GetElement<float>( SOA_STREAM_SIZE, 8, index );
+		size[ 0 ] = pb.m_StartSize;
+		size[ 1 ] = pb.m_EndSize;
+
+		GetElement<UINT>( SOA_STREAM_PROPERTIES, 4, index )[ 0 ] = pa.m_EmitterProperties;
+	}
+
+	// Only write the attributes that the simulation changes. The mass, lifespan, sizes and emitter properties are constant after emission
+	void			StoreSimulated( int index, const CPUParticlePartA& pa, const CPUParticlePartB& pb )
+	{
+		float* position = GetElement<float>( SOA_STREAM_POSITION, 16, index );
+		position[ 0 ] = pb.m_Position.x;
+		position[ 1 ] = pb.m_Position.y;
+		position[ 2 ] = pb.m_Position.z;
+
+		float* velocity = GetElement<float>( SOA_STREAM_VELOCITY, 16, index );
+		velocity[ 0 ] = pb.m_Velocity.x;
+		velocity[ 1 ] = pb.m_Velocity.y;
+		velocity[ 2 ] = pb.m_Velocity.z;
+
+		float* age = GetElement<float>( SOA_STREAM_AGE, 8, index );
+		age[ 0 ] = pb.m_Age;
+		age[ 1 ] = pb.m_DistanceToEye;
+
+		*GetElement<DirectX::XMFLOAT4>( SOA_STREAM_TINT, 16, index ) = pa.m_TintAndAlpha;
+
+		float* render = GetElement<float>( SOA_STREAM_RENDER, 16, index );
+		render[ 0 ] = pa.m_VelocityXY.x;
+		render[ 1 ] = pa.m_VelocityXY.y;
+		render[ 2 ] = pa.m_EmitterNdotL;
+		render[ 3 ] = pa.m_Rotation;
+
+		UINT* collision = GetElement<UINT>( SOA_STREAM_COLLISION, 8, index );
+		collision[ 0 ] = pa.m_IsSleeping;
+		collision[ 1 ] = pa.m_CollisionCount;
+	}
+
+	// The first element of a stream, for code that works on several particles at once
+	BYTE*			GetStream( int stream ) const { return m_pData + (size_t)m_MaxParticles * stream; }
+
+	// Copy the streams the render shaders read
+	void			CopyRenderData( int dstIndex, const SoAParticleStorage& src, int srcIndex )
+	{
+		*GetElement<DirectX::XMFLOAT4>( SOA_STREAM_TINT, 16, dstIndex ) = *src.GetElement<DirectX::XMFLOAT4>( SOA_STREAM_TINT, 16, srcIndex );
+		*GetElement<DirectX::XMFLOAT4>( SOA_STREAM_RENDER, 16, dstIndex ) = *src.GetElement<DirectX::XMFLOAT4>( SOA_STREAM_RENDER, 16, srcIndex );
+		*GetElement<UINT>( SOA_STREAM_PROPERTIES, 4, dstIndex ) = *src.GetElement<UINT>( SOA_STREAM_PROPERTIES, 4, srcIndex );
+	}
+
+private:
+
+	template<class T>
+	T*				GetElement( int stream, int elementSize, int index ) const { return (T*)( m_pData + (size_t)m_MaxParticles * stream + (size_t)index * elementSize ); }
+
+	BYTE*			m_pData;
+	int				m_MaxParticles;
+};
+
+
+// The quantized particles in two arrays of structures, the rendering half followed by the simulation half
+class CompactParticleStorage
+{
+public:
+
+	CompactParticleStorage( void* data, int maxParticles ) :
+		m_pParticlesA( (CompactParticlePartA*)data ),
+		m_pParticlesB( (CompactParticlePartB*)( (BYTE*)data + sizeof( CompactParticlePartA ) * maxParticles ) )
+	{
+	}
+
+	static size_t	GetSize( int maxParticles ) { return ( sizeof( CompactParticlePartA ) + sizeof( CompactParticlePartB ) ) * maxParticles; }
+
+	void			Load( int index, CPUParticlePartA& pa, CPUParticlePartB& pb ) const { DecodeCompactParticle( m_pParticlesA[ index ], m_pParticlesB[ index ], pa, pb ); }
+	void			Store( int index, const CPUParticlePartA& pa, const CPUParticlePartB& pb ) { EncodeCompactParticle( pa, pb, m_pParticlesA[ index ], m_pParticlesB[ index ] ); }
+
+	// The mass, lifespan and sizes are constant after emission so don't need re-encoding
+	void			StoreSimulated( int index, const CPUParticlePartA& pa, const CPUParticlePartB& pb )
+	{
+		EncodeCompactParticlePartA( pa, m_pParticlesA[ index ] );
+
+		CompactParticlePartB& compactB = m_pParticlesB[ index ];
+		compactB.m_Position = pb.m_Position;
+		compactB.m_Age = pb.m_Age;
+		compactB.m_Velocity = pb.m_Velocity;
+	}
+
+	void			CopyRenderData( int dstIndex, const CompactParticleStorage& src, int srcIndex ) { m_pParticlesA[ dstIndex ] = src.m_pParticlesA[ srcIndex ]; }
+
+private:
+
+	CompactParticlePartA*	m_pParticlesA;
+	CompactParticlePartB*	m_pParticlesB;
+};
+
+
+// Runs the same emit, simulate and alive/dead list logic as ParticleEmit.hlsl and ParticleSimulation.hlsl on the CPU.
+// Work is split into chunks of particles that are run across every core using the job system. With the SoA layout the
+// simulation runs four particles at a time, one per SIMD lane, while the other layouts vectorize each particle's own math with
+// DirectXMath. The particles are stored in any of the GPU system's layouts.
+class CPUParticleSimulation
+{
+public:
+
+	CPUParticleSimulation();
+	~CPUParticleSimulation();
+
+	void Init( int maxParticles, JobSystem* jobSystem, IParticleSystem::Layout layout = IParticleSystem::Layout_AoS );
+	void Release();
+
+	// Mark every particle as dead
+	void Reset();
+
+	// Reallocate the pool for a new capacity. The alive particles are moved to the start of the new pool in alive list order,
+	// any that don't fit are dropped
+	void Resize( int maxParticles );
+
+	void Emit( int numEmitters, const IParticleSystem::EmitterParams* emitters, const PER_FRAME_CONSTANT_BUFFER& constants );
+	void Simulate( float frameTime, const PER_FRAME_CONSTANT_BUFFER& constants, const EmitterTable& emitterTable );
+
+	// Sort the alive list on distance to the eye, nearest first. Particles at the same distance keep their alive list order, the same
+	// order SortLib's radix sort produces
+	void Sort();
+
+	int							GetMaxParticles() const { return m_MaxParticles; }
+	int							GetNumAlive() const { return m_NumAlive; }
+	int							GetNumDead() const { return m_NumDead; }
+
+	IParticleSystem::Layout		GetLayout() const { return m_Layout; }
+	const void*					GetParticleData() const { return m_pParticleData; }
+
+	// Unpack a single particle regardless of the layout. Not intended for bulk access
+	void						LoadParticle( int index, CPUParticlePartA& pa, CPUParticlePartB& pb ) const;
+	const DirectX::XMFLOAT4*	GetViewSpacePositions() const { return m_pViewSpacePositions; }
+	const float*				GetMaxRadii() const { return m_pMaxRadius; }
+	const CPUAliveIndex*		GetAliveList() const { return m_pAliveList; }
+
+	JobSystem*					GetJobSystem() const { return m_pJobSystem; }
+
+private:
+
+	size_t GetParticleDataSize() const;
+
+	template<class Storage>
+	void EmitParticles( Storage storage, int numEmitters, const IParticleSystem::EmitterParams* emitters );
+
+	template<class Storage>
+	void SimulateRange( Storage storage, int begin, int end, int chunk, float frameTime, const PER_FRAME_CONSTANT_BUFFER& constants, const EmitterTable& emitterTable );
+	void SimulateRangeSoA( SoAParticleStorage storage, int begin, int end, int chunk, float frameTime, const PER_FRAME_CONSTANT_BUFFER& constants, const EmitterTable& emitterTable );
+
+	int							m_MaxParticles;
+	JobSystem*					m_pJobSystem;
+	IParticleSystem::Layout		m_Layout;
+
+	// The particles in m_Layout, see AoSParticleStorage, SoAParticleStorage and CompactParticleStorage
+	void*						m_pParticleData;
+	DirectX::XMFLOAT4*			m_pViewSpacePositions;
+	float*						m_pMaxRadius;
+
+	// The dead list is a stack of free particle indices. Emission pops from the top
+	UINT*						m_pDeadList;
+	int							m_NumDead;
+
+	CPUAliveIndex*				m_pAliveList;
+	int							m_NumAlive;
+	CPUSortLib					m_SortLib;
+
+	// Each simulation chunk writes its alive and dead particles here before they are merged into the real lists
+	CPUAliveIndex*				m_pAliveScratch;
+	UINT*						m_pDeadScratch;
+	std::vector<int>			m_ChunkAliveCounts;
+	std::vector<int>			m_ChunkDeadCounts;
+
+	// The range of new particles each emitter owns this frame
+	struct EmissionRange
+	{
+		const IParticleSystem::EmitterParams*	m_pEmitter;
+		int										m_FirstParticle;
+		UINT									m_EmitterIndex;
+		UINT									m_Properties;
+		float									m_VelocityMagnitude;
+	};
+
+	std::vector<EmissionRange>	m_EmissionBatch;
+
+	// Frames emitted since the last reset. Part of the random number key so a replay from a reset is reproducible
+	UINT						m_EmitFrame;
+};
+
+
+#endif
@@ -0,0 +1,825 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "ParticleSystem.h"
+#include "CPUParticleSimulation.h"
+#include "EmitterTable.h"
+#include "JobSystem.h"
+#include "TiledRasterizer.h"
+#include <algorithm>
+
+
+#pragma warning( disable : 4100 ) // disable unreference formal parameter warnings for /W4 builds
+
+
+// Number of alive particles copied into the upload buffers per job
+static const int g_UploadChunkSize = 16384;
+
+// The tiled technique's tile size in pixels. The same as the GPU system's default
+static const int g_TiledRasterizerTileSize = 32;
+
+
+// CPU Particle System class. The simulation runs on the CPU across all cores and the results are uploaded to the GPU for rasterization. 
+// The tiled technique renders on the CPU as well, with the software reference in TiledRasterizer.h
+class CPUParticleSystem : public IParticleSystem
+{
+public:
+
+	CPUParticleSystem( AMD::ShaderCache& shadercache, Layout layout, int maxParticles );
+
+private:
+
+	enum QualityMode
+	{
+		NoLighting,
+		CheapLighting,
+		FullLighting,
+		NumQualityModes
+	};
+
+	enum StreakMode
+	{
+		StreaksOn,
+		StreaksOff,
+		NumStreakModes
+	};
+
+	enum BillboardMode
+	{
+		UseVS,
+		UseGS,
+		NumBillboardModes
+	};
+
+	virtual ~CPUParticleSystem();
+
+	virtual void OnCreateDevice( ID3D11Device* pDevice, ID3D11DeviceContext* pImmediateContext );
+	virtual void OnResizedSwapChain( const DXGI_SURFACE_DESC* pBackBufferSurfaceDesc );
+	virtual void OnReleasingSwapChain();
+	virtual void OnDestroyDevice();
+
+	virtual void Reset();
+
+	virtual void SetMaxParticles( int maxParticles );
+	virtual int GetMaxParticles() const { return m_MaxParticles; }
+
+	virtual void SetRenderBufferFormat( RenderBufferFormat ) {}
+
+	virtual void SetPerFrameConstants( const PER_FRAME_CONSTANT_BUFFER& constants ) { m_PerFrameConstants = constants; }
+
+	virtual void SetEmitterProperties( int firstEmitter, int numEmitters, const EmitterProperties* properties ) { m_EmitterTable.Set( firstEmitter, numEmitters, properties ); }
+
+	virtual void Render( float frameTime, int flags, Technique technique, CoarseCullingMode coarseCullingMode, const EmitterParams* pEmitters, int nNumEmitters, ID3D11ShaderResourceView* depthSRV );
+
+	virtual const Stats& GetStats() const { return m_Stats; }
+
+	// Create and release the resources whose size depends on the particle capacity
+	void CreateParticleBuffers();
+	void ReleaseParticleBuffers();
+
+	void UploadAliveParticles();
+
+	template<class Storage>
+	void CopyAliveParticles( Storage dst, Storage src, CPUAliveIndex* dstIndices );
+	void Rasterize( int flags, ID3D11ShaderResourceView* depthSRV );
+	void RenderTiled( int flags, ID3D11ShaderResourceView* depthSRV );
+	void CompositeTiledOutput();
+
+	ID3D11Device*				m_pDevice;
+	ID3D11DeviceContext*		m_pImmediateContext;
+
+	Layout						m_Layout;
+	int							m_MaxParticles;
+
+	// Dynamic copies of the alive particles in the same layout the GPU system's render shaders expect. With the SoA 
+	// layout this is a raw buffer and only the streams used for rendering are filled in
+	ID3D11Buffer*				m_pParticleBufferA;
+	ID3D11ShaderResourceView*	m_pParticleBufferA_SRV;
+
+	ID3D11Buffer*				m_pViewSpaceParticlePositions;
+	ID3D11ShaderResourceView*	m_pViewSpaceParticlePositionsSRV;
+
+	ID3D11Buffer*				m_pAliveIndexBuffer;
+	ID3D11ShaderResourceView*	m_pAliveIndexBufferSRV;
+
+	ID3D11Buffer*				m_pActiveListConstantBuffer;
+	ID3D11Buffer*				m_pParticleStorageConstantBuffer;
+
+	ID3D11Buffer*				m_pIndexBuffer;
+
+	ID3D11VertexShader*			m_pVS[ NumStreakModes ][ NumBillboardModes ];
+	ID3D11GeometryShader*		m_pGS[ NumStreakModes ];
+	ID3D11PixelShader*			m_pRasterizedPS[ NumQualityModes ][ NumStreakModes ];
+
+	// The tiled technique's output, uploaded each frame and composited over the scene like the GPU system's render buffer
+	ID3D11Texture2D*			m_pTiledOutput;
+	ID3D11ShaderResourceView*	m_pTiledOutputSRV;
+	int							m_TiledOutputWidth;
+	int							m_TiledOutputHeight;
+	ID3D11VertexShader*			m_pQuadVS;
+	ID3D11PixelShader*			m_pCopyPS;
+	ID3D11BlendState*			m_pCompositeBlendState;
+
+	// The tiled technique's inputs. The alive particles are compacted into alive list order
+	std::vector<CPUParticlePartA>	m_TiledParticles;
+	std::vector<DirectX::XMFLOAT4>	m_TiledPositions;
+	std::vector<float>				m_TiledRadii;
+	std::vector<UINT>				m_TiledIndices;
+	TiledRasterizerTileLists		m_TileLists;
+	std::vector<float>				m_TiledDepth;
+	std::vector<DirectX::XMFLOAT4>	m_TiledPixels;
+
+	// The particle atlas as read back from the GPU, and the view it was read from so it is only read back when it changes
+	ID3D11ShaderResourceView*		m_pAtlasSRV;
+	std::vector<DirectX::XMFLOAT4>	m_AtlasTexels;
+	TiledRasterizerTexture			m_Atlas;
+
+	JobSystem					m_JobSystem;
+	CPUParticleSimulation		m_Simulation;
+	PER_FRAME_CONSTANT_BUFFER	m_PerFrameConstants;
+
+	// The simulation writes the tint itself so the emitter table is only ever read on the CPU
+	EmitterTable				m_EmitterTable;
+
+	bool						m_ResetSystem;
+
+	Stats						m_Stats;
+};
+
+
+IParticleSystem* IParticleSystem::CreateCPUSystem( AMD::ShaderCache& shadercache, Layout layout, int maxParticles )
+{
+	return new CPUParticleSystem( shadercache, layout, maxParticles );
+}
+
+
+CPUParticleSystem::CPUParticleSystem( AMD::ShaderCache& shadercache, Layout layout, int maxParticles ) :
+	m_pDevice( nullptr ),
+	m_pImmediateContext( nullptr ),
+	m_Layout( layout ),
+	m_MaxParticles( std::max( 1, maxParticles ) ),
+	m_pParticleBufferA( nullptr ),
+	m_pParticleBufferA_SRV( nullptr ),
+	m_pViewSpaceParticlePositions( nullptr ),
+	m_pViewSpaceParticlePositionsSRV( nullptr ),
+	m_pAliveIndexBuffer( nullptr ),
+	m_pAliveIndexBufferSRV( nullptr ),
+	m_pActiveListConstantBuffer( nullptr ),
+	m_pParticleStorageConstantBuffer( nullptr ),
+	m_pIndexBuffer( nullptr ),
+	m_pTiledOutput( nullptr ),
+	m_pTiledOutputSRV( nullptr ),
+	m_TiledOutputWidth( 0 ),
+	m_TiledOutputHeight( 0 ),
+	m_pQuadVS( nullptr ),
+	m_pCopyPS( nullptr ),
+	m_pCompositeBlendState( nullptr ),
+	m_pAtlasSRV( nullptr ),
+	m_ResetSystem( true )
+{
+	ZeroMemory( &m_Atlas, sizeof( m_Atlas ) );
+	ZeroMemory( m_pVS, sizeof( m_pVS ) );
+	ZeroMemory( m_pGS, sizeof( m_pGS ) );
+	ZeroMemory( m_pRasterizedPS, sizeof( m_pRasterizedPS ) );
+	ZeroMemory( &m_PerFrameConstants, sizeof( m_PerFrameConstants ) );
+	ZeroMemory( &m_Stats, sizeof( m_Stats ) );
+
+	// Spin up one thread per core and allocate the particle pool
+	m_JobSystem.Init();
+	m_Simulation.Init( m_MaxParticles, &m_JobSystem, m_Layout );
+
+	// Create the rasterization shader permutations. These are the same shaders the GPU system uses
+	AMD::ShaderCache::Macro defines[ 32 ];
+	ZeroMemory( defines, sizeof( defines ) );
+
+	for ( int i = 0; i < NumStreakModes; i++ )
+	{
+		for ( int j = 0; j < NumBillboardModes; j++ )
+		{
+			int numDefines = 0;
+			if ( i == StreaksOn )
+			{
+				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"STREAKS" );
+				numDefines++;
+			}
+
+			if ( j == UseGS )
+			{
+				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"USE_GEOMETRY_SHADER" );
+				numDefines++;
+			}
+
+			if ( GetLayoutDefine( m_Layout ) )
+			{
+				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), GetLayoutDefine( m_Layout ) );
+				numDefines++;
+			}
+
+			shadercache.AddShader( (ID3D11DeviceChild**)&m_pVS[ i ][ j ], AMD::ShaderCache::SHADER_TYPE_VERTEX, L"vs_5_0", L"VS_StructuredBuffer", L"ParticleRender.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+		}
+	}
+
+	for ( int i = 0; i < NumStreakModes; i++ )
+	{
+		int numDefines = 0;
+		if ( i == StreaksOn )
+		{
+			wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"STREAKS" );
+			numDefines++;
+		}
+
+		wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"USE_GEOMETRY_SHADER" );
+		numDefines++;
+		shadercache.AddShader( (ID3D11DeviceChild**)&m_pGS[ i ], AMD::ShaderCache::SHADER_TYPE_GEOMETRY, L"gs_5_0", L"GS", L"ParticleRender.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+		numDefines--;
+
+		shadercache.AddShader( (ID3D11DeviceChild**)&m_pRasterizedPS[ FullLighting ][ i ], AMD::ShaderCache::SHADER_TYPE_PIXEL, L"ps_5_0", L"PS_Billboard", L"ParticleRender.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+
+		wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"CHEAP" );
+		numDefines++;
+		shadercache.AddShader( (ID3D11DeviceChild**)&m_pRasterizedPS[ CheapLighting ][ i ], AMD::ShaderCache::SHADER_TYPE_PIXEL, L"ps_5_0", L"PS_Billboard", L"ParticleRender.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+
+		wcscpy_s( defines[ numDefines - 1 ].m_wsName, ARRAYSIZE( defines[ numDefines - 1 ].m_wsName ), L"NOLIGHTING" );
+		shadercache.AddShader( (ID3D11DeviceChild**)&m_pRasterizedPS[ NoLighting ][ i ], AMD::ShaderCache::SHADER_TYPE_PIXEL, L"ps_5_0", L"PS_Billboard", L"ParticleRender.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+	}
+
+	// The tiled technique composites its output with the GPU system's quad
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pQuadVS, AMD::ShaderCache::SHADER_TYPE_VERTEX, L"vs_5_0", L"QuadVS", L"ParticleRenderQuad.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCopyPS, AMD::ShaderCache::SHADER_TYPE_PIXEL, L"ps_5_0", L"CopyPS", L"ParticleRenderQuad.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+}
+
+
+CPUParticleSystem::~CPUParticleSystem()
+{
+	OnReleasingSwapChain();
+	OnDestroyDevice();
+
+	m_Simulation.Release();
+	m_JobSystem.Release();
+}
+
+
+void CPUParticleSystem::Reset()
+{
+	m_ResetSystem = true;
+}
+
+
+// Resize the particle pool. The simulation carries the alive particles over, only the upload buffers need recreating
+void CPUParticleSystem::SetMaxParticles( int maxParticles )
+{
+	maxParticles = std::max( 1, maxParticles );
+	if ( maxParticles == m_MaxParticles )
+		return;
+
+	m_MaxParticles = maxParticles;
+	m_Simulation.Resize( m_MaxParticles );
+
+	if ( m_pDevice )
+	{
+		ReleaseParticleBuffers();
+		CreateParticleBuffers();
+	}
+}
+
+
+void CPUParticleSystem::Render( float frameTime, int flags, Technique technique, CoarseCullingMode coarseCullingMode, const EmitterParams* pEmitters, int nNumEmitters, ID3D11ShaderResourceView* depthSRV )
+{
+	if ( m_ResetSystem )
+	{
+		m_Simulation.Reset();
+		m_ResetSystem = false;
+	}
+
+	// Emit and simulate on the CPU. The stages are marked up with the same names as the GPU system so they can be compared
+	{
+		AMDProfileEvent( AMD_PROFILE_GREEN, L"Emission" );
+		m_Simulation.Emit( nNumEmitters, pEmitters, m_PerFrameConstants );
+	}
+
+	{
+		AMDProfileEvent( AMD_PROFILE_GREEN, L"Simulation" );
+		m_Simulation.Simulate( frameTime, m_PerFrameConstants, m_EmitterTable );
+	}
+
+	// Sort if requested. Not doing so results in the particles rendering out of order and not blending correctly
+	if ( flags & PF_Sort )
+	{
+		AMDProfileEvent( AMD_PROFILE_RED, L"Sort" );
+		m_Simulation.Sort();
+	}
+
+	if ( technique == Technique_Tiled )
+	{
+		RenderTiled( flags, depthSRV );
+	}
+	else
+	{
+		{
+			AMDProfileEvent( AMD_PROFILE_BLUE, L"Upload" );
+			UploadAliveParticles();
+		}
+
+		// There is no CPU version of the overdraw visualization so it falls back to rasterization
+		Rasterize( flags, depthSRV );
+	}
+
+	// Update the frame's stats. The CPU knows these exactly so unlike the GPU system they are valid in release too
+	m_Stats.m_MaxParticles = m_Simulation.GetMaxParticles();
+	m_Stats.m_NumActiveParticles = m_Simulation.GetNumAlive();
+	m_Stats.m_NumDead = m_Simulation.GetNumDead();
+	m_Stats.m_TileSize = technique == Technique_Tiled ? g_TiledRasterizerTileSize : 0;
+}
+
+
+// Copy the alive particles into the dynamic buffers in alive list order so the GPU only receives what it draws
+void CPUParticleSystem::UploadAliveParticles()
+{
+	const int numAlive = m_Simulation.GetNumAlive();
+
+	D3D11_MAPPED_SUBRESOURCE mappedParticles, mappedIndices;
+	m_pImmediateContext->Map( m_pParticleBufferA, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedParticles );
+	m_pImmediateContext->Map( m_pAliveIndexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedIndices );
+
+	// The source storage is only read from
+	void* particleData = const_cast<void*>( m_Simulation.GetParticleData() );
+	CPUAliveIndex* dstIndices = (CPUAliveIndex*)mappedIndices.pData;
+
+	switch ( m_Layout )
+	{
+		case Layout_SoA:		CopyAliveParticles( SoAParticleStorage( mappedParticles.pData, m_MaxParticles ), SoAParticleStorage( particleData, m_MaxParticles ), dstIndices ); break;
+		case Layout_Compact:	CopyAliveParticles( CompactParticleStorage( mappedParticles.pData, m_MaxParticles ), CompactParticleStorage( particleData, m_MaxParticles ), dstIndices ); break;
+		default:				CopyAliveParticles( AoSParticleStorage( mappedParticles.pData, m_MaxParticles ), AoSParticleStorage( particleData, m_MaxParticles ), dstIndices ); break;
+	}
+
+	m_pImmediateContext->Unmap( m_pAliveIndexBuffer, 0 );
+	m_pImmediateContext->Unmap( m_pParticleBufferA, 0 );
+
+	// The view space positions are the same in both layouts
+	D3D11_MAPPED_SUBRESOURCE mappedPositions;
+	m_pImmediateContext->Map( m_pViewSpaceParticlePositions, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedPositions );
+
+	DirectX::XMFLOAT4* dstPositions = (DirectX::XMFLOAT4*)mappedPositions.pData;
+	const DirectX::XMFLOAT4* srcPositions = m_Simulation.GetViewSpacePositions();
+	const CPUAliveIndex* aliveList = m_Simulation.GetAliveList();
+
+	m_JobSystem.ParallelFor( numAlive, g_UploadChunkSize, [&]( int begin, int end )
+	{
+		for ( int i = begin; i < end; i++ )
+		{
+			dstPositions[ i ] = srcPositions[ (int)aliveList[ i ].m_Index ];
+		}
+	} );
+
+	m_pImmediateContext->Unmap( m_pViewSpaceParticlePositions, 0 );
+
+	// Update the number of alive particles for the render shaders
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	m_pImmediateContext->Map( m_pActiveListConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource );
+	UINT* activeCount = (UINT*)MappedResource.pData;
+	activeCount[ 0 ] = (UINT)numAlive;
+	m_pImmediateContext->Unmap( m_pActiveListConstantBuffer, 0 );
+}
+
+
+// Gather the render data of the alive particles into the first numAlive slots of the upload buffers
+template<class Storage>
+void CPUParticleSystem::CopyAliveParticles( Storage dst, Storage src, CPUAliveIndex* dstIndices )
+{
+	const CPUAliveIndex* aliveList = m_Simulation.GetAliveList();
+
+	m_JobSystem.ParallelFor( m_Simulation.GetNumAlive(), g_UploadChunkSize, [&]( int begin, int end )
+	{
+		for ( int i = begin; i < end; i++ )
+		{
+			dst.CopyRenderData( i, src, (int)aliveList[ i ].m_Index );
+
+			// The uploaded particles are compacted so the alive list points at the compacted slot
+			dstIndices[ i ].m_Distance = aliveList[ i ].m_Distance;
+			dstIndices[ i ].m_Index = (float)i;
+		}
+	} );
+}
+
+
+// Conventional rasterization using the same shaders as the GPU system
+void CPUParticleSystem::Rasterize( int flags, ID3D11ShaderResourceView* depthSRV )
+{
+	AMDProfileEvent( AMD_PROFILE_BLUE, L"Render" );
+
+	const int numAlive = m_Simulation.GetNumAlive();
+	if ( numAlive == 0 )
+		return;
+
+	QualityMode quality = flags & PF_CheapLighting ? CheapLighting : FullLighting;
+	if ( flags & PF_NoLighting )
+		quality = NoLighting;
+	StreakMode streaks = flags & PF_Streaks ? StreaksOn : StreaksOff;
+	BillboardMode billboardMode = flags & PF_UseGeometryShader ? UseGS : UseVS;
+
+	// Set up shader stages
+	m_pImmediateContext->VSSetShader( m_pVS[ streaks ][ billboardMode ], nullptr, 0 );
+	m_pImmediateContext->GSSetShader( billboardMode == UseGS ? m_pGS[ streaks ] : nullptr, nullptr, 0 );
+	m_pImmediateContext->PSSetShader( m_pRasterizedPS[ quality ][ streaks ], nullptr, 0 );
+
+	ID3D11ShaderResourceView* vs_srv[] = { m_pParticleBufferA_SRV, m_pViewSpaceParticlePositionsSRV, m_pAliveIndexBufferSRV };
+	ID3D11ShaderResourceView* ps_srv[] = { depthSRV };
+
+	// Set a null vertex buffer
+	ID3D11Buffer* vb = nullptr;
+	UINT stride = 0;
+	UINT offset = 0;
+	m_pImmediateContext->IASetVertexBuffers( 0, 1, &vb, &stride, &offset );
+
+	m_pImmediateContext->VSSetConstantBuffers( 3, 1, &m_pActiveListConstantBuffer );
+	m_pImmediateContext->VSSetConstantBuffers( 4, 1, &m_pParticleStorageConstantBuffer );
+
+	if ( billboardMode == UseGS )
+	{
+		m_pImmediateContext->IASetIndexBuffer( nullptr, DXGI_FORMAT_UNKNOWN, 0 );
+		m_pImmediateContext->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_POINTLIST );
+	}
+	else
+	{
+		m_pImmediateContext->IASetIndexBuffer( m_pIndexBuffer, DXGI_FORMAT_R32_UINT, 0 );
+		m_pImmediateContext->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+	}
+
+	m_pImmediateContext->VSSetShaderResources( 0, ARRAYSIZE( vs_srv ), vs_srv );
+	m_pImmediateContext->PSSetShaderResources( 1, ARRAYSIZE( ps_srv ), ps_srv );
+
+	// The CPU knows exactly how many particles are alive so there is no need for an indirect draw
+	if ( billboardMode == UseGS )
+	{
+		m_pImmediateContext->Draw( numAlive, 0 );
+	}
+	else
+	{
+		m_pImmediateContext->DrawIndexed( numAlive * 6, 0, 0 );
+	}
+
+	ZeroMemory( vs_srv, sizeof( vs_srv ) );
+	m_pImmediateContext->VSSetShaderResources( 0, ARRAYSIZE( vs_srv ), vs_srv );
+	ZeroMemory( ps_srv, sizeof( ps_srv ) );
+	m_pImmediateContext->PSSetShaderResources( 1, ARRAYSIZE( ps_srv ), ps_srv );
+}
+
+
+// The tiled technique. The alive particles are gathered in alive list order, then culled into tiles, sorted and blended front to back 
+// across all cores with the same math as CullingCS.hlsl and TiledRendering.hlsl. The scene's depth and the particle atlas are read 
+// back from the GPU for it, so this stalls every frame
+void CPUParticleSystem::RenderTiled( int flags, ID3D11ShaderResourceView* depthSRV )
+{
+	const int numAlive = m_Simulation.GetNumAlive();
+	if ( numAlive == 0 || !m_pTiledOutput )
+		return;
+
+	// The rasterizer covers the screen in the constants, so it has to match the output
+	PER_FRAME_CONSTANT_BUFFER constants = m_PerFrameConstants;
+	constants.m_ScreenWidth = m_TiledOutputWidth;
+	constants.m_ScreenHeight = m_TiledOutputHeight;
+
+	{
+		AMDProfileEvent( AMD_PROFILE_BLUE, L"Gather" );
+
+		m_TiledIndices.resize( numAlive );
+		m_TiledPositions.resize( numAlive );
+		m_TiledRadii.resize( numAlive );
+		m_TiledParticles.resize( numAlive );
+
+		const CPUAliveIndex* aliveList = m_Simulation.GetAliveList();
+		const DirectX::XMFLOAT4* positions = m_Simulation.GetViewSpacePositions();
+		const float* maxRadii = m_Simulation.GetMaxRadii();
+
+		m_JobSystem.ParallelFor( numAlive, g_UploadChunkSize, [&]( int begin, int end )
+		{
+			for ( int i = begin; i < end; i++ )
+			{
+				m_TiledIndices[ i ] = (UINT)aliveList[ i ].m_Index;
+				m_TiledPositions[ i ] = positions[ (int)aliveList[ i ].m_Index ];
+				m_TiledRadii[ i ] = maxRadii[ (int)aliveList[ i ].m_Index ];
+			}
+		} );
+
+		LoadRenderParticles( m_Layout, m_Simulation.GetParticleData(), m_Simulation.GetMaxParticles(), &m_TiledIndices[ 0 ], numAlive, &m_TiledParticles[ 0 ], &m_JobSystem );
+
+		// From here on the particles are referred to by their compacted slot
+		for ( int i = 0; i < numAlive; i++ )
+		{
+			m_TiledIndices[ i ] = (UINT)i;
+		}
+	}
+
+	{
+		AMDProfileEvent( AMD_PROFILE_BLUE, L"ReadBack" );
+
+		// The application binds the atlas for the GPU system's tiled renderer. Only read it back when it changes
+		ID3D11ShaderResourceView* atlasSRV = nullptr;
+		m_pImmediateContext->CSGetShaderResources( 6, 1, &atlasSRV );
+		if ( atlasSRV != m_pAtlasSRV )
+		{
+			SAFE_RELEASE( m_pAtlasSRV );
+			m_pAtlasSRV = atlasSRV;
+			ReadBackTiledRasterizerTexture( m_pImmediateContext, m_pAtlasSRV, m_AtlasTexels, m_Atlas );
+		}
+		else
+		{
+			SAFE_RELEASE( atlasSRV );
+		}
+
+		if ( !ReadBackTiledRasterizerDepth( m_pImmediateContext, depthSRV, m_TiledOutputWidth, m_TiledOutputHeight, m_TiledDepth ) )
+		{
+			m_TiledDepth.clear();
+		}
+	}
+
+	{
+		AMDProfileEvent( AMD_PROFILE_BLUE, L"Culling" );
+		BuildTileLists( constants, g_TiledRasterizerTileSize, &m_TiledPositions[ 0 ], &m_TiledRadii[ 0 ], &m_TiledIndices[ 0 ], numAlive, m_TileLists, &m_JobSystem );
+	}
+
+	{
+		AMDProfileEvent( AMD_PROFILE_BLUE, L"Render" );
+
+		m_TiledPixels.resize( m_TiledOutputWidth * m_TiledOutputHeight );
+		RasterizeTiles( constants, flags, m_TileLists, &m_TiledParticles[ 0 ], &m_TiledPositions[ 0 ], m_TiledDepth.empty() ? nullptr : &m_TiledDepth[ 0 ], m_Atlas, &m_TiledPixels[ 0 ], &m_JobSystem );
+	}
+
+	CompositeTiledOutput();
+}
+
+
+// Upload the tiled technique's output and blend it over the current render target, the same way the GPU system does
+void CPUParticleSystem::CompositeTiledOutput()
+{
+	AMDProfileEvent( AMD_PROFILE_BLUE, L"RenderQuad" );
+
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	m_pImmediateContext->Map( m_pTiledOutput, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource );
+	for ( int y = 0; y < m_TiledOutputHeight; y++ )
+	{
+		memcpy( (BYTE*)MappedResource.pData + y * MappedResource.RowPitch, &m_TiledPixels[ y * m_TiledOutputWidth ], m_TiledOutputWidth * sizeof( DirectX::XMFLOAT4 ) );
+	}
+	m_pImmediateContext->Unmap( m_pTiledOutput, 0 );
+
+	m_pImmediateContext->OMSetBlendState( m_pCompositeBlendState, nullptr, 0xffffffff );
+
+	m_pImmediateContext->VSSetShader( m_pQuadVS, nullptr, 0 );
+	m_pImmediateContext->GSSetShader( nullptr, nullptr, 0 );
+	m_pImmediateContext->PSSetShader( m_pCopyPS, nullptr, 0 );
+
+	m_pImmediateContext->IASetIndexBuffer( nullptr, DXGI_FORMAT_UNKNOWN, 0 );
+	m_pImmediateContext->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+
+	ID3D11ShaderResourceView* srvs[] = { m_pTiledOutputSRV };
+	m_pImmediateContext->PSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+
+	// Draw one large triangle
+	m_pImmediateContext->Draw( 3, 0 );
+
+	ZeroMemory( srvs, sizeof( srvs ) );
+	m_pImmediateContext->PSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+
+	// Restore the default blend state
+	m_pImmediateContext->OMSetBlendState( nullptr, nullptr, 0xffffffff );
+}
+
+
+void CPUParticleSystem::OnCreateDevice( ID3D11Device* pDevice, ID3D11DeviceContext* pImmediateContext )
+{
+	m_pDevice = pDevice;
+	m_pImmediateContext = pImmediateContext;
+
+	// Create the constant buffer holding the alive count
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	desc.ByteWidth = 4 * sizeof( UINT );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pActiveListConstantBuffer );
+
+	// Create a blend state for compositing the tiled technique's premultiplied output onto the render target
+	D3D11_BLEND_DESC blendDesc;
+	ZeroMemory( &blendDesc, sizeof( blendDesc ) );
+	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	blendDesc.RenderTarget[0].BlendEnable = true;
+	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ZERO;
+	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ZERO;
+	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+	m_pDevice->CreateBlendState( &blendDesc, &m_pCompositeBlendState );
+
+	CreateParticleBuffers();
+}
+
+
+void CPUParticleSystem::CreateParticleBuffers()
+{
+	// The particle buffers are rewritten by the CPU every frame so create them as dynamic
+	D3D11_BUFFER_DESC desc;
+	D3D11_SHADER_RESOURCE_VIEW_DESC srv;
+	ZeroMemory( &desc, sizeof( desc ) );
+	ZeroMemory( &srv, sizeof( srv ) );
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	if ( m_Layout == Layout_SoA )
+	{
+		// The render shaders locate the streams from the capacity so the buffer is full size even though only some of the streams are uploaded
+		desc.ByteWidth = (UINT)SoAParticleStorage::GetSize( m_MaxParticles );
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+		m_pDevice->CreateBuffer( &desc, nullptr, &m_pParticleBufferA );
+
+		srv.Format = DXGI_FORMAT_R32_TYPELESS;
+		srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+		srv.BufferEx.FirstElement = 0;
+		srv.BufferEx.NumElements = desc.ByteWidth / 4;
+		srv.BufferEx.Flags = D3D11_BUFFEREX_SRV_FLAG_RAW;
+		m_pDevice->CreateShaderResourceView( m_pParticleBufferA, &srv, &m_pParticleBufferA_SRV );
+	}
+	else
+	{
+		// Only the rendering half of the particles is uploaded
+		UINT stride = m_Layout == Layout_Compact ? sizeof( CompactParticlePartA ) : sizeof( CPUParticlePartA );
+		desc.ByteWidth = stride * m_MaxParticles;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		desc.StructureByteStride = stride;
+		m_pDevice->CreateBuffer( &desc, nullptr, &m_pParticleBufferA );
+
+		srv.Format = DXGI_FORMAT_UNKNOWN;
+		srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srv.Buffer.ElementOffset = 0;
+		srv.Buffer.ElementWidth = m_MaxParticles;
+		m_pDevice->CreateShaderResourceView( m_pParticleBufferA, &srv, &m_pParticleBufferA_SRV );
+	}
+
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	srv.Format = DXGI_FORMAT_UNKNOWN;
+	srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srv.Buffer.ElementOffset = 0;
+	srv.Buffer.ElementWidth = m_MaxParticles;
+
+	desc.ByteWidth = sizeof( DirectX::XMFLOAT4 ) * m_MaxParticles;
+	desc.StructureByteStride = sizeof( DirectX::XMFLOAT4 );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pViewSpaceParticlePositions );
+	m_pDevice->CreateShaderResourceView( m_pViewSpaceParticlePositions, &srv, &m_pViewSpaceParticlePositionsSRV );
+
+	desc.ByteWidth = sizeof( CPUAliveIndex ) * m_MaxParticles;
+	desc.StructureByteStride = sizeof( CPUAliveIndex );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pAliveIndexBuffer );
+	m_pDevice->CreateShaderResourceView( m_pAliveIndexBuffer, &srv, &m_pAliveIndexBufferSRV );
+
+	// Create the constant buffer holding the particle capacity for the SoA stream offsets
+	UINT storageConstants[ 4 ] = { (UINT)m_MaxParticles, 0, 0, 0 };
+	D3D11_SUBRESOURCE_DATA storageData;
+	storageData.pSysMem = storageConstants;
+	storageData.SysMemPitch = 0;
+	storageData.SysMemSlicePitch = 0;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.ByteWidth = 4 * sizeof( UINT );
+	m_pDevice->CreateBuffer( &desc, &storageData, &m_pParticleStorageConstantBuffer );
+
+	// Create the particle billboard index buffer required for the rasterization VS-only path
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.ByteWidth = m_MaxParticles * 6 * sizeof( UINT );
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	desc.CPUAccessFlags = 0;
+	desc.MiscFlags = 0;
+	D3D11_SUBRESOURCE_DATA data;
+
+	UINT* indices = new UINT[ m_MaxParticles * 6 ];
+	data.pSysMem = indices;
+	data.SysMemPitch = 0;
+	data.SysMemSlicePitch = 0;
+
+	UINT base = 0;
+	for ( int i = 0; i < m_MaxParticles; i++ )
+	{
+		indices[ 0 ] = base + 0;
+		indices[ 1 ] = base + 1;
+		indices[ 2 ] = base + 2;
+
+		indices[ 3 ] = base + 2;
+		indices[ 4 ] = base + 1;
+		indices[ 5 ] = base + 3;
+
+		base += 4;
+		indices += 6;
+	}
+
+	m_pDevice->CreateBuffer( &desc, &data, &m_pIndexBuffer );
+
+	delete[] data.pSysMem;
+}
+
+
+void CPUParticleSystem::ReleaseParticleBuffers()
+{
+	SAFE_RELEASE( m_pIndexBuffer );
+	SAFE_RELEASE( m_pParticleStorageConstantBuffer );
+
+	SAFE_RELEASE( m_pAliveIndexBufferSRV );
+	SAFE_RELEASE( m_pAliveIndexBuffer );
+
+	SAFE_RELEASE( m_pViewSpaceParticlePositionsSRV );
+	SAFE_RELEASE( m_pViewSpaceParticlePositions );
+
+	SAFE_RELEASE( m_pParticleBufferA_SRV );
+	SAFE_RELEASE( m_pParticleBufferA );
+}
+
+
+// The tiled technique's output covers the back buffer. The CPU writes it every frame so it is dynamic
+void CPUParticleSystem::OnResizedSwapChain( const DXGI_SURFACE_DESC* pBackBufferSurfaceDesc )
+{
+	m_TiledOutputWidth = (int)pBackBufferSurfaceDesc->Width;
+	m_TiledOutputHeight = (int)pBackBufferSurfaceDesc->Height;
+
+	D3D11_TEXTURE2D_DESC desc;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.Width = pBackBufferSurfaceDesc->Width;
+	desc.Height = pBackBufferSurfaceDesc->Height;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	desc.SampleDesc.Count = 1;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	m_pDevice->CreateTexture2D( &desc, nullptr, &m_pTiledOutput );
+	DXUT_SetDebugName( m_pTiledOutput, "TiledOutput" );
+
+	m_pDevice->CreateShaderResourceView( m_pTiledOutput, nullptr, &m_pTiledOutputSRV );
+}
+
+
+void CPUParticleSystem::OnReleasingSwapChain()
+{
+	SAFE_RELEASE( m_pTiledOutputSRV );
+	SAFE_RELEASE( m_pTiledOutput );
+
+	m_TiledOutputWidth = 0;
+	m_TiledOutputHeight = 0;
+}
+
+
+void CPUParticleSystem::OnDestroyDevice()
+{
+	m_pImmediateContext = nullptr;
+	m_pDevice = nullptr;
+
+	ReleaseParticleBuffers();
+	SAFE_RELEASE( m_pActiveListConstantBuffer );
+	SAFE_RELEASE( m_pCompositeBlendState );
+	SAFE_RELEASE( m_pAtlasSRV );
+
+	SAFE_RELEASE( m_pCopyPS );
+	SAFE_RELEASE( m_pQuadVS );
+
+	for ( int j = 0; j < NumQualityModes; j++ )
+	{
+		for ( int k = 0; k < NumStreakModes; k++ )
+		{
+			SAFE_RELEASE( m_pRasterizedPS[ j ][ k ] );
+		}
+	}
+	for ( int k = 0; k < ARRAYSIZE( m_pGS ); k++ )
+	{
+		SAFE_RELEASE( m_pGS[ k ] );
+	}
+
+	for ( int i = 0; i < NumStreakModes; i++ )
+	{
+		for ( int j = 0; j < NumBillboardModes; j++ )
+		{
+			SAFE_RELEASE( m_pVS[ i ][ j ] );
+		}
+	}
+
+	m_ResetSystem = true;
+}
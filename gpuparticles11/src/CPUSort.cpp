@@ -0,0 +1,177 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "CPUSort.h"
+#include <algorithm>
+#include <string.h>
+
+
+#define CPU_SORT_BITS		8
+#define CPU_SORT_DIGITS		( 1 << CPU_SORT_BITS )
+
+// Items handed to each block. Each block owns a histogram so there is no point splitting the work up finer than this
+static const unsigned int g_MinItemsPerBlock = 16 * 1024;
+
+// Blocks per thread, so a thread that gets descheduled doesn't hold up the whole pass
+static const int g_BlocksPerThread = 4;
+
+
+// Flip the float's bits so that its ordering as an unsigned int matches its ordering as a float. Matches radixKey in SortLib.cpp
+static inline unsigned int radixKey( float distance )
+{
+	unsigned int bits;
+	memcpy( &bits, &distance, sizeof( bits ) );
+	unsigned int mask = ( bits & 0x80000000 ) ? 0xffffffff : 0x80000000;
+	return bits ^ mask;
+}
+
+
+CPUSortLib::CPUSortLib() :
+	m_pJobSystem( nullptr )
+{
+}
+
+
+CPUSortLib::~CPUSortLib()
+{
+	release();
+}
+
+
+void CPUSortLib::init( JobSystem* jobSystem )
+{
+	m_pJobSystem = jobSystem;
+}
+
+
+void CPUSortLib::release()
+{
+	std::vector<Item>().swap( m_scratch );
+	std::vector<unsigned int>().swap( m_histograms );
+	m_pJobSystem = nullptr;
+}
+
+
+void CPUSortLib::forEachBlock( int numBlocks, const JobSystem::RangeFunction& function )
+{
+	if ( m_pJobSystem && numBlocks > 1 )
+	{
+		m_pJobSystem->ParallelFor( numBlocks, 1, function );
+	}
+	else
+	{
+		function( 0, numBlocks );
+	}
+}
+
+
+void CPUSortLib::run( unsigned int maxSize, Item* items, unsigned int itemCount )
+{
+	if ( itemCount < 2 )
+		return;
+
+	// Size the scratch for the largest sort up front so it isn't reallocated as the particle count changes
+	if ( m_scratch.size() < std::max( maxSize, itemCount ) )
+	{
+		m_scratch.resize( std::max( maxSize, itemCount ) );
+	}
+
+	int numThreads = m_pJobSystem ? m_pJobSystem->GetNumThreads() : 1;
+	unsigned int maxBlocks = (unsigned int)( numThreads * g_BlocksPerThread );
+	unsigned int numBlocks = std::min( maxBlocks, std::max( 1u, itemCount / g_MinItemsPerBlock ) );
+	unsigned int blockSize = ( itemCount + numBlocks - 1 ) / numBlocks;
+	numBlocks = ( itemCount + blockSize - 1 ) / blockSize;
+
+	m_histograms.resize( numBlocks * CPU_SORT_DIGITS );
+
+	Item* source = items;
+	Item* destination = m_scratch.data();
+	unsigned int* histograms = m_histograms.data();
+
+	for ( int shift = 0; shift < 32; shift += CPU_SORT_BITS )
+	{
+		// Count the digits in each block
+		forEachBlock( (int)numBlocks, [&]( int begin, int end )
+		{
+			for ( int block = begin; block < end; block++ )
+			{
+				unsigned int* histogram = histograms + block * CPU_SORT_DIGITS;
+				memset( histogram, 0, CPU_SORT_DIGITS * sizeof( unsigned int ) );
+
+				unsigned int first = block * blockSize;
+				unsigned int last = std::min( first + blockSize, itemCount );
+				for ( unsigned int i = first; i < last; i++ )
+				{
+					histogram[ ( radixKey( source[ i ].distance ) >> shift ) & ( CPU_SORT_DIGITS - 1 ) ]++;
+				}
+			}
+		} );
+
+		// Turn the counts into scatter offsets. Digit-major so each block writes after every earlier block with the same digit, 
+		// which keeps the sort stable. A pass where every item has the same digit wouldn't move anything so skip it
+		unsigned int offset = 0;
+		bool skipPass = false;
+		for ( int digit = 0; digit < CPU_SORT_DIGITS && !skipPass; digit++ )
+		{
+			unsigned int digitStart = offset;
+			for ( unsigned int block = 0; block < numBlocks; block++ )
+			{
+				unsigned int count = histograms[ block * CPU_SORT_DIGITS + digit ];
+				histograms[ block * CPU_SORT_DIGITS + digit ] = offset;
+				offset += count;
+			}
+
+			skipPass = offset - digitStart == itemCount;
+		}
+
+		if ( skipPass )
+			continue;
+
+		// Scatter each block to its offsets, in order
+		forEachBlock( (int)numBlocks, [&]( int begin, int end )
+		{
+			for ( int block = begin; block < end; block++ )
+			{
+				unsigned int* offsets = histograms + block * CPU_SORT_DIGITS;
+
+				unsigned int first = block * blockSize;
+				unsigned int last = std::min( first + blockSize, itemCount );
+				for ( unsigned int i = first; i < last; i++ )
+				{
+					destination[ offsets[ ( radixKey( source[ i ].distance ) >> shift ) & ( CPU_SORT_DIGITS - 1 ) ]++ ] = source[ i ];
+				}
+			}
+		} );
+
+		std::swap( source, destination );
+	}
+
+	// An odd number of passes leaves the result in the scratch buffer
+	if ( source != items )
+	{
+		forEachBlock( (int)numBlocks, [&]( int begin, int end )
+		{
+			unsigned int first = begin * blockSize;
+			unsigned int last = std::min( end * blockSize, itemCount );
+			memcpy( items + first, source + first, ( last - first ) * sizeof( Item ) );
+		} );
+	}
+}
@@ -0,0 +1,66 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __CPU_SORT_H__
+#define __CPU_SORT_H__
+
+
+#include "JobSystem.h"
+#include <vector>
+
+
+// CPU counterpart of SortLib. Sorts ( distance, index ) pairs into ascending distance order with a stable LSD radix sort whose
+// passes are spread over a JobSystem. The order matches SortLib::referenceSort and the GPU radix sort exactly, so it can stand in
+// for either when validating or when the particles are simulated on the CPU
+class CPUSortLib
+{
+public:
+
+	// Same layout as SortLib::Item and CPUAliveIndex
+	struct Item
+	{
+		float distance;
+		float index;
+	};
+
+	CPUSortLib();
+	~CPUSortLib();
+
+	// Passing no job system runs every pass on the calling thread
+	void init( JobSystem* jobSystem );
+	void run( unsigned int maxSize, Item* items, unsigned int itemCount );
+	void release();
+
+private:
+
+	void forEachBlock( int numBlocks, const JobSystem::RangeFunction& function );
+
+	JobSystem*					m_pJobSystem;
+
+	// Ping-pong buffer for the scatter passes
+	std::vector<Item>			m_scratch;
+
+	// One digit histogram per block, turned into per-block scatter offsets by the scan
+	std::vector<unsigned int>	m_histograms;
+};
+
+
+#endif
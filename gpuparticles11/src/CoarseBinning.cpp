@@ -0,0 +1,219 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "CoarseBinning.h"
+#include <algorithm>
+#include <math.h>
+
+
+// Project a view space point with the transposed projection matrix from the constant buffer and return its NDC XY
+static inline DirectX::XMFLOAT2 ProjectToNDC( DirectX::FXMMATRIX projection, float x, float y, float z )
+{
+	DirectX::XMVECTOR p = DirectX::XMVector4Transform( DirectX::XMVectorSet( x, y, z, 1.0f ), projection );
+	DirectX::XMFLOAT4 result;
+	DirectX::XMStoreFloat4( &result, p );
+	return DirectX::XMFLOAT2( result.x / result.w, result.y / result.w );
+}
+
+
+bool GetSphereScreenBounds( const PER_FRAME_CONSTANT_BUFFER& constants, const DirectX::XMFLOAT4& viewSpacePosition, float radius, float margin, float& pixelMinX, float& pixelMinY, float& pixelMaxX, float& pixelMaxY )
+{
+	const float x = viewSpacePosition.x;
+	const float y = viewSpacePosition.y;
+	const float z = viewSpacePosition.z;
+	const float r = radius;
+
+	pixelMinX = pixelMinY = pixelMaxX = pixelMaxY = 0.0f;
+
+	// Spheres entirely behind the eye can't be seen
+	if ( -z >= r )
+		return false;
+
+	// Spheres reaching behind the eye cover the whole screen. Otherwise the extents are the projected corners of the front and back 
+	// faces of the sphere's bounding box, see GetSphereScreenBounds in Globals.h
+	float ndcMinX = -1.0f, ndcMinY = -1.0f, ndcMaxX = 1.0f, ndcMaxY = 1.0f;
+	if ( z - r > COARSE_BINNING_MIN_Z )
+	{
+		DirectX::XMMATRIX projection = DirectX::XMMatrixTranspose( constants.m_Projection );
+
+		DirectX::XMFLOAT2 p0 = ProjectToNDC( projection, x - r, y - r, z - r );
+		DirectX::XMFLOAT2 p1 = ProjectToNDC( projection, x + r, y + r, z - r );
+		DirectX::XMFLOAT2 p2 = ProjectToNDC( projection, x - r, y - r, z + r );
+		DirectX::XMFLOAT2 p3 = ProjectToNDC( projection, x + r, y + r, z + r );
+
+		ndcMinX = std::min( p0.x, p2.x );
+		ndcMinY = std::min( p0.y, p2.y );
+		ndcMaxX = std::max( p1.x, p3.x );
+		ndcMaxY = std::max( p1.y, p3.y );
+	}
+
+	const float screenWidth = (float)constants.m_ScreenWidth;
+	const float screenHeight = (float)constants.m_ScreenHeight;
+
+	pixelMinX = ( ndcMinX * 0.5f + 0.5f ) * screenWidth - margin;
+	pixelMinY = ( 0.5f - ndcMaxY * 0.5f ) * screenHeight - margin;
+	pixelMaxX = ( ndcMaxX * 0.5f + 0.5f ) * screenWidth + margin;
+	pixelMaxY = ( 0.5f - ndcMinY * 0.5f ) * screenHeight + margin;
+
+	if ( pixelMaxX < 0.0f || pixelMaxY < 0.0f || pixelMinX >= screenWidth || pixelMinY >= screenHeight )
+		return false;
+
+	return pixelMinX <= pixelMaxX && pixelMinY <= pixelMaxY;
+}
+
+
+bool GetCoarseBinRange( const PER_FRAME_CONSTANT_BUFFER& constants, const CoarseBinLayout& layout, const DirectX::XMFLOAT4& viewSpacePosition, float radius, float margin, int& minX, int& minY, int& maxX, int& maxY )
+{
+	minX = minY = maxX = maxY = 0;
+
+	float pixelMinX, pixelMinY, pixelMaxX, pixelMaxY;
+	if ( !GetSphereScreenBounds( constants, viewSpacePosition, radius, margin, pixelMinX, pixelMinY, pixelMaxX, pixelMaxY ) )
+		return false;
+
+	const float lastBinX = (float)( layout.m_NumBinsX - 1 );
+	const float lastBinY = (float)( layout.m_NumBinsY - 1 );
+
+	minX = (int)std::min( std::max( floorf( pixelMinX / layout.m_BinWidth ), 0.0f ), lastBinX );
+	minY = (int)std::min( std::max( floorf( pixelMinY / layout.m_BinHeight ), 0.0f ), lastBinY );
+	maxX = (int)std::min( std::max( floorf( pixelMaxX / layout.m_BinWidth ), 0.0f ), lastBinX );
+	maxY = (int)std::min( std::max( floorf( pixelMaxY / layout.m_BinHeight ), 0.0f ), lastBinY );
+	return true;
+}
+
+
+void BinParticles( const PER_FRAME_CONSTANT_BUFFER& constants, const CoarseBinLayout& layout, const DirectX::XMFLOAT4* viewSpacePositions, const float* maxRadii, const UINT* aliveIndices, int numAlive, std::vector< std::vector<UINT> >& bins )
+{
+	bins.assign( layout.m_NumBinsX * layout.m_NumBinsY, std::vector<UINT>() );
+
+	for ( int i = 0; i < numAlive; i++ )
+	{
+		UINT index = aliveIndices[ i ];
+
+		int minX, minY, maxX, maxY;
+		if ( !GetCoarseBinRange( constants, layout, viewSpacePositions[ index ], maxRadii[ index ], 0.0f, minX, minY, maxX, maxY ) )
+			continue;
+
+		for ( int binY = minY; binY <= maxY; binY++ )
+		{
+			for ( int binX = minX; binX <= maxX; binX++ )
+			{
+				bins[ binY * layout.m_NumBinsX + binX ].push_back( index );
+			}
+		}
+	}
+}
+
+
+// Test whether a particle is at least margin further than its radius behind a bin's furthest opaque depth
+static inline bool IsBehindBin( const float* binMaxZ, int bin, const DirectX::XMFLOAT4& viewSpacePosition, float radius, float margin )
+{
+	return binMaxZ && viewSpacePosition.z - binMaxZ[ bin ] >= radius + margin;
+}
+
+
+int ValidateCoarseBins( const PER_FRAME_CONSTANT_BUFFER& constants, const CoarseBinLayout& layout, const DirectX::XMFLOAT4* viewSpacePositions, const float* maxRadii, const float* binMaxZ, const UINT* aliveIndices, int numAlive, const std::vector< std::vector<UINT> >& bins )
+{
+	// The slack in the max Z test, in view space units
+	const float depthMargin = 0.001f;
+
+	const int numBins = layout.m_NumBinsX * layout.m_NumBinsY;
+	if ( (int)bins.size() != numBins )
+		return numAlive;
+
+	// Sort each bin so membership can be looked up
+	std::vector< std::vector<UINT> > sortedBins( bins );
+	for ( int i = 0; i < numBins; i++ )
+	{
+		std::sort( sortedBins[ i ].begin(), sortedBins[ i ].end() );
+	}
+
+	// The bins each alive particle is allowed to be in, keyed by particle index. Anything not alive gets an empty range
+	struct BinRange
+	{
+		int		m_MinX, m_MinY, m_MaxX, m_MaxY;
+	};
+
+	UINT maxIndex = 0;
+	for ( int i = 0; i < numAlive; i++ )
+	{
+		maxIndex = std::max( maxIndex, aliveIndices[ i ] );
+	}
+
+	const BinRange emptyRange = { 0, 0, -1, -1 };
+	std::vector<BinRange> allowedRanges( numAlive ? maxIndex + 1 : 0, emptyRange );
+
+	int numErrors = 0;
+	for ( int i = 0; i < numAlive; i++ )
+	{
+		UINT index = aliveIndices[ i ];
+		const DirectX::XMFLOAT4& position = viewSpacePositions[ index ];
+		float radius = maxRadii[ index ];
+
+		BinRange& allowed = allowedRanges[ index ];
+		if ( !GetCoarseBinRange( constants, layout, position, radius, 1.0f, allowed.m_MinX, allowed.m_MinY, allowed.m_MaxX, allowed.m_MaxY ) )
+		{
+			allowed = emptyRange;
+		}
+
+		// Every bin the particle definitely overlaps and isn't hidden in must hold it
+		int minX, minY, maxX, maxY;
+		if ( GetCoarseBinRange( constants, layout, position, radius, -1.0f, minX, minY, maxX, maxY ) )
+		{
+			for ( int binY = minY; binY <= maxY; binY++ )
+			{
+				for ( int binX = minX; binX <= maxX; binX++ )
+				{
+					if ( IsBehindBin( binMaxZ, binY * layout.m_NumBinsX + binX, position, radius, -depthMargin ) )
+						continue;
+
+					const std::vector<UINT>& bin = sortedBins[ binY * layout.m_NumBinsX + binX ];
+					if ( !std::binary_search( bin.begin(), bin.end(), index ) )
+					{
+						numErrors++;
+					}
+				}
+			}
+		}
+	}
+
+	// Every entry must be in a bin its particle could overlap and be seen in
+	for ( int binY = 0; binY < layout.m_NumBinsY; binY++ )
+	{
+		for ( int binX = 0; binX < layout.m_NumBinsX; binX++ )
+		{
+			const std::vector<UINT>& bin = sortedBins[ binY * layout.m_NumBinsX + binX ];
+			for ( size_t i = 0; i < bin.size(); i++ )
+			{
+				const BinRange& allowed = bin[ i ] < allowedRanges.size() ? allowedRanges[ bin[ i ] ] : emptyRange;
+				if ( binX < allowed.m_MinX || binX > allowed.m_MaxX || binY < allowed.m_MinY || binY > allowed.m_MaxY )
+				{
+					numErrors++;
+				}
+				else if ( IsBehindBin( binMaxZ, binY * layout.m_NumBinsX + binX, viewSpacePositions[ bin[ i ] ], maxRadii[ bin[ i ] ], depthMargin ) )
+				{
+					numErrors++;
+				}
+			}
+		}
+	}
+
+	return numErrors;
+}
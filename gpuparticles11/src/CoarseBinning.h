@@ -0,0 +1,63 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __COARSE_BINNING_H__
+#define __COARSE_BINNING_H__
+
+
+#include "ParticleSystem.h"
+#include <vector>
+
+
+// CPU model of the screen rect coarse binning in CoarseCullingCS.hlsl. Each particle's bounding sphere is projected to a conservative
+// screen rectangle and the particle is put in every bin the rectangle overlaps. It works on plain arrays, so it can bin the CPU
+// simulation's particles or check bins read back from the GPU without anything being rendered
+
+// The bin grid. Bins are numbered binY * m_NumBinsX + binX as on the GPU. They are whole numbers of culling tiles so the last row
+// and column can hang off the screen
+struct CoarseBinLayout
+{
+	int		m_NumBinsX;
+	int		m_NumBinsY;
+	int		m_BinWidth;		// Pixels
+	int		m_BinHeight;
+};
+
+// Project a particle's bounding sphere to a conservative screen rectangle in pixels, grown by margin pixels on each side or shrunk if 
+// margin is negative. Returns false if the particle is behind the eye, off screen or shrunk to nothing. Mirrors GetSphereScreenBounds 
+// in Globals.h, and is shared with the occlusion culling model
+bool GetSphereScreenBounds( const PER_FRAME_CONSTANT_BUFFER& constants, const DirectX::XMFLOAT4& viewSpacePosition, float radius, float margin, float& pixelMinX, float& pixelMinY, float& pixelMaxX, float& pixelMaxY );
+
+// Find the inclusive range of bins a particle overlaps. The screen rectangle is grown by margin pixels on each side, or shrunk if
+// margin is negative. Returns false if the particle is behind the eye, off screen or shrunk to nothing
+bool GetCoarseBinRange( const PER_FRAME_CONSTANT_BUFFER& constants, const CoarseBinLayout& layout, const DirectX::XMFLOAT4& viewSpacePosition, float radius, float margin, int& minX, int& minY, int& maxX, int& maxY );
+
+// Bin the particles on the alive list. Each bin lists the particle indices it holds in alive list order
+void BinParticles( const PER_FRAME_CONSTANT_BUFFER& constants, const CoarseBinLayout& layout, const DirectX::XMFLOAT4* viewSpacePositions, const float* maxRadii, const UINT* aliveIndices, int numAlive, std::vector< std::vector<UINT> >& bins );
+
+// Check bins built elsewhere against the model. The order within a bin is ignored, and a particle within a pixel of a bin edge may
+// be in either bin, so float rounding differences are not reported. binMaxZ is the furthest opaque view space depth in each bin when 
+// the bins were built with max Z culling, or null. Particles entirely behind it must be left out, again with a little slack either 
+// way. Returns the number of entries that are missing or misplaced
+int ValidateCoarseBins( const PER_FRAME_CONSTANT_BUFFER& constants, const CoarseBinLayout& layout, const DirectX::XMFLOAT4* viewSpacePositions, const float* maxRadii, const float* binMaxZ, const UINT* aliveIndices, int numAlive, const std::vector< std::vector<UINT> >& bins );
+
+
+#endif
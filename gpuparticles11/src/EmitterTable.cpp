@@ -0,0 +1,141 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "EmitterTable.h"
+#include <algorithm>
+
+
+EmitterTable::EmitterTable() :
+	m_DirtyBegin( 0 ),
+	m_DirtyEnd( 0 ),
+	m_pBuffer( nullptr ),
+	m_pBufferSRV( nullptr ),
+	m_Capacity( 0 )
+{
+	ZeroMemory( &m_Default, sizeof( m_Default ) );
+}
+
+
+EmitterTable::~EmitterTable()
+{
+	ReleaseGPUTable();
+}
+
+
+void EmitterTable::Set( int firstEmitter, int numEmitters, const IParticleSystem::EmitterProperties* properties )
+{
+	// The emitter index is packed into 16 bits of each particle so anything beyond MAX_EMITTERS can never be referenced
+	firstEmitter = std::max( firstEmitter, 0 );
+	numEmitters = std::min( numEmitters, MAX_EMITTERS - firstEmitter );
+	if ( numEmitters <= 0 )
+		return;
+
+	int end = firstEmitter + numEmitters;
+	if ( end > (int)m_Emitters.size() )
+	{
+		m_Emitters.resize( end, m_Default );
+	}
+
+	std::copy( properties, properties + numEmitters, m_Emitters.begin() + firstEmitter );
+
+	if ( m_DirtyBegin == m_DirtyEnd )
+	{
+		m_DirtyBegin = firstEmitter;
+		m_DirtyEnd = end;
+	}
+	else
+	{
+		m_DirtyBegin = std::min( m_DirtyBegin, firstEmitter );
+		m_DirtyEnd = std::max( m_DirtyEnd, end );
+	}
+}
+
+
+ID3D11ShaderResourceView* EmitterTable::UpdateGPUTable( ID3D11Device* pDevice, ID3D11DeviceContext* pImmediateContext )
+{
+	// Grow in powers of two so adding emitters one at a time doesn't recreate the buffer every frame. A new buffer needs everything uploading
+	if ( !m_pBuffer || (int)m_Emitters.size() > m_Capacity )
+	{
+		CreateGPUTable( pDevice );
+		m_DirtyBegin = 0;
+		m_DirtyEnd = (int)m_Emitters.size();
+	}
+
+	if ( m_DirtyBegin < m_DirtyEnd )
+	{
+		D3D11_BOX box;
+		box.left = m_DirtyBegin * sizeof( IParticleSystem::EmitterProperties );
+		box.right = m_DirtyEnd * sizeof( IParticleSystem::EmitterProperties );
+		box.top = 0;
+		box.bottom = 1;
+		box.front = 0;
+		box.back = 1;
+		pImmediateContext->UpdateSubresource( m_pBuffer, 0, &box, &m_Emitters[ m_DirtyBegin ], 0, 0 );
+	}
+
+	m_DirtyBegin = 0;
+	m_DirtyEnd = 0;
+
+	return m_pBufferSRV;
+}
+
+
+void EmitterTable::CreateGPUTable( ID3D11Device* pDevice )
+{
+	ReleaseGPUTable();
+
+	m_Capacity = 64;
+	while ( m_Capacity < (int)m_Emitters.size() )
+	{
+		m_Capacity *= 2;
+	}
+
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.ByteWidth = sizeof( IParticleSystem::EmitterProperties ) * m_Capacity;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.StructureByteStride = sizeof( IParticleSystem::EmitterProperties );
+
+	// Zero fill so the entries past the end of the table read the same as the CPU default
+	std::vector<IParticleSystem::EmitterProperties> initialData( m_Capacity, m_Default );
+	D3D11_SUBRESOURCE_DATA data;
+	data.pSysMem = &initialData[ 0 ];
+	data.SysMemPitch = 0;
+	data.SysMemSlicePitch = 0;
+	pDevice->CreateBuffer( &desc, &data, &m_pBuffer );
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srv;
+	ZeroMemory( &srv, sizeof( srv ) );
+	srv.Format = DXGI_FORMAT_UNKNOWN;
+	srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srv.Buffer.ElementWidth = m_Capacity;
+	pDevice->CreateShaderResourceView( m_pBuffer, &srv, &m_pBufferSRV );
+}
+
+
+void EmitterTable::ReleaseGPUTable()
+{
+	SAFE_RELEASE( m_pBufferSRV );
+	SAFE_RELEASE( m_pBuffer );
+	m_Capacity = 0;
+}
@@ -0,0 +1,68 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __EMITTER_TABLE_H__
+#define __EMITTER_TABLE_H__
+
+
+#include "ParticleSystem.h"
+#include <vector>
+
+
+// The per-emitter properties that live with the system rather than being passed in each frame. A CPU copy is kept so the table
+// survives device loss, and only the entries changed since the last upload are copied into the GPU structured buffer
+class EmitterTable
+{
+public:
+
+	EmitterTable();
+	~EmitterTable();
+
+	// Write a range of entries, growing the table if needed. Entries in any gap that opens up are zeroed
+	void Set( int firstEmitter, int numEmitters, const IParticleSystem::EmitterProperties* properties );
+
+	int GetNumEmitters() const { return (int)m_Emitters.size(); }
+
+	// Emitters that have never been set read as zero, the same as an out of range read from the structured buffer
+	const IParticleSystem::EmitterProperties& Get( int emitter ) const { return emitter < (int)m_Emitters.size() ? m_Emitters[ emitter ] : m_Default; }
+
+	// Upload the dirty range, recreating the buffer if the table has outgrown it. Returns the SRV to bind
+	ID3D11ShaderResourceView* UpdateGPUTable( ID3D11Device* pDevice, ID3D11DeviceContext* pImmediateContext );
+	void ReleaseGPUTable();
+
+private:
+
+	void CreateGPUTable( ID3D11Device* pDevice );
+
+	std::vector<IParticleSystem::EmitterProperties>	m_Emitters;
+	IParticleSystem::EmitterProperties				m_Default;
+
+	// The range of entries [begin, end) that differ from the GPU copy
+	int												m_DirtyBegin;
+	int												m_DirtyEnd;
+
+	ID3D11Buffer*									m_pBuffer;
+	ID3D11ShaderResourceView*						m_pBufferSRV;
+	int												m_Capacity;
+};
+
+
+#endif
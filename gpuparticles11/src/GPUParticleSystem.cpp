@@ -20,9 +20,15 @@
 // THE SOFTWARE.
 //
 #include "ParticleSystem.h"
-#include "ParticleHelpers.h"
+#include "ParticleFormat.h"
+#include "EmitterTable.h"
+#include "CoarseBinning.h"
+#include "OcclusionCulling.h"
+#include "RenderBufferFormat.h"
+#include "TiledRasterizer.h"
 #include "Shaders/ShaderConstants.h"
 #include "SortLib.h"
+#include <algorithm>
 
 
 #pragma warning( disable : 4100 ) // disable unreference formal parameter warnings for /W4 builds
@@ -32,7 +38,8 @@
 int align( int value, int alignment ) { return ( value + (alignment - 1) ) & ~(alignment - 1); }
 
 
-// GPUParticle structure is split into two sections for better cache efficiency - could even be SOA but would require creating more vertex buffers.
+// GPUParticle structure is split into two sections for better cache efficiency. Layout_Compact keeps the split but quantizes each half, see 
+// ParticleFormat.h. With Layout_SoA the particles are instead stored as a structure of arrays in a single raw buffer, see ParticleStorage.h
 struct GPUParticlePartA
 {
 	DirectX::XMVECTOR	m_params[ 3 ];
@@ -44,26 +51,35 @@ struct GPUParticlePartB
 };
 
 
-// The per-emitter constant buffer
-struct EmitterConstantBuffer
+// An emitter that emits this frame. Every one of these is packed into a structured buffer and emitted with a single dispatch
+struct GPUEmitter
 {
 	DirectX::XMVECTOR	m_EmitterPosition;
 	DirectX::XMVECTOR	m_EmitterVelocity;
 	DirectX::XMVECTOR	m_PositionVariance;
 
-	int					m_MaxParticlesThisFrame;
+	int					m_FirstParticle;		// The number of particles emitted by the previous emitters in the buffer
+	int					m_NumToEmit;
 	float				m_ParticleLifeSpan;
 	float				m_StartSize;
-	float				m_EndSize;
-	
 	
+	float				m_EndSize;
 	float				m_VelocityVariance;
 	float				m_Mass;
 	int					m_Index;
-	int					m_Streaks;
 
+	int					m_Streaks;
 	int					m_TextureIndex;
-	int					pads[ 3 ];
+	int					pads[ 2 ];
+};
+
+
+struct EmitterConstantBuffer
+{
+	int					m_NumEmitters;
+	int					m_NumToEmit;
+	UINT				m_EmitFrame;
+	int					pads;
 };
 
 
@@ -77,25 +93,86 @@ struct TilingConstantBuffer
 
 	unsigned int numCullingTilesPerCoarseTileX;
 	unsigned int numCullingTilesPerCoarseTileY;
-	unsigned int pads[ 2 ];
+	unsigned int coarseBinCapacity;
+	unsigned int tileListCapacity;
+
+	unsigned int tileResX;
+	unsigned int tileResY;
+	unsigned int maxShadingRate;
+	unsigned int opacityCulling;
+
+	unsigned int cullMaxZ;
+	unsigned int pads[ 3 ];
 };
 
 
-// The maximum number of supported GPU particles
-static const int g_maxParticles = 400*1024;
+// The largest particle pool supported. SortLib's bitonic sort handles at most 1M items
+static const int g_maxSupportedParticles = 1024*1024;
+static_assert( g_maxSupportedParticles < ( 1 << SORT_KEY_INDEX_BITS ), "Packed sort keys don't have enough bits for the particle index" );
 
 // The maximum number of coarse tiles
 static const int g_maxCoarseCullingTilesX = 16;
 static const int g_maxCoarseCullingTilesY = 8;
 static const int g_maxCoarseCullingTiles = g_maxCoarseCullingTilesX * g_maxCoarseCullingTilesY;
 
+// The coarse culling index buffer starts with room for this many bins per particle and grows to fit the totals read back from the GPU
+static const int g_initialCoarseBinsPerParticle = 2;
+
+// The tiled index buffer starts with room for this many particles per tile and grows the same way
+static const int g_initialParticlesPerTile = 256;
+
+// The largest tiled index buffer we create. D3D11 guarantees resources of at least this size can be created
+static const UINT g_maxTileListCapacity = ( D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM * 1024 * 1024 ) / sizeof( UINT );
+
+// The same limit for the coarse culling index buffer. Every particle in every bin would be 512MB at 1M particles
+static const UINT g_maxCoarseBinCapacity = g_maxTileListCapacity;
+
+// Frames between the culling passes writing their totals and the CPU reading them, so the readback doesn't stall
+static const int g_listTotalReadbackLatency = 3;
+
+// The fine-grained tile sizes the culling and tiled rendering shaders are compiled for, smallest first. A thread group has a thread 
+// per pixel of its tile, so D3D11's limit of 1024 threads per group rules out 64x64 tiles
+static const int g_tileSizes[] = { 8, 16, 32 };
+static const int g_numTileSizes = (int)ARRAYSIZE( g_tileSizes );
+static const int g_defaultTileSize = 2;		// Index into g_tileSizes of the size used when not adapting the tile size to the scene
+
+// The adaptive tile size picks the largest tiles for which this fraction of the occupied tiles would hold no more than the target 
+// number of particles. Long lists are sorted and rendered in chunks so they cost more per pixel than a few smaller tiles would. The 
+// target is capped at what a tile can sort in LDS in a single run, see GetMaxSingleRunParticles
+static const float g_tileSizeDensityPercentile = 0.9f;
+static const int g_tileSizeTargetParticles = 256;
+
+// The longest tile list CullingCS.hlsl sorts in a single run for a tile size, MAX_PARTICLES_PER_TILE_FOR_SORTING. Longer lists are 
+// sorted in runs that TileListMerge then has to merge, and the opacity culling can't cut them short
+static int GetMaxSingleRunParticles( int tileSize )
+{
+	return 2 * g_tileSizes[ tileSize ] * g_tileSizes[ tileSize ];
+}
+
+#if _DEBUG
+// Set to true to check the screen rect coarse binning against the CPU model in CoarseBinning.h. Stalls on several readbacks each frame
+static const bool g_validateCoarseBinning = false;
+
+// Set to true to check the occlusion culling against the CPU model in OcclusionCulling.h. Stalls on several readbacks each frame
+static const bool g_validateOcclusionCulling = false;
+
+// Set to true to check the tiled renderer against the CPU reference in TiledRasterizer.h. Stalls on several readbacks each frame
+static const bool g_validateTiledRendering = false;
+
+// The GPU's transcendentals aren't bit exact with the CPU's, so the tiled rendering check lets each channel differ this much. A few 
+// pixels can differ by more where a particle's edge or the alpha threshold falls between the two, so it only fails if more than 
+// one in g_tiledRenderingMaxErrorRatio pixels do
+static const float g_tiledRenderingTolerance = 2.0f / 255.0f;
+static const int g_tiledRenderingMaxErrorRatio = 1000;
+#endif
+
 
 // GPU Particle System class. Responsible for updating and rendering the particles
 class GPUParticleSystem : public IParticleSystem
 {
 public:
 
-	GPUParticleSystem( AMD::ShaderCache& shadercache );
+	GPUParticleSystem( AMD::ShaderCache& shadercache, Layout layout, int maxParticles, bool packedSortKeys );
 	
 private:
 
@@ -135,6 +212,13 @@ private:
 		NumBillboardModes
 	};
 
+	enum CoarseBinningMode
+	{
+		PlaneBinning,
+		ScreenRectBinning,
+		NumCoarseBinningModes
+	};
+
 	virtual ~GPUParticleSystem();
 
 	virtual void OnCreateDevice( ID3D11Device* pDevice, ID3D11DeviceContext* pImmediateContext );
@@ -144,29 +228,73 @@ private:
 
 	virtual void Reset();
 
+	virtual void SetMaxParticles( int maxParticles );
+	virtual int GetMaxParticles() const { return m_MaxParticles; }
+
+	// The shaders read the per-frame constants from the bound constant buffer. The CPU copy is only used to check the coarse bins
+	virtual void SetPerFrameConstants( const PER_FRAME_CONSTANT_BUFFER& constants ) { m_PerFrameConstants = constants; }
+
+	virtual void SetRenderBufferFormat( RenderBufferFormat format );
+
+	virtual void SetEmitterProperties( int firstEmitter, int numEmitters, const EmitterProperties* properties ) { m_EmitterTable.Set( firstEmitter, numEmitters, properties ); }
+
 	virtual void Render( float frameTime, int flags, Technique technique, CoarseCullingMode coarseCullingMode, const EmitterParams* pEmitters, int nNumEmitters, ID3D11ShaderResourceView* depthSRV );
 
 	virtual const Stats& GetStats() const { return m_Stats; }
 
 	void Emit( int numEmitters, const EmitterParams* emitters );
 	void Simulate( int flags, ID3D11ShaderResourceView* depthSRV );
-	void Sort();
+	void Sort( int flags );
 
 #if _DEBUG
 	int	ReadCounter( ID3D11UnorderedAccessView* uav );
+	void ReadBuffer( ID3D11Buffer* buffer, UINT numBytes, std::vector<BYTE>& data );
+	void DecodeSortItems( const std::vector<BYTE>& items, int numItems, std::vector<UINT>& indices );
+	void CheckCoarseBins( CoarseCullingMode coarseCullingMode );
+	void CheckOcclusionCulling();
+	void CheckTiledRendering( int flags, ID3D11ShaderResourceView* depthSRV );
 #endif
 
-	void CullParticlesIntoTiles( CoarseCullingMode coarseCullingMode, int flags, ID3D11ShaderResourceView* depthSRV );
+	void CullParticlesIntoTiles( CoarseCullingMode coarseCullingMode, int flags );
 
+	void ComputeDepthBounds( ID3D11ShaderResourceView* depthSRV );
+	void DownsampleDepth( ID3D11ShaderResourceView* depthSRV );
+	void BuildHiZ( ID3D11ShaderResourceView* depthSRV );
+	void OcclusionCull( ID3D11ShaderResourceView* depthSRV, BillboardMode billboardMode );
+	void MeasureAtlasOpacity();
 	void FillRenderBuffer( int flags, ID3D11ShaderResourceView* depthSRV, Technique technique );
-	void RenderQuad();
+	void RenderQuad( ID3D11ShaderResourceView* depthSRV );
 	void InitDeadList();
-	void FillRandomTexture();
-	void CoarseCulling( CoarseCullingMode coarseCullingMode );
+	void InitAliveArgs();
+
+	// The resources that are sized by the capacity of the particle pool
+	void CreateParticleBuffers();
+	void ReleaseParticleBuffers();
+	void MigrateParticles( int oldMaxParticles );
+	void CoarseCulling( CoarseCullingMode coarseCullingMode, int flags );
+	bool CreateCoarseCullingBuffer( UINT capacity );
+	void ReleaseCoarseCullingBuffer();
+	void UpdateCoarseBinCapacity();
+	bool CreateTiledIndexBuffer( UINT capacity );
+	void ReleaseTiledIndexBuffer();
+
+	// The screen sized texture the tiled renderer writes to, in m_RenderBufferFormat
+	void CreateRenderBuffer();
+	void ReleaseRenderBuffer();
+	void UpdateTileListCapacity();
+	void UpdateTileSize( int flags );
+	void SetTileSize( int tileSize );
+	UINT ReadBackListTotals( ID3D11Buffer** readback, bool* pending );
+	void CreateEmitterBuffer( int maxEmitters );
 		
 	ID3D11Device*				m_pDevice;
 	ID3D11DeviceContext*		m_pImmediateContext;
 
+	// With the SoA layout buffer A is a raw buffer holding every stream and buffer B is unused
+	Layout						m_Layout;
+	int							m_MaxParticles;
+	bool						m_PackedSortKeys;	// The alive list is packed uint keys rather than float2s
+
 	ID3D11Buffer*				m_pParticleBufferA;
 	ID3D11ShaderResourceView*	m_pParticleBufferA_SRV;
 	ID3D11UnorderedAccessView*	m_pParticleBufferA_UAV;
@@ -182,16 +310,40 @@ private:
 	ID3D11ShaderResourceView*	m_pMaxRadiusBufferSRV;
 	ID3D11UnorderedAccessView*	m_pMaxRadiusBufferUAV;
 
-	ID3D11Buffer*				m_pStridedCoarseCullingBuffer;
-	ID3D11ShaderResourceView*	m_pStridedCoarseCullingBufferSRV;
-	ID3D11UnorderedAccessView*	m_pStridedCoarseCullingBufferUAV;
+	ID3D11Buffer*				m_pCoarseCullingBuffer;
+	ID3D11ShaderResourceView*	m_pCoarseCullingBufferSRV;
+	ID3D11UnorderedAccessView*	m_pCoarseCullingBufferUAV;
+
+	ID3D11Buffer*				m_pCoarseCullingBufferCounters;
+	ID3D11ShaderResourceView*	m_pCoarseCullingBufferCountersSRV;
+	ID3D11UnorderedAccessView*	m_pCoarseCullingBufferCountersUAV;
+
+	// The start of each coarse bin in the index buffer, followed by the total number of entries
+	ID3D11Buffer*				m_pCoarseCullingBufferOffsets;
+	ID3D11ShaderResourceView*	m_pCoarseCullingBufferOffsetsSRV;
+	ID3D11UnorderedAccessView*	m_pCoarseCullingBufferOffsetsUAV;
+
+	// The number of entries the coarse culling index buffer holds, and the staging buffers its totals are read back through. The limit 
+	// drops to the current capacity if growing the buffer fails, so it isn't retried every frame
+	UINT						m_CoarseBinCapacity;
+	UINT						m_CoarseBinCapacityLimit;
+	ID3D11Buffer*				m_pCoarseBinTotalReadback[ g_listTotalReadbackLatency ];
+	bool						m_CoarseBinTotalPending[ g_listTotalReadbackLatency ];
+	int							m_CoarseBinReadbackIndex;
 
-	ID3D11Buffer*				m_pStridedCoarseCullingBufferCounters;
-	ID3D11ShaderResourceView*	m_pStridedCoarseCullingBufferCountersSRV;
-	ID3D11UnorderedAccessView*	m_pStridedCoarseCullingBufferCountersUAV;
+	// Each coarse culling thread group's count of particles per bin
+	ID3D11Buffer*				m_pCoarseBinGroupCounts;
+	ID3D11UnorderedAccessView*	m_pCoarseBinGroupCountsUAV;
 
 	ID3D11Buffer*				m_pDeadListBuffer;
 	ID3D11UnorderedAccessView*	m_pDeadListUAV;
+
+	// The indices of the particles to simulate, double buffered. The simulation reads the current list and appends the 
+	// survivors to the other one, then emission adds the new particles to it the next frame
+	ID3D11Buffer*				m_pSimulationListBuffer[ 2 ];
+	ID3D11ShaderResourceView*	m_pSimulationListSRV[ 2 ];
+	ID3D11UnorderedAccessView*	m_pSimulationListUAV[ 2 ];
+	int							m_CurrentSimulationList;
 	
 #if _DEBUG
 	ID3D11Buffer*				m_pDebugCounterBuffer;
@@ -199,6 +351,8 @@ private:
 
 	ID3D11Buffer*				m_pDeadListConstantBuffer;
 	ID3D11Buffer*				m_pActiveListConstantBuffer;
+	ID3D11Buffer*				m_pSimulationListConstantBuffer;
+	ID3D11Buffer*				m_pParticleStorageConstantBuffer;
 	
 	ID3D11Buffer*				m_pIndexBuffer;
 
@@ -211,10 +365,23 @@ private:
 	
 	ID3D11ComputeShader*		m_pCSSimulate[ NumBillboardModes ];
 	ID3D11ComputeShader*		m_pCSInitDeadList;
+	ID3D11ComputeShader*		m_pCSInitSimulateArgs;
+	ID3D11ComputeShader*		m_pCSInitAliveArgs;
 	ID3D11ComputeShader*		m_pCSEmit;
 	ID3D11ComputeShader*		m_pCSResetParticles;
+	ID3D11ComputeShader*		m_pCSGatherParticles;
+	ID3D11ComputeShader*		m_pCSScatterParticles;
 
 	ID3D11Buffer*				m_pEmitterConstantBuffer;
+
+	// This frame's emitters, see GPUEmitter. Grown on demand
+	ID3D11Buffer*				m_pEmitterBuffer;
+	ID3D11ShaderResourceView*	m_pEmitterBufferSRV;
+	int							m_MaxEmitters;
+
+	// The per-emitter properties read by the simulation. Only the entries that changed are uploaded each frame
+	EmitterTable				m_EmitterTable;
+
 	ID3D11Buffer*				m_pTilingConstantBuffer;
 	TilingConstantBuffer		m_tilingConstants;
 		
@@ -222,6 +389,18 @@ private:
 	ID3D11ShaderResourceView*	m_pAliveIndexBufferSRV;
 	ID3D11UnorderedAccessView*	m_pAliveIndexBufferUAV;
 
+	// The alive list entries that survive the occlusion culling, packed against the end of the buffer in the same order. The 
+	// rasterized draw reads this in place of the alive list when the culling is on
+	ID3D11Buffer*				m_pVisibleIndexBuffer;
+	ID3D11ShaderResourceView*	m_pVisibleIndexBufferSRV;
+	ID3D11UnorderedAccessView*	m_pVisibleIndexBufferUAV;
+
+	// The occlusion culling's bit mask of survivors per thread group, and each group's offset into them followed by the total
+	ID3D11Buffer*				m_pVisibilityMasks;
+	ID3D11UnorderedAccessView*	m_pVisibilityMasksUAV;
+	ID3D11Buffer*				m_pVisibleGroupOffsets;
+	ID3D11UnorderedAccessView*	m_pVisibleGroupOffsetsUAV;
+
 	int							m_NumDeadParticlesOnInit;
 	int							m_NumDeadParticlesAfterEmit;
 	int							m_NumDeadParticlesAfterSimulation;
@@ -229,35 +408,126 @@ private:
 
 	bool						m_ResetSystem;
 
-	ID3D11ComputeShader*		m_pTiledRenderingCS[ NumQualityModes ][ NumStreakModes ];
-	ID3D11ComputeShader*		m_pTileComplexityCS;
-
-	ID3D11ComputeShader*		m_pCoarseCullingCS[ NumCoarseCullingModes ];
-
-	ID3D11ComputeShader*		m_pCullingCS[ NumZCullingModes ][ NumCullingModes ][ 2 ];
+	// Frames emitted since the last reset, used to key the emission random numbers so a replay from a reset is reproducible
+	UINT						m_EmitFrame;
+
+	ID3D11ComputeShader*		m_pTiledRenderingCS[ g_numTileSizes ][ NumQualityModes ][ NumStreakModes ];
+	ID3D11ComputeShader*		m_pTileComplexityCS[ g_numTileSizes ];
+
+	ID3D11ComputeShader*		m_pCoarseBinCountCS[ NumCoarseBinningModes ][ NumCoarseCullingModes ];
+	ID3D11ComputeShader*		m_pCoarseBinScanCS[ NumCoarseCullingModes ];
+	ID3D11ComputeShader*		m_pCoarseBinScatterCS[ NumCoarseBinningModes ][ NumCoarseCullingModes ];
+
+	ID3D11ComputeShader*		m_pCullingCountCS[ g_numTileSizes ][ NumZCullingModes ][ NumCullingModes ][ 2 ];
+	ID3D11ComputeShader*		m_pTileListScanCS;
+	ID3D11ComputeShader*		m_pCullingCS[ g_numTileSizes ][ NumZCullingModes ][ NumCullingModes ][ 2 ];
+	ID3D11ComputeShader*		m_pTileListMergeCS[ g_numTileSizes ];
+	ID3D11ComputeShader*		m_pDownsampleDepthCS;
+	ID3D11ComputeShader*		m_pAtlasOpacityCS;
+	ID3D11ComputeShader*		m_pTileDepthBoundsCS;
+	ID3D11ComputeShader*		m_pCoarseBinDepthBoundsCS;
+	ID3D11ComputeShader*		m_pDownsampleHiZCS;
+	ID3D11ComputeShader*		m_pOcclusionCullCS;
+	ID3D11ComputeShader*		m_pOcclusionCullScanCS[ NumBillboardModes ];
+	ID3D11ComputeShader*		m_pOcclusionCullCompactCS;
+
+	// The lowest alpha in the core of each texture in the particle atlas, for the opacity culling
+	ID3D11Buffer*				m_pAtlasCoreOpacity;
+	ID3D11ShaderResourceView*	m_pAtlasCoreOpacitySRV;
+	ID3D11UnorderedAccessView*	m_pAtlasCoreOpacityUAV;
 	
-	ID3D11Buffer*				m_pRenderingBuffer;
+	RenderBufferFormat			m_RenderBufferFormat;
+	ID3D11Texture2D*			m_pRenderingBuffer;
 	ID3D11ShaderResourceView*	m_pRenderingBufferSRV;
 	ID3D11UnorderedAccessView*	m_pRenderingBufferUAV;
 
-	ID3D11Texture2D*			m_pRandomTexture;
-	ID3D11ShaderResourceView*	m_pRandomTextureSRV;
+	// The rate each tile is shaded at, picked by the culling count pass
+	ID3D11Buffer*				m_pTileShadingRates;
+	ID3D11ShaderResourceView*	m_pTileShadingRatesSRV;
+	ID3D11UnorderedAccessView*	m_pTileShadingRatesUAV;
+
+	// The nearest and furthest view space depth of the opaque scene in each culling tile and in each coarse bin
+	ID3D11Buffer*				m_pTileDepthBounds;
+	ID3D11ShaderResourceView*	m_pTileDepthBoundsSRV;
+	ID3D11UnorderedAccessView*	m_pTileDepthBoundsUAV;
+
+	ID3D11Buffer*				m_pCoarseBinDepthBounds;
+	ID3D11ShaderResourceView*	m_pCoarseBinDepthBoundsSRV;
+	ID3D11UnorderedAccessView*	m_pCoarseBinDepthBoundsUAV;
+
+	// The opaque scene's max depth at half and quarter resolution, for the tiles shaded at those rates
+	ID3D11Texture2D*			m_pLowResDepth[ NUM_SHADING_RATES - 1 ];
+	ID3D11ShaderResourceView*	m_pLowResDepthSRV[ NUM_SHADING_RATES - 1 ];
+	ID3D11UnorderedAccessView*	m_pLowResDepthUAV[ NUM_SHADING_RATES - 1 ];
+
+	// The Hi-Z pyramid of the opaque scene's max depth the rasterized particles are occlusion culled against, with a view of each level
+	ID3D11Texture2D*			m_pHiZ;
+	ID3D11ShaderResourceView*	m_pHiZSRV;
+	ID3D11ShaderResourceView*	m_pHiZLevelSRV[ MAX_HIZ_LEVELS ];
+	ID3D11UnorderedAccessView*	m_pHiZLevelUAV[ MAX_HIZ_LEVELS ];
+	int							m_NumHiZLevels;
 
 	ID3D11Buffer*				m_pIndirectDrawArgsBuffer;
 	ID3D11UnorderedAccessView*	m_pIndirectDrawArgsBufferUAV;
 
+	ID3D11Buffer*				m_pIndirectSimulateArgsBuffer;
+	ID3D11UnorderedAccessView*	m_pIndirectSimulateArgsBufferUAV;
+
+	// DispatchIndirect args for the passes over the alive list, at the ALIVE_ARGS offsets
+	ID3D11Buffer*				m_pIndirectAliveArgsBuffer;
+	ID3D11UnorderedAccessView*	m_pIndirectAliveArgsBufferUAV;
+
 	unsigned int				m_uWidth;
 	unsigned int				m_uHeight;
 
 	Stats						m_Stats;
 
+	PER_FRAME_CONSTANT_BUFFER	m_PerFrameConstants;
+
 	ID3D11BlendState*			m_pCompositeBlendState;
 	
 	SortLib						m_SortLib;
+	SortLib						m_RadixSortLib;
+	SortLib						m_TemporalSortLib;
 
+	// The tiles' particle lists, stored back to back
 	ID3D11Buffer*				m_pTiledIndexBuffer;
 	ID3D11ShaderResourceView*	m_pTiledIndexBufferSRV;
 	ID3D11UnorderedAccessView*	m_pTiledIndexBufferUAV;
+
+	// Where the merge of the tile lists that are too long to sort in LDS puts every other round. Laid out like the tiled index buffer
+	ID3D11Buffer*				m_pTileListScratch;
+	ID3D11UnorderedAccessView*	m_pTileListScratchUAV;
+
+	// The number of particles in each tile's list
+	ID3D11Buffer*				m_pTileListCounts;
+	ID3D11ShaderResourceView*	m_pTileListCountsSRV;
+	ID3D11UnorderedAccessView*	m_pTileListCountsUAV;
+
+	// The start of each tile's list in the tiled index buffer, followed by the total length of all the lists
+	ID3D11Buffer*				m_pTileListOffsets;
+	ID3D11ShaderResourceView*	m_pTileListOffsetsSRV;
+	ID3D11UnorderedAccessView*	m_pTileListOffsetsUAV;
+
+	// The number of entries the tiled index buffer holds, and the staging buffers its totals are read back through. The limit drops as 
+	// it does for the coarse culling buffer
+	UINT						m_TileListCapacity;
+	UINT						m_TileListCapacityLimit;
+	ID3D11Buffer*				m_pTileListTotalReadback[ g_listTotalReadbackLatency ];
+	bool						m_TileListTotalPending[ g_listTotalReadbackLatency ];
+	int							m_TileListReadbackIndex;
+
+	// The current fine-grained tile size as an index into g_tileSizes
+	int							m_TileSize;
+
+	// The histogram of particles per tile written by the tile list scan, and the staging buffers it is read back through along with 
+	// the tile size each one was built at
+	ID3D11Buffer*				m_pTileDensityHistogram;
+	ID3D11UnorderedAccessView*	m_pTileDensityHistogramUAV;
+	ID3D11Buffer*				m_pTileDensityReadback[ g_listTotalReadbackLatency ];
+	bool						m_TileDensityPending[ g_listTotalReadbackLatency ];
+	int							m_TileDensityTileSize[ g_listTotalReadbackLatency ];
+	int							m_TileDensityReadbackIndex;
 };
 
 
@@ -272,15 +542,18 @@ static const int g_NumCoarseTiles[ GPUParticleSystem::NumCoarseCullingModes ][ 2
 
 
 
-IParticleSystem* IParticleSystem::CreateGPUSystem( AMD::ShaderCache& shadercache )
+IParticleSystem* IParticleSystem::CreateGPUSystem( AMD::ShaderCache& shadercache, Layout layout, int maxParticles, bool packedSortKeys )
 {
-	return new GPUParticleSystem( shadercache );
+	return new GPUParticleSystem( shadercache, layout, maxParticles, packedSortKeys );
 }
 
 
-GPUParticleSystem::GPUParticleSystem( AMD::ShaderCache& shadercache ) :
+GPUParticleSystem::GPUParticleSystem( AMD::ShaderCache& shadercache, Layout layout, int maxParticles, bool packedSortKeys ) :
 	m_pDevice( nullptr ),
 	m_pImmediateContext( nullptr ),
+	m_Layout( layout ),
+	m_MaxParticles( std::max( 1, std::min( maxParticles, g_maxSupportedParticles ) ) ),
+	m_PackedSortKeys( packedSortKeys ),
 	m_pParticleBufferA( nullptr ),
 	m_pParticleBufferA_SRV( nullptr ),
 	m_pParticleBufferA_UAV( nullptr ),
@@ -292,64 +565,171 @@ GPUParticleSystem::GPUParticleSystem( AMD::ShaderCache& shadercache ) :
 	m_pMaxRadiusBuffer( nullptr ),
 	m_pMaxRadiusBufferSRV( nullptr ),
 	m_pMaxRadiusBufferUAV( nullptr ),
-	m_pStridedCoarseCullingBuffer( nullptr ),
-	m_pStridedCoarseCullingBufferSRV( nullptr ),
-	m_pStridedCoarseCullingBufferUAV( nullptr ),
-	m_pStridedCoarseCullingBufferCounters( nullptr ),
-	m_pStridedCoarseCullingBufferCountersSRV( nullptr ),
-	m_pStridedCoarseCullingBufferCountersUAV( nullptr ),
+	m_pCoarseCullingBuffer( nullptr ),
+	m_pCoarseCullingBufferSRV( nullptr ),
+	m_pCoarseCullingBufferUAV( nullptr ),
+	m_pCoarseCullingBufferCounters( nullptr ),
+	m_pCoarseCullingBufferCountersSRV( nullptr ),
+	m_pCoarseCullingBufferCountersUAV( nullptr ),
+	m_pCoarseCullingBufferOffsets( nullptr ),
+	m_pCoarseCullingBufferOffsetsSRV( nullptr ),
+	m_pCoarseCullingBufferOffsetsUAV( nullptr ),
+	m_CoarseBinCapacity( 0 ),
+	m_CoarseBinCapacityLimit( g_maxCoarseBinCapacity ),
+	m_CoarseBinReadbackIndex( 0 ),
+	m_pCoarseBinGroupCounts( nullptr ),
+	m_pCoarseBinGroupCountsUAV( nullptr ),
 	m_pDeadListBuffer( nullptr ),
 	m_pDeadListUAV( nullptr ),
+	m_CurrentSimulationList( 0 ),
 #if _DEBUG	
 	m_pDebugCounterBuffer( nullptr ),
 #endif
 	m_pDeadListConstantBuffer( nullptr ),
 	m_pActiveListConstantBuffer( nullptr ),
+	m_pSimulationListConstantBuffer( nullptr ),
+	m_pParticleStorageConstantBuffer( nullptr ),
 	m_pIndexBuffer( nullptr ),
 	m_pQuadVS( nullptr ),
 	m_pQuadPS( nullptr ),
 	m_pCSInitDeadList( nullptr ),
+	m_pCSInitSimulateArgs( nullptr ),
+	m_pCSInitAliveArgs( nullptr ),
 	m_pCSEmit( nullptr ),
 	m_pCSResetParticles( nullptr ),
+	m_pCSGatherParticles( nullptr ),
+	m_pCSScatterParticles( nullptr ),
 	m_pEmitterConstantBuffer( nullptr ),
+	m_pEmitterBuffer( nullptr ),
+	m_pEmitterBufferSRV( nullptr ),
+	m_MaxEmitters( 0 ),
 	m_pTilingConstantBuffer( nullptr ),
 	m_pAliveIndexBuffer( nullptr ),
 	m_pAliveIndexBufferSRV( nullptr ),
 	m_pAliveIndexBufferUAV( nullptr ),
+	m_pVisibleIndexBuffer( nullptr ),
+	m_pVisibleIndexBufferSRV( nullptr ),
+	m_pVisibleIndexBufferUAV( nullptr ),
+	m_pVisibilityMasks( nullptr ),
+	m_pVisibilityMasksUAV( nullptr ),
+	m_pVisibleGroupOffsets( nullptr ),
+	m_pVisibleGroupOffsetsUAV( nullptr ),
 	m_NumDeadParticlesOnInit( 0 ),
 	m_NumDeadParticlesAfterEmit( 0 ),
 	m_NumDeadParticlesAfterSimulation( 0 ),
 	m_NumActiveParticlesAfterSimulation( 0 ),
 	m_ResetSystem( true ),
-	m_pTileComplexityCS( nullptr ),
+	m_EmitFrame( 0 ),
+	m_RenderBufferFormat( RenderBuffer_RGBA16F ),
 	m_pRenderingBuffer( nullptr ),
 	m_pRenderingBufferSRV( nullptr ),
 	m_pRenderingBufferUAV( nullptr ),
-	m_pRandomTexture( nullptr ),
-	m_pRandomTextureSRV( nullptr ),
+	m_pTileShadingRates( nullptr ),
+	m_pTileShadingRatesSRV( nullptr ),
+	m_pTileShadingRatesUAV( nullptr ),
+	m_pDownsampleDepthCS( nullptr ),
+	m_pAtlasOpacityCS( nullptr ),
+	m_pTileDepthBoundsCS( nullptr ),
+	m_pCoarseBinDepthBoundsCS( nullptr ),
+	m_pDownsampleHiZCS( nullptr ),
+	m_pOcclusionCullCS( nullptr ),
+	m_pOcclusionCullCompactCS( nullptr ),
+	m_pTileDepthBounds( nullptr ),
+	m_pTileDepthBoundsSRV( nullptr ),
+	m_pTileDepthBoundsUAV( nullptr ),
+	m_pCoarseBinDepthBounds( nullptr ),
+	m_pCoarseBinDepthBoundsSRV( nullptr ),
+	m_pCoarseBinDepthBoundsUAV( nullptr ),
+	m_pHiZ( nullptr ),
+	m_pHiZSRV( nullptr ),
+	m_NumHiZLevels( 0 ),
+	m_pAtlasCoreOpacity( nullptr ),
+	m_pAtlasCoreOpacitySRV( nullptr ),
+	m_pAtlasCoreOpacityUAV( nullptr ),
 	m_pIndirectDrawArgsBuffer( nullptr ),
 	m_pIndirectDrawArgsBufferUAV( nullptr ),
+	m_pIndirectSimulateArgsBuffer( nullptr ),
+	m_pIndirectSimulateArgsBufferUAV( nullptr ),
+	m_pIndirectAliveArgsBuffer( nullptr ),
+	m_pIndirectAliveArgsBufferUAV( nullptr ),
 	m_uWidth( 0 ),
 	m_uHeight( 0 ),
 	m_pCompositeBlendState( nullptr ),
 	m_pTiledIndexBuffer( nullptr ),
 	m_pTiledIndexBufferSRV( nullptr ),
-	m_pTiledIndexBufferUAV( nullptr )
+	m_pTiledIndexBufferUAV( nullptr ),
+	m_pTileListScratch( nullptr ),
+	m_pTileListScratchUAV( nullptr ),
+	m_pTileListCounts( nullptr ),
+	m_pTileListCountsSRV( nullptr ),
+	m_pTileListCountsUAV( nullptr ),
+	m_pTileListOffsets( nullptr ),
+	m_pTileListOffsetsSRV( nullptr ),
+	m_pTileListOffsetsUAV( nullptr ),
+	m_TileListCapacity( 0 ),
+	m_TileListCapacityLimit( g_maxTileListCapacity ),
+	m_TileListReadbackIndex( 0 ),
+	m_TileSize( g_defaultTileSize ),
+	m_pTileDensityHistogram( nullptr ),
+	m_pTileDensityHistogramUAV( nullptr ),
+	m_TileDensityReadbackIndex( 0 )
 {
 	ZeroMemory( m_pVS, sizeof( m_pVS ) );
 	ZeroMemory( m_pGS, sizeof( m_pGS ) );
 	ZeroMemory( m_pRasterizedPS, sizeof( m_pRasterizedPS ) );
 	ZeroMemory( m_pTiledRenderingCS, sizeof( m_pTiledRenderingCS ) );
+	ZeroMemory( m_pTileComplexityCS, sizeof( m_pTileComplexityCS ) );
+	ZeroMemory( &m_tilingConstants, sizeof( m_tilingConstants ) );
 	ZeroMemory( m_pCullingCS, sizeof( m_pCullingCS ) );
-	ZeroMemory( m_pCoarseCullingCS, sizeof( m_pCoarseCullingCS ) );
+	ZeroMemory( m_pCullingCountCS, sizeof( m_pCullingCountCS ) );
+	ZeroMemory( m_pTileListMergeCS, sizeof( m_pTileListMergeCS ) );
+	m_pTileListScanCS = nullptr;
+	ZeroMemory( m_pLowResDepth, sizeof( m_pLowResDepth ) );
+	ZeroMemory( m_pLowResDepthSRV, sizeof( m_pLowResDepthSRV ) );
+	ZeroMemory( m_pLowResDepthUAV, sizeof( m_pLowResDepthUAV ) );
+	ZeroMemory( m_pHiZLevelSRV, sizeof( m_pHiZLevelSRV ) );
+	ZeroMemory( m_pHiZLevelUAV, sizeof( m_pHiZLevelUAV ) );
+	ZeroMemory( m_pOcclusionCullScanCS, sizeof( m_pOcclusionCullScanCS ) );
+	ZeroMemory( m_pTileListTotalReadback, sizeof( m_pTileListTotalReadback ) );
+	ZeroMemory( m_TileListTotalPending, sizeof( m_TileListTotalPending ) );
+	ZeroMemory( m_pTileDensityReadback, sizeof( m_pTileDensityReadback ) );
+	ZeroMemory( m_TileDensityPending, sizeof( m_TileDensityPending ) );
+	ZeroMemory( m_TileDensityTileSize, sizeof( m_TileDensityTileSize ) );
+	ZeroMemory( m_pCoarseBinTotalReadback, sizeof( m_pCoarseBinTotalReadback ) );
+	ZeroMemory( m_CoarseBinTotalPending, sizeof( m_CoarseBinTotalPending ) );
+	ZeroMemory( m_pCoarseBinCountCS, sizeof( m_pCoarseBinCountCS ) );
+	ZeroMemory( m_pCoarseBinScanCS, sizeof( m_pCoarseBinScanCS ) );
+	ZeroMemory( m_pCoarseBinScatterCS, sizeof( m_pCoarseBinScatterCS ) );
+	ZeroMemory( &m_PerFrameConstants, sizeof( m_PerFrameConstants ) );
+	ZeroMemory( &m_Stats, sizeof( m_Stats ) );
 	ZeroMemory( m_pCSSimulate, sizeof( m_pCSSimulate ) );
+	ZeroMemory( m_pSimulationListBuffer, sizeof( m_pSimulationListBuffer ) );
+	ZeroMemory( m_pSimulationListSRV, sizeof( m_pSimulationListSRV ) );
+	ZeroMemory( m_pSimulationListUAV, sizeof( m_pSimulationListUAV ) );
 	
 	// Create all the shader permutations 
 	AMD::ShaderCache::Macro defines[ 32 ];
 	ZeroMemory( defines, sizeof( defines ) );
+
+	// Every shader that reads or writes the particle buffers needs to know the layout, and the ones that use the alive list its format
+	AMD::ShaderCache::Macro layoutDefines[ 2 ];
+	ZeroMemory( layoutDefines, sizeof( layoutDefines ) );
+	int numLayoutDefines = 0;
+	if ( GetLayoutDefine( m_Layout ) )
+	{
+		wcscpy_s( layoutDefines[ numLayoutDefines ].m_wsName, ARRAYSIZE( layoutDefines[ numLayoutDefines ].m_wsName ), GetLayoutDefine( m_Layout ) );
+		numLayoutDefines++;
+	}
+	if ( m_PackedSortKeys )
+	{
+		wcscpy_s( layoutDefines[ numLayoutDefines ].m_wsName, ARRAYSIZE( layoutDefines[ numLayoutDefines ].m_wsName ), L"PACKED_SORT_KEYS" );
+		numLayoutDefines++;
+	}
 	
 	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSInitDeadList, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_InitDeadList", L"InitDeadList.hlsl", 0, nullptr, nullptr, nullptr, 0 );
-	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSEmit, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_Emit", L"ParticleEmit.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSInitSimulateArgs, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_InitSimulateArgs", L"InitSimulateArgsCS.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSInitAliveArgs, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_InitAliveArgs", L"InitSimulateArgsCS.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSEmit, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_Emit", L"ParticleEmit.hlsl", numLayoutDefines, layoutDefines, nullptr, nullptr, 0 );
 
 	for ( int i = 0; i < NumStreakModes; i++ )
 	{
@@ -368,6 +748,18 @@ GPUParticleSystem::GPUParticleSystem( AMD::ShaderCache& shadercache ) :
 				numDefines++;
 			}
 
+			if ( GetLayoutDefine( m_Layout ) )
+			{
+				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), GetLayoutDefine( m_Layout ) );
+				numDefines++;
+			}
+
+			if ( m_PackedSortKeys )
+			{
+				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"PACKED_SORT_KEYS" );
+				numDefines++;
+			}
+
 			shadercache.AddShader( (ID3D11DeviceChild**)&m_pVS[ i ][ j ], AMD::ShaderCache::SHADER_TYPE_VERTEX, L"vs_5_0", L"VS_StructuredBuffer", L"ParticleRender.hlsl", numDefines, defines, nullptr, nullptr, 0 );
 		}
 	}
@@ -380,11 +772,25 @@ GPUParticleSystem::GPUParticleSystem( AMD::ShaderCache& shadercache ) :
 			wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"USE_GEOMETRY_SHADER" );
 			numDefines++;
 		}
+
+		if ( GetLayoutDefine( m_Layout ) )
+		{
+			wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), GetLayoutDefine( m_Layout ) );
+			numDefines++;
+		}
+
+		if ( m_PackedSortKeys )
+		{
+			wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"PACKED_SORT_KEYS" );
+			numDefines++;
+		}
 		
 		shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSSimulate[ i ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_Simulate", L"ParticleSimulation.hlsl", numDefines, defines, nullptr, nullptr, 0 );
 	}
 
-	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSResetParticles, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_Reset", L"ParticleSimulation.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSResetParticles, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_Reset", L"ParticleSimulation.hlsl", numLayoutDefines, layoutDefines, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSGatherParticles, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_GatherParticles", L"ParticleMigrate.hlsl", numLayoutDefines, layoutDefines, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCSScatterParticles, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CS_ScatterParticles", L"ParticleMigrate.hlsl", numLayoutDefines, layoutDefines, nullptr, nullptr, 0 );
 	
 	for ( int i = 0; i < NumStreakModes; i++ )
 	{
@@ -410,81 +816,156 @@ GPUParticleSystem::GPUParticleSystem( AMD::ShaderCache& shadercache ) :
 		shadercache.AddShader( (ID3D11DeviceChild**)&m_pRasterizedPS[ NoLighting ][ i ], AMD::ShaderCache::SHADER_TYPE_PIXEL, L"ps_5_0", L"PS_Billboard", L"ParticleRender.hlsl", numDefines, defines, nullptr, nullptr, 0 );
 	}
 
-	for ( int j = 0; j < NumQualityModes; j++ )
+	// The tiled rendering and culling shaders are compiled for each tile size
+	for ( int t = 0; t < g_numTileSizes; t++ )
 	{
-		for ( int l = 0; l < NumStreakModes; l++ )
+		for ( int j = 0; j < NumQualityModes; j++ )
 		{
-			int numDefines = 0;
-			if ( j == CheapLighting )
-			{
-				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"CHEAP" );
-				numDefines++;
-			}
-			else if ( j == NoLighting )
+			for ( int l = 0; l < NumStreakModes; l++ )
 			{
-				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"NOLIGHTING" );
+				int numDefines = 0;
+				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"TILE_RES_X" );
+				defines[ numDefines ].m_iValue = g_tileSizes[ t ];
 				numDefines++;
-			}
 
-			if ( l == StreaksOn )
-			{
-				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"STREAKS" );
+				wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"TILE_RES_Y" );
+				defines[ numDefines ].m_iValue = g_tileSizes[ t ];
 				numDefines++;
-			}
-					
-			shadercache.AddShader( (ID3D11DeviceChild**)&m_pTiledRenderingCS[ j ][ l ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"FrontToBack", L"TiledRendering.hlsl", numDefines, defines, nullptr, nullptr, 0 );
-		}
-	}
 
-	for ( int k = 0; k < NumZCullingModes; k++ )
-	{
-		for ( int l = 0; l < NumCullingModes; l++ )
-		{
-			for ( int i = 0; i < 2; i++ )
-			{
-				int numDefines = 0;
-				if ( k == CullMaxZ )
+				if ( j == CheapLighting )
+				{
+					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"CHEAP" );
+					numDefines++;
+				}
+				else if ( j == NoLighting )
 				{
-					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"CULLMAXZ" );
+					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"NOLIGHTING" );
 					numDefines++;
 				}
 
-				if ( l == FrustumCull )
+				if ( l == StreaksOn )
 				{
-					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"USE_VIEW_FRUSTUM_PLANES" );
+					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"STREAKS" );
 					numDefines++;
 				}
 
-				if ( i == 1 )
+				if ( GetLayoutDefine( m_Layout ) )
 				{
-					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"COARSE_CULLING_ENABLED" );
+					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), GetLayoutDefine( m_Layout ) );
 					numDefines++;
+				}
 
-					int tilesX = g_NumCoarseTiles[ i ][ 0 ];
-					int tilesY = g_NumCoarseTiles[ i ][ 1 ];
+				shadercache.AddShader( (ID3D11DeviceChild**)&m_pTiledRenderingCS[ t ][ j ][ l ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"FrontToBack", L"TiledRendering.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+			}
+		}
 
-					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"NUM_COARSE_CULLING_TILES_X" );
-					defines[ numDefines ].m_iValue = tilesX;
+		for ( int k = 0; k < NumZCullingModes; k++ )
+		{
+			for ( int l = 0; l < NumCullingModes; l++ )
+			{
+				for ( int i = 0; i < 2; i++ )
+				{
+					int numDefines = 0;
+					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"TILE_RES_X" );
+					defines[ numDefines ].m_iValue = g_tileSizes[ t ];
 					numDefines++;
 
-					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"NUM_COARSE_CULLING_TILES_Y" );
-					defines[ numDefines ].m_iValue = tilesY;
+					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"TILE_RES_Y" );
+					defines[ numDefines ].m_iValue = g_tileSizes[ t ];
 					numDefines++;
 
-					wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"NUM_COARSE_TILES" );
-					defines[ numDefines ].m_iValue = tilesX * tilesY;
-					numDefines++;
-				}
+					if ( k == CullMaxZ )
+					{
+						wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"CULLMAXZ" );
+						numDefines++;
+					}
+
+					if ( l == FrustumCull )
+					{
+						wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"USE_VIEW_FRUSTUM_PLANES" );
+						numDefines++;
+					}
+
+					if ( i == 1 )
+					{
+						wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"COARSE_CULLING_ENABLED" );
+						numDefines++;
+
+						int tilesX = g_NumCoarseTiles[ i ][ 0 ];
+						int tilesY = g_NumCoarseTiles[ i ][ 1 ];
+
+						wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"NUM_COARSE_CULLING_TILES_X" );
+						defines[ numDefines ].m_iValue = tilesX;
+						numDefines++;
+
+						wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"NUM_COARSE_CULLING_TILES_Y" );
+						defines[ numDefines ].m_iValue = tilesY;
+						numDefines++;
+
+						wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"NUM_COARSE_TILES" );
+						defines[ numDefines ].m_iValue = tilesX * tilesY;
+						numDefines++;
+					}
+
+					if ( m_PackedSortKeys )
+					{
+						wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"PACKED_SORT_KEYS" );
+						numDefines++;
+					}
 					
-				shadercache.AddShader( (ID3D11DeviceChild**)&m_pCullingCS[ k ][ l ][ i ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"Culling", L"CullingCS.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+					shadercache.AddShader( (ID3D11DeviceChild**)&m_pCullingCountCS[ t ][ k ][ l ][ i ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CullingCount", L"CullingCS.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+					shadercache.AddShader( (ID3D11DeviceChild**)&m_pCullingCS[ t ][ k ][ l ][ i ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"Culling", L"CullingCS.hlsl", numDefines, defines, nullptr, nullptr, 0 );
 					
 				
+				}
 			}
 		}
+
+		// Visualization shader
+		int numDefines = 0;
+		wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"TILE_RES_X" );
+		defines[ numDefines ].m_iValue = g_tileSizes[ t ];
+		numDefines++;
+
+		wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"TILE_RES_Y" );
+		defines[ numDefines ].m_iValue = g_tileSizes[ t ];
+		numDefines++;
+
+		for ( int i = 0; i < numLayoutDefines; i++ )
+		{
+			defines[ numDefines++ ] = layoutDefines[ i ];
+		}
+
+		shadercache.AddShader( (ID3D11DeviceChild**)&m_pTileComplexityCS[ t ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"Overdraw", L"TiledRendering.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+		shadercache.AddShader( (ID3D11DeviceChild**)&m_pTileListMergeCS[ t ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"TileListMerge", L"CullingCS.hlsl", numDefines, defines, nullptr, nullptr, 0 );
 	}
 
-	// Visualization shader
-	shadercache.AddShader( (ID3D11DeviceChild**)&m_pTileComplexityCS, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"Overdraw", L"TiledRendering.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pTileListScanCS, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"TileListScan", L"CullingCS.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pDownsampleDepthCS, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"DownsampleMaxDepth", L"DownsampleDepthCS.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pAtlasOpacityCS, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"MeasureCoreOpacity", L"AtlasOpacityCS.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pTileDepthBoundsCS, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"TileDepthBounds", L"DepthBoundsCS.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pCoarseBinDepthBoundsCS, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CoarseBinDepthBounds", L"DepthBoundsCS.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pDownsampleHiZCS, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"DownsampleHiZ", L"DownsampleDepthCS.hlsl", 0, nullptr, nullptr, nullptr, 0 );
+
+	// Occlusion culling shaders. The scan writes the draw args so is compiled for each billboard mode
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pOcclusionCullCS, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"OcclusionCull", L"OcclusionCullingCS.hlsl", numLayoutDefines, layoutDefines, nullptr, nullptr, 0 );
+	shadercache.AddShader( (ID3D11DeviceChild**)&m_pOcclusionCullCompactCS, AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"OcclusionCullCompact", L"OcclusionCullingCS.hlsl", numLayoutDefines, layoutDefines, nullptr, nullptr, 0 );
+	for ( int i = 0; i < NumBillboardModes; i++ )
+	{
+		int numDefines = 0;
+		if ( i == UseGS )
+		{
+			wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"USE_GEOMETRY_SHADER" );
+			numDefines++;
+		}
+
+		for ( int j = 0; j < numLayoutDefines; j++ )
+		{
+			defines[ numDefines++ ] = layoutDefines[ j ];
+		}
+
+		shadercache.AddShader( (ID3D11DeviceChild**)&m_pOcclusionCullScanCS[ i ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"OcclusionCullScan", L"OcclusionCullingCS.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+	}
 	
 	// Coarse culling shaders
 	for ( int i = 1; i < NumCoarseCullingModes; i++ )
@@ -506,7 +987,26 @@ GPUParticleSystem::GPUParticleSystem( AMD::ShaderCache& shadercache ) :
 		defines[ numDefines ].m_iValue = tilesX * tilesY;
 		numDefines++;
 
-		shadercache.AddShader( (ID3D11DeviceChild**)&m_pCoarseCullingCS[ i ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CoarseCulling", L"CoarseCullingCS.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+		if ( m_PackedSortKeys )
+		{
+			wcscpy_s( defines[ numDefines ].m_wsName, ARRAYSIZE( defines[ numDefines ].m_wsName ), L"PACKED_SORT_KEYS" );
+			numDefines++;
+		}
+
+		shadercache.AddShader( (ID3D11DeviceChild**)&m_pCoarseBinScanCS[ i ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CoarseBinScan", L"CoarseCullingCS.hlsl", numDefines, defines, nullptr, nullptr, 0 );
+
+		for ( int j = 0; j < NumCoarseBinningModes; j++ )
+		{
+			int numBinningDefines = numDefines;
+			if ( j == ScreenRectBinning )
+			{
+				wcscpy_s( defines[ numBinningDefines ].m_wsName, ARRAYSIZE( defines[ numBinningDefines ].m_wsName ), L"SCREEN_RECT_BINNING" );
+				numBinningDefines++;
+			}
+
+			shadercache.AddShader( (ID3D11DeviceChild**)&m_pCoarseBinCountCS[ j ][ i ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CoarseBinCount", L"CoarseCullingCS.hlsl", numBinningDefines, defines, nullptr, nullptr, 0 );
+			shadercache.AddShader( (ID3D11DeviceChild**)&m_pCoarseBinScatterCS[ j ][ i ], AMD::ShaderCache::SHADER_TYPE_COMPUTE, L"cs_5_0", L"CoarseBinScatter", L"CoarseCullingCS.hlsl", numBinningDefines, defines, nullptr, nullptr, 0 );
+		}
 	}
 	
 	// Blit shader to write the UAV back onto our current render target
@@ -522,12 +1022,13 @@ GPUParticleSystem::~GPUParticleSystem()
 }
 
 
-// Use the sort lib to perform a bitonic sort over the particle indices based on their distance from camera
-void GPUParticleSystem::Sort()
+// Use the sort lib to perform a bitonic, radix or temporal sort over the particle indices based on their distance from camera
+void GPUParticleSystem::Sort( int flags )
 {
 	AMDProfileEvent( AMD_PROFILE_RED, L"Sort" );
 	
-	m_SortLib.run( g_maxParticles, m_pAliveIndexBufferUAV, m_pActiveListConstantBuffer );
+	SortLib& sortLib = ( flags & PF_TemporalSort ) ? m_TemporalSortLib : ( flags & PF_RadixSort ) ? m_RadixSortLib : m_SortLib;
+	sortLib.run( m_MaxParticles, m_pAliveIndexBufferUAV, m_pActiveListConstantBuffer );
 }
 
 
@@ -540,7 +1041,7 @@ void GPUParticleSystem::InitDeadList()
 	m_pImmediateContext->CSSetUnorderedAccessViews( 0, 1, &m_pDeadListUAV, initialCount );
 
 	// Disaptch a set of 1d thread groups to fill out the dead list, one thread per particle
-	m_pImmediateContext->Dispatch( align( g_maxParticles, 256 ) / 256, 1, 1 );
+	m_pImmediateContext->Dispatch( align( m_MaxParticles, 256 ) / 256, 1, 1 );
 	
 #if _DEBUG
 	m_NumDeadParticlesOnInit = ReadCounter( m_pDeadListUAV );
@@ -548,12 +1049,179 @@ void GPUParticleSystem::InitDeadList()
 }
 
 
+// Generate the DispatchIndirect args for the passes that run one thread per alive particle. Must follow the CopyStructureCount into
+// m_pActiveListConstantBuffer
+void GPUParticleSystem::InitAliveArgs()
+{
+	m_pImmediateContext->CSSetConstantBuffers( 3, 1, &m_pActiveListConstantBuffer );
+
+	UINT initialCounts[] = { (UINT)-1 };
+	m_pImmediateContext->CSSetUnorderedAccessViews( 2, 1, &m_pIndirectAliveArgsBufferUAV, initialCounts );
+
+	m_pImmediateContext->CSSetShader( m_pCSInitAliveArgs, nullptr, 0 );
+	m_pImmediateContext->Dispatch( 1, 1, 1 );
+
+	ID3D11UnorderedAccessView* nullUAV = nullptr;
+	m_pImmediateContext->CSSetUnorderedAccessViews( 2, 1, &nullUAV, nullptr );
+}
+
+
 void GPUParticleSystem::Reset()
 {
 	m_ResetSystem = true;
 }
 
 
+// Resize the particle pool. The alive particles are carried over into the new pool unless the system is about to be reset anyway
+void GPUParticleSystem::SetMaxParticles( int maxParticles )
+{
+	maxParticles = std::max( 1, std::min( maxParticles, g_maxSupportedParticles ) );
+	if ( maxParticles == m_MaxParticles )
+		return;
+
+	int oldMaxParticles = m_MaxParticles;
+	m_MaxParticles = maxParticles;
+
+	// Without a device the buffers are simply created at the new size in OnCreateDevice
+	if ( m_pDevice == nullptr )
+		return;
+
+	if ( m_ResetSystem )
+	{
+		ReleaseParticleBuffers();
+		CreateParticleBuffers();
+	}
+	else
+	{
+		MigrateParticles( oldMaxParticles );
+	}
+}
+
+
+// Move the alive particles from the current pool into a new one of m_MaxParticles. The particles are gathered via the alive list from 
+// the last simulation step, so they end up tightly packed at the start of the new pool and the rest of the pool becomes the dead list. 
+// The alive list, its count and the args sized from it are rebuilt for the new pool, so resizing again before the next simulation 
+// step gathers the migrated particles rather than the old pool's indices
+void GPUParticleSystem::MigrateParticles( int oldMaxParticles )
+{
+	AMDProfileEvent( AMD_PROFILE_GREEN, L"Migration" );
+
+	// Temporary storage for the gathered particles. This is independent of the layout
+	int numToGather = std::min( oldMaxParticles, m_MaxParticles );
+
+	ID3D11Buffer* migratedBuffers[ 2 ] = { nullptr, nullptr };
+	ID3D11ShaderResourceView* migratedSRVs[ 2 ] = { nullptr, nullptr };
+	ID3D11UnorderedAccessView* migratedUAVs[ 2 ] = { nullptr, nullptr };
+	UINT migratedStrides[ 2 ] = { sizeof( GPUParticlePartA ), sizeof( GPUParticlePartB ) };
+
+	for ( int i = 0; i < 2; i++ )
+	{
+		D3D11_BUFFER_DESC desc;
+		ZeroMemory( &desc, sizeof( desc ) );
+		desc.ByteWidth = migratedStrides[ i ] * numToGather;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		desc.StructureByteStride = migratedStrides[ i ];
+		m_pDevice->CreateBuffer( &desc, nullptr, &migratedBuffers[ i ] );
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srv;
+		ZeroMemory( &srv, sizeof( srv ) );
+		srv.Format = DXGI_FORMAT_UNKNOWN;
+		srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srv.Buffer.ElementWidth = numToGather;
+		m_pDevice->CreateShaderResourceView( migratedBuffers[ i ], &srv, &migratedSRVs[ i ] );
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uav;
+		ZeroMemory( &uav, sizeof( uav ) );
+		uav.Format = DXGI_FORMAT_UNKNOWN;
+		uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		uav.Buffer.NumElements = numToGather;
+		m_pDevice->CreateUnorderedAccessView( migratedBuffers[ i ], &uav, &migratedUAVs[ i ] );
+	}
+
+	// The new capacity. The number of particles to migrate is worked out on the GPU from this and the alive count so there is no readback
+	ID3D11Buffer* migrationConstantBuffer = nullptr;
+	{
+		D3D11_BUFFER_DESC desc;
+		ZeroMemory( &desc, sizeof( desc ) );
+		desc.ByteWidth = 4 * sizeof( UINT );
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+
+		UINT constants[ 4 ] = { (UINT)m_MaxParticles, 0, 0, 0 };
+		D3D11_SUBRESOURCE_DATA data;
+		data.pSysMem = constants;
+		data.SysMemPitch = 0;
+		data.SysMemSlicePitch = 0;
+		m_pDevice->CreateBuffer( &desc, &data, &migrationConstantBuffer );
+	}
+
+	ID3D11Buffer* cbs[] = { migrationConstantBuffer, nullptr, m_pActiveListConstantBuffer, m_pParticleStorageConstantBuffer };
+	m_pImmediateContext->CSSetConstantBuffers( 1, ARRAYSIZE( cbs ), cbs );
+
+	// Gather the alive particles out of the old pool
+	{
+		ID3D11UnorderedAccessView* uavs[] = { m_pParticleBufferA_UAV, m_pParticleBufferB_UAV, migratedUAVs[ 0 ], migratedUAVs[ 1 ] };
+		UINT initialCounts[] = { (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1 };
+		m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
+
+		m_pImmediateContext->CSSetShaderResources( 2, 1, &m_pAliveIndexBufferSRV );
+
+		// The args are from the frame that filled the alive list so they cover exactly the particles there are to gather
+		m_pImmediateContext->CSSetShader( m_pCSGatherParticles, nullptr, 0 );
+		m_pImmediateContext->DispatchIndirect( m_pIndirectAliveArgsBuffer, ALIVE_ARGS_GATHER * sizeof( UINT ) );
+
+		ID3D11ShaderResourceView* nullSRV = nullptr;
+		m_pImmediateContext->CSSetShaderResources( 2, 1, &nullSRV );
+
+		ZeroMemory( uavs, sizeof( uavs ) );
+		m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
+	}
+
+	// Swap in the new pool
+	ReleaseParticleBuffers();
+	CreateParticleBuffers();
+
+	// Scatter the particles into the new pool and build its dead and simulation lists
+	{
+		cbs[ 3 ] = m_pParticleStorageConstantBuffer;
+		m_pImmediateContext->CSSetConstantBuffers( 1, ARRAYSIZE( cbs ), cbs );
+
+		ID3D11UnorderedAccessView* uavs[] = { m_pParticleBufferA_UAV, m_pParticleBufferB_UAV, nullptr, nullptr, m_pDeadListUAV, m_pSimulationListUAV[ m_CurrentSimulationList ], m_pAliveIndexBufferUAV };
+		UINT initialCounts[] = { (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1, 0, 0, 0 };
+		m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
+
+		m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( migratedSRVs ), migratedSRVs );
+
+		m_pImmediateContext->CSSetShader( m_pCSScatterParticles, nullptr, 0 );
+		m_pImmediateContext->Dispatch( align( m_MaxParticles, 256 ) / 256, 1, 1 );
+
+		ID3D11ShaderResourceView* nullSRVs[ 2 ] = { nullptr, nullptr };
+		m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( nullSRVs ), nullSRVs );
+
+		ZeroMemory( uavs, sizeof( uavs ) );
+		m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
+	}
+
+	ZeroMemory( cbs, sizeof( cbs ) );
+	m_pImmediateContext->CSSetConstantBuffers( 1, ARRAYSIZE( cbs ), cbs );
+	m_pImmediateContext->CSSetShader( nullptr, nullptr, 0 );
+
+	// The new alive count replaces the old pool's in the constants and the gather args
+	m_pImmediateContext->CopyStructureCount( m_pActiveListConstantBuffer, 0, m_pAliveIndexBufferUAV );
+	InitAliveArgs();
+
+	SAFE_RELEASE( migrationConstantBuffer );
+	for ( int i = 0; i < 2; i++ )
+	{
+		SAFE_RELEASE( migratedUAVs[ i ] );
+		SAFE_RELEASE( migratedSRVs[ i ] );
+		SAFE_RELEASE( migratedBuffers[ i ] );
+	}
+}
+
+
 void GPUParticleSystem::Render( float frameTime, int flags, Technique technique, CoarseCullingMode coarseCullingMode, const EmitterParams* pEmitters, int nNumEmitters, ID3D11ShaderResourceView* depthSRV )
 {
 	// Save out the previous render target and depth stencil
@@ -563,7 +1231,17 @@ void GPUParticleSystem::Render( float frameTime, int flags, Technique technique,
 
 	// Unbind current targets while we run the compute stages of the system
 	m_pImmediateContext->OMSetRenderTargets( 0, nullptr, nullptr );
+
+	// Passes that cover the whole pool need its capacity
+	m_pImmediateContext->CSSetConstantBuffers( 4, 1, &m_pParticleStorageConstantBuffer );
 	
+	// Grow the coarse culling and tiled index buffers if earlier frames overflowed them
+	UpdateCoarseBinCapacity();
+	UpdateTileListCapacity();
+
+	// Pick the fine-grained tile size from how crowded the tiles have been
+	UpdateTileSize( flags );
+
 	// Set the coarse culling level
 	m_tilingConstants.numCoarseCullingTilesX = g_NumCoarseTiles[ coarseCullingMode ][ 0 ];
 	m_tilingConstants.numCoarseCullingTilesY = g_NumCoarseTiles[ coarseCullingMode ][ 1 ];
@@ -574,6 +1252,15 @@ void GPUParticleSystem::Render( float frameTime, int flags, Technique technique,
 		m_tilingConstants.numCullingTilesPerCoarseTileY = align( m_tilingConstants.numTilesY, m_tilingConstants.numCoarseCullingTilesY ) / m_tilingConstants.numCoarseCullingTilesY;
 	}
 
+	// Dense tiles may only drop to a lower shading rate in the tiled technique. The debug visualization is always at full resolution
+	m_tilingConstants.maxShadingRate = technique == Technique_Tiled && ( flags & PF_LowResolution ) ? NUM_SHADING_RATES - 1 : 0;
+
+	// Likewise the tile lists may only stop short in the tiled technique, as the visualization shows the whole list
+	m_tilingConstants.opacityCulling = technique == Technique_Tiled && ( flags & PF_OpacityCulling ) ? 1 : 0;
+
+	// The fine-grained culling picks its max Z culling shader, but the coarse bins check the constant
+	m_tilingConstants.cullMaxZ = flags & PF_CullMaxZ ? 1 : 0;
+
 	// Update the tiling constants buffer
 	D3D11_MAPPED_SUBRESOURCE MappedResource;
 	m_pImmediateContext->Map( m_pTilingConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource );
@@ -585,25 +1272,39 @@ void GPUParticleSystem::Render( float frameTime, int flags, Technique technique,
 	{
 		InitDeadList();
 		
-		ID3D11UnorderedAccessView* uavs[] = { m_pParticleBufferA_UAV, m_pParticleBufferB_UAV };
-		UINT initialCounts[] = { (UINT)-1, (UINT)-1 };
+		// Every particle is dead so empty the simulation list as well by resetting its counter
+		ID3D11UnorderedAccessView* uavs[] = { m_pParticleBufferA_UAV, m_pParticleBufferB_UAV, m_pSimulationListUAV[ m_CurrentSimulationList ] };
+		UINT initialCounts[] = { (UINT)-1, (UINT)-1, 0 };
 	
 		m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
 
 		m_pImmediateContext->CSSetShader( m_pCSResetParticles, nullptr, 0 );
-		m_pImmediateContext->Dispatch( align( g_maxParticles, 256 ) / 256, 1, 1 );
+		m_pImmediateContext->Dispatch( align( m_MaxParticles, 256 ) / 256, 1, 1 );
 		
+		m_EmitFrame = 0;
 		m_ResetSystem = false;
 	}
 	
 	// Emit particles into the system
 	Emit( nNumEmitters, pEmitters );
 
+	// Reduce the opaque scene's depth to the range in each tile and bin for the passes below
+	ComputeDepthBounds( depthSRV );
+
+	// The simulation works out how opaque each particle's core is from the atlas
+	if ( m_tilingConstants.opacityCulling )
+	{
+		MeasureAtlasOpacity();
+	}
+
 	// Run the simulation for this frame
 	Simulate( flags, depthSRV );
 	
 	// Copy the atomic counter in the alive list UAV into a constant buffer for access by subsequent passes
 	m_pImmediateContext->CopyStructureCount( m_pActiveListConstantBuffer, 0, m_pAliveIndexBufferUAV );
+
+	// Size the passes over the alive list from the same count
+	InitAliveArgs();
 		
 	// Only read number of alive and dead particle back to the CPU in debug as we don't want to stall the GPU in release code
 #if _DEBUG
@@ -617,7 +1318,17 @@ void GPUParticleSystem::Render( float frameTime, int flags, Technique technique,
 		// Sort if requested. Not doing so results in the particles rendering out of order and not blending correctly
 		if ( flags & PF_Sort )
 		{
-			Sort();
+			Sort( flags );
+		}
+
+		BillboardMode billboardMode = flags & PF_UseGeometryShader ? UseGS : UseVS;
+
+		// Drop the particles hidden behind the opaque scene. This runs after the sort so the survivors keep their order, and it leaves 
+		// the temporal sort's list intact for the next frame
+		bool occlusionCulling = ( flags & PF_OcclusionCulling ) != 0;
+		if ( occlusionCulling )
+		{
+			OcclusionCull( depthSRV, billboardMode );
 		}
 
 		AMDProfileEvent( AMD_PROFILE_BLUE, L"Render" );
@@ -626,14 +1337,13 @@ void GPUParticleSystem::Render( float frameTime, int flags, Technique technique,
 		if ( flags & PF_NoLighting )
 			quality = NoLighting;
 		StreakMode streaks = flags & PF_Streaks ? StreaksOn : StreaksOff;
-		BillboardMode billboardMode = flags & PF_UseGeometryShader ? UseGS : UseVS;
 
 		// Set up shader stages
 		m_pImmediateContext->VSSetShader( m_pVS[ streaks ][ billboardMode ], nullptr, 0 );
 		m_pImmediateContext->GSSetShader( billboardMode == UseGS ? m_pGS[ streaks ] : nullptr, nullptr, 0 );
 		m_pImmediateContext->PSSetShader( m_pRasterizedPS[ quality ][ streaks ], nullptr, 0 );
 	
-		ID3D11ShaderResourceView* vs_srv[] = { m_pParticleBufferA_SRV, m_pViewSpaceParticlePositionsSRV, m_pAliveIndexBufferSRV };
+		ID3D11ShaderResourceView* vs_srv[] = { m_pParticleBufferA_SRV, m_pViewSpaceParticlePositionsSRV, occlusionCulling ? m_pVisibleIndexBufferSRV : m_pAliveIndexBufferSRV };
 		ID3D11ShaderResourceView* ps_srv[] = { depthSRV };
 		
 		// Set a null vertex buffer
@@ -643,6 +1353,7 @@ void GPUParticleSystem::Render( float frameTime, int flags, Technique technique,
 		m_pImmediateContext->IASetVertexBuffers( 0, 1, &vb, &stride, &offset );
 		
 		m_pImmediateContext->VSSetConstantBuffers( 3, 1, &m_pActiveListConstantBuffer );
+		m_pImmediateContext->VSSetConstantBuffers( 4, 1, &m_pParticleStorageConstantBuffer );
 
 		if ( billboardMode == UseGS )
 		{
@@ -689,11 +1400,11 @@ void GPUParticleSystem::Render( float frameTime, int flags, Technique technique,
 		// Perform coarse culling if requested
 		if ( coarseCullingMode != CoarseCullingOff )
 		{
-			CoarseCulling( coarseCullingMode );
+			CoarseCulling( coarseCullingMode, flags );
 		}
 
 		// Perform fine-grained culling
-		CullParticlesIntoTiles( coarseCullingMode, flags, depthSRV );
+		CullParticlesIntoTiles( coarseCullingMode, flags );
 
 		{
 			// Do the tiled rendering into a UAV
@@ -706,14 +1417,15 @@ void GPUParticleSystem::Render( float frameTime, int flags, Technique technique,
 			SAFE_RELEASE( dsv );
 
 			// Render a quad that blits the tiled UAV onto the current render target
-			RenderQuad();
+			RenderQuad( depthSRV );
 		}
 	}
 
 	// Update the frame's stats. These aren't valid in release as we don't copy the GPU counters back onto the CPU
-	m_Stats.m_MaxParticles = g_maxParticles;
+	m_Stats.m_MaxParticles = m_MaxParticles;
 	m_Stats.m_NumActiveParticles = m_NumActiveParticlesAfterSimulation;
 	m_Stats.m_NumDead = m_NumDeadParticlesAfterSimulation;
+	m_Stats.m_TileSize = g_tileSizes[ m_TileSize ];
 }
 
 
@@ -722,93 +1434,99 @@ void GPUParticleSystem::OnCreateDevice( ID3D11Device* pDevice, ID3D11DeviceConte
 	m_pDevice = pDevice; 
 	m_pImmediateContext = pImmediateContext;
 
-	// Create the global particle pool. Each particle is split into two parts for better cache coherency. The first half contains the data more 
-	// relevant to rendering while the second half is more related to simulation
+	CreateParticleBuffers();
+
 	D3D11_BUFFER_DESC desc;
-	desc.ByteWidth = sizeof( GPUParticlePartA ) * g_maxParticles;
+	D3D11_SHADER_RESOURCE_VIEW_DESC srv;
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uav;
+
+	// In addition to the index buffer for the coarse culling, we also need to track how many particles are in each bin, 
+	// therefore we allocate one element per bin which is written by the coarse culling scan pass
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.ByteWidth = sizeof( UINT ) * g_maxCoarseCullingTiles;
 	desc.Usage = D3D11_USAGE_DEFAULT;
 	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
-	desc.CPUAccessFlags = 0;
-	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-	desc.StructureByteStride = sizeof( GPUParticlePartA );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pCoarseCullingBufferCounters );
 
-	m_pDevice->CreateBuffer( &desc, nullptr, &m_pParticleBufferA );
+	ZeroMemory( &uav, sizeof( uav ) );
+	uav.Format = DXGI_FORMAT_R32_UINT;
+	uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uav.Buffer.NumElements = g_maxCoarseCullingTiles;
+	m_pDevice->CreateUnorderedAccessView( m_pCoarseCullingBufferCounters, &uav, &m_pCoarseCullingBufferCountersUAV );
 
-	desc.ByteWidth = sizeof( GPUParticlePartB ) * g_maxParticles;
-	desc.StructureByteStride = sizeof( GPUParticlePartB );
+	ZeroMemory( &srv, sizeof( srv ) );
+	srv.Format = DXGI_FORMAT_R32_UINT;
+	srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srv.Buffer.NumElements = g_maxCoarseCullingTiles;
+	m_pDevice->CreateShaderResourceView( m_pCoarseCullingBufferCounters, &srv, &m_pCoarseCullingBufferCountersSRV );
 
-	m_pDevice->CreateBuffer( &desc, nullptr, &m_pParticleBufferB );
+	// The bin offsets have an extra element for the total, which is copied into the staging buffers so the CPU can size the index buffer
+	desc.ByteWidth = sizeof( UINT ) * ( g_maxCoarseCullingTiles + 1 );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pCoarseCullingBufferOffsets );
 
-	D3D11_SHADER_RESOURCE_VIEW_DESC srv;
-	srv.Format = DXGI_FORMAT_UNKNOWN;
-	srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
-	srv.Buffer.ElementOffset = 0;
-	srv.Buffer.ElementWidth = g_maxParticles;
-	
-	m_pDevice->CreateShaderResourceView( m_pParticleBufferA, &srv, &m_pParticleBufferA_SRV );
-	
-	D3D11_UNORDERED_ACCESS_VIEW_DESC uav;
-	uav.Format = DXGI_FORMAT_UNKNOWN;
-	uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
-	uav.Buffer.FirstElement = 0;
-	uav.Buffer.NumElements = g_maxParticles;
-	uav.Buffer.Flags = 0;
-	m_pDevice->CreateUnorderedAccessView( m_pParticleBufferA, &uav, &m_pParticleBufferA_UAV );
-	m_pDevice->CreateUnorderedAccessView( m_pParticleBufferB, &uav, &m_pParticleBufferB_UAV );
+	uav.Buffer.NumElements = g_maxCoarseCullingTiles + 1;
+	m_pDevice->CreateUnorderedAccessView( m_pCoarseCullingBufferOffsets, &uav, &m_pCoarseCullingBufferOffsetsUAV );
 
-	// The view space positions of particles are cached during simulation so allocate a buffer for them
-	desc.ByteWidth = 16 * g_maxParticles;
-	desc.StructureByteStride = 16;
-	m_pDevice->CreateBuffer( &desc, 0, &m_pViewSpaceParticlePositions );
-	m_pDevice->CreateShaderResourceView( m_pViewSpaceParticlePositions, &srv, &m_pViewSpaceParticlePositionsSRV );
-	m_pDevice->CreateUnorderedAccessView( m_pViewSpaceParticlePositions, &uav, &m_pViewSpaceParticlePositionsUAV );
+	srv.Buffer.NumElements = g_maxCoarseCullingTiles + 1;
+	m_pDevice->CreateShaderResourceView( m_pCoarseCullingBufferOffsets, &srv, &m_pCoarseCullingBufferOffsetsSRV );
 
-	// The maximum radii of each particle is cached during simulation to avoid recomputing multiple times later. This is only required
-	// for streaked particles as they are not round so we cache the max radius of X and Y
-	desc.ByteWidth = 4 * g_maxParticles;
-	desc.StructureByteStride = 4;
-	m_pDevice->CreateBuffer( &desc, 0, &m_pMaxRadiusBuffer );
-	m_pDevice->CreateShaderResourceView( m_pMaxRadiusBuffer, &srv, &m_pMaxRadiusBufferSRV );
-	m_pDevice->CreateUnorderedAccessView( m_pMaxRadiusBuffer, &uav, &m_pMaxRadiusBufferUAV );
-	
-	// The dead particle index list. Created as an append buffer
-	desc.ByteWidth = sizeof( UINT ) * g_maxParticles;
-	desc.Usage = D3D11_USAGE_DEFAULT;
-	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
-	desc.CPUAccessFlags = 0;
-	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-	desc.StructureByteStride = sizeof( UINT );
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.ByteWidth = sizeof( UINT );
+	for ( int i = 0; i < g_listTotalReadbackLatency; i++ )
+	{
+		m_pDevice->CreateBuffer( &desc, nullptr, &m_pCoarseBinTotalReadback[ i ] );
+		m_pDevice->CreateBuffer( &desc, nullptr, &m_pTileListTotalReadback[ i ] );
+	}
 
-	m_pDevice->CreateBuffer( &desc, nullptr, &m_pDeadListBuffer );
+	// The tile density histogram and its staging buffers
+	desc.ByteWidth = sizeof( UINT ) * NUM_TILE_DENSITY_BUCKETS;
+	for ( int i = 0; i < g_listTotalReadbackLatency; i++ )
+	{
+		m_pDevice->CreateBuffer( &desc, nullptr, &m_pTileDensityReadback[ i ] );
+	}
 
-	uav.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_APPEND;
-	m_pDevice->CreateUnorderedAccessView( m_pDeadListBuffer, &uav, &m_pDeadListUAV );
-	
-	// Create the coarse culling buffer. This is an index buffer that allocates the maximum number of particles for each coarse bin
-	desc.StructureByteStride = 0;
-	desc.MiscFlags = 0;
-	desc.ByteWidth = sizeof( UINT ) * g_maxParticles * g_maxCoarseCullingTiles;
-	m_pDevice->CreateBuffer( &desc, nullptr, &m_pStridedCoarseCullingBuffer );
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.ByteWidth = sizeof( UINT ) * NUM_TILE_DENSITY_BUCKETS;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pTileDensityHistogram );
 
-	uav.Format = DXGI_FORMAT_R32_UINT;
-	uav.Buffer.Flags = 0;
-	uav.Buffer.NumElements = g_maxParticles * g_maxCoarseCullingTiles;
-	m_pDevice->CreateUnorderedAccessView( m_pStridedCoarseCullingBuffer, &uav, &m_pStridedCoarseCullingBufferUAV );
+	uav.Buffer.NumElements = NUM_TILE_DENSITY_BUCKETS;
+	m_pDevice->CreateUnorderedAccessView( m_pTileDensityHistogram, &uav, &m_pTileDensityHistogramUAV );
 
-	srv.Format = DXGI_FORMAT_R32_UINT;
-	srv.Buffer.NumElements = g_maxParticles * g_maxCoarseCullingTiles;
-	m_pDevice->CreateShaderResourceView( m_pStridedCoarseCullingBuffer, &srv, &m_pStridedCoarseCullingBufferSRV );
+	// The atlas core opacity starts out as zero so nothing is culled until it has been measured
+	float atlasCoreOpacity[ NUM_ATLAS_SLOTS ] = {};
+	D3D11_SUBRESOURCE_DATA atlasCoreOpacityData = { atlasCoreOpacity, 0, 0 };
 
-	// In addition to the index buffer for the coarse culling, we also need to track how many particles are in each bin, 
-	// therefore we allocate one element per bin which is atomically incremented as each particle is added
-	desc.ByteWidth = sizeof( UINT ) * g_maxCoarseCullingTiles;
-	m_pDevice->CreateBuffer( &desc, nullptr, &m_pStridedCoarseCullingBufferCounters );
+	desc.ByteWidth = sizeof( atlasCoreOpacity );
+	desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
+	m_pDevice->CreateBuffer( &desc, &atlasCoreOpacityData, &m_pAtlasCoreOpacity );
+
+	uav.Format = DXGI_FORMAT_R32_FLOAT;
+	uav.Buffer.NumElements = NUM_ATLAS_SLOTS;
+	m_pDevice->CreateUnorderedAccessView( m_pAtlasCoreOpacity, &uav, &m_pAtlasCoreOpacityUAV );
+
+	srv.Format = DXGI_FORMAT_R32_FLOAT;
+	srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srv.Buffer.ElementOffset = 0;
+	srv.Buffer.NumElements = NUM_ATLAS_SLOTS;
+	m_pDevice->CreateShaderResourceView( m_pAtlasCoreOpacity, &srv, &m_pAtlasCoreOpacitySRV );
+
+	// The depth bounds of each coarse bin
+	desc.ByteWidth = 2 * sizeof( float ) * g_maxCoarseCullingTiles;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.StructureByteStride = 2 * sizeof( float );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pCoarseBinDepthBounds );
 
+	uav.Format = DXGI_FORMAT_UNKNOWN;
 	uav.Buffer.NumElements = g_maxCoarseCullingTiles;
-	m_pDevice->CreateUnorderedAccessView( m_pStridedCoarseCullingBufferCounters, &uav, &m_pStridedCoarseCullingBufferCountersUAV );
+	m_pDevice->CreateUnorderedAccessView( m_pCoarseBinDepthBounds, &uav, &m_pCoarseBinDepthBoundsUAV );
 
+	srv.Format = DXGI_FORMAT_UNKNOWN;
 	srv.Buffer.NumElements = g_maxCoarseCullingTiles;
-	m_pDevice->CreateShaderResourceView( m_pStridedCoarseCullingBufferCounters, &srv, &m_pStridedCoarseCullingBufferCountersSRV );
+	m_pDevice->CreateShaderResourceView( m_pCoarseBinDepthBounds, &srv, &m_pCoarseBinDepthBoundsSRV );
 
 
 	// Create a staging buffer that is used to read GPU atomic counter into that can then be mapped for reading 
@@ -822,7 +1540,7 @@ void GPUParticleSystem::OnCreateDevice( ID3D11Device* pDevice, ID3D11DeviceConte
 	m_pDevice->CreateBuffer( &desc, nullptr, &m_pDebugCounterBuffer );
 #endif
 
-	// Create constant buffers to copy the dead and alive list counters into
+	// Create constant buffers to copy the dead, alive and simulation list counters into
 	ZeroMemory( &desc, sizeof( desc ) );
 	desc.Usage = D3D11_USAGE_DEFAULT;
 	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
@@ -830,6 +1548,7 @@ void GPUParticleSystem::OnCreateDevice( ID3D11Device* pDevice, ID3D11DeviceConte
 	desc.ByteWidth = 4 * sizeof( UINT );
 	m_pDevice->CreateBuffer( &desc, nullptr, &m_pDeadListConstantBuffer );
 	m_pDevice->CreateBuffer( &desc, nullptr, &m_pActiveListConstantBuffer );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pSimulationListConstantBuffer );
 
 	// Create the emitter constant buffer
 	ZeroMemory( &desc, sizeof( desc ) );
@@ -839,10 +1558,234 @@ void GPUParticleSystem::OnCreateDevice( ID3D11Device* pDevice, ID3D11DeviceConte
 	desc.ByteWidth = sizeof( EmitterConstantBuffer );
 	m_pDevice->CreateBuffer( &desc, nullptr, &m_pEmitterConstantBuffer );
 
+	// Create the buffer holding the emitters for each frame. This is grown if more emitters are passed in
+	CreateEmitterBuffer( 64 );
+
 	// Create the tiling constant buffer
 	desc.ByteWidth = sizeof( m_tilingConstants );
 	m_pDevice->CreateBuffer( &desc, nullptr, &m_pTilingConstantBuffer );
 	
+	// Create the buffer to store the indirect args for the DrawInstancedIndirect call
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	desc.ByteWidth = 5 * sizeof( UINT );
+	desc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pIndirectDrawArgsBuffer );
+	
+	ZeroMemory( &uav, sizeof( uav ) );
+	uav.Format = DXGI_FORMAT_R32_UINT;
+	uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uav.Buffer.FirstElement = 0;
+	uav.Buffer.NumElements = 5;
+	uav.Buffer.Flags = 0;
+	m_pDevice->CreateUnorderedAccessView( m_pIndirectDrawArgsBuffer, &uav, &m_pIndirectDrawArgsBufferUAV );
+
+	// Create the buffer to store the indirect args for the simulation's DispatchIndirect call
+	desc.ByteWidth = 3 * sizeof( UINT );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pIndirectSimulateArgsBuffer );
+
+	uav.Buffer.NumElements = 3;
+	m_pDevice->CreateUnorderedAccessView( m_pIndirectSimulateArgsBuffer, &uav, &m_pIndirectSimulateArgsBufferUAV );
+
+	// Create the buffer to store the indirect args for the passes sized by the alive count. Starts out with nothing alive
+	{
+		UINT initialArgs[ ALIVE_ARGS_SIZE ];
+		for ( int i = 0; i < ALIVE_ARGS_SIZE; i++ )
+		{
+			initialArgs[ i ] = 1;
+		}
+		initialArgs[ ALIVE_ARGS_GATHER ] = 0;
+
+		D3D11_SUBRESOURCE_DATA data;
+		data.pSysMem = initialArgs;
+		data.SysMemPitch = 0;
+		data.SysMemSlicePitch = 0;
+
+		desc.ByteWidth = ALIVE_ARGS_SIZE * sizeof( UINT );
+		m_pDevice->CreateBuffer( &desc, &data, &m_pIndirectAliveArgsBuffer );
+	}
+
+	uav.Buffer.NumElements = ALIVE_ARGS_SIZE;
+	m_pDevice->CreateUnorderedAccessView( m_pIndirectAliveArgsBuffer, &uav, &m_pIndirectAliveArgsBufferUAV );
+	
+	// Create a blend state for compositing the particles onto the render target
+	D3D11_BLEND_DESC blendDesc;
+	ZeroMemory(&blendDesc, sizeof(D3D11_BLEND_DESC));
+	blendDesc.AlphaToCoverageEnable = false;
+	blendDesc.IndependentBlendEnable = false;
+	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	blendDesc.RenderTarget[0].BlendEnable = true;
+	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
+	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
+	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ZERO;
+	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ZERO;
+	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+	m_pDevice->CreateBlendState( &blendDesc, &m_pCompositeBlendState );
+
+	// Create the SortLib resources
+	unsigned int packedIndexBits = m_PackedSortKeys ? SORT_KEY_INDEX_BITS : 0;
+	m_SortLib.init( m_pDevice, m_pImmediateContext, SortLib::Algorithm_Bitonic, packedIndexBits );
+	m_RadixSortLib.init( m_pDevice, m_pImmediateContext, SortLib::Algorithm_Radix, packedIndexBits );
+	m_TemporalSortLib.init( m_pDevice, m_pImmediateContext, SortLib::Algorithm_Temporal, packedIndexBits );
+}
+
+
+// Create the particle pool and every other resource that has an element per particle
+void GPUParticleSystem::CreateParticleBuffers()
+{
+	D3D11_BUFFER_DESC desc;
+	D3D11_SHADER_RESOURCE_VIEW_DESC srv;
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uav;
+
+	if ( m_Layout == Layout_SoA )
+	{
+		// Create the global particle pool as a structure of arrays. All the streams live in one raw buffer so the simulation 
+		// still only needs one UAV for the particles
+		ZeroMemory( &desc, sizeof( desc ) );
+		desc.ByteWidth = SOA_PARTICLE_SIZE * m_MaxParticles;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+
+		m_pDevice->CreateBuffer( &desc, nullptr, &m_pParticleBufferA );
+
+		ZeroMemory( &srv, sizeof( srv ) );
+		srv.Format = DXGI_FORMAT_R32_TYPELESS;
+		srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
+		srv.BufferEx.FirstElement = 0;
+		srv.BufferEx.NumElements = desc.ByteWidth / 4;
+		srv.BufferEx.Flags = D3D11_BUFFEREX_SRV_FLAG_RAW;
+		m_pDevice->CreateShaderResourceView( m_pParticleBufferA, &srv, &m_pParticleBufferA_SRV );
+
+		ZeroMemory( &uav, sizeof( uav ) );
+		uav.Format = DXGI_FORMAT_R32_TYPELESS;
+		uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		uav.Buffer.FirstElement = 0;
+		uav.Buffer.NumElements = desc.ByteWidth / 4;
+		uav.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+		m_pDevice->CreateUnorderedAccessView( m_pParticleBufferA, &uav, &m_pParticleBufferA_UAV );
+	}
+	else
+	{
+		// Create the global particle pool. Each particle is split into two parts for better cache coherency. The first half contains the data more 
+		// relevant to rendering while the second half is more related to simulation. The compact layout uses the same split with quantized parts
+		UINT strideA = m_Layout == Layout_Compact ? sizeof( CompactParticlePartA ) : sizeof( GPUParticlePartA );
+		UINT strideB = m_Layout == Layout_Compact ? sizeof( CompactParticlePartB ) : sizeof( GPUParticlePartB );
+
+		desc.ByteWidth = strideA * m_MaxParticles;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		desc.StructureByteStride = strideA;
+
+		m_pDevice->CreateBuffer( &desc, nullptr, &m_pParticleBufferA );
+
+		desc.ByteWidth = strideB * m_MaxParticles;
+		desc.StructureByteStride = strideB;
+
+		m_pDevice->CreateBuffer( &desc, nullptr, &m_pParticleBufferB );
+
+		srv.Format = DXGI_FORMAT_UNKNOWN;
+		srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srv.Buffer.ElementOffset = 0;
+		srv.Buffer.ElementWidth = m_MaxParticles;
+	
+		m_pDevice->CreateShaderResourceView( m_pParticleBufferA, &srv, &m_pParticleBufferA_SRV );
+	
+		uav.Format = DXGI_FORMAT_UNKNOWN;
+		uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		uav.Buffer.FirstElement = 0;
+		uav.Buffer.NumElements = m_MaxParticles;
+		uav.Buffer.Flags = 0;
+		m_pDevice->CreateUnorderedAccessView( m_pParticleBufferA, &uav, &m_pParticleBufferA_UAV );
+		m_pDevice->CreateUnorderedAccessView( m_pParticleBufferB, &uav, &m_pParticleBufferB_UAV );
+	}
+
+	// The view space positions of particles are cached during simulation so allocate a buffer for them
+	desc.ByteWidth = 16 * m_MaxParticles;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	desc.CPUAccessFlags = 0;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.StructureByteStride = 16;
+
+	srv.Format = DXGI_FORMAT_UNKNOWN;
+	srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srv.Buffer.ElementOffset = 0;
+	srv.Buffer.ElementWidth = m_MaxParticles;
+
+	uav.Format = DXGI_FORMAT_UNKNOWN;
+	uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uav.Buffer.FirstElement = 0;
+	uav.Buffer.NumElements = m_MaxParticles;
+	uav.Buffer.Flags = 0;
+	m_pDevice->CreateBuffer( &desc, 0, &m_pViewSpaceParticlePositions );
+	m_pDevice->CreateShaderResourceView( m_pViewSpaceParticlePositions, &srv, &m_pViewSpaceParticlePositionsSRV );
+	m_pDevice->CreateUnorderedAccessView( m_pViewSpaceParticlePositions, &uav, &m_pViewSpaceParticlePositionsUAV );
+
+	// The maximum radii of each particle is cached during simulation to avoid recomputing multiple times later. This is only required
+	// for streaked particles as they are not round so we cache the max radius of X and Y. The opacity culling's lower bound on the 
+	// opacity of the particle's core is cached alongside
+	desc.ByteWidth = 8 * m_MaxParticles;
+	desc.StructureByteStride = 8;
+	m_pDevice->CreateBuffer( &desc, 0, &m_pMaxRadiusBuffer );
+	m_pDevice->CreateShaderResourceView( m_pMaxRadiusBuffer, &srv, &m_pMaxRadiusBufferSRV );
+	m_pDevice->CreateUnorderedAccessView( m_pMaxRadiusBuffer, &uav, &m_pMaxRadiusBufferUAV );
+	
+	// The dead particle index list. Created as an append buffer
+	desc.ByteWidth = sizeof( UINT ) * m_MaxParticles;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	desc.CPUAccessFlags = 0;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.StructureByteStride = sizeof( UINT );
+
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pDeadListBuffer );
+
+	uav.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_APPEND;
+	m_pDevice->CreateUnorderedAccessView( m_pDeadListBuffer, &uav, &m_pDeadListUAV );
+
+	// The simulation lists. These are append buffers like the dead list but are also read by the simulation
+	for ( int i = 0; i < 2; i++ )
+	{
+		m_pDevice->CreateBuffer( &desc, nullptr, &m_pSimulationListBuffer[ i ] );
+		m_pDevice->CreateShaderResourceView( m_pSimulationListBuffer[ i ], &srv, &m_pSimulationListSRV[ i ] );
+		m_pDevice->CreateUnorderedAccessView( m_pSimulationListBuffer[ i ], &uav, &m_pSimulationListUAV[ i ] );
+	}
+	
+	// Create the coarse culling buffer. The bins are packed together so this only needs to hold the particles that were binned. Start 
+	// with a guess at how many bins each particle overlaps and let UpdateCoarseBinCapacity grow it
+	m_CoarseBinCapacityLimit = g_maxCoarseBinCapacity;
+	CreateCoarseCullingBuffer( std::min( (UINT)m_MaxParticles * g_initialCoarseBinsPerParticle, g_maxCoarseBinCapacity ) );
+
+	// Create the per-group bin counts for the coarse culling. One set of counts per coarse culling thread group
+	desc.StructureByteStride = 0;
+	desc.MiscFlags = 0;
+	uav.Format = DXGI_FORMAT_R32_UINT;
+	uav.Buffer.Flags = 0;
+	int numCoarseBinGroupCounts = ( align( m_MaxParticles, COARSE_CULLING_THREADS ) / COARSE_CULLING_THREADS ) * g_maxCoarseCullingTiles;
+	desc.ByteWidth = sizeof( UINT ) * numCoarseBinGroupCounts;
+	desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pCoarseBinGroupCounts );
+
+	uav.Buffer.NumElements = numCoarseBinGroupCounts;
+	m_pDevice->CreateUnorderedAccessView( m_pCoarseBinGroupCounts, &uav, &m_pCoarseBinGroupCountsUAV );
+
+	// Create the constant buffer holding the capacity of the pool
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.ByteWidth = 4 * sizeof( UINT );
+	UINT storageConstants[ 4 ] = { (UINT)m_MaxParticles, 0, 0, 0 };
+	D3D11_SUBRESOURCE_DATA storageData;
+	storageData.pSysMem = storageConstants;
+	storageData.SysMemPitch = 0;
+	storageData.SysMemSlicePitch = 0;
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	m_pDevice->CreateBuffer( &desc, &storageData, &m_pParticleStorageConstantBuffer );
+
 	struct IndexBufferElement
 	{
 		float		distance;	// distance squared from the particle to the camera
@@ -851,59 +1794,69 @@ void GPUParticleSystem::OnCreateDevice( ID3D11Device* pDevice, ID3D11DeviceConte
 
 	// Create the index buffer of alive particles that is to be sorted (at least in the rasterization path).
 	// For the tiled rendering path this could be just a UINT index buffer as particles are not globally sorted
-	desc.ByteWidth = sizeof( IndexBufferElement ) * g_maxParticles;
+	UINT indexElementSize = (UINT)( m_PackedSortKeys ? sizeof( UINT ) : sizeof( IndexBufferElement ) );
+	desc.ByteWidth = indexElementSize * m_MaxParticles;
 	desc.Usage = D3D11_USAGE_DEFAULT;
 	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
 	desc.CPUAccessFlags = 0;
 	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-	desc.StructureByteStride = sizeof( IndexBufferElement );
+	desc.StructureByteStride = indexElementSize;
 
 	m_pDevice->CreateBuffer( &desc, nullptr, &m_pAliveIndexBuffer );
 
 	srv.Format = DXGI_FORMAT_UNKNOWN;
 	srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
 	srv.Buffer.ElementOffset = 0;
-	srv.Buffer.ElementWidth = g_maxParticles;
+	srv.Buffer.ElementWidth = m_MaxParticles;
 	
 	m_pDevice->CreateShaderResourceView( m_pAliveIndexBuffer, &srv, &m_pAliveIndexBufferSRV );
 
-	uav.Buffer.NumElements = g_maxParticles;
+	uav.Buffer.NumElements = m_MaxParticles;
 	uav.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_COUNTER;
 	uav.Format = DXGI_FORMAT_UNKNOWN;
 	m_pDevice->CreateUnorderedAccessView( m_pAliveIndexBuffer, &uav, &m_pAliveIndexBufferUAV );
 
-	// Create the buffer to store the indirect args for the DrawInstancedIndirect call
-	ZeroMemory( &desc, sizeof( desc ) );
-	desc.Usage = D3D11_USAGE_DEFAULT;
+	// The occlusion culled copy of the alive list has the same format but no counter
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pVisibleIndexBuffer );
+	m_pDevice->CreateShaderResourceView( m_pVisibleIndexBuffer, &srv, &m_pVisibleIndexBufferSRV );
+
+	uav.Buffer.Flags = 0;
+	m_pDevice->CreateUnorderedAccessView( m_pVisibleIndexBuffer, &uav, &m_pVisibleIndexBufferUAV );
+
+	// The occlusion culling's survivor masks and group offsets. The offsets have an extra element for the total
+	int numOcclusionCullingGroups = align( m_MaxParticles, OCCLUSION_CULLING_THREADS ) / OCCLUSION_CULLING_THREADS;
 	desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
-	desc.ByteWidth = 5 * sizeof( UINT );
-	desc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
-	m_pDevice->CreateBuffer( &desc, nullptr, &m_pIndirectDrawArgsBuffer );
-	
-	ZeroMemory( &uav, sizeof( uav ) );
+	desc.MiscFlags = 0;
+	desc.StructureByteStride = 0;
+	desc.ByteWidth = sizeof( UINT ) * OCCLUSION_CULLING_MASK_WORDS * numOcclusionCullingGroups;
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pVisibilityMasks );
+
 	uav.Format = DXGI_FORMAT_R32_UINT;
-	uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
-	uav.Buffer.FirstElement = 0;
-	uav.Buffer.NumElements = 5;
-	uav.Buffer.Flags = 0;
-	m_pDevice->CreateUnorderedAccessView( m_pIndirectDrawArgsBuffer, &uav, &m_pIndirectDrawArgsBufferUAV );
-	
+	uav.Buffer.NumElements = OCCLUSION_CULLING_MASK_WORDS * numOcclusionCullingGroups;
+	m_pDevice->CreateUnorderedAccessView( m_pVisibilityMasks, &uav, &m_pVisibilityMasksUAV );
+
+	desc.ByteWidth = sizeof( UINT ) * ( numOcclusionCullingGroups + 1 );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pVisibleGroupOffsets );
+
+	uav.Buffer.NumElements = numOcclusionCullingGroups + 1;
+	m_pDevice->CreateUnorderedAccessView( m_pVisibleGroupOffsets, &uav, &m_pVisibleGroupOffsetsUAV );
+
 	// Create the particle billboard index buffer required for the rasterization VS-only path
 	ZeroMemory( &desc, sizeof( desc ) );
-	desc.ByteWidth = g_maxParticles * 6 * sizeof( UINT );
+	desc.ByteWidth = m_MaxParticles * 6 * sizeof( UINT );
 	desc.Usage = D3D11_USAGE_IMMUTABLE;
 	desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
 	desc.CPUAccessFlags = 0;
 	desc.MiscFlags = 0;
 	D3D11_SUBRESOURCE_DATA data;
 
-	UINT* indices = new UINT[ g_maxParticles * 6 ];
+	UINT* indices = new UINT[ m_MaxParticles * 6 ];
 	data.pSysMem = indices;
 	data.SysMemPitch = 0;
 	data.SysMemSlicePitch = 0;
 
 	UINT base = 0;
-	for ( int i = 0; i < g_maxParticles; i++ )
+	for ( int i = 0; i < m_MaxParticles; i++ )
 	{
 		indices[ 0 ] = base + 0;
 		indices[ 1 ] = base + 1;
@@ -920,27 +1873,57 @@ void GPUParticleSystem::OnCreateDevice( ID3D11Device* pDevice, ID3D11DeviceConte
 	m_pDevice->CreateBuffer( &desc, &data, &m_pIndexBuffer );
 
 	delete[] data.pSysMem;
+}
 
-	// Create a blend state for compositing the particles onto the render target
-	D3D11_BLEND_DESC blendDesc;
-	ZeroMemory(&blendDesc, sizeof(D3D11_BLEND_DESC));
-	blendDesc.AlphaToCoverageEnable = false;
-	blendDesc.IndependentBlendEnable = false;
-	blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
-	blendDesc.RenderTarget[0].BlendEnable = true;
-	blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_ONE;
-	blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
-	blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
-	blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ZERO;
-	blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ZERO;
-	blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
-	m_pDevice->CreateBlendState( &blendDesc, &m_pCompositeBlendState );
 
-	// Create the SortLib resources
-	m_SortLib.init( m_pDevice, m_pImmediateContext );
+void GPUParticleSystem::ReleaseParticleBuffers()
+{
+	SAFE_RELEASE( m_pIndexBuffer );
+
+	SAFE_RELEASE( m_pVisibleGroupOffsetsUAV );
+	SAFE_RELEASE( m_pVisibleGroupOffsets );
+	SAFE_RELEASE( m_pVisibilityMasksUAV );
+	SAFE_RELEASE( m_pVisibilityMasks );
+
+	SAFE_RELEASE( m_pVisibleIndexBufferUAV );
+	SAFE_RELEASE( m_pVisibleIndexBufferSRV );
+	SAFE_RELEASE( m_pVisibleIndexBuffer );
 
-	// Initialize the random numbers texture
-	FillRandomTexture();
+	SAFE_RELEASE( m_pAliveIndexBufferUAV );
+	SAFE_RELEASE( m_pAliveIndexBufferSRV );
+	SAFE_RELEASE( m_pAliveIndexBuffer );
+
+	SAFE_RELEASE( m_pParticleStorageConstantBuffer );
+
+	ReleaseCoarseCullingBuffer();
+
+	SAFE_RELEASE( m_pCoarseBinGroupCountsUAV );
+	SAFE_RELEASE( m_pCoarseBinGroupCounts );
+
+	for ( int i = 0; i < 2; i++ )
+	{
+		SAFE_RELEASE( m_pSimulationListUAV[ i ] );
+		SAFE_RELEASE( m_pSimulationListSRV[ i ] );
+		SAFE_RELEASE( m_pSimulationListBuffer[ i ] );
+	}
+
+	SAFE_RELEASE( m_pDeadListUAV );
+	SAFE_RELEASE( m_pDeadListBuffer );
+
+	SAFE_RELEASE( m_pMaxRadiusBufferUAV );
+	SAFE_RELEASE( m_pMaxRadiusBufferSRV );
+	SAFE_RELEASE( m_pMaxRadiusBuffer );
+
+	SAFE_RELEASE( m_pViewSpaceParticlePositionsUAV );
+	SAFE_RELEASE( m_pViewSpaceParticlePositionsSRV );
+	SAFE_RELEASE( m_pViewSpaceParticlePositions );
+
+	SAFE_RELEASE( m_pParticleBufferB_UAV );
+	SAFE_RELEASE( m_pParticleBufferB );
+
+	SAFE_RELEASE( m_pParticleBufferA_UAV );
+	SAFE_RELEASE( m_pParticleBufferA_SRV );
+	SAFE_RELEASE( m_pParticleBufferA );
 }
 
 
@@ -951,326 +1934,1398 @@ void GPUParticleSystem::OnResizedSwapChain( const DXGI_SURFACE_DESC* pBackBuffer
 	m_uHeight = pBackBufferSurfaceDesc->Height;
 
 	// Ensure the numbers of tiles are sufficient to cover the screen
-	m_tilingConstants.numTilesX = align( m_uWidth, TILE_RES_X ) / TILE_RES_X;
-	m_tilingConstants.numTilesY = align( m_uHeight, TILE_RES_Y ) / TILE_RES_Y;
-
-	unsigned int uNumRenderingTiles = m_tilingConstants.numTilesX * m_tilingConstants.numTilesY;
- 
-	// Allocate the tiled rendering buffer as RGBA16F
-	D3D11_BUFFER_DESC BufferDesc;
-	ZeroMemory( &BufferDesc, sizeof(BufferDesc) );
-	int numPixels = uNumRenderingTiles * TILE_RES_X * TILE_RES_Y;
-	BufferDesc.ByteWidth = 8 * numPixels;
-	BufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
-	BufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	V( m_pDevice->CreateBuffer( &BufferDesc, nullptr, &m_pRenderingBuffer ) );
-	DXUT_SetDebugName( m_pRenderingBuffer, "RenderingBuffer" );
+	SetTileSize( m_TileSize );
 
-	DXGI_FORMAT format = DXGI_FORMAT_R16G16B16A16_FLOAT;
-	
-	D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc;
-	ZeroMemory( &SRVDesc, sizeof( SRVDesc ) );
-	SRVDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
-	SRVDesc.Buffer.ElementOffset = 0;
-	SRVDesc.Format = format;
-	SRVDesc.Buffer.ElementWidth = numPixels;
-	V( m_pDevice->CreateShaderResourceView( m_pRenderingBuffer, &SRVDesc, &m_pRenderingBufferSRV ) );
+	CreateRenderBuffer();
 
-	D3D11_UNORDERED_ACCESS_VIEW_DESC UAVDesc;
-	ZeroMemory( &UAVDesc, sizeof( UAVDesc ) );
-	UAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
-	UAVDesc.Buffer.FirstElement = 0;
-	UAVDesc.Format = format;
-	UAVDesc.Buffer.NumElements = numPixels;
-	V( m_pDevice->CreateUnorderedAccessView( m_pRenderingBuffer, &UAVDesc, &m_pRenderingBufferUAV ) );
+	// The tile size can change every frame, so the buffers need to be big enough for any of them. The smallest tiles are the most 
+	// numerous
+	unsigned int uMinTileSize = g_tileSizes[ 0 ];
 
-	unsigned int uNumCullingTiles = m_tilingConstants.numTilesX * m_tilingConstants.numTilesY;
+	unsigned int uNumCullingTiles = ( align( m_uWidth, uMinTileSize ) / uMinTileSize ) * ( align( m_uHeight, uMinTileSize ) / uMinTileSize );
 
-	// Allocate the tiled culling index buffer (for fine-grained culling)
+	// Allocate the per-tile list counts and offsets (for fine-grained culling). The offsets have an extra element for the total
+	D3D11_BUFFER_DESC BufferDesc;
 	ZeroMemory( &BufferDesc, sizeof(BufferDesc) );
-	int numElements = uNumCullingTiles * PARTICLES_TILE_BUFFER_SIZE;
-	BufferDesc.ByteWidth = 4 * numElements;
+	BufferDesc.ByteWidth = 4 * uNumCullingTiles;
 	BufferDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
 	BufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	V( m_pDevice->CreateBuffer( &BufferDesc, nullptr, &m_pTiledIndexBuffer ) );
+	V( m_pDevice->CreateBuffer( &BufferDesc, nullptr, &m_pTileListCounts ) );
+
+	BufferDesc.ByteWidth = 4 * ( uNumCullingTiles + 1 );
+	V( m_pDevice->CreateBuffer( &BufferDesc, nullptr, &m_pTileListOffsets ) );
 	
+	D3D11_UNORDERED_ACCESS_VIEW_DESC UAVDesc;
 	ZeroMemory( &UAVDesc, sizeof( UAVDesc ) );
 	UAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
 	UAVDesc.Buffer.FirstElement = 0;
 	UAVDesc.Format = DXGI_FORMAT_R32_UINT;
-	UAVDesc.Buffer.NumElements = numElements;
-	V( m_pDevice->CreateUnorderedAccessView( m_pTiledIndexBuffer, &UAVDesc, &m_pTiledIndexBufferUAV ) );
+	UAVDesc.Buffer.NumElements = uNumCullingTiles;
+	V( m_pDevice->CreateUnorderedAccessView( m_pTileListCounts, &UAVDesc, &m_pTileListCountsUAV ) );
 
+	UAVDesc.Buffer.NumElements = uNumCullingTiles + 1;
+	V( m_pDevice->CreateUnorderedAccessView( m_pTileListOffsets, &UAVDesc, &m_pTileListOffsetsUAV ) );
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc;
 	ZeroMemory( &SRVDesc, sizeof( SRVDesc ) );
 	SRVDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
 	SRVDesc.Buffer.ElementOffset = 0;
 	SRVDesc.Format = DXGI_FORMAT_R32_UINT;
-	SRVDesc.Buffer.ElementWidth = numElements;
-	V( m_pDevice->CreateShaderResourceView( m_pTiledIndexBuffer, &SRVDesc, &m_pTiledIndexBufferSRV ) );
-}
-
+	SRVDesc.Buffer.ElementWidth = uNumCullingTiles;
+	V( m_pDevice->CreateShaderResourceView( m_pTileListCounts, &SRVDesc, &m_pTileListCountsSRV ) );
 
-void GPUParticleSystem::OnReleasingSwapChain()
-{
-	SAFE_RELEASE( m_pRenderingBufferUAV );
-	SAFE_RELEASE( m_pRenderingBufferSRV );
-	SAFE_RELEASE( m_pRenderingBuffer );
+	SRVDesc.Buffer.ElementWidth = uNumCullingTiles + 1;
+	V( m_pDevice->CreateShaderResourceView( m_pTileListOffsets, &SRVDesc, &m_pTileListOffsetsSRV ) );
 
-	SAFE_RELEASE( m_pTiledIndexBufferUAV );
-	SAFE_RELEASE( m_pTiledIndexBufferSRV );
-	SAFE_RELEASE( m_pTiledIndexBuffer );
-}
+	// Allocate the per-tile shading rates
+	BufferDesc.ByteWidth = 4 * uNumCullingTiles;
+	V( m_pDevice->CreateBuffer( &BufferDesc, nullptr, &m_pTileShadingRates ) );
+	DXUT_SetDebugName( m_pTileShadingRates, "TileShadingRates" );
 
+	UAVDesc.Buffer.NumElements = uNumCullingTiles;
+	V( m_pDevice->CreateUnorderedAccessView( m_pTileShadingRates, &UAVDesc, &m_pTileShadingRatesUAV ) );
 
-void GPUParticleSystem::OnDestroyDevice()
-{
-	m_pImmediateContext = nullptr;
-	m_pDevice = nullptr;
+	SRVDesc.Buffer.ElementWidth = uNumCullingTiles;
+	V( m_pDevice->CreateShaderResourceView( m_pTileShadingRates, &SRVDesc, &m_pTileShadingRatesSRV ) );
 
-	SAFE_RELEASE( m_pIndexBuffer );
+	// Allocate the per-tile depth bounds
+	BufferDesc.ByteWidth = 2 * sizeof( float ) * uNumCullingTiles;
+	BufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	BufferDesc.StructureByteStride = 2 * sizeof( float );
+	V( m_pDevice->CreateBuffer( &BufferDesc, nullptr, &m_pTileDepthBounds ) );
+	DXUT_SetDebugName( m_pTileDepthBounds, "TileDepthBounds" );
 
-	SAFE_RELEASE( m_pIndirectDrawArgsBufferUAV );
-	SAFE_RELEASE( m_pIndirectDrawArgsBuffer );
+	UAVDesc.Format = DXGI_FORMAT_UNKNOWN;
+	V( m_pDevice->CreateUnorderedAccessView( m_pTileDepthBounds, &UAVDesc, &m_pTileDepthBoundsUAV ) );
 
-	SAFE_RELEASE( m_pRandomTextureSRV );
-	SAFE_RELEASE( m_pRandomTexture );
+	SRVDesc.Format = DXGI_FORMAT_UNKNOWN;
+	V( m_pDevice->CreateShaderResourceView( m_pTileDepthBounds, &SRVDesc, &m_pTileDepthBoundsSRV ) );
 
+	// Allocate the half and quarter resolution max depth
+	for ( int i = 0; i < NUM_SHADING_RATES - 1; i++ )
+	{
+		unsigned int uBlockSize = 2 << i;
+
+		D3D11_TEXTURE2D_DESC TextureDesc;
+		ZeroMemory( &TextureDesc, sizeof( TextureDesc ) );
+		TextureDesc.Width = align( m_uWidth, uBlockSize ) / uBlockSize;
+		TextureDesc.Height = align( m_uHeight, uBlockSize ) / uBlockSize;
+		TextureDesc.MipLevels = 1;
+		TextureDesc.ArraySize = 1;
+		TextureDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		TextureDesc.SampleDesc.Count = 1;
+		TextureDesc.Usage = D3D11_USAGE_DEFAULT;
+		TextureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		V( m_pDevice->CreateTexture2D( &TextureDesc, nullptr, &m_pLowResDepth[ i ] ) );
+		DXUT_SetDebugName( m_pLowResDepth[ i ], "LowResDepth" );
+
+		V( m_pDevice->CreateShaderResourceView( m_pLowResDepth[ i ], nullptr, &m_pLowResDepthSRV[ i ] ) );
+		V( m_pDevice->CreateUnorderedAccessView( m_pLowResDepth[ i ], nullptr, &m_pLowResDepthUAV[ i ] ) );
+	}
+
+	// Allocate the Hi-Z pyramid, all the way down to 1x1. The first level is half the screen rounded up to a power of two so that 
+	// every level is exactly half the one before
+	{
+		unsigned int uHiZWidth = 1;
+		while ( uHiZWidth * 2 < m_uWidth )
+			uHiZWidth *= 2;
+
+		unsigned int uHiZHeight = 1;
+		while ( uHiZHeight * 2 < m_uHeight )
+			uHiZHeight *= 2;
+
+		m_NumHiZLevels = 1;
+		while ( ( std::max( uHiZWidth, uHiZHeight ) >> m_NumHiZLevels ) > 0 )
+			m_NumHiZLevels++;
+		assert( m_NumHiZLevels <= MAX_HIZ_LEVELS );
+
+		D3D11_TEXTURE2D_DESC TextureDesc;
+		ZeroMemory( &TextureDesc, sizeof( TextureDesc ) );
+		TextureDesc.Width = uHiZWidth;
+		TextureDesc.Height = uHiZHeight;
+		TextureDesc.MipLevels = m_NumHiZLevels;
+		TextureDesc.ArraySize = 1;
+		TextureDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		TextureDesc.SampleDesc.Count = 1;
+		TextureDesc.Usage = D3D11_USAGE_DEFAULT;
+		TextureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		V( m_pDevice->CreateTexture2D( &TextureDesc, nullptr, &m_pHiZ ) );
+		DXUT_SetDebugName( m_pHiZ, "HiZ" );
+
+		V( m_pDevice->CreateShaderResourceView( m_pHiZ, nullptr, &m_pHiZSRV ) );
+
+		for ( int i = 0; i < m_NumHiZLevels; i++ )
+		{
+			D3D11_SHADER_RESOURCE_VIEW_DESC LevelSRVDesc;
+			ZeroMemory( &LevelSRVDesc, sizeof( LevelSRVDesc ) );
+			LevelSRVDesc.Format = DXGI_FORMAT_R32_FLOAT;
+			LevelSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+			LevelSRVDesc.Texture2D.MostDetailedMip = i;
+			LevelSRVDesc.Texture2D.MipLevels = 1;
+			V( m_pDevice->CreateShaderResourceView( m_pHiZ, &LevelSRVDesc, &m_pHiZLevelSRV[ i ] ) );
+
+			D3D11_UNORDERED_ACCESS_VIEW_DESC LevelUAVDesc;
+			ZeroMemory( &LevelUAVDesc, sizeof( LevelUAVDesc ) );
+			LevelUAVDesc.Format = DXGI_FORMAT_R32_FLOAT;
+			LevelUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+			LevelUAVDesc.Texture2D.MipSlice = i;
+			V( m_pDevice->CreateUnorderedAccessView( m_pHiZ, &LevelUAVDesc, &m_pHiZLevelUAV[ i ] ) );
+		}
+	}
+
+	// Allocate the tiled culling index buffer. How many tiles each particle lands in depends on the scene so start with a guess for 
+	// the default tile size and let UpdateTileListCapacity grow it
+	unsigned int uDefaultTileSize = g_tileSizes[ g_defaultTileSize ];
+	unsigned int uNumDefaultTiles = ( align( m_uWidth, uDefaultTileSize ) / uDefaultTileSize ) * ( align( m_uHeight, uDefaultTileSize ) / uDefaultTileSize );
+	m_TileListCapacityLimit = g_maxTileListCapacity;
+	CreateTiledIndexBuffer( std::min( uNumDefaultTiles * g_initialParticlesPerTile, g_maxTileListCapacity ) );
+}
+
+
+void GPUParticleSystem::OnReleasingSwapChain()
+{
+	ReleaseRenderBuffer();
+
+	ReleaseTiledIndexBuffer();
+
+	SAFE_RELEASE( m_pTileListCountsUAV );
+	SAFE_RELEASE( m_pTileListCountsSRV );
+	SAFE_RELEASE( m_pTileListCounts );
+
+	SAFE_RELEASE( m_pTileListOffsetsUAV );
+	SAFE_RELEASE( m_pTileListOffsetsSRV );
+	SAFE_RELEASE( m_pTileListOffsets );
+
+	SAFE_RELEASE( m_pTileShadingRatesUAV );
+	SAFE_RELEASE( m_pTileShadingRatesSRV );
+	SAFE_RELEASE( m_pTileShadingRates );
+
+	SAFE_RELEASE( m_pTileDepthBoundsUAV );
+	SAFE_RELEASE( m_pTileDepthBoundsSRV );
+	SAFE_RELEASE( m_pTileDepthBounds );
+
+	for ( int i = 0; i < NUM_SHADING_RATES - 1; i++ )
+	{
+		SAFE_RELEASE( m_pLowResDepthUAV[ i ] );
+		SAFE_RELEASE( m_pLowResDepthSRV[ i ] );
+		SAFE_RELEASE( m_pLowResDepth[ i ] );
+	}
+
+	for ( int i = 0; i < MAX_HIZ_LEVELS; i++ )
+	{
+		SAFE_RELEASE( m_pHiZLevelUAV[ i ] );
+		SAFE_RELEASE( m_pHiZLevelSRV[ i ] );
+	}
+	SAFE_RELEASE( m_pHiZSRV );
+	SAFE_RELEASE( m_pHiZ );
+	m_NumHiZLevels = 0;
+}
+
+
+void GPUParticleSystem::OnDestroyDevice()
+{
+	m_pImmediateContext = nullptr;
+	m_pDevice = nullptr;
+
+	ReleaseParticleBuffers();
+
+	SAFE_RELEASE( m_pIndirectSimulateArgsBufferUAV );
+	SAFE_RELEASE( m_pIndirectSimulateArgsBuffer );
+
+	SAFE_RELEASE( m_pIndirectAliveArgsBufferUAV );
+	SAFE_RELEASE( m_pIndirectAliveArgsBuffer );
+
+	SAFE_RELEASE( m_pIndirectDrawArgsBufferUAV );
+	SAFE_RELEASE( m_pIndirectDrawArgsBuffer );
+
+	SAFE_RELEASE( m_pSimulationListConstantBuffer );
 	SAFE_RELEASE( m_pActiveListConstantBuffer );
 	SAFE_RELEASE( m_pDeadListConstantBuffer );
 
-#if _DEBUG
-	SAFE_RELEASE( m_pDebugCounterBuffer );
-#endif	
+#if _DEBUG
+	SAFE_RELEASE( m_pDebugCounterBuffer );
+#endif	
+
+	SAFE_RELEASE( m_pCoarseCullingBufferCountersUAV );
+	SAFE_RELEASE( m_pCoarseCullingBufferCountersSRV );
+	SAFE_RELEASE( m_pCoarseCullingBufferCounters );
+
+	SAFE_RELEASE( m_pCoarseCullingBufferOffsetsUAV );
+	SAFE_RELEASE( m_pCoarseCullingBufferOffsetsSRV );
+	SAFE_RELEASE( m_pCoarseCullingBufferOffsets );
+
+	for ( int i = 0; i < g_listTotalReadbackLatency; i++ )
+	{
+		SAFE_RELEASE( m_pCoarseBinTotalReadback[ i ] );
+		m_CoarseBinTotalPending[ i ] = false;
+
+		SAFE_RELEASE( m_pTileListTotalReadback[ i ] );
+		m_TileListTotalPending[ i ] = false;
+
+		SAFE_RELEASE( m_pTileDensityReadback[ i ] );
+		m_TileDensityPending[ i ] = false;
+	}
+
+	SAFE_RELEASE( m_pTileDensityHistogramUAV );
+	SAFE_RELEASE( m_pTileDensityHistogram );
+
+	SAFE_RELEASE( m_pAtlasCoreOpacityUAV );
+	SAFE_RELEASE( m_pAtlasCoreOpacitySRV );
+	SAFE_RELEASE( m_pAtlasCoreOpacity );
+
+	SAFE_RELEASE( m_pCoarseBinDepthBoundsUAV );
+	SAFE_RELEASE( m_pCoarseBinDepthBoundsSRV );
+	SAFE_RELEASE( m_pCoarseBinDepthBounds );
+	
+	SAFE_RELEASE( m_pQuadPS );
+	SAFE_RELEASE( m_pQuadVS );
+
+	for ( int j = 0; j < NumQualityModes; j++ )
+	{
+		for ( int k = 0; k < NumStreakModes; k++ )
+		{
+			SAFE_RELEASE( m_pRasterizedPS[ j ][ k ] );
+		}
+	}
+	for ( int k = 0; k < ARRAYSIZE( m_pGS ); k++ )
+	{
+		SAFE_RELEASE( m_pGS[ k ] );
+	}
+
+	for ( int i = 0; i < NumStreakModes; i++ )
+	{
+		for ( int j = 0; j < NumBillboardModes; j++ )
+		{
+			SAFE_RELEASE( m_pVS[ i ][ j ] );
+		}
+	}
+
+	for ( int i = 0; i < NumBillboardModes; i++ )
+	{
+		SAFE_RELEASE( m_pCSSimulate[ i ] );
+	}
+
+	SAFE_RELEASE( m_pCSResetParticles );
+	SAFE_RELEASE( m_pCSScatterParticles );
+	SAFE_RELEASE( m_pCSGatherParticles );
+	SAFE_RELEASE( m_pCSInitDeadList );
+	SAFE_RELEASE( m_pCSInitSimulateArgs );
+	SAFE_RELEASE( m_pCSInitAliveArgs );
+	SAFE_RELEASE( m_pCSEmit );
+
+	for ( int i = 0; i < NumCoarseCullingModes; i++ )
+	{
+		SAFE_RELEASE( m_pCoarseBinScanCS[ i ] );
+
+		for ( int j = 0; j < NumCoarseBinningModes; j++ )
+		{
+			SAFE_RELEASE( m_pCoarseBinCountCS[ j ][ i ] );
+			SAFE_RELEASE( m_pCoarseBinScatterCS[ j ][ i ] );
+		}
+	}
+
+	for ( int t = 0; t < g_numTileSizes; t++ )
+	{
+		SAFE_RELEASE( m_pTileComplexityCS[ t ] );
+		SAFE_RELEASE( m_pTileListMergeCS[ t ] );
+	
+		for ( int j = 0; j < NumQualityModes; j++ )
+		{
+			for ( int l = 0; l < NumStreakModes; l++ )
+			{
+				SAFE_RELEASE( m_pTiledRenderingCS[ t ][ j ][ l ] );
+			}
+		}
+
+		for ( int k = 0; k < NumZCullingModes; k++ )
+		{
+			for ( int l = 0; l < NumCullingModes; l++ )
+			{
+				for ( int i = 0; i < 2; i++ )
+				{
+					SAFE_RELEASE( m_pCullingCountCS[ t ][ k ][ l ][ i ] );
+					SAFE_RELEASE( m_pCullingCS[ t ][ k ][ l ][ i ] );
+				}
+			}
+		}
+	}
+
+	SAFE_RELEASE( m_pTileListScanCS );
+	SAFE_RELEASE( m_pDownsampleDepthCS );
+	SAFE_RELEASE( m_pAtlasOpacityCS );
+	SAFE_RELEASE( m_pTileDepthBoundsCS );
+	SAFE_RELEASE( m_pCoarseBinDepthBoundsCS );
+	SAFE_RELEASE( m_pDownsampleHiZCS );
+	SAFE_RELEASE( m_pOcclusionCullCS );
+	SAFE_RELEASE( m_pOcclusionCullCompactCS );
+
+	for ( int i = 0; i < NumBillboardModes; i++ )
+	{
+		SAFE_RELEASE( m_pOcclusionCullScanCS[ i ] );
+	}
+	
+	SAFE_RELEASE( m_pEmitterBufferSRV );
+	SAFE_RELEASE( m_pEmitterBuffer );
+	m_MaxEmitters = 0;
+
+	m_EmitterTable.ReleaseGPUTable();
+
+	SAFE_RELEASE( m_pEmitterConstantBuffer );
+	SAFE_RELEASE( m_pTilingConstantBuffer );
+
+	SAFE_RELEASE( m_pCompositeBlendState );
+	
+	m_SortLib.release();
+	m_RadixSortLib.release();
+	m_TemporalSortLib.release();
+
+	m_ResetSystem = true;
+}
+
+
+// Per-frame emission of particles into the GPU simulation
+void GPUParticleSystem::Emit( int numEmitters, const EmitterParams* emitters )
+{
+	AMDProfileEvent( AMD_PROFILE_GREEN, L"Emission" );
+
+	if ( numEmitters > m_MaxEmitters )
+	{
+		CreateEmitterBuffer( numEmitters );
+	}
+
+	// Pack the emitters that emit this frame into the emitter buffer. The running total of particles gives each emitter a contiguous 
+	// range of threads in the dispatch, so the CS can find its emitter with a binary search
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	m_pImmediateContext->Map( m_pEmitterBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource );
+	GPUEmitter* gpuEmitters = (GPUEmitter*)MappedResource.pData;
+
+	int numEmittersThisFrame = 0;
+	int numToEmit = 0;
+	for ( int i = 0; i < numEmitters; i++ )
+	{
+		const EmitterParams& emitter = emitters[ i ];
+	
+		if ( emitter.m_NumToEmit > 0 )
+		{	
+			GPUEmitter& gpuEmitter = gpuEmitters[ numEmittersThisFrame++ ];
+			gpuEmitter.m_EmitterPosition = emitter.m_Position;
+			gpuEmitter.m_EmitterVelocity = emitter.m_Velocity;
+			gpuEmitter.m_PositionVariance = emitter.m_PositionVariance;
+			gpuEmitter.m_FirstParticle = numToEmit;
+			gpuEmitter.m_NumToEmit = emitter.m_NumToEmit;
+			gpuEmitter.m_ParticleLifeSpan = emitter.m_ParticleLifeSpan;
+			gpuEmitter.m_StartSize = emitter.m_StartSize;
+			gpuEmitter.m_EndSize = emitter.m_EndSize;
+			gpuEmitter.m_VelocityVariance = emitter.m_VelocityVariance;
+			gpuEmitter.m_Mass = emitter.m_Mass;
+			gpuEmitter.m_Index = i;
+			gpuEmitter.m_Streaks = emitter.m_Streaks ? 1 : 0;
+			gpuEmitter.m_TextureIndex = emitter.m_TextureIndex;
+
+			numToEmit += emitter.m_NumToEmit;
+		}
+	}
+
+	m_pImmediateContext->Unmap( m_pEmitterBuffer, 0 );
+
+	if ( numToEmit > 0 )
+	{
+		m_pImmediateContext->Map( m_pEmitterConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource );
+		EmitterConstantBuffer* constants = (EmitterConstantBuffer*)MappedResource.pData;
+		constants->m_NumEmitters = numEmittersThisFrame;
+		constants->m_NumToEmit = numToEmit;
+		constants->m_EmitFrame = m_EmitFrame;
+		m_pImmediateContext->Unmap( m_pEmitterConstantBuffer, 0 );
+
+		// Set resources but don't reset any atomic counters. The new particles are added to the end of the current simulation list
+		ID3D11UnorderedAccessView* uavs[] = { m_pParticleBufferA_UAV, m_pParticleBufferB_UAV, m_pDeadListUAV, m_pSimulationListUAV[ m_CurrentSimulationList ] };
+		UINT initialCounts[] = { (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1 };
+		m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
+
+		// Copy the current number of dead particles into a CB so we know how many new particles are available to be spawned
+		m_pImmediateContext->CopyStructureCount( m_pDeadListConstantBuffer, 0, m_pDeadListUAV );
+
+		ID3D11Buffer* buffers[] = { m_pEmitterConstantBuffer, m_pDeadListConstantBuffer };
+		m_pImmediateContext->CSSetConstantBuffers( 1, ARRAYSIZE( buffers ), buffers );
+
+		ID3D11ShaderResourceView* srvs[] = { m_pEmitterBufferSRV };
+		m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+	
+		// Dispatch enough thread groups to spawn the requested particles for all the emitters
+		m_pImmediateContext->CSSetShader( m_pCSEmit, nullptr, 0 );
+		m_pImmediateContext->Dispatch( align( numToEmit, 1024 ) / 1024, 1, 1 );
+
+		ZeroMemory( srvs, sizeof( srvs ) );
+		m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+	}
+
+	m_EmitFrame++;
+
+#if _DEBUG
+	m_NumDeadParticlesAfterEmit = ReadCounter( m_pDeadListUAV );
+#endif
+}
+
+
+// Create the dynamic buffer holding the frame's emitters. The size is rounded up so it doesn't get recreated as emitters are added one by one
+void GPUParticleSystem::CreateEmitterBuffer( int maxEmitters )
+{
+	SAFE_RELEASE( m_pEmitterBufferSRV );
+	SAFE_RELEASE( m_pEmitterBuffer );
+
+	m_MaxEmitters = align( maxEmitters, 64 );
+
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.ByteWidth = sizeof( GPUEmitter ) * m_MaxEmitters;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.StructureByteStride = sizeof( GPUEmitter );
+	m_pDevice->CreateBuffer( &desc, nullptr, &m_pEmitterBuffer );
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srv;
+	ZeroMemory( &srv, sizeof( srv ) );
+	srv.Format = DXGI_FORMAT_UNKNOWN;
+	srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srv.Buffer.ElementWidth = m_MaxEmitters;
+	m_pDevice->CreateShaderResourceView( m_pEmitterBuffer, &srv, &m_pEmitterBufferSRV );
+}
+
+
+// Per-frame simulation step
+void GPUParticleSystem::Simulate( int flags, ID3D11ShaderResourceView* depthSRV )
+{
+	AMDProfileEvent( AMD_PROFILE_GREEN, L"Simulation" );
+
+	int nextSimulationList = 1 - m_CurrentSimulationList;
+
+	// Copy the number of particles on the simulation list into a CB and use it to size the dispatch. This also resets the draw args
+	m_pImmediateContext->CopyStructureCount( m_pSimulationListConstantBuffer, 0, m_pSimulationListUAV[ m_CurrentSimulationList ] );
+	m_pImmediateContext->CSSetConstantBuffers( 6, 1, &m_pSimulationListConstantBuffer );
+
+	ID3D11UnorderedAccessView* argsUAVs[] = { m_pIndirectSimulateArgsBufferUAV, m_pIndirectDrawArgsBufferUAV };
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( argsUAVs ), argsUAVs, nullptr );
+	m_pImmediateContext->CSSetShader( m_pCSInitSimulateArgs, nullptr, 0 );
+	m_pImmediateContext->Dispatch( 1, 1, 1 );
+
+	ZeroMemory( argsUAVs, sizeof( argsUAVs ) );
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( argsUAVs ), argsUAVs, nullptr );
+
+	// Set the UAVs and reset the alive index buffer's counter and that of the simulation list for next frame
+	ID3D11UnorderedAccessView* uavs[] = { m_pParticleBufferA_UAV, m_pParticleBufferB_UAV, m_pDeadListUAV, m_pAliveIndexBufferUAV, m_pViewSpaceParticlePositionsUAV, m_pMaxRadiusBufferUAV, m_pIndirectDrawArgsBufferUAV, m_pSimulationListUAV[ nextSimulationList ] };
+	UINT initialCounts[] = { (UINT)-1, (UINT)-1, (UINT)-1, 0, (UINT)-1, (UINT)-1, (UINT)-1, 0 };
+	
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
+	
+	// Bring the emitter table up to date. Emitters that haven't changed since last frame cost nothing
+	ID3D11ShaderResourceView* emitterTableSRV = m_EmitterTable.UpdateGPUTable( m_pDevice, m_pImmediateContext );
+
+	// Bind the depth buffer as a texture for doing collision detection and response, the list of particles to simulate, the emitter table, 
+	// the atlas core opacity and the tile depth bounds that let most particles skip the collision test
+	ID3D11ShaderResourceView* srvs[] = { depthSRV, m_pSimulationListSRV[ m_CurrentSimulationList ], emitterTableSRV, m_pAtlasCoreOpacitySRV, m_pTileDepthBoundsSRV };
+	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+	m_pImmediateContext->CSSetConstantBuffers( 5, 1, &m_pTilingConstantBuffer );
+
+	// Pick the correct CS based on the system's options
+	BillboardMode billboardMode = flags & PF_UseGeometryShader ? UseGS : UseVS;
+	
+	// Only dispatch enough thread groups to update the particles on the simulation list
+	m_pImmediateContext->CSSetShader( m_pCSSimulate[ billboardMode ], nullptr, 0 );
+	m_pImmediateContext->DispatchIndirect( m_pIndirectSimulateArgsBuffer, 0 );
+
+	ZeroMemory( srvs, sizeof( srvs ) );
+	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+
+	ZeroMemory( uavs, sizeof( uavs ) );
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
+
+	m_CurrentSimulationList = nextSimulationList;
+}
+
+
+// Helper function to read atomic UAV counters back onto the CPU. This will cause a stall so only use in debug
+#if _DEBUG
+int	GPUParticleSystem::ReadCounter( ID3D11UnorderedAccessView* uav )
+{
+	int count = 0;
+
+	// Copy the UAV counter to a staging resource
+	m_pImmediateContext->CopyStructureCount( m_pDebugCounterBuffer, 0, uav );
+	
+	// Map the staging resource
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	m_pImmediateContext->Map( m_pDebugCounterBuffer, 0, D3D11_MAP_READ, 0, &MappedResource );
+	
+	// Read the data
+	count = *(int*)MappedResource.pData;
+
+	m_pImmediateContext->Unmap( m_pDebugCounterBuffer, 0 );
+
+	return count;
+}
+
+
+// Copy the start of a buffer back to the CPU. This will cause a stall so only use in debug
+void GPUParticleSystem::ReadBuffer( ID3D11Buffer* buffer, UINT numBytes, std::vector<BYTE>& data )
+{
+	data.resize( numBytes );
+	if ( numBytes == 0 )
+		return;
+
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.ByteWidth = numBytes;
+
+	ID3D11Buffer* stagingBuffer = nullptr;
+	m_pDevice->CreateBuffer( &desc, nullptr, &stagingBuffer );
+
+	D3D11_BOX box = { 0, 0, 0, numBytes, 1, 1 };
+	m_pImmediateContext->CopySubresourceRegion( stagingBuffer, 0, 0, 0, 0, buffer, 0, &box );
+
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	m_pImmediateContext->Map( stagingBuffer, 0, D3D11_MAP_READ, 0, &MappedResource );
+	memcpy( &data[ 0 ], MappedResource.pData, numBytes );
+	m_pImmediateContext->Unmap( stagingBuffer, 0 );
+
+	SAFE_RELEASE( stagingBuffer );
+}
+
+
+// Pull the particle indices out of alive list entries read back with ReadBuffer
+void GPUParticleSystem::DecodeSortItems( const std::vector<BYTE>& items, int numItems, std::vector<UINT>& indices )
+{
+	indices.resize( numItems );
+	for ( int i = 0; i < numItems; i++ )
+	{
+		if ( m_PackedSortKeys )
+			indices[ i ] = ( (const UINT*)&items[ 0 ] )[ i ] & ( ( 1u << SORT_KEY_INDEX_BITS ) - 1 );
+		else
+			indices[ i ] = (UINT)( (const float*)&items[ 0 ] )[ i * 2 + 1 ];
+	}
+}
+
+
+// Read back this frame's coarse bins and the particles they were built from, and check them against the CPU model
+void GPUParticleSystem::CheckCoarseBins( CoarseCullingMode coarseCullingMode )
+{
+	int numAlive = ReadCounter( m_pAliveIndexBufferUAV );
+
+	CoarseBinLayout layout;
+	layout.m_NumBinsX = g_NumCoarseTiles[ coarseCullingMode ][ 0 ];
+	layout.m_NumBinsY = g_NumCoarseTiles[ coarseCullingMode ][ 1 ];
+	layout.m_BinWidth = m_tilingConstants.numCullingTilesPerCoarseTileX * m_tilingConstants.tileResX;
+	layout.m_BinHeight = m_tilingConstants.numCullingTilesPerCoarseTileY * m_tilingConstants.tileResY;
+	int numBins = layout.m_NumBinsX * layout.m_NumBinsY;
+
+	std::vector<BYTE> positions, radii, aliveList, counters, offsets, binContents, binDepthBounds;
+	ReadBuffer( m_pCoarseCullingBufferCounters, sizeof( UINT ) * numBins, counters );
+	ReadBuffer( m_pCoarseCullingBufferOffsets, sizeof( UINT ) * ( numBins + 1 ), offsets );
+
+	// The bins are incomplete until UpdateCoarseBinCapacity has caught up
+	UINT numEntries = ( (const UINT*)&offsets[ 0 ] )[ numBins ];
+	if ( numEntries > m_CoarseBinCapacity )
+		return;
+
+	ReadBuffer( m_pViewSpaceParticlePositions, sizeof( DirectX::XMFLOAT4 ) * m_MaxParticles, positions );
+	ReadBuffer( m_pMaxRadiusBuffer, sizeof( DirectX::XMFLOAT2 ) * m_MaxParticles, radii );
+	ReadBuffer( m_pAliveIndexBuffer, (UINT)( ( m_PackedSortKeys ? sizeof( UINT ) : 2 * sizeof( float ) ) * numAlive ), aliveList );
+	ReadBuffer( m_pCoarseCullingBuffer, sizeof( UINT ) * numEntries, binContents );
+
+	std::vector<UINT> aliveIndices;
+	DecodeSortItems( aliveList, numAlive, aliveIndices );
+
+	// The bins are packed back to back, see CoarseBinScatter in CoarseCullingCS.hlsl
+	std::vector< std::vector<UINT> > bins( numBins );
+	for ( int i = 0; i < numBins && numEntries > 0; i++ )
+	{
+		UINT offset = std::min( ( (const UINT*)&offsets[ 0 ] )[ i ], numEntries );
+		UINT count = std::min( ( (const UINT*)&counters[ 0 ] )[ i ], numEntries - offset );
+		const UINT* bin = (const UINT*)&binContents[ 0 ] + offset;
+		bins[ i ].assign( bin, bin + count );
+	}
+
+	// The radius buffer holds the core opacity alongside each radius
+	std::vector<float> maxRadii( m_MaxParticles );
+	for ( int i = 0; i < m_MaxParticles; i++ )
+	{
+		maxRadii[ i ] = ( (const DirectX::XMFLOAT2*)&radii[ 0 ] )[ i ].x;
+	}
+
+	// With max Z culling the bins leave out particles behind the furthest opaque pixel in the bin
+	std::vector<float> binMaxZ;
+	if ( m_tilingConstants.cullMaxZ )
+	{
+		ReadBuffer( m_pCoarseBinDepthBounds, sizeof( DirectX::XMFLOAT2 ) * numBins, binDepthBounds );
+
+		binMaxZ.resize( numBins );
+		for ( int i = 0; i < numBins; i++ )
+		{
+			binMaxZ[ i ] = ( (const DirectX::XMFLOAT2*)&binDepthBounds[ 0 ] )[ i ].y;
+		}
+	}
+
+	int numErrors = ValidateCoarseBins( m_PerFrameConstants, layout, (const DirectX::XMFLOAT4*)&positions[ 0 ], &maxRadii[ 0 ], binMaxZ.empty() ? nullptr : &binMaxZ[ 0 ], numAlive ? &aliveIndices[ 0 ] : nullptr, numAlive, bins );
+	if ( numErrors )
+	{
+		char message[ 128 ];
+		sprintf_s( message, "GPUParticleSystem: %d coarse bin entries don't match the CPU model\n", numErrors );
+		OutputDebugStringA( message );
+	}
+	assert( numErrors == 0 );
+}
+
+
+// Read back this frame's occlusion culling and the particles and Hi-Z pyramid it worked from, and check it against the CPU model
+void GPUParticleSystem::CheckOcclusionCulling()
+{
+	int numAlive = ReadCounter( m_pAliveIndexBufferUAV );
+	int numGroups = align( numAlive, OCCLUSION_CULLING_THREADS ) / OCCLUSION_CULLING_THREADS;
+	UINT itemSize = (UINT)( m_PackedSortKeys ? sizeof( UINT ) : 2 * sizeof( float ) );
+
+	std::vector<BYTE> positions, radii, aliveList, offsets, visibleList;
+	ReadBuffer( m_pVisibleGroupOffsets, sizeof( UINT ) * ( numGroups + 1 ), offsets );
+	int numVisible = (int)( (const UINT*)&offsets[ 0 ] )[ numGroups ];
+
+	ReadBuffer( m_pViewSpaceParticlePositions, sizeof( DirectX::XMFLOAT4 ) * m_MaxParticles, positions );
+	ReadBuffer( m_pMaxRadiusBuffer, sizeof( DirectX::XMFLOAT2 ) * m_MaxParticles, radii );
+	ReadBuffer( m_pAliveIndexBuffer, itemSize * numAlive, aliveList );
+	ReadBuffer( m_pVisibleIndexBuffer, itemSize * numAlive, visibleList );
+
+	std::vector<UINT> aliveIndices, visibleIndices;
+	DecodeSortItems( aliveList, numAlive, aliveIndices );
+	DecodeSortItems( visibleList, numAlive, visibleIndices );
+
+	// The survivors are packed against the end of the list
+	visibleIndices.erase( visibleIndices.begin(), visibleIndices.begin() + ( numAlive - std::min( numVisible, numAlive ) ) );
+
+	std::vector<float> maxRadii( m_MaxParticles );
+	for ( int i = 0; i < m_MaxParticles; i++ )
+	{
+		maxRadii[ i ] = ( (const DirectX::XMFLOAT2*)&radii[ 0 ] )[ i ].x;
+	}
+
+	// Read back the first level of the pyramid. The model builds the rest from it
+	D3D11_TEXTURE2D_DESC desc;
+	m_pHiZ->GetDesc( &desc );
+	desc.MipLevels = 1;
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+	ID3D11Texture2D* stagingTexture = nullptr;
+	m_pDevice->CreateTexture2D( &desc, nullptr, &stagingTexture );
+	m_pImmediateContext->CopySubresourceRegion( stagingTexture, 0, 0, 0, 0, m_pHiZ, 0, nullptr );
+
+	std::vector<float> firstLevel( desc.Width * desc.Height );
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	m_pImmediateContext->Map( stagingTexture, 0, D3D11_MAP_READ, 0, &MappedResource );
+	for ( UINT y = 0; y < desc.Height; y++ )
+	{
+		memcpy( &firstLevel[ y * desc.Width ], (const BYTE*)MappedResource.pData + y * MappedResource.RowPitch, desc.Width * sizeof( float ) );
+	}
+	m_pImmediateContext->Unmap( stagingTexture, 0 );
+
+	SAFE_RELEASE( stagingTexture );
+
+	HiZPyramid hiZ;
+	BuildHiZPyramid( &firstLevel[ 0 ], (int)desc.Width, (int)desc.Height, hiZ );
+
+	int numErrors = ValidateOcclusionCulling( m_PerFrameConstants, hiZ, (const DirectX::XMFLOAT4*)&positions[ 0 ], &maxRadii[ 0 ], numAlive ? &aliveIndices[ 0 ] : nullptr, numAlive, visibleIndices.empty() ? nullptr : &visibleIndices[ 0 ], (int)visibleIndices.size() );
+	if ( numVisible > numAlive )
+	{
+		numErrors++;
+	}
+
+	if ( numErrors )
+	{
+		char message[ 128 ];
+		sprintf_s( message, "GPUParticleSystem: %d visible list entries don't match the CPU model\n", numErrors );
+		OutputDebugStringA( message );
+	}
+	assert( numErrors == 0 );
+}
+
+
+// Read back this frame's tile lists and render buffer, and check them against the CPU reference. The reference renders the GPU's own 
+// lists, so this checks the lists are front to back and the pixels match rather than the culling. Tiles shaded at a lower rate are 
+// skipped as the reference only shades at full rate
+void GPUParticleSystem::CheckTiledRendering( int flags, ID3D11ShaderResourceView* depthSRV )
+{
+	int numTiles = (int)( m_tilingConstants.numTilesX * m_tilingConstants.numTilesY );
+
+	std::vector<BYTE> counts, offsets, indices, positions, particleData, shadingRates;
+	ReadBuffer( m_pTileListCounts, sizeof( UINT ) * numTiles, counts );
+	ReadBuffer( m_pTileListOffsets, sizeof( UINT ) * ( numTiles + 1 ), offsets );
+
+	// The lists are incomplete until UpdateTileListCapacity has caught up
+	UINT numEntries = ( (const UINT*)&offsets[ 0 ] )[ numTiles ];
+	if ( numEntries > m_TileListCapacity )
+		return;
+
+	ReadBuffer( m_pTiledIndexBuffer, sizeof( UINT ) * numEntries, indices );
+	ReadBuffer( m_pViewSpaceParticlePositions, sizeof( DirectX::XMFLOAT4 ) * m_MaxParticles, positions );
+
+	D3D11_BUFFER_DESC particleDesc;
+	m_pParticleBufferA->GetDesc( &particleDesc );
+	ReadBuffer( m_pParticleBufferA, particleDesc.ByteWidth, particleData );
+
+	if ( m_tilingConstants.maxShadingRate > 0 )
+	{
+		ReadBuffer( m_pTileShadingRates, sizeof( UINT ) * numTiles, shadingRates );
+	}
+
+	TiledRasterizerTileLists lists;
+	lists.m_TileSize = g_tileSizes[ m_TileSize ];
+	lists.m_NumTilesX = (int)m_tilingConstants.numTilesX;
+	lists.m_NumTilesY = (int)m_tilingConstants.numTilesY;
+	lists.m_Counts.assign( (const UINT*)&counts[ 0 ], (const UINT*)&counts[ 0 ] + numTiles );
+	lists.m_Offsets.assign( (const UINT*)&offsets[ 0 ], (const UINT*)&offsets[ 0 ] + numTiles + 1 );
+	if ( numEntries )
+	{
+		lists.m_Indices.assign( (const UINT*)&indices[ 0 ], (const UINT*)&indices[ 0 ] + numEntries );
+	}
+
+	// Every list has to be in front to back order, however many runs it was sorted in, and point at real particles
+	const DirectX::XMFLOAT4* viewSpacePositions = (const DirectX::XMFLOAT4*)&positions[ 0 ];
+	int numListErrors = 0;
+	for ( int tile = 0; tile < numTiles; tile++ )
+	{
+		if ( lists.m_Offsets[ tile ] + lists.m_Counts[ tile ] > numEntries )
+		{
+			numListErrors++;
+			lists.m_Counts[ tile ] = 0;
+			continue;
+		}
+
+		const UINT* list = lists.m_Indices.data() + lists.m_Offsets[ tile ];
+		for ( UINT i = 0; i < lists.m_Counts[ tile ]; i++ )
+		{
+			if ( list[ i ] >= (UINT)m_MaxParticles )
+			{
+				numListErrors++;
+				lists.m_Counts[ tile ] = i;
+				break;
+			}
+
+			if ( i > 0 && viewSpacePositions[ list[ i ] ].z < viewSpacePositions[ list[ i - 1 ] ].z )
+			{
+				numListErrors++;
+			}
+		}
+	}
+
+	if ( numListErrors )
+	{
+		char message[ 128 ];
+		sprintf_s( message, "GPUParticleSystem: %d tile list entries are out of order or out of range\n", numListErrors );
+		OutputDebugStringA( message );
+	}
+	assert( numListErrors == 0 );
+
+	// Gather the rest of what the reference needs and render the lists with it
+	std::vector<UINT> particleIndices( m_MaxParticles );
+	for ( int i = 0; i < m_MaxParticles; i++ )
+	{
+		particleIndices[ i ] = (UINT)i;
+	}
+
+	std::vector<CPUParticlePartA> particles( m_MaxParticles );
+	LoadRenderParticles( m_Layout, &particleData[ 0 ], m_MaxParticles, &particleIndices[ 0 ], m_MaxParticles, &particles[ 0 ], nullptr );
+
+	int width = (int)m_uWidth;
+	int height = (int)m_uHeight;
+
+	std::vector<float> depth;
+	if ( depthSRV && !ReadBackTiledRasterizerDepth( m_pImmediateContext, depthSRV, width, height, depth ) )
+		return;
+
+	// The application binds the atlas in slot 6 for the tiled renderer
+	ID3D11ShaderResourceView* atlasSRV = nullptr;
+	m_pImmediateContext->CSGetShaderResources( 6, 1, &atlasSRV );
+	std::vector<DirectX::XMFLOAT4> atlasTexels;
+	TiledRasterizerTexture atlas;
+	ReadBackTiledRasterizerTexture( m_pImmediateContext, atlasSRV, atlasTexels, atlas );
+	SAFE_RELEASE( atlasSRV );
+
+	// The reference covers the screen in the constants, so it has to match the render buffer
+	PER_FRAME_CONSTANT_BUFFER constants = m_PerFrameConstants;
+	constants.m_ScreenWidth = width;
+	constants.m_ScreenHeight = height;
+
+	int numPixels = width * height;
+	std::vector<DirectX::XMFLOAT4> reference( numPixels );
+	RasterizeTiles( constants, flags, lists, &particles[ 0 ], viewSpacePositions, depth.empty() ? nullptr : &depth[ 0 ], atlas, &reference[ 0 ], nullptr );
+
+	// Compare in the render buffer's format so the reference goes through the same conversion as the UAV store
+	int bytesPerPixel = GetRenderBufferBytesPerPixel( m_RenderBufferFormat );
+	std::vector<BYTE> packed( numPixels * bytesPerPixel );
+	PackRenderBuffer( m_RenderBufferFormat, &reference[ 0 ], numPixels, &packed[ 0 ] );
+
+	std::vector<BYTE> rendered;
+	D3D11_TEXTURE2D_DESC renderBufferDesc;
+	if ( !ReadBackTexture( m_pImmediateContext, m_pRenderingBufferSRV, bytesPerPixel, rendered, renderBufferDesc ) )
+		return;
+
+	int numComparedPixels = 0;
+	int numErrors = 0;
+	for ( int y = 0; y < height; y++ )
+	{
+		for ( int x = 0; x < width; x++ )
+		{
+			int tile = ( y / lists.m_TileSize ) * lists.m_NumTilesX + x / lists.m_TileSize;
+			if ( !shadingRates.empty() && ( (const UINT*)&shadingRates[ 0 ] )[ tile ] > 0 )
+				continue;
+
+			numComparedPixels++;
+
+			int pixel = y * width + x;
+			const BYTE* expected = &packed[ pixel * bytesPerPixel ];
+			const BYTE* actual = &rendered[ pixel * bytesPerPixel ];
+			if ( memcmp( expected, actual, bytesPerPixel ) == 0 )
+				continue;
+
+			DirectX::XMFLOAT4 a = UnpackRenderBufferPixel( m_RenderBufferFormat, expected );
+			DirectX::XMFLOAT4 b = UnpackRenderBufferPixel( m_RenderBufferFormat, actual );
+			float difference = std::max( std::max( fabsf( a.x - b.x ), fabsf( a.y - b.y ) ), std::max( fabsf( a.z - b.z ), fabsf( a.w - b.w ) ) );
+			if ( !( difference <= g_tiledRenderingTolerance ) )
+			{
+				numErrors++;
+			}
+		}
+	}
+
+	if ( numErrors )
+	{
+		char message[ 128 ];
+		sprintf_s( message, "GPUParticleSystem: %d of %d tiled renderer pixels don't match the CPU reference\n", numErrors, numComparedPixels );
+		OutputDebugStringA( message );
+	}
+	assert( numErrors <= numComparedPixels / g_tiledRenderingMaxErrorRatio );
+}
+#endif
+
+
+// Cull the particles into coarse bins to dramatically improve performance
+void GPUParticleSystem::CoarseCulling( CoarseCullingMode coarseCullingMode, int flags )
+{
+	AMDProfileEvent( AMD_PROFILE_BLUE, L"CoarseCulling" );
+
+	// Set the UAVs - first one is the index buffer that holds all the bins back to back. Second is the per-bin counters that keep track of the number of particles in each bin.
+	// The third is the per thread group counts used to lay out the bins, and the last is where each bin starts
+	UINT initialCounts[] = { (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1 };
+	ID3D11UnorderedAccessView* uavs[] = { m_pCoarseCullingBufferUAV, m_pCoarseCullingBufferCountersUAV, m_pCoarseBinGroupCountsUAV, m_pCoarseCullingBufferOffsetsUAV };
+	
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
+	
+	ID3D11ShaderResourceView* srvs[] = { m_pViewSpaceParticlePositionsSRV, m_pMaxRadiusBufferSRV, m_pAliveIndexBufferSRV, m_pCoarseBinDepthBoundsSRV };
+	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+	
+	m_pImmediateContext->CSSetConstantBuffers( 3, 1, &m_pActiveListConstantBuffer );
+	m_pImmediateContext->CSSetConstantBuffers( 5, 1, &m_pTilingConstantBuffer );
+
+	CoarseBinningMode binning = flags & PF_ScreenRectBinning ? ScreenRectBinning : PlaneBinning;
+	int numBins = g_NumCoarseTiles[ coarseCullingMode ][ 0 ] * g_NumCoarseTiles[ coarseCullingMode ][ 1 ];
+
+	// Count the particles each thread group puts in each bin, turn the counts into offsets, then write the particles out
+	m_pImmediateContext->CSSetShader( m_pCoarseBinCountCS[ binning ][ coarseCullingMode ], nullptr, 0 );
+	m_pImmediateContext->DispatchIndirect( m_pIndirectAliveArgsBuffer, ALIVE_ARGS_COARSE_CULLING * sizeof( UINT ) );
+
+	m_pImmediateContext->CSSetShader( m_pCoarseBinScanCS[ coarseCullingMode ], nullptr, 0 );
+	m_pImmediateContext->Dispatch( numBins, 1, 1 );
+
+	m_pImmediateContext->CSSetShader( m_pCoarseBinScatterCS[ binning ][ coarseCullingMode ], nullptr, 0 );
+	m_pImmediateContext->DispatchIndirect( m_pIndirectAliveArgsBuffer, ALIVE_ARGS_COARSE_CULLING * sizeof( UINT ) );
+	
+	ZeroMemory( uavs, sizeof( uavs ) );
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
+
+	ZeroMemory( srvs, sizeof( srvs ) );
+	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+
+	// Queue up a copy of the total number of entries so UpdateCoarseBinCapacity can check it once the GPU has caught up
+	D3D11_BOX box = { (UINT)( numBins * sizeof( UINT ) ), 0, 0, (UINT)( ( numBins + 1 ) * sizeof( UINT ) ), 1, 1 };
+	m_pImmediateContext->CopySubresourceRegion( m_pCoarseBinTotalReadback[ m_CoarseBinReadbackIndex ], 0, 0, 0, 0, m_pCoarseCullingBufferOffsets, 0, &box );
+	m_CoarseBinTotalPending[ m_CoarseBinReadbackIndex ] = true;
+	m_CoarseBinReadbackIndex = ( m_CoarseBinReadbackIndex + 1 ) % g_listTotalReadbackLatency;
+
+#if _DEBUG
+	if ( g_validateCoarseBinning && ( flags & PF_ScreenRectBinning ) )
+	{
+		CheckCoarseBins( coarseCullingMode );
+	}
+#endif
+}
+
+
+// Create the index buffer the coarse culling packs its bins into. On failure nothing is left behind and the capacity is zero, so the 
+// coarse culling drops every entry rather than writing through a null view
+bool GPUParticleSystem::CreateCoarseCullingBuffer( UINT capacity )
+{
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.ByteWidth = sizeof( UINT ) * capacity;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	HRESULT hr = m_pDevice->CreateBuffer( &desc, nullptr, &m_pCoarseCullingBuffer );
+
+	if ( SUCCEEDED( hr ) )
+	{
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uav;
+		ZeroMemory( &uav, sizeof( uav ) );
+		uav.Format = DXGI_FORMAT_R32_UINT;
+		uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		uav.Buffer.NumElements = capacity;
+		hr = m_pDevice->CreateUnorderedAccessView( m_pCoarseCullingBuffer, &uav, &m_pCoarseCullingBufferUAV );
+	}
+
+	if ( SUCCEEDED( hr ) )
+	{
+		D3D11_SHADER_RESOURCE_VIEW_DESC srv;
+		ZeroMemory( &srv, sizeof( srv ) );
+		srv.Format = DXGI_FORMAT_R32_UINT;
+		srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srv.Buffer.NumElements = capacity;
+		hr = m_pDevice->CreateShaderResourceView( m_pCoarseCullingBuffer, &srv, &m_pCoarseCullingBufferSRV );
+	}
+
+	if ( FAILED( hr ) )
+	{
+		DXUTTRACE( L"Failed to create a coarse culling buffer of %u entries\n", capacity );
+		ReleaseCoarseCullingBuffer();
+		return false;
+	}
+
+	DXUT_SetDebugName( m_pCoarseCullingBuffer, "CoarseCullingBuffer" );
+
+	m_CoarseBinCapacity = capacity;
+	m_tilingConstants.coarseBinCapacity = capacity;
+	return true;
+}
+
+
+void GPUParticleSystem::ReleaseCoarseCullingBuffer()
+{
+	SAFE_RELEASE( m_pCoarseCullingBufferUAV );
+	SAFE_RELEASE( m_pCoarseCullingBufferSRV );
+	SAFE_RELEASE( m_pCoarseCullingBuffer );
+
+	m_CoarseBinCapacity = 0;
+	m_tilingConstants.coarseBinCapacity = 0;
+}
+
+
+// Check the coarse culling totals that have made it back from the GPU and grow the index buffer if a frame needed more room than it 
+// had. Until then the fine culling skips the entries that didn't fit, so particles near the bottom right of the screen can go missing 
+// for a few frames
+void GPUParticleSystem::UpdateCoarseBinCapacity()
+{
+	UINT requiredCapacity = ReadBackListTotals( m_pCoarseBinTotalReadback, m_CoarseBinTotalPending );
+	if ( requiredCapacity > m_CoarseBinCapacity && m_CoarseBinCapacity < m_CoarseBinCapacityLimit )
+	{
+		// Leave some headroom so a slowly growing total doesn't reallocate every few frames. Every particle in every bin is the most 
+		// that can ever be needed
+		UINT maxCapacity = std::min( (UINT)m_MaxParticles * g_maxCoarseCullingTiles, m_CoarseBinCapacityLimit );
+		UINT capacity = std::min( requiredCapacity + requiredCapacity / 4, maxCapacity );
+
+		// Go back to the size that worked if the bigger buffer can't be created, and stop trying to grow it
+		UINT oldCapacity = m_CoarseBinCapacity;
+		ReleaseCoarseCullingBuffer();
+		if ( !CreateCoarseCullingBuffer( capacity ) )
+		{
+			m_CoarseBinCapacityLimit = oldCapacity;
+			CreateCoarseCullingBuffer( oldCapacity );
+		}
+	}
+}
+
+
+// Create the index buffer the fine-grained culling packs its tile lists into, and the scratch buffer the merge ping-pongs with. As 
+// with the coarse culling buffer, on failure nothing is left behind and the capacity is zero
+bool GPUParticleSystem::CreateTiledIndexBuffer( UINT capacity )
+{
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.ByteWidth = sizeof( UINT ) * capacity;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	HRESULT hr = m_pDevice->CreateBuffer( &desc, nullptr, &m_pTiledIndexBuffer );
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uav;
+	ZeroMemory( &uav, sizeof( uav ) );
+	uav.Format = DXGI_FORMAT_R32_UINT;
+	uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uav.Buffer.NumElements = capacity;
+
+	if ( SUCCEEDED( hr ) )
+	{
+		hr = m_pDevice->CreateUnorderedAccessView( m_pTiledIndexBuffer, &uav, &m_pTiledIndexBufferUAV );
+	}
+
+	if ( SUCCEEDED( hr ) )
+	{
+		D3D11_SHADER_RESOURCE_VIEW_DESC srv;
+		ZeroMemory( &srv, sizeof( srv ) );
+		srv.Format = DXGI_FORMAT_R32_UINT;
+		srv.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		srv.Buffer.NumElements = capacity;
+		hr = m_pDevice->CreateShaderResourceView( m_pTiledIndexBuffer, &srv, &m_pTiledIndexBufferSRV );
+	}
+
+	// The merge scratch only needs the UAV
+	if ( SUCCEEDED( hr ) )
+	{
+		desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+		hr = m_pDevice->CreateBuffer( &desc, nullptr, &m_pTileListScratch );
+	}
+
+	if ( SUCCEEDED( hr ) )
+	{
+		hr = m_pDevice->CreateUnorderedAccessView( m_pTileListScratch, &uav, &m_pTileListScratchUAV );
+	}
+
+	if ( FAILED( hr ) )
+	{
+		DXUTTRACE( L"Failed to create a tiled index buffer of %u entries\n", capacity );
+		ReleaseTiledIndexBuffer();
+		return false;
+	}
+
+	DXUT_SetDebugName( m_pTiledIndexBuffer, "TiledIndexBuffer" );
+	DXUT_SetDebugName( m_pTileListScratch, "TileListScratch" );
+
+	m_TileListCapacity = capacity;
+	m_tilingConstants.tileListCapacity = capacity;
+	return true;
+}
+
+
+void GPUParticleSystem::ReleaseTiledIndexBuffer()
+{
+	SAFE_RELEASE( m_pTiledIndexBufferUAV );
+	SAFE_RELEASE( m_pTiledIndexBufferSRV );
+	SAFE_RELEASE( m_pTiledIndexBuffer );
+	SAFE_RELEASE( m_pTileListScratchUAV );
+	SAFE_RELEASE( m_pTileListScratch );
+
+	m_TileListCapacity = 0;
+	m_tilingConstants.tileListCapacity = 0;
+}
+
+
+// The render buffer is a texture the size of the screen rather than a buffer, so tiles that hang off the edge of the screen don't 
+// need padding and the UAV store does the conversion to the format
+void GPUParticleSystem::CreateRenderBuffer()
+{
+	HRESULT hr;
+
+	D3D11_TEXTURE2D_DESC TextureDesc;
+	ZeroMemory( &TextureDesc, sizeof( TextureDesc ) );
+	TextureDesc.Width = m_uWidth;
+	TextureDesc.Height = m_uHeight;
+	TextureDesc.MipLevels = 1;
+	TextureDesc.ArraySize = 1;
+	TextureDesc.Format = GetRenderBufferDXGIFormat( m_RenderBufferFormat );
+	TextureDesc.SampleDesc.Count = 1;
+	TextureDesc.Usage = D3D11_USAGE_DEFAULT;
+	TextureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	V( m_pDevice->CreateTexture2D( &TextureDesc, nullptr, &m_pRenderingBuffer ) );
+	DXUT_SetDebugName( m_pRenderingBuffer, "RenderingBuffer" );
 
-	SAFE_RELEASE( m_pAliveIndexBufferUAV );
-	SAFE_RELEASE( m_pAliveIndexBufferSRV );
-	SAFE_RELEASE( m_pAliveIndexBuffer );
+	V( m_pDevice->CreateShaderResourceView( m_pRenderingBuffer, nullptr, &m_pRenderingBufferSRV ) );
+	V( m_pDevice->CreateUnorderedAccessView( m_pRenderingBuffer, nullptr, &m_pRenderingBufferUAV ) );
+}
 
-	SAFE_RELEASE( m_pDeadListUAV );
-	SAFE_RELEASE( m_pDeadListBuffer );
 
-	SAFE_RELEASE( m_pStridedCoarseCullingBufferUAV );
-	SAFE_RELEASE( m_pStridedCoarseCullingBufferSRV );
-	SAFE_RELEASE( m_pStridedCoarseCullingBuffer );
+void GPUParticleSystem::ReleaseRenderBuffer()
+{
+	SAFE_RELEASE( m_pRenderingBufferUAV );
+	SAFE_RELEASE( m_pRenderingBufferSRV );
+	SAFE_RELEASE( m_pRenderingBuffer );
+}
 
-	SAFE_RELEASE( m_pStridedCoarseCullingBufferCountersUAV );
-	SAFE_RELEASE( m_pStridedCoarseCullingBufferCountersSRV );
-	SAFE_RELEASE( m_pStridedCoarseCullingBufferCounters );
 
-	SAFE_RELEASE( m_pMaxRadiusBufferUAV );
-	SAFE_RELEASE( m_pMaxRadiusBufferSRV );
-	SAFE_RELEASE( m_pMaxRadiusBuffer );
+// Recreate the render buffer straight away if the swap chain already exists, otherwise it picks up the format when it is created
+void GPUParticleSystem::SetRenderBufferFormat( RenderBufferFormat format )
+{
+	if ( format == m_RenderBufferFormat )
+		return;
 
-	SAFE_RELEASE( m_pViewSpaceParticlePositionsUAV );
-	SAFE_RELEASE( m_pViewSpaceParticlePositionsSRV );
-	SAFE_RELEASE( m_pViewSpaceParticlePositions );
+	m_RenderBufferFormat = format;
 
-	SAFE_RELEASE( m_pParticleBufferB_UAV );
-	SAFE_RELEASE( m_pParticleBufferB );
+	if ( m_pRenderingBuffer )
+	{
+		ReleaseRenderBuffer();
+		CreateRenderBuffer();
+	}
+}
 
-	SAFE_RELEASE( m_pParticleBufferA_UAV );
-	SAFE_RELEASE( m_pParticleBufferA_SRV );
-	SAFE_RELEASE( m_pParticleBufferA );
-	
-	SAFE_RELEASE( m_pQuadPS );
-	SAFE_RELEASE( m_pQuadVS );
 
-	for ( int j = 0; j < NumQualityModes; j++ )
+// As UpdateCoarseBinCapacity, but for the tile lists. Until the buffer has grown the culling drops the entries that didn't fit, so 
+// particles in the tiles at the bottom right of the screen can go missing for a few frames. Once the buffer is at its largest they go 
+// missing for good, which is reported through the stats and the debug output
+void GPUParticleSystem::UpdateTileListCapacity()
+{
+	UINT requiredCapacity = ReadBackListTotals( m_pTileListTotalReadback, m_TileListTotalPending );
+	if ( requiredCapacity == 0 )
+		return;
+
+	if ( requiredCapacity > m_TileListCapacity && m_TileListCapacity < m_TileListCapacityLimit )
 	{
-		for ( int k = 0; k < NumStreakModes; k++ )
+		UINT capacity = std::min( requiredCapacity + requiredCapacity / 4, m_TileListCapacityLimit );
+
+		// Go back to the size that worked if the bigger buffers can't be created, and stop trying to grow them
+		UINT oldCapacity = m_TileListCapacity;
+		ReleaseTiledIndexBuffer();
+		if ( !CreateTiledIndexBuffer( capacity ) )
 		{
-			SAFE_RELEASE( m_pRasterizedPS[ j ][ k ] );
+			m_TileListCapacityLimit = oldCapacity;
+			CreateTiledIndexBuffer( oldCapacity );
 		}
 	}
-	for ( int k = 0; k < ARRAYSIZE( m_pGS ); k++ )
+
+	// Whatever still doesn't fit after growing, if the capacity was clamped or the buffers couldn't grow
+	int overflow = requiredCapacity > m_TileListCapacity ? (int)( requiredCapacity - m_TileListCapacity ) : 0;
+	if ( overflow > 0 && m_Stats.m_TileListOverflow == 0 )
 	{
-		SAFE_RELEASE( m_pGS[ k ] );
+		DXUTTRACE( L"The tile lists need %u entries but can hold at most %u, so particles are missing from the tiled renderer\n", requiredCapacity, m_TileListCapacity );
 	}
 
-	for ( int i = 0; i < NumStreakModes; i++ )
+	m_Stats.m_TileListOverflow = overflow;
+}
+
+
+// Pick the tile size for this frame from the newest tile density histogram that has made it back from the GPU
+void GPUParticleSystem::UpdateTileSize( int flags )
+{
+	// Go through the staging buffers oldest first so the newest histogram wins
+	UINT histogram[ NUM_TILE_DENSITY_BUCKETS ];
+	int histogramTileSize = -1;
+	for ( int i = 0; i < g_listTotalReadbackLatency; i++ )
 	{
-		for ( int j = 0; j < NumBillboardModes; j++ )
+		int slot = ( m_TileDensityReadbackIndex + i ) % g_listTotalReadbackLatency;
+		if ( !m_TileDensityPending[ slot ] )
+			continue;
+
+		// Don't wait for the GPU. Anything still in flight is picked up on a later frame
+		D3D11_MAPPED_SUBRESOURCE MappedResource;
+		if ( m_pImmediateContext->Map( m_pTileDensityReadback[ slot ], 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &MappedResource ) == S_OK )
 		{
-			SAFE_RELEASE( m_pVS[ i ][ j ] );
+			memcpy( histogram, MappedResource.pData, sizeof( histogram ) );
+			m_pImmediateContext->Unmap( m_pTileDensityReadback[ slot ], 0 );
+			m_TileDensityPending[ slot ] = false;
+			histogramTileSize = m_TileDensityTileSize[ slot ];
 		}
 	}
 
-	for ( int i = 0; i < NumBillboardModes; i++ )
+	if ( !( flags & PF_AdaptiveTileSize ) )
 	{
-		SAFE_RELEASE( m_pCSSimulate[ i ] );
+		SetTileSize( g_defaultTileSize );
+		return;
 	}
 
-	SAFE_RELEASE( m_pCSResetParticles );
-	SAFE_RELEASE( m_pCSInitDeadList );
-	SAFE_RELEASE( m_pCSEmit );
+	if ( histogramTileSize < 0 )
+		return;
 
-	for ( int i = 0; i < NumCoarseCullingModes; i++ )
+	// Nothing on screen, so keep the per-tile overhead down with the largest tiles
+	UINT numOccupiedTiles = 0;
+	for ( int i = 1; i < NUM_TILE_DENSITY_BUCKETS; i++ )
 	{
-		SAFE_RELEASE( m_pCoarseCullingCS[ i ] );
+		numOccupiedTiles += histogram[ i ];
 	}
 
-	SAFE_RELEASE( m_pTileComplexityCS );
-	
-	for ( int j = 0; j < NumQualityModes; j++ )
+	if ( numOccupiedTiles == 0 )
 	{
-		for ( int l = 0; l < NumStreakModes; l++ )
-		{
-			SAFE_RELEASE( m_pTiledRenderingCS[ j ][ l ] );
-		}
+		SetTileSize( g_numTileSizes - 1 );
+		return;
 	}
 
-	for ( int k = 0; k < NumZCullingModes; k++ )
+	// Find the longest list the percentile of the occupied tiles stay within. Bucket n holds lists of up to 2^n-1 particles
+	UINT percentileTiles = std::max( 1u, (UINT)( numOccupiedTiles * g_tileSizeDensityPercentile ) );
+	UINT numTiles = 0;
+	int bucket = 1;
+	for ( ; bucket < NUM_TILE_DENSITY_BUCKETS - 1; bucket++ )
+	{
+		numTiles += histogram[ bucket ];
+		if ( numTiles >= percentileTiles )
+			break;
+	}
+
+	float listLength = (float)( ( 1 << bucket ) - 1 );
+
+	// Assume the particles are small compared to the tiles, so the length of a tile's list scales with its area. Pick the largest 
+	// tiles that stay within the target, keeping the lists short enough to sort in a single run. Growing the tiles needs some headroom 
+	// so the choice doesn't flip back and forth. The smallest tiles are the fallback when nothing else fits, and lists too long for a 
+	// single run there are merged
+	float histogramTileArea = (float)( g_tileSizes[ histogramTileSize ] * g_tileSizes[ histogramTileSize ] );
+	int tileSize = 0;
+	for ( int i = g_numTileSizes - 1; i > 0; i-- )
 	{
-		for ( int l = 0; l < NumCullingModes; l++ )
+		float tileArea = (float)( g_tileSizes[ i ] * g_tileSizes[ i ] );
+		float target = (float)std::min( g_tileSizeTargetParticles, GetMaxSingleRunParticles( i ) );
+		if ( i > m_TileSize )
+			target *= 0.5f;
+		if ( listLength * tileArea / histogramTileArea <= target )
 		{
-			for ( int i = 0; i < 2; i++ )
-			{
-				SAFE_RELEASE( m_pCullingCS[ k ][ l ][ i ] );
-			}
+			tileSize = i;
+			break;
 		}
 	}
-	
-	SAFE_RELEASE( m_pEmitterConstantBuffer );
-	SAFE_RELEASE( m_pTilingConstantBuffer );
-
-	SAFE_RELEASE( m_pCompositeBlendState );
-	
-	m_SortLib.release();
 
-	m_ResetSystem = true;
+	SetTileSize( tileSize );
 }
 
 
-// Per-frame emission of particles into the GPU simulation
-void GPUParticleSystem::Emit( int numEmitters, const EmitterParams* emitters )
+// Set the fine-grained tile size and the number of tiles needed to cover the screen with it
+void GPUParticleSystem::SetTileSize( int tileSize )
 {
-	AMDProfileEvent( AMD_PROFILE_GREEN, L"Emission" );
-	
-	// Set resources but don't reset any atomic counters
-	ID3D11UnorderedAccessView* uavs[] = { m_pParticleBufferA_UAV, m_pParticleBufferB_UAV, m_pDeadListUAV };
-	UINT initialCounts[] = { (UINT)-1, (UINT)-1, (UINT)-1 };
-	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
+	m_TileSize = tileSize;
 
-	ID3D11Buffer* buffers[] = { m_pEmitterConstantBuffer, m_pDeadListConstantBuffer };
-	m_pImmediateContext->CSSetConstantBuffers( 1, ARRAYSIZE( buffers ), buffers );
+	int size = g_tileSizes[ tileSize ];
+	m_tilingConstants.tileResX = size;
+	m_tilingConstants.tileResY = size;
+	m_tilingConstants.numTilesX = align( m_uWidth, size ) / size;
+	m_tilingConstants.numTilesY = align( m_uHeight, size ) / size;
+}
 
-	ID3D11ShaderResourceView* srvs[] = { m_pRandomTextureSRV };
-	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
-	
-	m_pImmediateContext->CSSetShader( m_pCSEmit, nullptr, 0 );
 
-	// Run CS for each emitter
-	for ( int i = 0; i < numEmitters; i++ )
+// Return the largest of the list totals that have made it back from the GPU
+UINT GPUParticleSystem::ReadBackListTotals( ID3D11Buffer** readback, bool* pending )
+{
+	UINT total = 0;
+	for ( int i = 0; i < g_listTotalReadbackLatency; i++ )
 	{
-		const EmitterParams& emitter = emitters[ i ];
-	
-		if ( emitter.m_NumToEmit > 0 )
-		{	
-			// Update the emitter constant buffer
-			D3D11_MAPPED_SUBRESOURCE MappedResource;
-			m_pImmediateContext->Map( m_pEmitterConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource );
-			EmitterConstantBuffer* constants = (EmitterConstantBuffer*)MappedResource.pData;
-			constants->m_EmitterPosition = emitter.m_Position;
-			constants->m_EmitterVelocity = emitter.m_Velocity;
-			constants->m_MaxParticlesThisFrame = emitter.m_NumToEmit;
-			constants->m_ParticleLifeSpan = emitter.m_ParticleLifeSpan;
-			constants->m_StartSize = emitter.m_StartSize;
-			constants->m_EndSize = emitter.m_EndSize;
-			constants->m_PositionVariance = emitter.m_PositionVariance;
-			constants->m_VelocityVariance = emitter.m_VelocityVariance;
-			constants->m_Mass = emitter.m_Mass;
-			constants->m_Index = i;
-			constants->m_Streaks = emitter.m_Streaks ? 1 : 0;
-			constants->m_TextureIndex = emitter.m_TextureIndex;
-			m_pImmediateContext->Unmap( m_pEmitterConstantBuffer, 0 );
-		
-			// Copy the current number of dead particles into a CB so we know how many new particles are available to be spawned
-			m_pImmediateContext->CopyStructureCount( m_pDeadListConstantBuffer, 0, m_pDeadListUAV );
-		
-			// Dispatch enough thread groups to spawn the requested particles
-			int numThreadGroups = align( emitter.m_NumToEmit, 1024 ) / 1024;
-			m_pImmediateContext->Dispatch( numThreadGroups, 1, 1 );
+		if ( !pending[ i ] )
+			continue;
+
+		// Don't wait for the GPU. Anything still in flight is picked up on a later frame
+		D3D11_MAPPED_SUBRESOURCE MappedResource;
+		if ( m_pImmediateContext->Map( readback[ i ], 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &MappedResource ) == S_OK )
+		{
+			total = std::max( total, *(const UINT*)MappedResource.pData );
+			m_pImmediateContext->Unmap( readback[ i ], 0 );
+			pending[ i ] = false;
 		}
 	}
 
-#if _DEBUG
-	m_NumDeadParticlesAfterEmit = ReadCounter( m_pDeadListUAV );
-#endif
+	return total;
 }
 
 
-// Per-frame simulation step
-void GPUParticleSystem::Simulate( int flags, ID3D11ShaderResourceView* depthSRV )
+// Perform fine-grained culling. The culling tile size matches the tile size that we will be rendering with
+void GPUParticleSystem::CullParticlesIntoTiles( CoarseCullingMode coarseCullingMode, int flags )
 {
-	AMDProfileEvent( AMD_PROFILE_GREEN, L"Simulation" );
+	AMDProfileEvent( AMD_PROFILE_BLUE, L"Culling" );
 
-	// Set the UAVs and reset the alive index buffer's counter
-	ID3D11UnorderedAccessView* uavs[] = { m_pParticleBufferA_UAV, m_pParticleBufferB_UAV, m_pDeadListUAV, m_pAliveIndexBufferUAV, m_pViewSpaceParticlePositionsUAV, m_pMaxRadiusBufferUAV, m_pIndirectDrawArgsBufferUAV };
-	UINT initialCounts[] = { (UINT)-1, (UINT)-1, (UINT)-1, 0, (UINT)-1, (UINT)-1, (UINT)-1 };
-	
+	// Set the UAVs we are going to write to - the tile lists, the number of particles in each list, where each list starts, the 
+	// histogram of the list lengths, the rate each tile is shaded at and the scratch space for merging the lists
+	UINT initialCounts[] = { (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1 };
+	ID3D11UnorderedAccessView* uavs[] = { m_pTiledIndexBufferUAV, m_pTileListCountsUAV, m_pTileListOffsetsUAV, m_pTileDensityHistogramUAV, m_pTileShadingRatesUAV, m_pTileListScratchUAV };
 	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
 	
-	// Bind the depth buffer as a texture for doing collision detection and response
-	ID3D11ShaderResourceView* srvs[] = { depthSRV };
+	// Set the CS inputs
+	ID3D11ShaderResourceView* srvs[] = { m_pViewSpaceParticlePositionsSRV, m_pMaxRadiusBufferSRV, m_pAliveIndexBufferSRV, m_pTileDepthBoundsSRV, m_pCoarseCullingBufferSRV, m_pCoarseCullingBufferCountersSRV, m_pCoarseCullingBufferOffsetsSRV };
 	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
-
-	// Pick the correct CS based on the system's options
-	BillboardMode billboardMode = flags & PF_UseGeometryShader ? UseGS : UseVS;
 	
-	// Dispatch enough thread groups to update all the particles
-	m_pImmediateContext->CSSetShader( m_pCSSimulate[ billboardMode ], nullptr, 0 );
-	m_pImmediateContext->Dispatch( align( g_maxParticles, 256 ) / 256, 1, 1 );
+	m_pImmediateContext->CSSetConstantBuffers( 3, 1, &m_pActiveListConstantBuffer );
+	m_pImmediateContext->CSSetConstantBuffers( 5, 1, &m_pTilingConstantBuffer );
+		
+	// Pick the right shader based on the system options
+	ZCullingMode zculling = flags & PF_CullMaxZ ? CullMaxZ : NoZCulling;
+	CullingMode culling = flags & PF_ScreenSpaceCulling ? ScreenspaceCull : FrustumCull;
 
-	ZeroMemory( srvs, sizeof( srvs ) );
-	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+	int coarse = coarseCullingMode == CoarseCullingOff ? 0 : 1;
+
+	// Count the particles in each tile with a thread group per tile, lay the lists out with a single thread group, write them in 
+	// sorted runs, then merge the runs of the lists that didn't fit in LDS
+	m_pImmediateContext->CSSetShader( m_pCullingCountCS[ m_TileSize ][ zculling ][ culling ][ coarse ], nullptr, 0 );
+	m_pImmediateContext->Dispatch( m_tilingConstants.numTilesX, m_tilingConstants.numTilesY, 1 );
+
+	m_pImmediateContext->CSSetShader( m_pTileListScanCS, nullptr, 0 );
+	m_pImmediateContext->Dispatch( 1, 1, 1 );
+
+	m_pImmediateContext->CSSetShader( m_pCullingCS[ m_TileSize ][ zculling ][ culling ][ coarse ], nullptr, 0 );
+	m_pImmediateContext->Dispatch( m_tilingConstants.numTilesX, m_tilingConstants.numTilesY, 1 );
 
+	m_pImmediateContext->CSSetShader( m_pTileListMergeCS[ m_TileSize ], nullptr, 0 );
+	m_pImmediateContext->Dispatch( m_tilingConstants.numTilesX, m_tilingConstants.numTilesY, 1 );
+		
 	ZeroMemory( uavs, sizeof( uavs ) );
 	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
+
+	ZeroMemory( srvs, sizeof( srvs ) );
+	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+
+	// Queue up a copy of the total length of the lists so UpdateTileListCapacity can check it once the GPU has caught up
+	UINT numTiles = m_tilingConstants.numTilesX * m_tilingConstants.numTilesY;
+	D3D11_BOX box = { (UINT)( numTiles * sizeof( UINT ) ), 0, 0, (UINT)( ( numTiles + 1 ) * sizeof( UINT ) ), 1, 1 };
+	m_pImmediateContext->CopySubresourceRegion( m_pTileListTotalReadback[ m_TileListReadbackIndex ], 0, 0, 0, 0, m_pTileListOffsets, 0, &box );
+	m_TileListTotalPending[ m_TileListReadbackIndex ] = true;
+	m_TileListReadbackIndex = ( m_TileListReadbackIndex + 1 ) % g_listTotalReadbackLatency;
+
+	// And the same for the tile density histogram, remembering which tile size it was built at
+	m_pImmediateContext->CopyResource( m_pTileDensityReadback[ m_TileDensityReadbackIndex ], m_pTileDensityHistogram );
+	m_TileDensityPending[ m_TileDensityReadbackIndex ] = true;
+	m_TileDensityTileSize[ m_TileDensityReadbackIndex ] = m_TileSize;
+	m_TileDensityReadbackIndex = ( m_TileDensityReadbackIndex + 1 ) % g_listTotalReadbackLatency;
 }
 
 
-// Helper function to read atomic UAV counters back onto the CPU. This will cause a stall so only use in debug
-#if _DEBUG
-int	GPUParticleSystem::ReadCounter( ID3D11UnorderedAccessView* uav )
+// Find the nearest and furthest view space depth of the opaque scene in each culling tile, and then from those in each coarse bin
+void GPUParticleSystem::ComputeDepthBounds( ID3D11ShaderResourceView* depthSRV )
 {
-	int count = 0;
+	AMDProfileEvent( AMD_PROFILE_BLUE, L"DepthBounds" );
 
-	// Copy the UAV counter to a staging resource
-	m_pImmediateContext->CopyStructureCount( m_pDebugCounterBuffer, 0, uav );
-	
-	// Map the staging resource
-	D3D11_MAPPED_SUBRESOURCE MappedResource;
-	m_pImmediateContext->Map( m_pDebugCounterBuffer, 0, D3D11_MAP_READ, 0, &MappedResource );
-	
-	// Read the data
-	count = *(int*)MappedResource.pData;
+	UINT initialCounts[] = { (UINT)-1, (UINT)-1 };
+	ID3D11UnorderedAccessView* uavs[] = { m_pTileDepthBoundsUAV, m_pCoarseBinDepthBoundsUAV };
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
 
-	m_pImmediateContext->Unmap( m_pDebugCounterBuffer, 0 );
+	ID3D11ShaderResourceView* srvs[] = { depthSRV };
+	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
 
-	return count;
+	m_pImmediateContext->CSSetConstantBuffers( 5, 1, &m_pTilingConstantBuffer );
+
+	// A thread group per tile, then one per bin if there are any
+	m_pImmediateContext->CSSetShader( m_pTileDepthBoundsCS, nullptr, 0 );
+	m_pImmediateContext->Dispatch( m_tilingConstants.numTilesX, m_tilingConstants.numTilesY, 1 );
+
+	UINT numBins = m_tilingConstants.numCoarseCullingTilesX * m_tilingConstants.numCoarseCullingTilesY;
+	if ( numBins > 0 )
+	{
+		m_pImmediateContext->CSSetShader( m_pCoarseBinDepthBoundsCS, nullptr, 0 );
+		m_pImmediateContext->Dispatch( numBins, 1, 1 );
+	}
+
+	m_pImmediateContext->CSSetShader( nullptr, nullptr, 0 );
+
+	ZeroMemory( uavs, sizeof( uavs ) );
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
+
+	ZeroMemory( srvs, sizeof( srvs ) );
+	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
 }
-#endif
 
 
-// Cull the particles into coarse bins to dramatically improve performance
-void GPUParticleSystem::CoarseCulling( CoarseCullingMode coarseCullingMode )
+// Take the max of the opaque scene's depth over each 2x2 and 4x4 block for the tiles that are shaded at half or quarter rate
+void GPUParticleSystem::DownsampleDepth( ID3D11ShaderResourceView* depthSRV )
 {
-	AMDProfileEvent( AMD_PROFILE_BLUE, L"CoarseCulling" );
+	AMDProfileEvent( AMD_PROFILE_BLUE, L"DownsampleDepth" );
 
-	// Set the UAVs - first one is the index buffer that is divided into n bins. Second is the per-bin counters that keep track of the number of particles in each bin
 	UINT initialCounts[] = { (UINT)-1, (UINT)-1 };
-	ID3D11UnorderedAccessView* uavs[] = { m_pStridedCoarseCullingBufferUAV, m_pStridedCoarseCullingBufferCountersUAV };
-	
+	ID3D11UnorderedAccessView* uavs[] = { m_pLowResDepthUAV[ 0 ], m_pLowResDepthUAV[ 1 ] };
 	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
-	
-	ID3D11ShaderResourceView* srvs[] = { m_pViewSpaceParticlePositionsSRV, m_pMaxRadiusBufferSRV, m_pAliveIndexBufferSRV,  };
+
+	ID3D11ShaderResourceView* srvs[] = { depthSRV };
 	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
-	
-	m_pImmediateContext->CSSetConstantBuffers( 3, 1, &m_pActiveListConstantBuffer );
 
-	m_pImmediateContext->CSSetShader( m_pCoarseCullingCS[ coarseCullingMode ], nullptr, 0 );
-	m_pImmediateContext->Dispatch( align( g_maxParticles, COARSE_CULLING_THREADS ) / COARSE_CULLING_THREADS, 1, 1 );		// Could use DispatchIndirect based on number of alive particles
-	
+	// A thread per quarter resolution texel
+	m_pImmediateContext->CSSetShader( m_pDownsampleDepthCS, nullptr, 0 );
+	m_pImmediateContext->Dispatch( align( align( m_uWidth, 4 ) / 4, LOW_RES_DEPTH_THREADS ) / LOW_RES_DEPTH_THREADS, align( align( m_uHeight, 4 ) / 4, LOW_RES_DEPTH_THREADS ) / LOW_RES_DEPTH_THREADS, 1 );
+	m_pImmediateContext->CSSetShader( nullptr, nullptr, 0 );
+
 	ZeroMemory( uavs, sizeof( uavs ) );
 	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
 
@@ -1279,51 +3334,132 @@ void GPUParticleSystem::CoarseCulling( CoarseCullingMode coarseCullingMode )
 }
 
 
-// Perform fine-grained culling. The culling tile size matches the tile size that we will be rendering with
-void GPUParticleSystem::CullParticlesIntoTiles( CoarseCullingMode coarseCullingMode, int flags, ID3D11ShaderResourceView* depthSRV )
+// Build the Hi-Z pyramid from the opaque scene's depth. Each level takes the max over 2x2 texels of the one before, starting from 
+// the depth buffer
+void GPUParticleSystem::BuildHiZ( ID3D11ShaderResourceView* depthSRV )
 {
-	AMDProfileEvent( AMD_PROFILE_BLUE, L"Culling" );
+	AMDProfileEvent( AMD_PROFILE_BLUE, L"BuildHiZ" );
+
+	D3D11_TEXTURE2D_DESC desc;
+	m_pHiZ->GetDesc( &desc );
+
+	m_pImmediateContext->CSSetShader( m_pDownsampleHiZCS, nullptr, 0 );
 
-	// Set the UAV we are going to write to
 	UINT initialCounts[] = { (UINT)-1 };
-	ID3D11UnorderedAccessView* uavs[] = { m_pTiledIndexBufferUAV };
+	ID3D11UnorderedAccessView* uavs[] = { nullptr };
+	ID3D11ShaderResourceView* srvs[] = { nullptr };
+
+	for ( int i = 0; i < m_NumHiZLevels; i++ )
+	{
+		// Bind the output first, as binding the level before as an input while it is still the bound output would be dropped
+		uavs[ 0 ] = m_pHiZLevelUAV[ i ];
+		m_pImmediateContext->CSSetUnorderedAccessViews( 2, ARRAYSIZE( uavs ), uavs, initialCounts );
+
+		srvs[ 0 ] = i == 0 ? depthSRV : m_pHiZLevelSRV[ i - 1 ];
+		m_pImmediateContext->CSSetShaderResources( 1, ARRAYSIZE( srvs ), srvs );
+
+		// A thread per texel of the level
+		UINT levelWidth = std::max( desc.Width >> i, 1u );
+		UINT levelHeight = std::max( desc.Height >> i, 1u );
+		m_pImmediateContext->Dispatch( align( levelWidth, HIZ_THREADS ) / HIZ_THREADS, align( levelHeight, HIZ_THREADS ) / HIZ_THREADS, 1 );
+	}
+
+	m_pImmediateContext->CSSetShader( nullptr, nullptr, 0 );
+
+	ZeroMemory( uavs, sizeof( uavs ) );
+	m_pImmediateContext->CSSetUnorderedAccessViews( 2, ARRAYSIZE( uavs ), uavs, nullptr );
+
+	ZeroMemory( srvs, sizeof( srvs ) );
+	m_pImmediateContext->CSSetShaderResources( 1, ARRAYSIZE( srvs ), srvs );
+}
+
+
+// Cull the sorted alive list against the Hi-Z pyramid. The survivors are compacted in order into the visible index buffer and the 
+// draw args are rewritten to draw only them
+void GPUParticleSystem::OcclusionCull( ID3D11ShaderResourceView* depthSRV, BillboardMode billboardMode )
+{
+	BuildHiZ( depthSRV );
+
+	AMDProfileEvent( AMD_PROFILE_BLUE, L"OcclusionCull" );
+
+	UINT initialCounts[] = { (UINT)-1, (UINT)-1, (UINT)-1, (UINT)-1 };
+	ID3D11UnorderedAccessView* uavs[] = { m_pVisibilityMasksUAV, m_pVisibleGroupOffsetsUAV, m_pVisibleIndexBufferUAV, m_pIndirectDrawArgsBufferUAV };
 	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
-	
-	// Set the CS inputs
-	ID3D11ShaderResourceView* srvs[] = { m_pViewSpaceParticlePositionsSRV, m_pMaxRadiusBufferSRV, m_pAliveIndexBufferSRV, depthSRV, m_pStridedCoarseCullingBufferSRV, m_pStridedCoarseCullingBufferCountersSRV };
+
+	ID3D11ShaderResourceView* srvs[] = { m_pViewSpaceParticlePositionsSRV, m_pMaxRadiusBufferSRV, m_pAliveIndexBufferSRV, m_pHiZSRV };
 	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
-	
+
 	m_pImmediateContext->CSSetConstantBuffers( 3, 1, &m_pActiveListConstantBuffer );
-	m_pImmediateContext->CSSetConstantBuffers( 5, 1, &m_pTilingConstantBuffer );
-		
-	// Pick the right shader based on the system options
-	ZCullingMode zculling = flags & PF_CullMaxZ ? CullMaxZ : NoZCulling;
-	CullingMode culling = flags & PF_ScreenSpaceCulling ? ScreenspaceCull : FrustumCull;
 
-	m_pImmediateContext->CSSetShader( m_pCullingCS[ zculling ][ culling ][ coarseCullingMode == CoarseCullingOff ? 0 : 1 ], nullptr, 0 );
+	// A thread per alive particle to test them, a single group to turn the per-group counts into offsets, then a thread per alive 
+	// particle again to write out the survivors
+	m_pImmediateContext->CSSetShader( m_pOcclusionCullCS, nullptr, 0 );
+	m_pImmediateContext->DispatchIndirect( m_pIndirectAliveArgsBuffer, ALIVE_ARGS_OCCLUSION_CULLING * sizeof( UINT ) );
+
+	m_pImmediateContext->CSSetShader( m_pOcclusionCullScanCS[ billboardMode ], nullptr, 0 );
+	m_pImmediateContext->Dispatch( 1, 1, 1 );
+
+	m_pImmediateContext->CSSetShader( m_pOcclusionCullCompactCS, nullptr, 0 );
+	m_pImmediateContext->DispatchIndirect( m_pIndirectAliveArgsBuffer, ALIVE_ARGS_OCCLUSION_CULLING * sizeof( UINT ) );
+
+	m_pImmediateContext->CSSetShader( nullptr, nullptr, 0 );
 
-	// Dispatch a thread group per tile
-	m_pImmediateContext->Dispatch( m_tilingConstants.numTilesX, m_tilingConstants.numTilesY, 1 );
-		
 	ZeroMemory( uavs, sizeof( uavs ) );
 	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
 
 	ZeroMemory( srvs, sizeof( srvs ) );
 	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+
+#if _DEBUG
+	if ( g_validateOcclusionCulling )
+	{
+		CheckOcclusionCulling();
+	}
+#endif
+}
+
+
+// Find the lowest alpha in the core of each texture in the particle atlas. The atlas is bound by the application for the tiled 
+// renderer, so this is cheap enough to do every frame rather than track when it changes
+void GPUParticleSystem::MeasureAtlasOpacity()
+{
+	AMDProfileEvent( AMD_PROFILE_BLUE, L"MeasureAtlasOpacity" );
+
+	UINT initialCounts[] = { (UINT)-1 };
+	ID3D11UnorderedAccessView* uavs[] = { m_pAtlasCoreOpacityUAV };
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
+
+	// A thread group per texture
+	m_pImmediateContext->CSSetShader( m_pAtlasOpacityCS, nullptr, 0 );
+	m_pImmediateContext->Dispatch( NUM_ATLAS_SLOTS, 1, 1 );
+	m_pImmediateContext->CSSetShader( nullptr, nullptr, 0 );
+
+	ZeroMemory( uavs, sizeof( uavs ) );
+	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
 }
 
 
 // Do the tiled rendering using a compute shader
 void GPUParticleSystem::FillRenderBuffer( int flags, ID3D11ShaderResourceView* depthSRV, Technique technique )
 {
+	// The tiles that are shaded at a lower rate use the downsampled depth
+	if ( m_tilingConstants.maxShadingRate > 0 )
+	{
+		DownsampleDepth( depthSRV );
+	}
+
 	// Set the UAV that we will write the shaded particle pixels to
 	UINT initialCounts[] = { (UINT)-1 };
 	ID3D11UnorderedAccessView* uavs[] = { m_pRenderingBufferUAV };
 	m_pImmediateContext->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, initialCounts );
 	
 	// Set the shader inputs. Note that the coarse culling buffer isn't required for tiled rendering, but we pass it through for the debug visualization 
-	ID3D11ShaderResourceView* srvs[] = { m_pParticleBufferA_SRV, m_pViewSpaceParticlePositionsSRV, depthSRV, m_pTiledIndexBufferSRV, m_pStridedCoarseCullingBufferCountersSRV };
+	ID3D11ShaderResourceView* srvs[] = { m_pParticleBufferA_SRV, m_pViewSpaceParticlePositionsSRV, depthSRV, m_pTiledIndexBufferSRV, m_pCoarseCullingBufferCountersSRV, m_pTileListCountsSRV };
 	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+
+	// Slot 6 holds the particle texture so the tile list offsets, the shading rates and the low resolution depth go after it
+	ID3D11ShaderResourceView* tileSRVs[] = { m_pTileListOffsetsSRV, m_pTileShadingRatesSRV, m_pLowResDepthSRV[ 0 ], m_pLowResDepthSRV[ 1 ] };
+	m_pImmediateContext->CSSetShaderResources( 7, ARRAYSIZE( tileSRVs ), tileSRVs );
 	
 	m_pImmediateContext->CSSetConstantBuffers( 3, 1, &m_pActiveListConstantBuffer );
 	m_pImmediateContext->CSSetConstantBuffers( 5, 1, &m_pTilingConstantBuffer );
@@ -1337,8 +3473,8 @@ void GPUParticleSystem::FillRenderBuffer( int flags, ID3D11ShaderResourceView* d
 	ID3D11ComputeShader* shader = nullptr;
 	switch ( technique )
 	{
-		case Technique_Overdraw: shader = m_pTileComplexityCS; break;
-		case Technique_Tiled: shader = m_pTiledRenderingCS[ quality ][ streaks ]; break;
+		case Technique_Overdraw: shader = m_pTileComplexityCS[ m_TileSize ]; break;
+		case Technique_Tiled: shader = m_pTiledRenderingCS[ m_TileSize ][ quality ][ streaks ]; break;
 	}
 
 	m_pImmediateContext->CSSetShader( shader, nullptr, 0 );
@@ -1352,11 +3488,21 @@ void GPUParticleSystem::FillRenderBuffer( int flags, ID3D11ShaderResourceView* d
 
 	ZeroMemory( srvs, sizeof( srvs ) );
 	m_pImmediateContext->CSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+
+	ZeroMemory( tileSRVs, sizeof( tileSRVs ) );
+	m_pImmediateContext->CSSetShaderResources( 7, ARRAYSIZE( tileSRVs ), tileSRVs );
+
+#if _DEBUG
+	if ( g_validateTiledRendering && technique == Technique_Tiled )
+	{
+		CheckTiledRendering( flags, depthSRV );
+	}
+#endif
 }
 
 
-// Function to write the UAV back on to the scene render target
-void GPUParticleSystem::RenderQuad()
+// Function to write the UAV back on to the scene render target. Tiles that were shaded at a lower rate are upsampled using the depth
+void GPUParticleSystem::RenderQuad( ID3D11ShaderResourceView* depthSRV )
 {
 	AMDProfileEvent( AMD_PROFILE_BLUE, L"RenderQuad" );
 	
@@ -1371,9 +3517,10 @@ void GPUParticleSystem::RenderQuad()
 	m_pImmediateContext->IASetIndexBuffer( nullptr, DXGI_FORMAT_UNKNOWN, 0 );
 	m_pImmediateContext->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
 
-	// Bind the tiled UAV to the pixel shader
-	ID3D11ShaderResourceView* srvs[] = { m_pRenderingBufferSRV };
+	// Bind the tiled UAV to the pixel shader along with what it needs to upsample the low resolution tiles
+	ID3D11ShaderResourceView* srvs[] = { m_pRenderingBufferSRV, m_pTileShadingRatesSRV, depthSRV, m_pLowResDepthSRV[ 0 ], m_pLowResDepthSRV[ 1 ] };
 	m_pImmediateContext->PSSetShaderResources( 0, ARRAYSIZE( srvs ), srvs );
+	m_pImmediateContext->PSSetConstantBuffers( 5, 1, &m_pTilingConstantBuffer );
 
 	// Draw one large triangle
 	m_pImmediateContext->Draw( 3, 0 );
@@ -1383,49 +3530,4 @@ void GPUParticleSystem::RenderQuad()
 
 	// Restore the default blend state
 	m_pImmediateContext->OMSetBlendState( nullptr, nullptr, 0xffffffff );
-}
-
-
-// Populate a texture with random numbers (used for the emission of particles)
-void GPUParticleSystem::FillRandomTexture()
-{
-	D3D11_TEXTURE2D_DESC desc;
-	ZeroMemory( &desc, sizeof( desc ) );
-	desc.Width = 1024;
-	desc.Height = 1024;
-	desc.ArraySize = 1;
-	desc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-	desc.Usage = D3D11_USAGE_IMMUTABLE;
-	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-	desc.MipLevels = 1;
-	desc.SampleDesc.Count = 1;
-	desc.SampleDesc.Quality = 0;
-	
-	float* values = new float[ desc.Width * desc.Height * 4 ];
-	float* ptr = values;
-	for ( UINT i = 0; i < desc.Width * desc.Height; i++ )
-	{
-		ptr[ 0 ] = RandomVariance( 0.0f, 1.0f );
-		ptr[ 1 ] = RandomVariance( 0.0f, 1.0f );
-		ptr[ 2 ] = RandomVariance( 0.0f, 1.0f );
-		ptr[ 3 ] = RandomVariance( 0.0f, 1.0f );
-		ptr += 4;
-	}
-
-	D3D11_SUBRESOURCE_DATA data;
-	data.pSysMem = values;
-	data.SysMemPitch = desc.Width * 16;
-	data.SysMemSlicePitch = 0; 
-
-	m_pDevice->CreateTexture2D( &desc, &data, &m_pRandomTexture );
-		
-	delete[] values;
-
-	D3D11_SHADER_RESOURCE_VIEW_DESC srv;
-	srv.Format = desc.Format;
-	srv.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	srv.Texture2D.MipLevels = 1;
-	srv.Texture2D.MostDetailedMip = 0;
-	
-	m_pDevice->CreateShaderResourceView( m_pRandomTexture, &srv, &m_pRandomTextureSRV );
 }
\ No newline at end of file
@@ -34,49 +34,14 @@
 #include "resource.h"
 #include "ParticleSystem.h"
 #include "ParticleHelpers.h"
+#include "ParticleFormat.h"
+#include "ParticleTrace.h"
+#include "Benchmark.h"
 #include "Terrain.h"
 #include "Shaders/ShaderConstants.h"
 
 #pragma warning( disable : 4100 ) // disable unreference formal parameter warnings for /W4 builds
 
-// Parameters that only change ONCE per frame
-struct PER_FRAME_CONSTANT_BUFFER
-{
-	DirectX::XMVECTOR	m_StartColor[ NUM_EMITTERS ];
-	DirectX::XMVECTOR	m_EndColor[ NUM_EMITTERS ];
-	DirectX::XMVECTOR	m_EmitterLightingCenter[ NUM_EMITTERS ];
-
-	DirectX::XMMATRIX	m_ViewProjection;
-	DirectX::XMMATRIX	m_ViewProjInv;
-	DirectX::XMMATRIX	m_View;
-	DirectX::XMMATRIX	m_ViewInv;
-	DirectX::XMMATRIX	m_Projection;
-	DirectX::XMMATRIX	m_ProjectionInv;
-	
-	DirectX::XMVECTOR	m_EyePosition;
-	DirectX::XMVECTOR	m_SunDirection;
-	DirectX::XMVECTOR	m_SunColor;
-	DirectX::XMVECTOR	m_AmbientColor;
-
-	DirectX::XMVECTOR	m_SunDirectionVS;
-	DirectX::XMVECTOR	pads2[ 3 ];
-
-	float				m_FrameTime;
-	int					m_ScreenWidth;
-	int					m_ScreenHeight;
-	int					m_FrameIndex;
-	
-	float				m_AlphaThreshold;
-	float				m_CollisionThickness;
-	float				m_ElapsedTime;
-	int					m_CollisionsEnabled;
-
-	int					m_ShowSleepingParticles;
-	int					m_EnableSleepState;
-	int					pads[ 2 ];
-	
-};
-
 //--------------------------------------------------------------------------------------
 // Global variables
 //--------------------------------------------------------------------------------------
@@ -129,8 +94,24 @@ ID3D11PixelShader*						g_pQuadPS = nullptr;
 ID3D11Buffer*							g_pPerFrameConstantBuffer = nullptr;
 PER_FRAME_CONSTANT_BUFFER				g_GlobalConstantBuffer;
 
-// The particle system itself
+// The particle systems. The active one is selected in the UI
 IParticleSystem*						g_pGPUParticleSystem = nullptr;
+IParticleSystem*						g_pCPUParticleSystem = nullptr;
+IParticleSystem*						g_pParticleSystem = nullptr;
+
+// The storage layout for the particle data. This is fixed when the particle systems are created, so it is picked with -layout:soa or 
+// -layout:compact on the command line
+IParticleSystem::Layout					g_ParticleLayout = IParticleSystem::Layout_AoS;
+
+// Sort the GPU system's alive list as packed uint keys rather than float2s. Also fixed when the particle systems are created, and 
+// turned on with -packedsortkeys
+bool									g_PackedSortKeys = false;
+
+// The selectable particle capacities. Both systems are resized together and keep their alive particles where they fit
+const int								g_MaxParticleOptions[] = { 64 * 1024, 128 * 1024, 256 * 1024, 400 * 1024, 512 * 1024, 1024 * 1024 };
+const wchar_t*							g_MaxParticleNames[] = { L"64K Particles", L"128K Particles", L"256K Particles", L"400K Particles", L"512K Particles", L"1M Particles" };
+int										g_MaxParticlesIndex = 3;
+CDXUTComboBox*							g_MaxParticlesCombo = nullptr;
 
 // The texture atlas for the particles
 ID3D11ShaderResourceView*				g_pTextureAtlas = nullptr;
@@ -167,7 +148,10 @@ IParticleSystem::EmitterParams			g_VolcanoSparksEmitter;
 IParticleSystem::EmitterParams			g_VolcanoSmokeEmitter;
 
 IParticleSystem::EmitterParams			g_TankSmokeEmitters[ 2 ];
-EmissionRate							g_EmissionRates[ NUM_EMITTERS ];
+
+// The most emitters a scene sends to the particle system in one frame, counting the collision test emitter
+const int								g_MaxFrameEmitters = 4;
+EmissionRate							g_EmissionRates[ g_MaxFrameEmitters ];
 
 IParticleSystem::EmitterParams			g_CollisionTestEmitter;
 bool									g_SpawnCollisionTestParticles = false;
@@ -255,10 +239,18 @@ int							g_AlphaThreshold = 97;
 CDXUTCheckBox*				g_DepthBufferCollisionsCheckBox = nullptr;
 CDXUTCheckBox*				g_CullMaxZCheckBox = nullptr;
 CDXUTCheckBox*				g_CullInScreenSpaceCheckBox = nullptr;
+CDXUTCheckBox*				g_AdaptiveTileSizeCheckBox = nullptr;
+CDXUTCheckBox*				g_LowResolutionCheckBox = nullptr;
+CDXUTCheckBox*				g_OpacityCullingCheckBox = nullptr;
+CDXUTCheckBox*				g_ScreenRectBinningCheckBox = nullptr;
 CDXUTCheckBox*				g_SortCheckBox = nullptr;
+CDXUTCheckBox*				g_RadixSortCheckBox = nullptr;
+CDXUTCheckBox*				g_TemporalSortCheckBox = nullptr;
 CDXUTCheckBox*				g_SupportStreaksCheckBox = nullptr;
 CDXUTCheckBox*				g_UseGeometryShaderCheckBox = nullptr;
+CDXUTCheckBox*				g_OcclusionCullingCheckBox = nullptr;
 CDXUTCheckBox*				g_PauseCheckBox = nullptr;
+CDXUTCheckBox*				g_CPUSimulationCheckBox = nullptr;
 
 AMD::Slider*				g_CollisionThicknessSlider = nullptr;
 int							g_CollisionThickness = 40;
@@ -280,6 +272,17 @@ LightingMode							g_LightingMode = FullLighting;
 CDXUTComboBox*							g_CoarseCullingCombo = nullptr;
 IParticleSystem::CoarseCullingMode		g_CoarseCullingMode = IParticleSystem::CoarseCulling8x8;
 
+// The emitter table entries the sample has set, kept here so they can be recorded
+std::vector<IParticleSystem::EmitterProperties>	g_EmitterProperties;
+
+// Frame recording and replay. See the -record and -benchmark command line options
+ParticleTraceFrame						g_FrameInput;
+ParticleTraceWriter						g_TraceWriter;
+ParticleTraceReader						g_TraceReader;
+Benchmark								g_Benchmark;
+bool									g_Benchmarking = false;
+bool									g_UseWARPDevice = false;
+
 
 
 //--------------------------------------------------------------------------------------
@@ -299,12 +302,18 @@ enum
 	IDC_TOGGLEFULLSCREEN = 1,
 	IDC_CHANGEDEVICE,
 	IDC_PAUSE,
+	IDC_CPU_SIMULATION,
+	IDC_MAX_PARTICLES_LABEL,
+	IDC_MAX_PARTICLES,
 
 	IDC_SCENE_LABEL,
 	IDC_SCENE,
 
 	IDC_SORT,
+	IDC_RADIX_SORT,
+	IDC_TEMPORAL_SORT,
 	IDC_USE_GEOMETRY_SHADER,
+	IDC_OCCLUSION_CULLING,
 
 	IDC_TECHNIQUE_LABEL,
 	IDC_TECHNIQUE,
@@ -318,10 +327,14 @@ enum
 	IDC_LIGHTING_MODE,
 	IDC_CULL_MAXZ,
 	IDC_CULL_SCREENSPACE,
+	IDC_ADAPTIVE_TILE_SIZE,
+	IDC_LOW_RESOLUTION,
+	IDC_OPACITY_CULLING,
 	IDC_SUPPORT_STREAKS,
 
 	IDC_COARSE_CULLING_LABEL,
 	IDC_COARSE_CULLING,
+	IDC_SCREEN_RECT_BINNING,
 
 	IDC_COLLISIONS_ENABLED,
 	IDC_COLLISION_THICKNESS,
@@ -358,6 +371,11 @@ HRESULT AddShadersToCache();
 void ChangeScene();
 void PopulateEmitters( int& numEmitters, IParticleSystem::EmitterParams* emitters, int maxEmitters, float frameTime );
 void DoCollisionTest();
+void SetEmitterProperties( int emitter, DirectX::FXMVECTOR startColor, DirectX::FXMVECTOR endColor, DirectX::FXMVECTOR lightingCenter );
+void SetEmitterProperties( int emitter, const IParticleSystem::EmitterProperties& properties );
+void GatherFrameInput( float frameTime, float elapsedTime );
+void ReplayFrameInput( const ParticleTraceFrame& frame );
+int RunBenchmark();
 
 // Clean up previously allocated render target resources
 void DestroyRenderTargets()
@@ -406,6 +424,12 @@ void CreateRenderTargets()
 	srvDesc.Texture2D.MipLevels = 1;
 	srvDesc.Texture2D.MostDetailedMip = 0;
 	V( device->CreateShaderResourceView( g_RenderTargetTexture, &srvDesc, &g_RenderTargetSRV ) );
+
+	// Keep the tiled renderer's output at the precision of the target it is composited onto
+	if ( g_pGPUParticleSystem )
+	{
+		g_pGPUParticleSystem->SetRenderBufferFormat( g_RenderTargetFormat == RT_RGBA16F ? IParticleSystem::RenderBuffer_RGBA16F : IParticleSystem::RenderBuffer_RGBA8 );
+	}
 }
 
 
@@ -437,6 +461,54 @@ int WINAPI wWinMain( HINSTANCE, HINSTANCE, LPWSTR, int )
     DXUTSetCallbackD3D11DeviceDestroyed( OnD3D11DestroyDevice );
     DXUTSetCallbackD3D11FrameRender( OnD3D11FrameRender );
 
+	// The options the particle systems are created with. These come first as the headless benchmark uses the layout too
+	for ( int i = 1; i < __argc; i++ )
+	{
+		const wchar_t* arg = __wargv[ i ];
+		if ( _wcsicmp( arg, L"-layout:aos" ) == 0 )
+			g_ParticleLayout = IParticleSystem::Layout_AoS;
+		else if ( _wcsicmp( arg, L"-layout:soa" ) == 0 )
+			g_ParticleLayout = IParticleSystem::Layout_SoA;
+		else if ( _wcsicmp( arg, L"-layout:compact" ) == 0 )
+			g_ParticleLayout = IParticleSystem::Layout_Compact;
+		else if ( _wcsicmp( arg, L"-packedsortkeys" ) == 0 )
+			g_PackedSortKeys = true;
+	}
+
+	// Replay a recorded trace without presenting anything if a benchmark has been requested
+	bool benchmark = g_Benchmark.ParseCommandLine( __argc, __wargv );
+
+	// The sort benchmark runs entirely on the CPU so doesn't need a window or device
+	if ( g_Benchmark.GetSortBenchmarkItems() > 0 )
+	{
+		return g_Benchmark.RunSortBenchmark() ? 0 : 1;
+	}
+
+	// Likewise the check of the compact particle format's round trip
+	if ( g_Benchmark.ValidateFormat() )
+	{
+		return TestCompactParticleFormat() == 0 ? 0 : 1;
+	}
+
+	if ( benchmark )
+	{
+		// A headless replay drives the CPU simulation directly without a window or device
+		if ( g_Benchmark.IsHeadless() )
+		{
+			return g_Benchmark.RunHeadlessBenchmark( g_MaxParticleOptions[ g_MaxParticlesIndex ], g_ParticleLayout ) ? 0 : 1;
+		}
+
+		return RunBenchmark();
+	}
+
+	for ( int i = 1; i < __argc; i++ )
+	{
+		if ( _wcsnicmp( __wargv[ i ], L"-record:", 8 ) == 0 && !g_TraceWriter.Open( __wargv[ i ] + 8 ) )
+		{
+			DXUTTRACE( L"Failed to create the particle trace %s\n", __wargv[ i ] + 8 );
+		}
+	}
+
 	InitApp();
     DXUTInit( true, true, nullptr ); // Parse the command line, show msgboxes on error, no extra command line params
     DXUTSetCursorSettings( true, true );
@@ -453,9 +525,19 @@ int WINAPI wWinMain( HINSTANCE, HINSTANCE, LPWSTR, int )
 	// Ensure the ShaderCache aborts if in a lengthy generation process
 	g_ShaderCache.Abort();
 
+	if ( g_TraceWriter.IsOpen() && !g_TraceWriter.Close() )
+	{
+		DXUTTRACE( L"Failed to write the particle trace\n" );
+	}
+
 	delete g_pGPUParticleSystem;
 	g_pGPUParticleSystem = 0;
 
+	delete g_pCPUParticleSystem;
+	g_pCPUParticleSystem = 0;
+
+	g_pParticleSystem = 0;
+
     return DXUTGetExitCode();
 }
 
@@ -549,8 +631,25 @@ void InitGUIControls()
 	iY += groupDelta;
 
 	g_HUD.m_GUI.AddCheckBox( IDC_PAUSE, L"Pause Simulation (P)", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 'P', false, &g_PauseCheckBox );
+	g_HUD.m_GUI.AddCheckBox( IDC_CPU_SIMULATION, L"CPU Simulation (U)", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 'U', false, &g_CPUSimulationCheckBox );
+
+	g_HUD.m_GUI.AddStatic( IDC_MAX_PARTICLES_LABEL, L"Max Particles", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth + 20, AMD::HUD::iElementHeight );
+	g_HUD.m_GUI.AddComboBox( IDC_MAX_PARTICLES, AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth + 20, AMD::HUD::iElementHeight, 0, false, &g_MaxParticlesCombo );
+	if( g_MaxParticlesCombo )
+	{
+		g_MaxParticlesCombo->SetDropHeight( 70 );
+		for ( int i = 0; i < ARRAYSIZE( g_MaxParticleNames ); i++ )
+		{
+			g_MaxParticlesCombo->AddItem( g_MaxParticleNames[ i ], nullptr );
+		}
+		g_MaxParticlesCombo->SetSelectedByIndex( g_MaxParticlesIndex );
+	}
+
 	g_HUD.m_GUI.AddCheckBox( IDC_SORT, L"Sort Particles", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, true, 0, false, &g_SortCheckBox );
+	g_HUD.m_GUI.AddCheckBox( IDC_RADIX_SORT, L"Radix Sort", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 0, false, &g_RadixSortCheckBox );
+	g_HUD.m_GUI.AddCheckBox( IDC_TEMPORAL_SORT, L"Temporal Sort", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 0, false, &g_TemporalSortCheckBox );
 	g_HUD.m_GUI.AddCheckBox( IDC_USE_GEOMETRY_SHADER, L"Use GS (G)", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 'G', false, &g_UseGeometryShaderCheckBox );
+	g_HUD.m_GUI.AddCheckBox( IDC_OCCLUSION_CULLING, L"Occlusion Culling", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 0, false, &g_OcclusionCullingCheckBox );
 
 	g_HUD.m_GUI.AddStatic( IDC_TECHNIQUE_LABEL, L"Technique (+/-)", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth + 20, AMD::HUD::iElementHeight );
 	g_HUD.m_GUI.AddComboBox( IDC_TECHNIQUE, AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth + 20, AMD::HUD::iElementHeight, 0, false, &g_TechniqueCombo );
@@ -603,6 +702,9 @@ void InitGUIControls()
 	g_HUD.m_GUI.AddCheckBox( IDC_SUPPORT_STREAKS, L"Streaks (K)", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, true, 'K', false, &g_SupportStreaksCheckBox );
 	g_HUD.m_GUI.AddCheckBox( IDC_CULL_MAXZ, L"Cull Max(Z)", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, true, 'Z', false, &g_CullMaxZCheckBox );
 	g_HUD.m_GUI.AddCheckBox( IDC_CULL_SCREENSPACE, L"Cull in Screen-space", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, true, 0, false, &g_CullInScreenSpaceCheckBox );
+	g_HUD.m_GUI.AddCheckBox( IDC_ADAPTIVE_TILE_SIZE, L"Adaptive Tile Size", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 0, false, &g_AdaptiveTileSizeCheckBox );
+	g_HUD.m_GUI.AddCheckBox( IDC_LOW_RESOLUTION, L"Low-res Dense Tiles", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 0, false, &g_LowResolutionCheckBox );
+	g_HUD.m_GUI.AddCheckBox( IDC_OPACITY_CULLING, L"Opacity Culling", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 0, false, &g_OpacityCullingCheckBox );
 		
 	g_HUD.m_GUI.AddStatic( IDC_COARSE_CULLING_LABEL, L"Coarse Culling (R)", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth + 20, AMD::HUD::iElementHeight );
 	g_HUD.m_GUI.AddComboBox( IDC_COARSE_CULLING, AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth + 20, AMD::HUD::iElementHeight, 0, false, &g_CoarseCullingCombo );
@@ -624,6 +726,7 @@ void InitGUIControls()
 		}
 		g_CoarseCullingCombo->SetSelectedByIndex( g_CoarseCullingMode );
 	}
+	g_HUD.m_GUI.AddCheckBox( IDC_SCREEN_RECT_BINNING, L"Screen Rect Binning", AMD::HUD::iElementOffset, iY += AMD::HUD::iElementDelta, AMD::HUD::iElementWidth, AMD::HUD::iElementHeight, false, 0, false, &g_ScreenRectBinningCheckBox );
 
 	iY += groupDelta;
 
@@ -651,10 +754,22 @@ void RenderText()
 
 #if defined _DEBUG
 	// stats only generated in debug as they involve GPU readback
-	const IParticleSystem::Stats& stats = g_pGPUParticleSystem->GetStats();
+	const IParticleSystem::Stats& stats = g_pParticleSystem->GetStats();
 	WCHAR buff[ 1024 ];
-	swprintf_s( buff, 1024, L"GPU Particles: %d/%d (%d dead)", stats.m_NumActiveParticles, stats.m_MaxParticles, stats.m_NumDead );
+	swprintf_s( buff, 1024, g_pParticleSystem == g_pCPUParticleSystem ? L"CPU Particles: %d/%d (%d dead)" : L"GPU Particles: %d/%d (%d dead)", stats.m_NumActiveParticles, stats.m_MaxParticles, stats.m_NumDead );
 	g_pTxtHelper->DrawTextLine( buff );
+
+	if ( stats.m_TileSize > 0 )
+	{
+		swprintf_s( buff, 1024, L"Tile size: %dx%d", stats.m_TileSize, stats.m_TileSize );
+		g_pTxtHelper->DrawTextLine( buff );
+	}
+
+	if ( stats.m_TileListOverflow > 0 )
+	{
+		swprintf_s( buff, 1024, L"Tile lists overflowed by %d entries", stats.m_TileListOverflow );
+		g_pTxtHelper->DrawTextLine( buff );
+	}
 #endif
 
 
@@ -832,7 +947,9 @@ HRESULT CALLBACK OnD3D11CreateDevice( ID3D11Device* pd3dDevice, const DXGI_SURFA
 		// Add the applications shaders to the cache
 		AddShadersToCache();
 
-		g_pGPUParticleSystem = IParticleSystem::CreateGPUSystem( g_ShaderCache );
+		g_pGPUParticleSystem = IParticleSystem::CreateGPUSystem( g_ShaderCache, g_ParticleLayout, g_MaxParticleOptions[ g_MaxParticlesIndex ], g_PackedSortKeys );
+		g_pCPUParticleSystem = IParticleSystem::CreateCPUSystem( g_ShaderCache, g_ParticleLayout, g_MaxParticleOptions[ g_MaxParticlesIndex ] );
+		g_pParticleSystem = g_pGPUParticleSystem;
         g_ShaderCache.GenerateShaders( AMD::ShaderCache::CREATE_TYPE_COMPILE_CHANGES );    // Only compile shaders that have changed (development mode)
         bFirstPass = false;
     }
@@ -840,6 +957,7 @@ HRESULT CALLBACK OnD3D11CreateDevice( ID3D11Device* pd3dDevice, const DXGI_SURFA
 	V( DirectX::CreateDDSTextureFromFile( pd3dDevice, L"..\\Media\\atlas.dds", nullptr, &g_pTextureAtlas ) );
 		
 	g_pGPUParticleSystem->OnCreateDevice( pd3dDevice, pd3dImmediateContext );
+	g_pCPUParticleSystem->OnCreateDevice( pd3dDevice, pd3dImmediateContext );
 
 	V( g_Blitter.OnCreateDevice( pd3dDevice ) );
 	
@@ -885,6 +1003,7 @@ HRESULT CALLBACK OnD3D11ResizedSwapChain( ID3D11Device* pd3dDevice, IDXGISwapCha
 	g_Blitter.OnResizedSwapChain( pBackBufferSurfaceDesc );
 
 	g_pGPUParticleSystem->OnResizedSwapChain( pBackBufferSurfaceDesc );
+	g_pCPUParticleSystem->OnResizedSwapChain( pBackBufferSurfaceDesc );
 
 	
 
@@ -904,8 +1023,14 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 	bool enableRasterOptions = g_Technique == IParticleSystem::Technique_Rasterize;
 	g_SortCheckBox->SetEnabled( enableRasterOptions );
 	g_SortCheckBox->SetVisible( enableRasterOptions );
+	g_RadixSortCheckBox->SetEnabled( enableRasterOptions );
+	g_RadixSortCheckBox->SetVisible( enableRasterOptions );
+	g_TemporalSortCheckBox->SetEnabled( enableRasterOptions );
+	g_TemporalSortCheckBox->SetVisible( enableRasterOptions );
 	g_UseGeometryShaderCheckBox->SetEnabled( enableRasterOptions );
 	g_UseGeometryShaderCheckBox->SetVisible( enableRasterOptions );
+	g_OcclusionCullingCheckBox->SetEnabled( enableRasterOptions );
+	g_OcclusionCullingCheckBox->SetVisible( enableRasterOptions );
 
 	// Increment the time IF we aren't paused
 	float fFrameTime = g_PauseCheckBox->GetChecked() ? 0.0f : fElapsedTime;
@@ -925,12 +1050,21 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
         return;
     }       
 	
-	// Increment the frame index and wrap if necessary
-	if ( !g_PauseCheckBox->GetChecked() )
+	// Work out what the particle system is given this frame, either from the UI and camera or from the trace being replayed
+	if ( g_Benchmarking )
 	{
-		g_GlobalConstantBuffer.m_FrameIndex++;
-		g_GlobalConstantBuffer.m_FrameIndex %= 1000;
+		ReplayFrameInput( g_FrameInput );
 	}
+	else
+	{
+		GatherFrameInput( fFrameTime, fElapsedTime );
+
+		if ( g_TraceWriter.IsOpen() && g_ShaderCache.ShadersReady() )
+		{
+			g_TraceWriter.AddFrame( g_FrameInput );
+		}
+	}
+
     // Clear the backbuffer and depth stencil
     float ClearColor[4] = { 0.176f, 0.196f, 0.667f, 1.0f };
  
@@ -938,38 +1072,6 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 	pd3dImmediateContext->ClearRenderTargetView( (ID3D11RenderTargetView*)g_RenderTargetRTV, ClearColor );
 	pd3dImmediateContext->ClearDepthStencilView( g_pDepthStencilView, D3D11_CLEAR_DEPTH, 1.0, 0 );
   
-	// Compute some matrices for our per-frame constant buffer
-	DirectX::XMMATRIX mView = g_Camera.GetViewMatrix();
-	DirectX::XMMATRIX mProj = g_Camera.GetProjMatrix();
-	DirectX::XMMATRIX mViewProjection = mView * mProj;
-	
-	g_GlobalConstantBuffer.m_ViewProjection = DirectX::XMMatrixTranspose( mViewProjection );
-	g_GlobalConstantBuffer.m_View  = DirectX::XMMatrixTranspose( mView );
-	g_GlobalConstantBuffer.m_Projection = DirectX::XMMatrixTranspose( mProj );
-
-	DirectX::XMMATRIX viewProjInv = DirectX::XMMatrixInverse( nullptr, mViewProjection );
-	g_GlobalConstantBuffer.m_ViewProjInv = DirectX::XMMatrixTranspose( viewProjInv );
-
-	DirectX::XMMATRIX viewInv = DirectX::XMMatrixInverse( nullptr, mView );
-	g_GlobalConstantBuffer.m_ViewInv= DirectX::XMMatrixTranspose( viewInv );
-
-	DirectX::XMMATRIX projInv = DirectX::XMMatrixInverse( nullptr, mProj );
-	g_GlobalConstantBuffer.m_ProjectionInv = DirectX::XMMatrixTranspose( projInv );
-
-	g_GlobalConstantBuffer.m_SunDirectionVS = DirectX::XMVector4Transform( g_GlobalConstantBuffer.m_SunDirection, mView );
-
-	g_GlobalConstantBuffer.m_EyePosition = g_Camera.GetEyePt();
-
-	g_GlobalConstantBuffer.m_FrameTime = fFrameTime;
-
-	g_GlobalConstantBuffer.m_AlphaThreshold = (float)g_AlphaThreshold / 100.0f;
-	g_GlobalConstantBuffer.m_CollisionThickness = (float)g_CollisionThickness * 0.1f;
-
-	g_GlobalConstantBuffer.m_CollisionsEnabled = g_DepthBufferCollisionsCheckBox->GetChecked() ? 1 : 0;
-	g_GlobalConstantBuffer.m_EnableSleepState = g_EnableSleepStateCheckBox->GetChecked() ? 1 : 0;
-	g_GlobalConstantBuffer.m_ShowSleepingParticles = g_ShowSleepingParticlesCheckBox->GetChecked() ? 1 : 0;
-
-
     // Update the per-frame constant buffer
     HRESULT hr;
     
@@ -1061,35 +1163,13 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 		pd3dImmediateContext->PSSetShaderResources( 0, 1, &g_pTextureAtlas );
 		pd3dImmediateContext->CSSetShaderResources( 6, 1, &g_pTextureAtlas );
 			
-		// Fill in array of emitters that we will send to the particle system
-		IParticleSystem::EmitterParams emitters[ 5 ];
-		int numEmitters = 0;
-		PopulateEmitters( numEmitters, emitters, ARRAYSIZE( emitters ), fElapsedTime );
-		
 		// Unbind the depth buffer because we don't need it and we are going to be using it as shader input
 		pd3dImmediateContext->OMSetRenderTargets( 1, &g_RenderTargetRTV, nullptr );
 		
-		// Convert our UI options into the particle system flags
-		int flags = 0;
-		if ( g_SortCheckBox->GetChecked() )
-			flags |= IParticleSystem::PF_Sort;
-		if ( g_CullMaxZCheckBox->GetChecked() )
-			flags |= IParticleSystem::PF_CullMaxZ;
-		if ( g_CullInScreenSpaceCheckBox->GetChecked() )
-			flags |= IParticleSystem::PF_ScreenSpaceCulling;
-		if ( g_SupportStreaksCheckBox->GetChecked() )
-			flags |= IParticleSystem::PF_Streaks;
-		
-		if ( g_LightingMode == NoLighting )
-			flags |= IParticleSystem::PF_NoLighting;
-		else if ( g_LightingMode == CheapLighting )
-			flags |= IParticleSystem::PF_CheapLighting;
-		
-		if ( g_UseGeometryShaderCheckBox->GetChecked() )
-			flags |= IParticleSystem::PF_UseGeometryShader;
-				
-		// Render the GPU particles system
-		g_pGPUParticleSystem->Render( fFrameTime, flags, g_Technique, g_CoarseCullingMode, emitters, numEmitters, g_pDepthStencilSRV );
+		// Render the active particle system. The CPU system needs its own copy of the frame constants
+		g_pParticleSystem->SetPerFrameConstants( g_GlobalConstantBuffer );
+		const IParticleSystem::EmitterParams* emitters = g_FrameInput.m_Emitters.empty() ? nullptr : &g_FrameInput.m_Emitters[ 0 ];
+		g_pParticleSystem->Render( g_FrameInput.m_FrameTime, g_FrameInput.m_Flags, g_FrameInput.m_Technique, g_FrameInput.m_CoarseCullingMode, emitters, (int)g_FrameInput.m_Emitters.size(), g_pDepthStencilSRV );
 
 		//  Unset the GS in-case we have been using it previously
 		pd3dImmediateContext->GSSetShader( nullptr, nullptr, 0 );
@@ -1097,6 +1177,10 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
         TIMER_End()
     }
 
+	// Nothing is presented while benchmarking so skip the HUD and the blit to the back buffer
+	if ( g_Benchmarking )
+		return;
+
     DXUT_BeginPerfEvent( DXUT_PERFEVENTCOLOR, L"HUD / Stats" );
 
 	// Set the render target to be our back buffer
@@ -1144,6 +1228,132 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 }
 
 
+// Work out this frame's input to the particle system from the camera and the UI
+void GatherFrameInput( float frameTime, float elapsedTime )
+{
+	// Increment the frame index and wrap if necessary
+	if ( !g_PauseCheckBox->GetChecked() )
+	{
+		g_GlobalConstantBuffer.m_FrameIndex++;
+		g_GlobalConstantBuffer.m_FrameIndex %= 1000;
+	}
+
+	// Compute some matrices for our per-frame constant buffer
+	DirectX::XMMATRIX mView = g_Camera.GetViewMatrix();
+	DirectX::XMMATRIX mProj = g_Camera.GetProjMatrix();
+	DirectX::XMMATRIX mViewProjection = mView * mProj;
+	
+	g_GlobalConstantBuffer.m_ViewProjection = DirectX::XMMatrixTranspose( mViewProjection );
+	g_GlobalConstantBuffer.m_View  = DirectX::XMMatrixTranspose( mView );
+	g_GlobalConstantBuffer.m_Projection = DirectX::XMMatrixTranspose( mProj );
+
+	DirectX::XMMATRIX viewProjInv = DirectX::XMMatrixInverse( nullptr, mViewProjection );
+	g_GlobalConstantBuffer.m_ViewProjInv = DirectX::XMMatrixTranspose( viewProjInv );
+
+	DirectX::XMMATRIX viewInv = DirectX::XMMatrixInverse( nullptr, mView );
+	g_GlobalConstantBuffer.m_ViewInv= DirectX::XMMatrixTranspose( viewInv );
+
+	DirectX::XMMATRIX projInv = DirectX::XMMatrixInverse( nullptr, mProj );
+	g_GlobalConstantBuffer.m_ProjectionInv = DirectX::XMMatrixTranspose( projInv );
+
+	g_GlobalConstantBuffer.m_SunDirectionVS = DirectX::XMVector4Transform( g_GlobalConstantBuffer.m_SunDirection, mView );
+
+	g_GlobalConstantBuffer.m_EyePosition = g_Camera.GetEyePt();
+
+	g_GlobalConstantBuffer.m_FrameTime = frameTime;
+
+	g_GlobalConstantBuffer.m_AlphaThreshold = (float)g_AlphaThreshold / 100.0f;
+	g_GlobalConstantBuffer.m_CollisionThickness = (float)g_CollisionThickness * 0.1f;
+
+	g_GlobalConstantBuffer.m_CollisionsEnabled = g_DepthBufferCollisionsCheckBox->GetChecked() ? 1 : 0;
+	g_GlobalConstantBuffer.m_EnableSleepState = g_EnableSleepStateCheckBox->GetChecked() ? 1 : 0;
+	g_GlobalConstantBuffer.m_ShowSleepingParticles = g_ShowSleepingParticlesCheckBox->GetChecked() ? 1 : 0;
+
+	// Convert our UI options into the particle system flags
+	int flags = 0;
+	if ( g_SortCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_Sort;
+	if ( g_RadixSortCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_RadixSort;
+	if ( g_TemporalSortCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_TemporalSort;
+	if ( g_CullMaxZCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_CullMaxZ;
+	if ( g_CullInScreenSpaceCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_ScreenSpaceCulling;
+	if ( g_AdaptiveTileSizeCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_AdaptiveTileSize;
+	if ( g_LowResolutionCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_LowResolution;
+	if ( g_OpacityCullingCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_OpacityCulling;
+	if ( g_ScreenRectBinningCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_ScreenRectBinning;
+	if ( g_SupportStreaksCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_Streaks;
+	
+	if ( g_LightingMode == NoLighting )
+		flags |= IParticleSystem::PF_NoLighting;
+	else if ( g_LightingMode == CheapLighting )
+		flags |= IParticleSystem::PF_CheapLighting;
+	
+	if ( g_UseGeometryShaderCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_UseGeometryShader;
+	if ( g_OcclusionCullingCheckBox->GetChecked() )
+		flags |= IParticleSystem::PF_OcclusionCulling;
+
+	// Fill in array of emitters that we will send to the particle system
+	IParticleSystem::EmitterParams emitters[ g_MaxFrameEmitters ];
+	int numEmitters = 0;
+	if ( g_ShaderCache.ShadersReady() )
+	{
+		PopulateEmitters( numEmitters, emitters, ARRAYSIZE( emitters ), elapsedTime );
+	}
+
+	g_FrameInput.m_Constants = g_GlobalConstantBuffer;
+	g_FrameInput.m_FrameTime = frameTime;
+	g_FrameInput.m_Flags = flags;
+	g_FrameInput.m_Technique = g_Technique;
+	g_FrameInput.m_CoarseCullingMode = g_CoarseCullingMode;
+	g_FrameInput.m_Scene = g_Scene;
+	g_FrameInput.m_Emitters.assign( emitters, emitters + numEmitters );
+
+	// Record the table entry of each emitter alongside it so a replay colors the particles the same way
+	IParticleSystem::EmitterProperties noProperties = {};
+	g_FrameInput.m_EmitterProperties.resize( numEmitters );
+	for ( int i = 0; i < numEmitters; i++ )
+	{
+		g_FrameInput.m_EmitterProperties[ i ] = i < (int)g_EmitterProperties.size() ? g_EmitterProperties[ i ] : noProperties;
+	}
+}
+
+
+// Take this frame's input to the particle system from the trace being replayed
+void ReplayFrameInput( const ParticleTraceFrame& frame )
+{
+	// Switching scene in the sample resets the particle system so do the same here
+	if ( frame.m_Scene != g_Scene )
+	{
+		g_Scene = (SceneType)frame.m_Scene;
+		g_pParticleSystem->Reset();
+	}
+
+	// The recorded constants are used as they are apart from the screen size which has to match the render targets
+	g_GlobalConstantBuffer = frame.m_Constants;
+	g_GlobalConstantBuffer.m_ScreenWidth = g_ScreenWidth;
+	g_GlobalConstantBuffer.m_ScreenHeight = g_ScreenHeight;
+
+	// Only update the emitter table entries that have changed so the table uploads match the recorded session
+	for ( int i = 0; i < (int)frame.m_EmitterProperties.size(); i++ )
+	{
+		if ( i >= (int)g_EmitterProperties.size() || memcmp( &frame.m_EmitterProperties[ i ], &g_EmitterProperties[ i ], sizeof( IParticleSystem::EmitterProperties ) ) != 0 )
+		{
+			SetEmitterProperties( i, frame.m_EmitterProperties[ i ] );
+		}
+	}
+}
+
+
 //--------------------------------------------------------------------------------------
 // Release D3D11 resources created in OnD3D11ResizedSwapChain 
 //--------------------------------------------------------------------------------------
@@ -1151,6 +1361,8 @@ void CALLBACK OnD3D11ReleasingSwapChain( void* pUserContext )
 {
 	if ( g_pGPUParticleSystem )
 		g_pGPUParticleSystem->OnReleasingSwapChain();
+	if ( g_pCPUParticleSystem )
+		g_pCPUParticleSystem->OnReleasingSwapChain();
 
     g_DialogResourceManager.OnD3D11ReleasingSwapChain();
 
@@ -1201,6 +1413,8 @@ void CALLBACK OnD3D11DestroyDevice( void* pUserContext )
 
 	if ( g_pGPUParticleSystem )
 		g_pGPUParticleSystem->OnDestroyDevice();
+	if ( g_pCPUParticleSystem )
+		g_pCPUParticleSystem->OnDestroyDevice();
 	
     SAFE_RELEASE( g_pPerFrameConstantBuffer );
 	
@@ -1219,6 +1433,11 @@ bool CALLBACK ModifyDeviceSettings( DXUTDeviceSettings* pDeviceSettings, void* p
 {
     pDeviceSettings->d3d11.AutoCreateDepthStencil = false;
 
+	if ( g_UseWARPDevice )
+	{
+		pDeviceSettings->d3d11.DriverType = D3D_DRIVER_TYPE_WARP;
+	}
+
     return true;
 }
 
@@ -1314,7 +1533,7 @@ void CALLBACK OnKeyboard( UINT nChar, bool bKeyDown, bool bAltDown, void* pUserC
 			{
 				if ( bAltDown )
 				{
-					g_pGPUParticleSystem->Reset();
+					g_pParticleSystem->Reset();
 				}
 				else
 				{
@@ -1400,6 +1619,18 @@ void CALLBACK OnGUIEvent( UINT nEvent, int nControlID, CDXUTControl* pControl, v
 			DoCollisionTest();
 			break;
 
+		case IDC_CPU_SIMULATION:
+			// Start the newly selected system from scratch so it doesn't resume from a stale state
+			g_pParticleSystem = g_CPUSimulationCheckBox->GetChecked() ? g_pCPUParticleSystem : g_pGPUParticleSystem;
+			g_pParticleSystem->Reset();
+			break;
+
+		case IDC_MAX_PARTICLES:
+			g_MaxParticlesIndex = g_MaxParticlesCombo->GetSelectedIndex();
+			g_pGPUParticleSystem->SetMaxParticles( g_MaxParticleOptions[ g_MaxParticlesIndex ] );
+			g_pCPUParticleSystem->SetMaxParticles( g_MaxParticleOptions[ g_MaxParticlesIndex ] );
+			break;
+
 		default:
 			AMD::OnGUIEvent( nEvent, nControlID, pControl, pUserContext );
 			break;
@@ -1463,9 +1694,7 @@ void ChangeScene()
 			// Sparks
 			g_EmissionRates[ 0 ].m_ParticlesPerSecond = 1500.0f;
 			
-			g_GlobalConstantBuffer.m_StartColor[ 0 ] = DirectX::XMVectorSet( 10.0f, 10.0f, 0.0f, 1.0f );
-			g_GlobalConstantBuffer.m_EndColor[ 0 ] = DirectX::XMVectorSet( 1.0f, 0.0f, 0.0f, 1.0f );
-			g_GlobalConstantBuffer.m_EmitterLightingCenter[ 0 ] = spawnPosition;
+			SetEmitterProperties( 0, DirectX::XMVectorSet( 10.0f, 10.0f, 0.0f, 1.0f ), DirectX::XMVectorSet( 1.0f, 0.0f, 0.0f, 1.0f ), spawnPosition );
 
 			g_VolcanoSparksEmitter.m_Position = spawnPosition;
 			g_VolcanoSparksEmitter.m_Velocity = DirectX::XMVectorSet( 0.0f, 30.0f, 0.0f, 0.0f );
@@ -1482,9 +1711,7 @@ void ChangeScene()
 			// Smoke
 			g_EmissionRates[ 1 ].m_ParticlesPerSecond = 100.0f;
 			
-			g_GlobalConstantBuffer.m_StartColor[ 1 ] = DirectX::XMVectorSet( 0.5f, 0.5f, 0.5f, 1.0f );
-			g_GlobalConstantBuffer.m_EndColor[ 1 ] = DirectX::XMVectorSet( 0.6f, 0.6f, 0.65f, 1.0f );
-			g_GlobalConstantBuffer.m_EmitterLightingCenter[ 1 ] = spawnPosition;
+			SetEmitterProperties( 1, DirectX::XMVectorSet( 0.5f, 0.5f, 0.5f, 1.0f ), DirectX::XMVectorSet( 0.6f, 0.6f, 0.65f, 1.0f ), spawnPosition );
 
 			g_VolcanoSmokeEmitter.m_Position = spawnPosition;
 			g_VolcanoSmokeEmitter.m_Velocity = DirectX::XMVectorSet( 0.0f, 5.0f, 0.0f, 0.0f );
@@ -1536,9 +1763,7 @@ void ChangeScene()
 
 			for ( int i = 0; i < numTankEmitters; i++ )
 			{
-				g_GlobalConstantBuffer.m_StartColor[ i ] = startColors[ i ];
-				g_GlobalConstantBuffer.m_EndColor[ i ] = endColors[ i ];
-				g_GlobalConstantBuffer.m_EmitterLightingCenter[ i ] = spawnPositions[ i ];
+				SetEmitterProperties( i, startColors[ i ], endColors[ i ], spawnPositions[ i ] );
 				
 				g_TankSmokeEmitters[ i ].m_Position = spawnPositions[ i ];
 				g_TankSmokeEmitters[ i ].m_Velocity = DirectX::XMVectorSet( 0.2f, 0.1f, 0.1f, 0.0f );
@@ -1559,8 +1784,9 @@ void ChangeScene()
 		}
 	}
 
-	// Reset the particle system when the scene changes so no particles from the previous scene persist
+	// Reset the particle systems when the scene changes so no particles from the previous scene persist
 	g_pGPUParticleSystem->Reset();
+	g_pCPUParticleSystem->Reset();
 
 	if( g_CameraCombo )
 	{
@@ -1615,7 +1841,6 @@ void PopulateEmitters( int& numEmitters, IParticleSystem::EmitterParams* emitter
 		emitters[ numEmitters++ ] = g_CollisionTestEmitter;
 		g_SpawnCollisionTestParticles = false;
 	}
-
 	// Update all our active emitters so we know how many whole numbers of particles to emit from each emitter this frame
 	for ( int i = 0; i < numEmitters; i++ )
 	{
@@ -1639,20 +1864,18 @@ void PopulateEmitters( int& numEmitters, IParticleSystem::EmitterParams* emitter
 void DoCollisionTest()
 {
 	// Set up some spawn parameters to dump a load of particles into our scene for a collision stress test.
-	// When hammering 'T' huge numbers of particles will be spawned. As they overlap in screen space, they are 
-	// likely to exceed the per tile buffer limits. This will result in visual artefacts. In a real world scenario, 
-	// it is up to the user to decide how to handle this either by limiting the number of particles that can be spawned or 
-	// setting the buffer sizes appropriately. Be aware that increasing the buffer sizes increases the LDS requirements.
-	// Increasing the amount of LDS used per thread group may result in fewer waves being run in parallel.
+	// When hammering 'T' huge numbers of particles will be spawned. As they overlap in screen space the tiles they 
+	// land in get very long particle lists. There is no per tile limit, but the dense tiles are sorted and rendered in 
+	// chunks so they cost much more than the rest of the screen, and the tile list buffer takes a few frames to grow 
+	// when the total jumps. In a real world scenario it is up to the user to decide whether to limit the number of 
+	// particles that can be spawned.
 
 
 	g_SpawnCollisionTestParticles = true;
 
 	DirectX::XMVECTOR spawnPosition = DirectX::XMVectorSet( 0.0f, 6.0f, 0.0f, 1.0f );
 
-	g_GlobalConstantBuffer.m_StartColor[ 2 ] = DirectX::XMVectorSet( 1.0f, 0.0f, 0.0f, 1.0f );
-	g_GlobalConstantBuffer.m_EndColor[ 2 ] = g_GlobalConstantBuffer.m_StartColor[ 2 ];
-	g_GlobalConstantBuffer.m_EmitterLightingCenter[ 2 ] = spawnPosition;
+	SetEmitterProperties( 2, DirectX::XMVectorSet( 1.0f, 0.0f, 0.0f, 1.0f ), DirectX::XMVectorSet( 1.0f, 0.0f, 0.0f, 1.0f ), spawnPosition );
 				
 	g_CollisionTestEmitter.m_Position = spawnPosition;
 	g_CollisionTestEmitter.m_Velocity = DirectX::XMVectorSet( 0.0f, 1.0f, 0.0f, 0.0f );
@@ -1667,6 +1890,117 @@ void DoCollisionTest()
 	g_CollisionTestEmitter.m_Streaks = false;
 }
 
+
+// Update an emitter's entry in the emitter property table of both particle systems so switching between them keeps the colors
+void SetEmitterProperties( int emitter, DirectX::FXMVECTOR startColor, DirectX::FXMVECTOR endColor, DirectX::FXMVECTOR lightingCenter )
+{
+	IParticleSystem::EmitterProperties properties;
+	DirectX::XMStoreFloat4( &properties.m_StartColor, startColor );
+	DirectX::XMStoreFloat4( &properties.m_EndColor, endColor );
+	DirectX::XMStoreFloat4( &properties.m_LightingCenter, lightingCenter );
+
+	SetEmitterProperties( emitter, properties );
+}
+
+
+void SetEmitterProperties( int emitter, const IParticleSystem::EmitterProperties& properties )
+{
+	if ( emitter >= (int)g_EmitterProperties.size() )
+	{
+		IParticleSystem::EmitterProperties noProperties = {};
+		g_EmitterProperties.resize( emitter + 1, noProperties );
+	}
+	g_EmitterProperties[ emitter ] = properties;
+
+	g_pGPUParticleSystem->SetEmitterProperties( emitter, 1, &properties );
+	g_pCPUParticleSystem->SetEmitterProperties( emitter, 1, &properties );
+}
+
+
+// Replay the trace given by -benchmark in a hidden window and write the timings of each stage out. Returns the process exit code
+int RunBenchmark()
+{
+	// The trace is memory mapped and each frame is decoded just before it is rendered, outside of the timed stages
+	if ( !g_TraceReader.Open( g_Benchmark.GetTracePath() ) || !g_TraceReader.ReadFrame( 0, g_FrameInput ) )
+	{
+		DXUTTRACE( L"Failed to load the particle trace %s\n", g_Benchmark.GetTracePath() );
+		return 1;
+	}
+
+	InitApp();
+	DXUTInit( true, false, nullptr ); // Parse the command line, no msgboxes so a failure can't block an automated run
+	DXUTCreateWindow( L"GPU Particles v1.1 Benchmark" );
+
+	// The CPU backend only needs a device to upload and draw what it simulated, so use WARP rather than tie the run to a GPU
+	g_UseWARPDevice = g_Benchmark.UseCPUSystem();
+
+	// Match the resolution the trace was recorded at as it changes the cost of the culling and rendering
+	if ( FAILED( DXUTCreateDevice( D3D_FEATURE_LEVEL_11_0, true, g_FrameInput.m_Constants.m_ScreenWidth, g_FrameInput.m_Constants.m_ScreenHeight ) ) )
+	{
+		DXUTShutdown( 1 );
+		return DXUTGetExitCode();
+	}
+	ShowWindow( DXUTGetHWND(), SW_HIDE );
+
+	InitGUIControls();
+
+	ChangeScene();
+
+	g_pParticleSystem = g_Benchmark.UseCPUSystem() ? g_pCPUParticleSystem : g_pGPUParticleSystem;
+	g_Benchmarking = true;
+
+	// The shaders are compiled on a worker thread. Keep the message queue moving while we wait for them
+	MSG msg;
+	while ( !g_ShaderCache.ShadersReady() )
+	{
+		while ( PeekMessage( &msg, nullptr, 0, 0, PM_REMOVE ) )
+		{
+			TranslateMessage( &msg );
+			DispatchMessage( &msg );
+		}
+		Sleep( 10 );
+	}
+
+	// Render the trace frame by frame. Nothing is presented so the frame rate isn't capped by vsync or the compositor
+	bool ok = true;
+	for ( int i = 0; i < g_TraceReader.GetNumFrames() && ok; i++ )
+	{
+		while ( PeekMessage( &msg, nullptr, 0, 0, PM_REMOVE ) )
+		{
+			TranslateMessage( &msg );
+			DispatchMessage( &msg );
+		}
+
+		ok = g_TraceReader.ReadFrame( i, g_FrameInput );
+		if ( ok )
+		{
+			OnD3D11FrameRender( DXUTGetD3D11Device(), DXUTGetD3D11DeviceContext(), 0.0, g_FrameInput.m_FrameTime, nullptr );
+
+			g_Benchmark.RecordFrame( i );
+		}
+	}
+
+	if ( !ok )
+	{
+		DXUTTRACE( L"The particle trace %s is corrupt\n", g_Benchmark.GetTracePath() );
+	}
+
+	int exitCode = ok && g_Benchmark.WriteResults( DXUTGetDeviceStats(), g_pParticleSystem->GetMaxParticles() ) ? 0 : 1;
+
+	g_ShaderCache.Abort();
+	DXUTShutdown( exitCode );
+
+	delete g_pGPUParticleSystem;
+	g_pGPUParticleSystem = 0;
+
+	delete g_pCPUParticleSystem;
+	g_pCPUParticleSystem = 0;
+
+	g_pParticleSystem = 0;
+
+	return exitCode;
+}
+
 //--------------------------------------------------------------------------------------
 // EOF.
 //--------------------------------------------------------------------------------------
@@ -0,0 +1,186 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "JobSystem.h"
+
+
+JobSystem::JobSystem() :
+	m_pFunction( nullptr ),
+	m_Count( 0 ),
+	m_GrainSize( 1 ),
+	m_Generation( 0 ),
+	m_NumBusyWorkers( 0 ),
+	m_Quit( false )
+{
+	m_NextChunk = 0;
+	m_ChunksRemaining = 0;
+}
+
+
+JobSystem::~JobSystem()
+{
+	Release();
+}
+
+
+void JobSystem::Init( int numThreads )
+{
+	Release();
+
+	if ( numThreads <= 0 )
+	{
+		numThreads = (int)std::thread::hardware_concurrency();
+	}
+
+	// The calling thread is one of the threads so only spawn the remainder
+	m_Quit = false;
+	for ( int i = 1; i < numThreads; i++ )
+	{
+		m_Workers.push_back( std::thread( &JobSystem::WorkerThread, this ) );
+	}
+}
+
+
+void JobSystem::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_Quit = true;
+	}
+	m_WakeCondition.notify_all();
+
+	for ( size_t i = 0; i < m_Workers.size(); i++ )
+	{
+		m_Workers[ i ].join();
+	}
+	m_Workers.clear();
+}
+
+
+void JobSystem::ParallelFor( int count, int grainSize, const RangeFunction& function )
+{
+	if ( count <= 0 )
+		return;
+
+	if ( grainSize < 1 )
+		grainSize = 1;
+
+	int numChunks = ( count + grainSize - 1 ) / grainSize;
+
+	// Not worth waking anyone up
+	if ( m_Workers.empty() || numChunks == 1 )
+	{
+		for ( int begin = 0; begin < count; begin += grainSize )
+		{
+			function( begin, begin + grainSize < count ? begin + grainSize : count );
+		}
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock( m_Mutex );
+
+		// Stragglers from the previous job may still hold its parameters so let them drain first
+		while ( m_NumBusyWorkers > 0 )
+		{
+			m_DoneCondition.wait( lock );
+		}
+
+		m_pFunction = &function;
+		m_Count = count;
+		m_GrainSize = grainSize;
+		m_NextChunk = 0;
+		m_ChunksRemaining = numChunks;
+		m_Generation++;
+	}
+	m_WakeCondition.notify_all();
+
+	// The calling thread helps out
+	RunChunks();
+
+	std::unique_lock<std::mutex> lock( m_Mutex );
+	while ( m_ChunksRemaining > 0 )
+	{
+		m_DoneCondition.wait( lock );
+	}
+}
+
+
+void JobSystem::RunChunks()
+{
+	const RangeFunction* pFunction = m_pFunction;
+	const int count = m_Count;
+	const int grainSize = m_GrainSize;
+	const int numChunks = ( count + grainSize - 1 ) / grainSize;
+
+	for ( ;; )
+	{
+		int chunk = m_NextChunk++;
+		if ( chunk >= numChunks )
+			break;
+
+		int begin = chunk * grainSize;
+		int end = begin + grainSize < count ? begin + grainSize : count;
+		(*pFunction)( begin, end );
+
+		// Whoever finishes the last chunk wakes the thread waiting in ParallelFor
+		if ( --m_ChunksRemaining == 0 )
+		{
+			std::lock_guard<std::mutex> lock( m_Mutex );
+			m_DoneCondition.notify_all();
+		}
+	}
+}
+
+
+void JobSystem::WorkerThread()
+{
+	unsigned int lastGeneration = 0;
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		lastGeneration = m_Generation;
+	}
+
+	for ( ;; )
+	{
+		{
+			std::unique_lock<std::mutex> lock( m_Mutex );
+			while ( !m_Quit && m_Generation == lastGeneration )
+			{
+				m_WakeCondition.wait( lock );
+			}
+
+			if ( m_Quit )
+				return;
+
+			lastGeneration = m_Generation;
+			m_NumBusyWorkers++;
+		}
+
+		RunChunks();
+
+		{
+			std::lock_guard<std::mutex> lock( m_Mutex );
+			m_NumBusyWorkers--;
+		}
+		m_DoneCondition.notify_all();
+	}
+}
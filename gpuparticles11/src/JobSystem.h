@@ -0,0 +1,79 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __JOB_SYSTEM_H__
+#define __JOB_SYSTEM_H__
+
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+
+// Minimal fork-join thread pool used by the CPU particle system. The calling thread always takes part in the work
+// so a pool created with one thread runs everything inline.
+class JobSystem
+{
+public:
+
+	// A range of work items [begin, end)
+	typedef std::function<void( int begin, int end )> RangeFunction;
+
+	JobSystem();
+	~JobSystem();
+
+	// Spawn the worker threads. Passing zero uses one thread per hardware thread
+	void Init( int numThreads = 0 );
+	void Release();
+
+	// Split [0, count) into chunks of grainSize and run them across all threads. Returns once every chunk has completed
+	void ParallelFor( int count, int grainSize, const RangeFunction& function );
+
+	// Total number of threads that take part in a ParallelFor, including the calling thread
+	int GetNumThreads() const { return (int)m_Workers.size() + 1; }
+
+private:
+
+	void WorkerThread();
+	void RunChunks();
+
+	std::vector<std::thread>	m_Workers;
+	std::mutex					m_Mutex;
+	std::condition_variable		m_WakeCondition;
+	std::condition_variable		m_DoneCondition;
+
+	// The current job. Only written while no worker is busy
+	const RangeFunction*		m_pFunction;
+	int							m_Count;
+	int							m_GrainSize;
+	std::atomic<int>			m_NextChunk;
+	std::atomic<int>			m_ChunksRemaining;
+
+	unsigned int				m_Generation;
+	int							m_NumBusyWorkers;
+	bool						m_Quit;
+};
+
+
+#endif
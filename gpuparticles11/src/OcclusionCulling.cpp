@@ -0,0 +1,147 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "OcclusionCulling.h"
+#include "CoarseBinning.h"
+#include <algorithm>
+#include <math.h>
+
+
+void BuildHiZPyramid( const float* firstLevel, int width, int height, HiZPyramid& pyramid )
+{
+	pyramid.m_Levels.assign( 1, std::vector<float>( firstLevel, firstLevel + width * height ) );
+	pyramid.m_Widths.assign( 1, width );
+	pyramid.m_Heights.assign( 1, height );
+
+	while ( width > 1 || height > 1 )
+	{
+		const std::vector<float>& src = pyramid.m_Levels.back();
+		int srcWidth = width;
+		int srcHeight = height;
+
+		width = std::max( width / 2, 1 );
+		height = std::max( height / 2, 1 );
+
+		// Texels past the edge of the level before count as zero, as loads past the edge of a texture do on the GPU
+		std::vector<float> dst( width * height, 0.0f );
+		for ( int y = 0; y < height; y++ )
+		{
+			for ( int x = 0; x < width; x++ )
+			{
+				float depth = 0.0f;
+				for ( int i = 0; i < 4; i++ )
+				{
+					int srcX = x * 2 + ( i & 1 );
+					int srcY = y * 2 + ( i >> 1 );
+					if ( srcX < srcWidth && srcY < srcHeight )
+					{
+						depth = std::max( depth, src[ srcY * srcWidth + srcX ] );
+					}
+				}
+				dst[ y * width + x ] = depth;
+			}
+		}
+
+		pyramid.m_Levels.push_back( dst );
+		pyramid.m_Widths.push_back( width );
+		pyramid.m_Heights.push_back( height );
+	}
+}
+
+
+bool IsParticleOccluded( const PER_FRAME_CONSTANT_BUFFER& constants, const HiZPyramid& hiZ, const DirectX::XMFLOAT4& viewSpacePosition, float radius, float pixelMargin, float depthMargin )
+{
+	float pixelMinX, pixelMinY, pixelMaxX, pixelMaxY;
+	if ( !GetSphereScreenBounds( constants, viewSpacePosition, radius, pixelMargin, pixelMinX, pixelMinY, pixelMaxX, pixelMaxY ) )
+		return true;
+
+	float frontZ = viewSpacePosition.z - radius - depthMargin;
+	if ( frontZ <= COARSE_BINNING_MIN_Z || hiZ.m_Levels.empty() )
+		return false;
+
+	// Clip the rectangle to the screen and pick the level where it spans at most two texels each way
+	int p0x = (int)std::max( pixelMinX, 0.0f );
+	int p0y = (int)std::max( pixelMinY, 0.0f );
+	int p1x = (int)std::min( pixelMaxX, (float)( constants.m_ScreenWidth - 1 ) );
+	int p1y = (int)std::min( pixelMaxY, (float)( constants.m_ScreenHeight - 1 ) );
+	int size = std::max( p1x - p0x, p1y - p0y ) + 1;
+
+	int level = 0;
+	while ( ( 2 << level ) < size )
+		level++;
+	level = std::min( level, (int)hiZ.m_Levels.size() - 1 );
+
+	// Take the max over every texel the rectangle touches. On the GPU that is the same as the corners
+	const std::vector<float>& texels = hiZ.m_Levels[ level ];
+	const int width = hiZ.m_Widths[ level ];
+	const int height = hiZ.m_Heights[ level ];
+
+	float depth = 0.0f;
+	for ( int y = p0y >> ( level + 1 ); y <= ( p1y >> ( level + 1 ) ) && y < height; y++ )
+	{
+		for ( int x = p0x >> ( level + 1 ); x <= ( p1x >> ( level + 1 ) ) && x < width; x++ )
+		{
+			depth = std::max( depth, texels[ y * width + x ] );
+		}
+	}
+
+	// Convert to view space with the inverse projection, see ConvertProjDepthToView in Globals.h
+	DirectX::XMFLOAT4X4 projectionInv;
+	DirectX::XMStoreFloat4x4( &projectionInv, DirectX::XMMatrixTranspose( constants.m_ProjectionInv ) );
+	float viewZ = 1.0f / ( depth * projectionInv._34 + projectionInv._44 );
+
+	return frontZ > viewZ;
+}
+
+
+int ValidateOcclusionCulling( const PER_FRAME_CONSTANT_BUFFER& constants, const HiZPyramid& hiZ, const DirectX::XMFLOAT4* viewSpacePositions, const float* maxRadii, const UINT* aliveIndices, int numAlive, const UINT* visibleIndices, int numVisible )
+{
+	// The slack in the depth test, in view space units
+	const float depthMargin = 0.01f;
+
+	// Walk the two lists together. Alive list entries are unique so each visible entry can only match the next one the lists share
+	int numErrors = 0;
+	int next = 0;
+	for ( int i = 0; i < numAlive; i++ )
+	{
+		UINT index = aliveIndices[ i ];
+		const DirectX::XMFLOAT4& position = viewSpacePositions[ index ];
+		float radius = maxRadii[ index ];
+
+		if ( next < numVisible && visibleIndices[ next ] == index )
+		{
+			// Kept, so it must not be certain to be culled
+			if ( IsParticleOccluded( constants, hiZ, position, radius, 1.0f, depthMargin ) )
+			{
+				numErrors++;
+			}
+			next++;
+		}
+		else if ( !IsParticleOccluded( constants, hiZ, position, radius, -1.0f, -depthMargin ) )
+		{
+			// Dropped, so it must not be certain to be kept
+			numErrors++;
+		}
+	}
+
+	// Anything left over is not on the alive list or out of order
+	return numErrors + ( numVisible - next );
+}
@@ -0,0 +1,57 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __OCCLUSION_CULLING_H__
+#define __OCCLUSION_CULLING_H__
+
+
+#include "ParticleSystem.h"
+#include <vector>
+
+
+// CPU model of the Hi-Z occlusion culling in OcclusionCullingCS.hlsl. Each particle's bounding sphere is projected to the same 
+// conservative screen rectangle as the coarse binning, see CoarseBinning.h, and tested against the level of the pyramid where the 
+// rectangle spans at most 2x2 texels. Like the coarse binning model it works on plain arrays so it can check a readback
+
+// The furthest device depth of the opaque scene. Level n texels cover 2^(n+1) x 2^(n+1) pixels
+struct HiZPyramid
+{
+	std::vector< std::vector<float> >	m_Levels;
+	std::vector<int>					m_Widths;
+	std::vector<int>					m_Heights;
+};
+
+// Build the pyramid above its first level, down to 1x1. Each level takes the max over 2x2 texels of the one before
+void BuildHiZPyramid( const float* firstLevel, int width, int height, HiZPyramid& pyramid );
+
+// Test whether a particle is culled, either for being off screen or for being entirely behind the pyramid. The screen rectangle is 
+// grown by pixelMargin pixels and the front of the sphere pulled depthMargin towards the eye, or the reverse if they are negative. So 
+// with positive margins a culled particle is certain to be culled on the GPU, and with negative margins one that isn't culled is 
+// certain to be kept. Particles that reach too close to the eye to be projected are never culled
+bool IsParticleOccluded( const PER_FRAME_CONSTANT_BUFFER& constants, const HiZPyramid& hiZ, const DirectX::XMFLOAT4& viewSpacePosition, float radius, float pixelMargin, float depthMargin );
+
+// Check a visible list built elsewhere against the model. It must be the alive list in the same order less the culled particles. 
+// Particles within a pixel or a little depth of the decision may go either way, so float rounding differences are not reported. 
+// Returns the number of entries that are wrongly kept, wrongly dropped or out of order
+int ValidateOcclusionCulling( const PER_FRAME_CONSTANT_BUFFER& constants, const HiZPyramid& hiZ, const DirectX::XMFLOAT4* viewSpacePositions, const float* maxRadii, const UINT* aliveIndices, int numAlive, const UINT* visibleIndices, int numVisible );
+
+
+#endif
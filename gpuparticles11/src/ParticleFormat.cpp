@@ -0,0 +1,224 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "ParticleFormat.h"
+#include <DirectXPackedVector.h>
+#include <math.h>
+#include <string.h>
+
+
+static inline UINT PackHalf2( float x, float y )
+{
+	return (UINT)DirectX::PackedVector::XMConvertFloatToHalf( x ) | ( (UINT)DirectX::PackedVector::XMConvertFloatToHalf( y ) << 16 );
+}
+
+
+static inline float UnpackHalfLow( UINT packed )
+{
+	return DirectX::PackedVector::XMConvertHalfToFloat( (DirectX::PackedVector::HALF)( packed & 0xffff ) );
+}
+
+
+static inline float UnpackHalfHigh( UINT packed )
+{
+	return DirectX::PackedVector::XMConvertHalfToFloat( (DirectX::PackedVector::HALF)( packed >> 16 ) );
+}
+
+
+// The rotation only ever increases so store it as a fraction of a turn rather than a half, which would lose precision as it grows
+static inline UINT PackRotation( float rotation )
+{
+	float turns = rotation / DirectX::XM_2PI;
+	turns -= floorf( turns );
+
+	return (UINT)( turns * 65536.0f + 0.5f ) & 0xffff;
+}
+
+
+static inline float UnpackRotation( UINT packed )
+{
+	return (float)packed * ( DirectX::XM_2PI / 65536.0f );
+}
+
+
+static inline UINT PackUnorm16( float value )
+{
+	value = value < 0.0f ? 0.0f : ( value > 1.0f ? 1.0f : value );
+
+	return (UINT)( value * 65535.0f + 0.5f );
+}
+
+
+static inline float UnpackUnorm16( UINT packed )
+{
+	return (float)packed / 65535.0f;
+}
+
+
+void EncodeCompactParticlePartA( const CPUParticlePartA& pa, CompactParticlePartA& compactA )
+{
+	compactA.m_TintAndAlpha[ 0 ] = PackHalf2( pa.m_TintAndAlpha.x, pa.m_TintAndAlpha.y );
+	compactA.m_TintAndAlpha[ 1 ] = PackHalf2( pa.m_TintAndAlpha.z, pa.m_TintAndAlpha.w );
+	compactA.m_VelocityXY = PackHalf2( pa.m_VelocityXY.x, pa.m_VelocityXY.y );
+	compactA.m_RotationAndNdotL = PackRotation( pa.m_Rotation ) | ( PackUnorm16( pa.m_EmitterNdotL ) << 16 );
+
+	UINT collisionCount = pa.m_CollisionCount < (UINT)COMPACT_MAX_COLLISION_COUNT ? pa.m_CollisionCount : (UINT)COMPACT_MAX_COLLISION_COUNT;
+
+	compactA.m_Properties = pa.m_EmitterProperties & COMPACT_PROPERTIES_MASK;
+	compactA.m_Properties |= ( pa.m_IsSleeping ? 1 : 0 ) << COMPACT_SLEEPING_BIT;
+	compactA.m_Properties |= collisionCount << COMPACT_COLLISION_COUNT_SHIFT;
+}
+
+
+void DecodeCompactParticlePartA( const CompactParticlePartA& compactA, CPUParticlePartA& pa )
+{
+	pa.m_TintAndAlpha = DirectX::XMFLOAT4( UnpackHalfLow( compactA.m_TintAndAlpha[ 0 ] ), UnpackHalfHigh( compactA.m_TintAndAlpha[ 0 ] ), 
+										   UnpackHalfLow( compactA.m_TintAndAlpha[ 1 ] ), UnpackHalfHigh( compactA.m_TintAndAlpha[ 1 ] ) );
+	pa.m_VelocityXY = DirectX::XMFLOAT2( UnpackHalfLow( compactA.m_VelocityXY ), UnpackHalfHigh( compactA.m_VelocityXY ) );
+	pa.m_Rotation = UnpackRotation( compactA.m_RotationAndNdotL & 0xffff );
+	pa.m_EmitterNdotL = UnpackUnorm16( compactA.m_RotationAndNdotL >> 16 );
+
+	pa.m_EmitterProperties = compactA.m_Properties & COMPACT_PROPERTIES_MASK;
+	pa.m_IsSleeping = ( compactA.m_Properties >> COMPACT_SLEEPING_BIT ) & 1;
+	pa.m_CollisionCount = compactA.m_Properties >> COMPACT_COLLISION_COUNT_SHIFT;
+	pa.m_pads[ 0 ] = 0.0f;
+}
+
+
+void EncodeCompactParticle( const CPUParticlePartA& pa, const CPUParticlePartB& pb, CompactParticlePartA& compactA, CompactParticlePartB& compactB )
+{
+	EncodeCompactParticlePartA( pa, compactA );
+
+	compactB.m_Position = pb.m_Position;
+	compactB.m_Age = pb.m_Age;
+	compactB.m_Velocity = pb.m_Velocity;
+	compactB.m_MassAndLifespan = PackHalf2( pb.m_Mass, pb.m_Lifespan );
+	compactB.m_StartAndEndSize = PackHalf2( pb.m_StartSize, pb.m_EndSize );
+}
+
+
+void DecodeCompactParticle( const CompactParticlePartA& compactA, const CompactParticlePartB& compactB, CPUParticlePartA& pa, CPUParticlePartB& pb )
+{
+	DecodeCompactParticlePartA( compactA, pa );
+
+	pb.m_Position = compactB.m_Position;
+	pb.m_Age = compactB.m_Age;
+	pb.m_Velocity = compactB.m_Velocity;
+	pb.m_Mass = UnpackHalfLow( compactB.m_MassAndLifespan );
+	pb.m_Lifespan = UnpackHalfHigh( compactB.m_MassAndLifespan );
+	pb.m_StartSize = UnpackHalfLow( compactB.m_StartAndEndSize );
+	pb.m_EndSize = UnpackHalfHigh( compactB.m_StartAndEndSize );
+	pb.m_DistanceToEye = 0.0f;
+}
+
+
+// Rounding to the nearest half is within half a ulp, ie 2^-11 relative. The absolute term covers values that end up as denormals
+static bool IsHalfClose( float expected, float actual )
+{
+	return fabsf( expected - actual ) <= fabsf( expected ) * ( 1.0f / 2048.0f ) + 6.0e-8f;
+}
+
+
+static bool IsRotationClose( float expected, float actual )
+{
+	float difference = fmodf( fabsf( expected - actual ), DirectX::XM_2PI );
+	difference = difference < DirectX::XM_PI ? difference : DirectX::XM_2PI - difference;
+
+	return difference <= DirectX::XM_PI / 65536.0f + 1.0e-5f;
+}
+
+
+// Count a failed check rather than asserting so the validation also runs in release builds
+#define CHECK_FORMAT( condition ) if ( !( condition ) ) numFailures++
+
+int TestCompactParticleFormat()
+{
+	int numFailures = 0;
+
+	const float values[] = { 0.0f, 1.0f, -1.0f, 0.5f, 0.3333f, 1.0e-5f, -2.75f, 17.3f, 123.456f, 0.999f };
+	const int numValues = ARRAYSIZE( values );
+
+	for ( int i = 0; i < 64; i++ )
+	{
+		CPUParticlePartA pa;
+		CPUParticlePartB pb;
+
+		pa.m_TintAndAlpha = DirectX::XMFLOAT4( fabsf( values[ i % numValues ] ), fabsf( values[ ( i + 1 ) % numValues ] ), fabsf( values[ ( i + 2 ) % numValues ] ), (float)( i % 11 ) / 10.0f );
+		pa.m_VelocityXY = DirectX::XMFLOAT2( values[ ( i + 3 ) % numValues ], values[ ( i + 4 ) % numValues ] * 10.0f );
+		pa.m_EmitterNdotL = (float)( i % 17 ) / 16.0f;
+		pa.m_EmitterProperties = ( i & 0xffff ) | ( ( i % 4 ) << 16 ) | ( ( i & 1 ) << 24 );
+		pa.m_Rotation = (float)i * 0.73f;
+		pa.m_IsSleeping = ( i >> 1 ) & 1;
+		pa.m_CollisionCount = i * 3;
+		pa.m_pads[ 0 ] = 0.0f;
+
+		pb.m_Position = DirectX::XMFLOAT3( values[ i % numValues ] * 100.0f, values[ ( i + 5 ) % numValues ], -values[ ( i + 7 ) % numValues ] * 30.0f );
+		pb.m_Mass = 1.0f + values[ ( i + 2 ) % numValues ];
+		pb.m_Velocity = DirectX::XMFLOAT3( values[ ( i + 1 ) % numValues ], values[ ( i + 6 ) % numValues ] * 4.0f, values[ ( i + 8 ) % numValues ] );
+		pb.m_Lifespan = 0.5f + (float)i * 0.25f;
+		pb.m_DistanceToEye = 42.0f;
+		pb.m_Age = pb.m_Lifespan * 0.5f;
+		pb.m_StartSize = 0.01f * (float)( i + 1 );
+		pb.m_EndSize = 0.1f * (float)( i + 1 );
+
+		CompactParticlePartA compactA;
+		CompactParticlePartB compactB;
+		EncodeCompactParticle( pa, pb, compactA, compactB );
+
+		CPUParticlePartA decodedA;
+		CPUParticlePartB decodedB;
+		DecodeCompactParticle( compactA, compactB, decodedA, decodedB );
+
+		// Quantized attributes
+		CHECK_FORMAT( IsHalfClose( pa.m_TintAndAlpha.x, decodedA.m_TintAndAlpha.x ) );
+		CHECK_FORMAT( IsHalfClose( pa.m_TintAndAlpha.y, decodedA.m_TintAndAlpha.y ) );
+		CHECK_FORMAT( IsHalfClose( pa.m_TintAndAlpha.z, decodedA.m_TintAndAlpha.z ) );
+		CHECK_FORMAT( IsHalfClose( pa.m_TintAndAlpha.w, decodedA.m_TintAndAlpha.w ) );
+		CHECK_FORMAT( IsHalfClose( pa.m_VelocityXY.x, decodedA.m_VelocityXY.x ) );
+		CHECK_FORMAT( IsHalfClose( pa.m_VelocityXY.y, decodedA.m_VelocityXY.y ) );
+		CHECK_FORMAT( fabsf( pa.m_EmitterNdotL - decodedA.m_EmitterNdotL ) <= 0.5f / 65535.0f + 1.0e-6f );
+		CHECK_FORMAT( IsRotationClose( pa.m_Rotation, decodedA.m_Rotation ) );
+		CHECK_FORMAT( IsHalfClose( pb.m_Mass, decodedB.m_Mass ) );
+		CHECK_FORMAT( IsHalfClose( pb.m_Lifespan, decodedB.m_Lifespan ) );
+		CHECK_FORMAT( IsHalfClose( pb.m_StartSize, decodedB.m_StartSize ) );
+		CHECK_FORMAT( IsHalfClose( pb.m_EndSize, decodedB.m_EndSize ) );
+
+		// Packed integer attributes are exact, apart from the collision count saturating
+		CHECK_FORMAT( decodedA.m_EmitterProperties == pa.m_EmitterProperties );
+		CHECK_FORMAT( decodedA.m_IsSleeping == pa.m_IsSleeping );
+		CHECK_FORMAT( decodedA.m_CollisionCount == ( pa.m_CollisionCount < (UINT)COMPACT_MAX_COLLISION_COUNT ? pa.m_CollisionCount : (UINT)COMPACT_MAX_COLLISION_COUNT ) );
+
+		// Full precision attributes are exact
+		CHECK_FORMAT( memcmp( &decodedB.m_Position, &pb.m_Position, sizeof( pb.m_Position ) ) == 0 );
+		CHECK_FORMAT( memcmp( &decodedB.m_Velocity, &pb.m_Velocity, sizeof( pb.m_Velocity ) ) == 0 );
+		CHECK_FORMAT( decodedB.m_Age == pb.m_Age );
+
+		// Re-encoding a decoded particle must be lossless
+		CompactParticlePartA reencodedA;
+		CompactParticlePartB reencodedB;
+		EncodeCompactParticle( decodedA, decodedB, reencodedA, reencodedB );
+		CHECK_FORMAT( memcmp( &reencodedA, &compactA, sizeof( compactA ) ) == 0 );
+		CHECK_FORMAT( memcmp( &reencodedB, &compactB, sizeof( compactB ) ) == 0 );
+	}
+
+	return numFailures;
+}
+
@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __PARTICLE_FORMAT_H__
+#define __PARTICLE_FORMAT_H__
+
+
+#include "ParticleSystem.h"
+
+
+// CPU mirror of GPUParticlePartA in Globals.h. The layout must match as this is uploaded as-is for rendering
+struct CPUParticlePartA
+{
+	DirectX::XMFLOAT4	m_TintAndAlpha;
+	DirectX::XMFLOAT2	m_VelocityXY;
+	float				m_EmitterNdotL;
+	UINT				m_EmitterProperties;
+
+	float				m_Rotation;
+	UINT				m_IsSleeping;
+	UINT				m_CollisionCount;
+	float				m_pads[ 1 ];
+};
+
+// CPU mirror of GPUParticlePartB in Globals.h
+struct CPUParticlePartB
+{
+	DirectX::XMFLOAT3	m_Position;
+	float				m_Mass;
+
+	DirectX::XMFLOAT3	m_Velocity;
+	float				m_Lifespan;
+
+	float				m_DistanceToEye;
+	float				m_Age;
+	float				m_StartSize;
+	float				m_EndSize;
+};
+
+
+// Quantized particle used by Layout_Compact. Mirrors GPUCompactParticlePartA in ParticleStorage.h.
+// The color and view space velocity are stored as halfs, the rotation and lighting term as 16-bit fractions and the sleeping flag
+// and collision count are packed into the spare bits of the emitter properties
+struct CompactParticlePartA
+{
+	UINT				m_TintAndAlpha[ 2 ];	// fp16 RGBA
+	UINT				m_VelocityXY;			// fp16 XY
+	UINT				m_RotationAndNdotL;		// Rotation as a fraction of a turn in 0-15 bits, emitter N.L in 16-31 bits
+	UINT				m_Properties;			// Emitter properties plus the COMPACT_SLEEPING_BIT and the collision count
+};
+
+// Mirrors GPUCompactParticlePartB in ParticleStorage.h. The position, velocity and age are integrated every frame so stay at full
+// precision. The distance to the eye is recomputed every frame and isn't stored
+struct CompactParticlePartB
+{
+	DirectX::XMFLOAT3	m_Position;
+	float				m_Age;
+	DirectX::XMFLOAT3	m_Velocity;
+	UINT				m_MassAndLifespan;		// fp16 mass and lifespan
+	UINT				m_StartAndEndSize;		// fp16 start and end size
+};
+
+
+// Convert to and from the compact format using the same rounding as the HLSL in ParticleStorage.h
+void EncodeCompactParticle( const CPUParticlePartA& pa, const CPUParticlePartB& pb, CompactParticlePartA& compactA, CompactParticlePartB& compactB );
+void DecodeCompactParticle( const CompactParticlePartA& compactA, const CompactParticlePartB& compactB, CPUParticlePartA& pa, CPUParticlePartB& pb );
+
+void EncodeCompactParticlePartA( const CPUParticlePartA& pa, CompactParticlePartA& compactA );
+void DecodeCompactParticlePartA( const CompactParticlePartA& compactA, CPUParticlePartA& pa );
+
+// Encode and decode a set of particles and check the results are within the expected quantization error. Returns the number of 
+// checks that failed. Run by the -validateformat command line option
+int TestCompactParticleFormat();
+
+
+#endif
@@ -25,6 +25,42 @@
 
 #include "..\\..\\DXUT\\Core\\DXUT.h"
 #include "..\\..\\AMD_SDK\\inc\\AMD_SDK.h"
+#include "Shaders/ShaderConstants.h"
+
+
+// Parameters that only change ONCE per frame. Mirrors PerFrameConstantBuffer in Globals.h
+struct PER_FRAME_CONSTANT_BUFFER
+{
+	DirectX::XMMATRIX	m_ViewProjection;
+	DirectX::XMMATRIX	m_ViewProjInv;
+	DirectX::XMMATRIX	m_View;
+	DirectX::XMMATRIX	m_ViewInv;
+	DirectX::XMMATRIX	m_Projection;
+	DirectX::XMMATRIX	m_ProjectionInv;
+	
+	DirectX::XMVECTOR	m_EyePosition;
+	DirectX::XMVECTOR	m_SunDirection;
+	DirectX::XMVECTOR	m_SunColor;
+	DirectX::XMVECTOR	m_AmbientColor;
+
+	DirectX::XMVECTOR	m_SunDirectionVS;
+	DirectX::XMVECTOR	pads2[ 3 ];
+
+	float				m_FrameTime;
+	int					m_ScreenWidth;
+	int					m_ScreenHeight;
+	int					m_FrameIndex;
+	
+	float				m_AlphaThreshold;
+	float				m_CollisionThickness;
+	float				m_ElapsedTime;
+	int					m_CollisionsEnabled;
+
+	int					m_ShowSleepingParticles;
+	int					m_EnableSleepState;
+	int					pads[ 2 ];
+	
+};
 
 
 // Implementation-agnostic particle system interface
@@ -39,7 +75,9 @@ struct IParticleSystem
 		Technique_Max
 	};
 
-	// The coarse culling mode to use, if any
+	// The coarse culling mode to use, if any. The bins are packed into a buffer that starts at two entries per particle and grows to fit 
+	// the totals read back from the GPU. Those totals arrive a few frames late, so when the particles suddenly spread over more bins than 
+	// the buffer holds, the entries that don't fit are dropped and those particles don't render until the buffer has grown
 	enum CoarseCullingMode
 	{
 		CoarseCullingOff,
@@ -49,12 +87,32 @@ struct IParticleSystem
 		NumCoarseCullingModes
 	};
 
+	// How the particle attributes are laid out in memory
+	enum Layout
+	{
+		Layout_AoS,		// Two arrays of structures split into the rendering and simulation halves of each particle
+		Layout_SoA,		// A structure of arrays with one stream per group of attributes so each pass only fetches what it uses
+		Layout_Compact,	// Like Layout_AoS but quantized to 56 bytes per particle instead of 96, see ParticleFormat.h
+		Layout_Max
+	};
+
+	// The format the tiled renderer's output is held in until it is composited. Pick the one that matches the render target's 
+	// precision, see RenderBufferFormat.h for the exact conversions
+	enum RenderBufferFormat
+	{
+		RenderBuffer_RGBA16F,	// 8 bytes per pixel
+		RenderBuffer_RGBA8,		// 4 bytes per pixel. Enough for an 8 bit render target as the colour is clamped there anyway
+		RenderBuffer_Max
+	};
+
 	// Per-frame stats from the particle system
 	struct Stats
 	{
 		int		m_MaxParticles;
 		int		m_NumActiveParticles;
 		int		m_NumDead;
+		int		m_TileSize;				// The fine-grained tile size used by the tiled renderer, or zero if the system doesn't have one
+		int		m_TileListOverflow;		// Tile list entries the tiled renderer dropped for lack of room, as of the last totals read back
 	};
 
 	enum Flags
@@ -62,10 +120,17 @@ struct IParticleSystem
 		PF_Sort = 1 << 0,				// Sort the particles
 		PF_CheapLighting = 1 << 1,		// Perform minimal lighting on the particles to ease ALU load
 		PF_NoLighting = 1 << 2,			// Do no lighting at all, just display the particle texture on the billboard
-		PF_CullMaxZ = 1 << 3,			// Do per-tile MaxZ culling if applicable
+		PF_CullMaxZ = 1 << 3,			// Do per-tile and per-bin MaxZ culling if applicable
 		PF_Streaks = 1 << 4,			// Streak the particles based on velocity
 		PF_UseGeometryShader = 1 << 5,	// Use the GS to do the billboarding, otherwise uses the VS for better performance
-		PF_ScreenSpaceCulling = 1 << 6	// Do the tile culling in screen space to avoid potential false positives with frustum culling
+		PF_ScreenSpaceCulling = 1 << 6,	// Do the tile culling in screen space to avoid potential false positives with frustum culling
+		PF_RadixSort = 1 << 7,			// Sort with a radix sort rather than a bitonic sort
+		PF_TemporalSort = 1 << 8,		// Sort by merging new particles into last frame's order. Takes precedence over PF_RadixSort
+		PF_ScreenRectBinning = 1 << 9,	// Coarse cull by writing each particle's screen rect into the bins it overlaps rather than testing it against every bin
+		PF_AdaptiveTileSize = 1 << 10,	// Pick the tiled renderer's tile size each frame from how many particles recent frames had per tile
+		PF_LowResolution = 1 << 11,		// Let the tiled renderer shade dense tiles at half or quarter resolution and upsample them when compositing
+		PF_OpacityCulling = 1 << 12,	// Stop each tile's list once the particles in front are certain to have made the whole tile opaque. Only applies to lists short enough to sort in one go
+		PF_OcclusionCulling = 1 << 13	// Skip drawing the rasterized particles that are hidden behind the opaque scene
 	};
 
 	// Per-emitter parameters
@@ -84,8 +149,36 @@ struct IParticleSystem
 		bool				m_Streaks;				// Streak the particles in the direction of travel
 	};
 
-	// Create a GPU particle system. Add more factory functions to create other types of system eg CPU-updated system
-	static IParticleSystem* CreateGPUSystem( AMD::ShaderCache& shadercache );
+	// Per-emitter properties read by the simulation. Mirrors EmitterProperties in ParticleSimulation.hlsl
+	struct EmitterProperties
+	{
+		DirectX::XMFLOAT4	m_StartColor;			// Tint of the particles at spawn time
+		DirectX::XMFLOAT4	m_EndColor;				// Tint the particles fade to as they age
+		DirectX::XMFLOAT4	m_LightingCenter;		// Centre of the vertical cylinder used for the emitter-based lighting
+	};
+
+	// Default particle capacity. The GPU system is limited to 1M (g_maxSupportedParticles in GPUParticleSystem.cpp) as that is the most 
+	// the bitonic sort in SortLib can handle with MAX_NUM_TG thread groups of 512 items, and the most the packed sort keys can index
+	static const int DefaultMaxParticles = 400 * 1024;
+
+	// Create a particle system that is simulated and rendered on the GPU. With packedSortKeys the alive list holds one uint per 
+	// particle rather than a float2, see Shaders/SortKeys.h
+	static IParticleSystem* CreateGPUSystem( AMD::ShaderCache& shadercache, Layout layout = Layout_AoS, int maxParticles = DefaultMaxParticles, bool packedSortKeys = false );
+
+	// Create a particle system that is simulated on the CPU across all cores. The tiled technique renders on the CPU as well, the 
+	// others use the GPU for rendering
+	static IParticleSystem* CreateCPUSystem( AMD::ShaderCache& shadercache, Layout layout = Layout_AoS, int maxParticles = DefaultMaxParticles );
+
+	// The shader define that selects the layout in Shaders/ParticleStorage.h. Null for Layout_AoS as that is the default
+	static const wchar_t* GetLayoutDefine( Layout layout )
+	{
+		switch ( layout )
+		{
+			case Layout_SoA:		return L"SOA_LAYOUT";
+			case Layout_Compact:	return L"COMPACT_LAYOUT";
+			default:				return nullptr;
+		}
+	}
 
 	virtual ~IParticleSystem() {}
 
@@ -97,6 +190,20 @@ struct IParticleSystem
 	// Completely resets the state of all particles. Handy for changing scenes etc
 	virtual void Reset() = 0;
 
+	// Change the particle capacity. Alive particles are carried over to the new pool, when shrinking any that don't fit are dropped
+	virtual void SetMaxParticles( int maxParticles ) = 0;
+	virtual int GetMaxParticles() const = 0;
+
+	// Update entries in the emitter property table. The table is indexed by the emitter's position in the array passed to Render and 
+	// persists between frames, so only emitters whose properties change need to be set. It grows as needed up to MAX_EMITTERS
+	virtual void SetEmitterProperties( int firstEmitter, int numEmitters, const EmitterProperties* properties ) = 0;
+
+	// Set the format of the tiled renderer's output. Systems without a tiled renderer can ignore this
+	virtual void SetRenderBufferFormat( RenderBufferFormat format ) = 0;
+
+	// Hand the system a CPU copy of this frame's constants. Systems that only read the bound constant buffer can ignore this
+	virtual void SetPerFrameConstants( const PER_FRAME_CONSTANT_BUFFER& constants ) = 0;
+
 	// Render the system given a frame delta.
 	virtual void Render( float frameTime, int flags, Technique technique, CoarseCullingMode coarseCullingMode, const EmitterParams* pEmitters, int nNumEmitters, ID3D11ShaderResourceView* depthSRV ) = 0;
 	
@@ -0,0 +1,473 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "ParticleTrace.h"
+#include <algorithm>
+
+
+// A trace file is a header, a chunk per frame and then the file offset of every chunk so replay can seek. Each chunk holds one frame's 
+// record, which is its fixed size fields followed by its emitters and emitter properties written as they are in memory. A trace is 
+// therefore only readable by a build with the same structure layouts, which the version and frame size guard.
+//
+// Unless the chunk is a keyframe the record is XORed with the previous frame's record first. Most of a frame is the same as the last
+// one so that leaves long runs of zeros, which are encoded as pairs of counts: the zero bytes to skip and then the number of literal
+// bytes that follow. A keyframe is written whenever the record size changes as well as at a fixed interval
+static const UINT g_TraceMagic = 0x43525450;	// "PTRC"
+static const UINT g_TraceVersion = 2;
+
+struct TraceFileHeader
+{
+	UINT	m_Magic;
+	UINT	m_Version;
+	UINT	m_FrameSize;		// sizeof( TraceFileFrame ), to catch traces written with a different PER_FRAME_CONSTANT_BUFFER
+	UINT	m_NumFrames;
+	UINT64	m_IndexOffset;
+};
+
+struct TraceFileChunk
+{
+	UINT	m_RecordSize;
+	UINT	m_EncodedSize;
+	UINT	m_Keyframe;
+	UINT	m_Pad;
+};
+
+struct TraceFileFrame
+{
+	PER_FRAME_CONSTANT_BUFFER	m_Constants;
+	float						m_FrameTime;
+	int							m_Flags;
+	int							m_Technique;
+	int							m_CoarseCullingMode;
+	int							m_Scene;
+	int							m_NumEmitters;
+};
+
+
+// Flatten a frame into its record
+static void SerializeFrame( const ParticleTraceFrame& frame, std::vector<unsigned char>& record )
+{
+	TraceFileFrame fileFrame;
+	ZeroMemory( &fileFrame, sizeof( fileFrame ) );
+	fileFrame.m_Constants = frame.m_Constants;
+	fileFrame.m_FrameTime = frame.m_FrameTime;
+	fileFrame.m_Flags = frame.m_Flags;
+	fileFrame.m_Technique = frame.m_Technique;
+	fileFrame.m_CoarseCullingMode = frame.m_CoarseCullingMode;
+	fileFrame.m_Scene = frame.m_Scene;
+	fileFrame.m_NumEmitters = (int)frame.m_Emitters.size();
+
+	size_t emittersSize = frame.m_Emitters.size() * sizeof( IParticleSystem::EmitterParams );
+	size_t propertiesSize = frame.m_EmitterProperties.size() * sizeof( IParticleSystem::EmitterProperties );
+
+	record.resize( sizeof( fileFrame ) + emittersSize + propertiesSize );
+	memcpy( &record[ 0 ], &fileFrame, sizeof( fileFrame ) );
+	if ( emittersSize > 0 )
+	{
+		memcpy( &record[ sizeof( fileFrame ) ], &frame.m_Emitters[ 0 ], emittersSize );
+		memcpy( &record[ sizeof( fileFrame ) + emittersSize ], &frame.m_EmitterProperties[ 0 ], propertiesSize );
+	}
+}
+
+
+// Unpack a record back into a frame. Returns false if the record is malformed
+static bool DeserializeFrame( const std::vector<unsigned char>& record, ParticleTraceFrame& frame )
+{
+	TraceFileFrame fileFrame;
+	if ( record.size() < sizeof( fileFrame ) )
+		return false;
+
+	memcpy( &fileFrame, &record[ 0 ], sizeof( fileFrame ) );
+	if ( fileFrame.m_NumEmitters < 0 || fileFrame.m_NumEmitters > MAX_EMITTERS )
+		return false;
+
+	size_t emittersSize = fileFrame.m_NumEmitters * sizeof( IParticleSystem::EmitterParams );
+	size_t propertiesSize = fileFrame.m_NumEmitters * sizeof( IParticleSystem::EmitterProperties );
+	if ( record.size() != sizeof( fileFrame ) + emittersSize + propertiesSize )
+		return false;
+
+	frame.m_Constants = fileFrame.m_Constants;
+	frame.m_FrameTime = fileFrame.m_FrameTime;
+	frame.m_Flags = fileFrame.m_Flags;
+	frame.m_Technique = (IParticleSystem::Technique)fileFrame.m_Technique;
+	frame.m_CoarseCullingMode = (IParticleSystem::CoarseCullingMode)fileFrame.m_CoarseCullingMode;
+	frame.m_Scene = fileFrame.m_Scene;
+	frame.m_Emitters.resize( fileFrame.m_NumEmitters );
+	frame.m_EmitterProperties.resize( fileFrame.m_NumEmitters );
+
+	if ( fileFrame.m_NumEmitters > 0 )
+	{
+		memcpy( &frame.m_Emitters[ 0 ], &record[ sizeof( fileFrame ) ], emittersSize );
+		memcpy( &frame.m_EmitterProperties[ 0 ], &record[ sizeof( fileFrame ) + emittersSize ], propertiesSize );
+	}
+
+	return true;
+}
+
+
+// Counts are stored 7 bits at a time with the top bit set on every byte but the last
+static void WriteCount( std::vector<unsigned char>& encoded, size_t count )
+{
+	while ( count >= 0x80 )
+	{
+		encoded.push_back( (unsigned char)( count | 0x80 ) );
+		count >>= 7;
+	}
+	encoded.push_back( (unsigned char)count );
+}
+
+
+static bool ReadCount( const unsigned char*& pData, const unsigned char* pEnd, size_t& count )
+{
+	count = 0;
+	for ( int shift = 0; shift < 35; shift += 7 )
+	{
+		if ( pData == pEnd )
+			return false;
+
+		unsigned char byte = *pData++;
+		count |= (size_t)( byte & 0x7f ) << shift;
+		if ( ( byte & 0x80 ) == 0 )
+			return true;
+	}
+
+	return false;
+}
+
+
+// Encode record, or its difference to previous if there is one, as runs of zero and literal bytes
+static void EncodeRecord( const std::vector<unsigned char>& record, const std::vector<unsigned char>* previous, std::vector<unsigned char>& encoded )
+{
+	encoded.clear();
+
+	size_t size = record.size();
+	std::vector<unsigned char> delta( record );
+	if ( previous )
+	{
+		for ( size_t i = 0; i < size; i++ )
+		{
+			delta[ i ] ^= (*previous)[ i ];
+		}
+	}
+
+	size_t i = 0;
+	while ( i < size )
+	{
+		size_t zeros = 0;
+		while ( i + zeros < size && delta[ i + zeros ] == 0 )
+		{
+			zeros++;
+		}
+		i += zeros;
+
+		// A single zero byte is cheaper to keep in the literals than to start a new run for
+		size_t literals = 0;
+		while ( i + literals < size && ( delta[ i + literals ] != 0 || ( i + literals + 1 < size && delta[ i + literals + 1 ] != 0 ) ) )
+		{
+			literals++;
+		}
+
+		WriteCount( encoded, zeros );
+		WriteCount( encoded, literals );
+		encoded.insert( encoded.end(), delta.begin() + i, delta.begin() + i + literals );
+		i += literals;
+	}
+}
+
+
+ParticleTraceWriter::ParticleTraceWriter() :
+	m_File( nullptr ),
+	m_Failed( false ),
+	m_KeyframeInterval( 300 )
+{
+}
+
+
+ParticleTraceWriter::~ParticleTraceWriter()
+{
+	Close();
+}
+
+
+bool ParticleTraceWriter::Open( const wchar_t* path, int keyframeInterval )
+{
+	Close();
+
+	_wfopen_s( &m_File, path, L"wb" );
+	if ( !m_File )
+		return false;
+
+	m_Failed = false;
+	m_KeyframeInterval = std::max( 1, keyframeInterval );
+	m_FrameOffsets.clear();
+	m_PreviousRecord.clear();
+
+	// The header is rewritten with the frame count and index offset once the trace is closed
+	TraceFileHeader header;
+	ZeroMemory( &header, sizeof( header ) );
+	m_Failed = fwrite( &header, sizeof( header ), 1, m_File ) != 1;
+
+	return !m_Failed;
+}
+
+
+void ParticleTraceWriter::AddFrame( const ParticleTraceFrame& frame )
+{
+	if ( !m_File || m_Failed )
+		return;
+
+	SerializeFrame( frame, m_Record );
+
+	bool keyframe = ( m_FrameOffsets.size() % m_KeyframeInterval ) == 0 || m_Record.size() != m_PreviousRecord.size();
+	EncodeRecord( m_Record, keyframe ? nullptr : &m_PreviousRecord, m_Encoded );
+
+	TraceFileChunk chunk;
+	chunk.m_RecordSize = (UINT)m_Record.size();
+	chunk.m_EncodedSize = (UINT)m_Encoded.size();
+	chunk.m_Keyframe = keyframe ? 1 : 0;
+	chunk.m_Pad = 0;
+
+	m_FrameOffsets.push_back( (UINT64)_ftelli64( m_File ) );
+	m_Failed = fwrite( &chunk, sizeof( chunk ), 1, m_File ) != 1 || fwrite( &m_Encoded[ 0 ], m_Encoded.size(), 1, m_File ) != 1;
+
+	m_PreviousRecord.swap( m_Record );
+}
+
+
+bool ParticleTraceWriter::Close()
+{
+	if ( !m_File )
+		return false;
+
+	TraceFileHeader header;
+	header.m_Magic = g_TraceMagic;
+	header.m_Version = g_TraceVersion;
+	header.m_FrameSize = sizeof( TraceFileFrame );
+	header.m_NumFrames = (UINT)m_FrameOffsets.size();
+	header.m_IndexOffset = (UINT64)_ftelli64( m_File );
+
+	if ( !m_Failed && !m_FrameOffsets.empty() )
+	{
+		m_Failed = fwrite( &m_FrameOffsets[ 0 ], sizeof( UINT64 ), m_FrameOffsets.size(), m_File ) != m_FrameOffsets.size();
+	}
+
+	if ( !m_Failed )
+	{
+		m_Failed = _fseeki64( m_File, 0, SEEK_SET ) != 0 || fwrite( &header, sizeof( header ), 1, m_File ) != 1;
+	}
+
+	m_Failed = fclose( m_File ) != 0 || m_Failed;
+	m_File = nullptr;
+
+	return !m_Failed;
+}
+
+
+ParticleTraceReader::ParticleTraceReader() :
+	m_File( INVALID_HANDLE_VALUE ),
+	m_Mapping( nullptr ),
+	m_pData( nullptr ),
+	m_Size( 0 ),
+	m_NumFrames( 0 ),
+	m_IndexOffset( 0 ),
+	m_RecordFrame( -1 )
+{
+}
+
+
+ParticleTraceReader::~ParticleTraceReader()
+{
+	Close();
+}
+
+
+bool ParticleTraceReader::Open( const wchar_t* path )
+{
+	Close();
+
+	m_File = CreateFileW( path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if ( m_File == INVALID_HANDLE_VALUE )
+		return false;
+
+	LARGE_INTEGER size;
+	if ( !GetFileSizeEx( m_File, &size ) || size.QuadPart < (LONGLONG)sizeof( TraceFileHeader ) )
+	{
+		Close();
+		return false;
+	}
+
+	m_Mapping = CreateFileMappingW( m_File, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	m_pData = m_Mapping ? (const unsigned char*)MapViewOfFile( m_Mapping, FILE_MAP_READ, 0, 0, 0 ) : nullptr;
+	if ( !m_pData )
+	{
+		Close();
+		return false;
+	}
+	m_Size = (UINT64)size.QuadPart;
+
+	TraceFileHeader header;
+	memcpy( &header, m_pData, sizeof( header ) );
+
+	bool ok = header.m_Magic == g_TraceMagic && header.m_Version == g_TraceVersion && header.m_FrameSize == sizeof( TraceFileFrame ) &&
+			  header.m_IndexOffset >= sizeof( header ) && header.m_IndexOffset <= m_Size && 
+			  header.m_NumFrames <= ( m_Size - header.m_IndexOffset ) / sizeof( UINT64 );
+	if ( !ok )
+	{
+		Close();
+		return false;
+	}
+
+	m_NumFrames = (int)header.m_NumFrames;
+	m_IndexOffset = header.m_IndexOffset;
+	m_RecordFrame = -1;
+
+	return true;
+}
+
+
+void ParticleTraceReader::Close()
+{
+	if ( m_pData )
+	{
+		UnmapViewOfFile( m_pData );
+		m_pData = nullptr;
+	}
+
+	if ( m_Mapping )
+	{
+		CloseHandle( m_Mapping );
+		m_Mapping = nullptr;
+	}
+
+	if ( m_File != INVALID_HANDLE_VALUE )
+	{
+		CloseHandle( m_File );
+		m_File = INVALID_HANDLE_VALUE;
+	}
+
+	m_Size = 0;
+	m_NumFrames = 0;
+	m_IndexOffset = 0;
+	m_Record.clear();
+	m_RecordFrame = -1;
+}
+
+
+bool ParticleTraceReader::ReadFrame( int index, ParticleTraceFrame& frame )
+{
+	if ( index < 0 || index >= m_NumFrames )
+		return false;
+
+	// Carry on from the last decoded frame if we can, otherwise go back to the keyframe the requested frame depends on
+	int first = index;
+	if ( m_RecordFrame >= 0 && m_RecordFrame <= index )
+	{
+		first = m_RecordFrame + 1;
+	}
+	else
+	{
+		const unsigned char* pChunk = nullptr;
+		while ( first > 0 && GetChunk( first, pChunk ) )
+		{
+			TraceFileChunk chunk;
+			memcpy( &chunk, pChunk, sizeof( chunk ) );
+			if ( chunk.m_Keyframe )
+				break;
+
+			first--;
+		}
+	}
+
+	for ( int i = first; i <= index; i++ )
+	{
+		if ( !DecodeRecord( i ) )
+		{
+			m_RecordFrame = -1;
+			return false;
+		}
+	}
+
+	return DeserializeFrame( m_Record, frame );
+}
+
+
+// Find a frame's chunk, checking that it and its encoded record lie before the index
+bool ParticleTraceReader::GetChunk( int index, const unsigned char*& pChunk ) const
+{
+	UINT64 offset = 0;
+	memcpy( &offset, m_pData + m_IndexOffset + index * sizeof( UINT64 ), sizeof( offset ) );
+
+	if ( offset < sizeof( TraceFileHeader ) || offset > m_IndexOffset || m_IndexOffset - offset < sizeof( TraceFileChunk ) )
+		return false;
+
+	// The chunks aren't aligned so copy the header out before looking at it
+	TraceFileChunk chunk;
+	memcpy( &chunk, m_pData + offset, sizeof( chunk ) );
+	if ( chunk.m_EncodedSize > m_IndexOffset - offset - sizeof( chunk ) )
+		return false;
+
+	pChunk = m_pData + offset;
+	return true;
+}
+
+
+bool ParticleTraceReader::DecodeRecord( int index )
+{
+	const unsigned char* pChunk = nullptr;
+	if ( !GetChunk( index, pChunk ) )
+		return false;
+
+	TraceFileChunk chunk;
+	memcpy( &chunk, pChunk, sizeof( chunk ) );
+
+	// A keyframe starts from zero, anything else is applied on top of the previous frame
+	if ( chunk.m_Keyframe )
+	{
+		m_Record.assign( chunk.m_RecordSize, 0 );
+	}
+	else if ( m_RecordFrame != index - 1 || m_Record.size() != chunk.m_RecordSize )
+	{
+		return false;
+	}
+
+	const unsigned char* pData = pChunk + sizeof( chunk );
+	const unsigned char* pEnd = pData + chunk.m_EncodedSize;
+
+	size_t i = 0;
+	while ( pData < pEnd )
+	{
+		size_t zeros = 0, literals = 0;
+		if ( !ReadCount( pData, pEnd, zeros ) || !ReadCount( pData, pEnd, literals ) )
+			return false;
+
+		if ( zeros > m_Record.size() - i || literals > m_Record.size() - i - zeros || literals > (size_t)( pEnd - pData ) )
+			return false;
+
+		i += zeros;
+		for ( size_t j = 0; j < literals; j++ )
+		{
+			m_Record[ i++ ] ^= *pData++;
+		}
+	}
+
+	m_RecordFrame = index;
+	return true;
+}
@@ -0,0 +1,107 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __PARTICLE_TRACE_H__
+#define __PARTICLE_TRACE_H__
+
+
+#include "ParticleSystem.h"
+#include <vector>
+
+
+// Everything the sample hands to the particle system for one frame. The camera is captured through the matrices in the constants
+struct ParticleTraceFrame
+{
+	PER_FRAME_CONSTANT_BUFFER						m_Constants;
+	float											m_FrameTime;
+	int												m_Flags;
+	IParticleSystem::Technique						m_Technique;
+	IParticleSystem::CoarseCullingMode				m_CoarseCullingMode;
+	int												m_Scene;				// The sample scene rendered into the depth buffer the particles collide with
+	std::vector<IParticleSystem::EmitterParams>		m_Emitters;
+	std::vector<IParticleSystem::EmitterProperties>	m_EmitterProperties;	// The emitter table entry of each emitter
+};
+
+
+// Streams frames to a trace file as they are recorded. Each frame is stored as the difference to the previous one with the unchanged
+// bytes run-length encoded away, apart from a keyframe every so often that replay can seek to. See the -record command line option
+class ParticleTraceWriter
+{
+public:
+
+	ParticleTraceWriter();
+	~ParticleTraceWriter();
+
+	bool Open( const wchar_t* path, int keyframeInterval = 300 );
+	bool IsOpen() const { return m_File != nullptr; }
+
+	void AddFrame( const ParticleTraceFrame& frame );
+
+	// Write the frame index and finish the header. Returns false if anything failed to write since the trace was opened
+	bool Close();
+
+private:
+
+	FILE*						m_File;
+	bool						m_Failed;
+	int							m_KeyframeInterval;
+	std::vector<UINT64>			m_FrameOffsets;
+	std::vector<unsigned char>	m_Record;
+	std::vector<unsigned char>	m_PreviousRecord;
+	std::vector<unsigned char>	m_Encoded;
+};
+
+
+// Memory maps a trace file for replay and decodes frames out of it on request. Reading the frames in order is the fast path, any 
+// other order decodes forward from the closest keyframe. See the -benchmark command line option
+class ParticleTraceReader
+{
+public:
+
+	ParticleTraceReader();
+	~ParticleTraceReader();
+
+	bool Open( const wchar_t* path );
+	void Close();
+
+	int GetNumFrames() const { return m_NumFrames; }
+
+	bool ReadFrame( int index, ParticleTraceFrame& frame );
+
+private:
+
+	bool GetChunk( int index, const unsigned char*& pChunk ) const;
+	bool DecodeRecord( int index );
+
+	HANDLE						m_File;
+	HANDLE						m_Mapping;
+	const unsigned char*		m_pData;
+	UINT64						m_Size;
+
+	int							m_NumFrames;
+	UINT64						m_IndexOffset;			// Where the offset of each frame's chunk is stored
+
+	std::vector<unsigned char>	m_Record;				// The raw record of the last decoded frame
+	int							m_RecordFrame;
+};
+
+
+#endif
@@ -0,0 +1,179 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "RenderBufferFormat.h"
+#include <string.h>
+
+
+static inline UINT FloatBits( float value )
+{
+	UINT bits;
+	memcpy( &bits, &value, sizeof( bits ) );
+	return bits;
+}
+
+
+static inline float BitsToFloat( UINT bits )
+{
+	float value;
+	memcpy( &value, &bits, sizeof( value ) );
+	return value;
+}
+
+
+UINT16 FloatToHalf( float value )
+{
+	UINT bits = FloatBits( value );
+	UINT sign = ( bits >> 16 ) & 0x8000;
+	UINT magnitude = bits & 0x7fffffff;
+
+	// NaN keeps its top mantissa bits, with the quiet bit set so it can't turn into infinity
+	if ( magnitude > 0x7f800000 )
+		return (UINT16)( sign | 0x7e00 | ( ( magnitude >> 13 ) & 0x3ff ) );
+
+	// Too large, including infinity. 0x477ff000 is half way between the largest half and the next power of two
+	if ( magnitude >= 0x477ff000 )
+		return (UINT16)( sign | 0x7c00 );
+
+	// Normal halves. Rebias the exponent and round the 13 dropped mantissa bits to nearest even
+	if ( magnitude >= 0x38800000 )
+	{
+		UINT rebiased = magnitude - ( ( 127 - 15 ) << 23 );
+		UINT rounded = rebiased + 0x0fff + ( ( rebiased >> 13 ) & 1 );
+		return (UINT16)( sign | ( rounded >> 13 ) );
+	}
+
+	// Denormal halves, or zero. Shift the mantissa with its implicit bit down to the denormal's scale then round to nearest even
+	if ( magnitude < 0x33000000 )
+		return (UINT16)sign;
+
+	UINT exponent = magnitude >> 23;
+	UINT mantissa = ( magnitude & 0x007fffff ) | 0x00800000;
+	UINT shift = 126 - exponent;
+	UINT halfway = 1u << ( shift - 1 );
+	UINT dropped = mantissa & ( ( 1u << shift ) - 1 );
+	UINT result = mantissa >> shift;
+	if ( dropped > halfway || ( dropped == halfway && ( result & 1 ) ) )
+		result++;
+	return (UINT16)( sign | result );
+}
+
+
+float HalfToFloat( UINT16 value )
+{
+	UINT sign = ( (UINT)value & 0x8000 ) << 16;
+	UINT exponent = ( value >> 10 ) & 0x1f;
+	UINT mantissa = value & 0x3ff;
+
+	if ( exponent == 0x1f )
+		return BitsToFloat( sign | 0x7f800000 | ( mantissa << 13 ) );
+
+	if ( exponent == 0 )
+	{
+		// Zero or a denormal, which is the mantissa scaled by 2^-24
+		float magnitude = (float)mantissa * ( 1.0f / 16777216.0f );
+		return sign ? -magnitude : magnitude;
+	}
+
+	return BitsToFloat( sign | ( ( exponent + 127 - 15 ) << 23 ) | ( mantissa << 13 ) );
+}
+
+
+UINT8 FloatToUNorm8( float value )
+{
+	// Written so NaN fails both tests and ends up as zero
+	if ( !( value > 0.0f ) )
+		return 0;
+	if ( !( value < 1.0f ) )
+		return 255;
+
+	return (UINT8)( value * 255.0f + 0.5f );
+}
+
+
+float UNorm8ToFloat( UINT8 value )
+{
+	return (float)value / 255.0f;
+}
+
+
+DXGI_FORMAT GetRenderBufferDXGIFormat( IParticleSystem::RenderBufferFormat format )
+{
+	return format == IParticleSystem::RenderBuffer_RGBA8 ? DXGI_FORMAT_R8G8B8A8_UNORM : DXGI_FORMAT_R16G16B16A16_FLOAT;
+}
+
+
+int GetRenderBufferBytesPerPixel( IParticleSystem::RenderBufferFormat format )
+{
+	return format == IParticleSystem::RenderBuffer_RGBA8 ? 4 : 8;
+}
+
+
+void PackRenderBufferPixel( IParticleSystem::RenderBufferFormat format, const DirectX::XMFLOAT4& pixel, void* dst )
+{
+	if ( format == IParticleSystem::RenderBuffer_RGBA8 )
+	{
+		UINT8 packed[ 4 ] = { FloatToUNorm8( pixel.x ), FloatToUNorm8( pixel.y ), FloatToUNorm8( pixel.z ), FloatToUNorm8( pixel.w ) };
+		memcpy( dst, packed, sizeof( packed ) );
+	}
+	else
+	{
+		UINT16 packed[ 4 ] = { FloatToHalf( pixel.x ), FloatToHalf( pixel.y ), FloatToHalf( pixel.z ), FloatToHalf( pixel.w ) };
+		memcpy( dst, packed, sizeof( packed ) );
+	}
+}
+
+
+DirectX::XMFLOAT4 UnpackRenderBufferPixel( IParticleSystem::RenderBufferFormat format, const void* src )
+{
+	if ( format == IParticleSystem::RenderBuffer_RGBA8 )
+	{
+		UINT8 packed[ 4 ];
+		memcpy( packed, src, sizeof( packed ) );
+		return DirectX::XMFLOAT4( UNorm8ToFloat( packed[ 0 ] ), UNorm8ToFloat( packed[ 1 ] ), UNorm8ToFloat( packed[ 2 ] ), UNorm8ToFloat( packed[ 3 ] ) );
+	}
+	else
+	{
+		UINT16 packed[ 4 ];
+		memcpy( packed, src, sizeof( packed ) );
+		return DirectX::XMFLOAT4( HalfToFloat( packed[ 0 ] ), HalfToFloat( packed[ 1 ] ), HalfToFloat( packed[ 2 ] ), HalfToFloat( packed[ 3 ] ) );
+	}
+}
+
+
+void PackRenderBuffer( IParticleSystem::RenderBufferFormat format, const DirectX::XMFLOAT4* pixels, int numPixels, void* dst )
+{
+	const int bytesPerPixel = GetRenderBufferBytesPerPixel( format );
+	for ( int i = 0; i < numPixels; i++ )
+	{
+		PackRenderBufferPixel( format, pixels[ i ], (BYTE*)dst + i * bytesPerPixel );
+	}
+}
+
+
+void UnpackRenderBuffer( IParticleSystem::RenderBufferFormat format, const void* src, int numPixels, DirectX::XMFLOAT4* pixels )
+{
+	const int bytesPerPixel = GetRenderBufferBytesPerPixel( format );
+	for ( int i = 0; i < numPixels; i++ )
+	{
+		pixels[ i ] = UnpackRenderBufferPixel( format, (const BYTE*)src + i * bytesPerPixel );
+	}
+}
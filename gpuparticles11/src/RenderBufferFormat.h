@@ -0,0 +1,56 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __RENDER_BUFFER_FORMAT_H__
+#define __RENDER_BUFFER_FORMAT_H__
+
+
+#include "ParticleSystem.h"
+
+
+// The exact conversions between the tiled renderer's float RGBA output and the render buffer formats. They are plain bit 
+// manipulation with no dependency on the GPU or on DirectXMath's conversion routines, so images from the software rasterizer can be 
+// packed for bit-exact comparison with the GPU, and buffers read back from the GPU can be unpacked on any platform
+//
+// Float16 conversion rounds to nearest even. Values too large for a half become infinity, values too small become zero, or a 
+// denormal if one is close enough, and NaNs stay NaNs. UNORM8 conversion clamps to [0, 1], turns NaN into zero, scales by 255 and 
+// rounds half up, as the D3D11 spec requires of typed UAV stores
+
+// Scalar conversions
+UINT16 FloatToHalf( float value );
+float HalfToFloat( UINT16 value );
+UINT8 FloatToUNorm8( float value );
+float UNorm8ToFloat( UINT8 value );
+
+// The DXGI format the render buffer is created with, and how many bytes each pixel takes
+DXGI_FORMAT GetRenderBufferDXGIFormat( IParticleSystem::RenderBufferFormat format );
+int GetRenderBufferBytesPerPixel( IParticleSystem::RenderBufferFormat format );
+
+// Pack a pixel into the format's memory layout, RGBA from the lowest address. dst must hold GetRenderBufferBytesPerPixel bytes
+void PackRenderBufferPixel( IParticleSystem::RenderBufferFormat format, const DirectX::XMFLOAT4& pixel, void* dst );
+DirectX::XMFLOAT4 UnpackRenderBufferPixel( IParticleSystem::RenderBufferFormat format, const void* src );
+
+// Pack or unpack a run of pixels
+void PackRenderBuffer( IParticleSystem::RenderBufferFormat format, const DirectX::XMFLOAT4* pixels, int numPixels, void* dst );
+void UnpackRenderBuffer( IParticleSystem::RenderBufferFormat format, const void* src, int numPixels, DirectX::XMFLOAT4* pixels );
+
+
+#endif
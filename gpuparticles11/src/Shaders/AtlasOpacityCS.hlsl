@@ -0,0 +1,79 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// Measures how opaque the core of each texture in the particle atlas is, for the opacity culling in CullingCS.hlsl. The core is the 
+// disc of OPACITY_CULL_CORE_RADIUS of the billboard's radius, which stays the same whatever the particle's rotation. Filtering can 
+// pull in texels up to a texel outside the disc, so the lowest alpha is taken over the disc's bounding box grown by a texel
+//
+
+#include "ShaderConstants.h"
+
+
+// The particle texture atlas. Bound by the application for the tiled renderer
+Texture2D 							g_ParticleTexture				: register( t6 );
+
+// The lowest alpha in the core of each texture in the atlas
+RWBuffer<float>						g_AtlasCoreOpacity				: register( u0 );
+
+
+groupshared uint					g_ldsMinAlpha;
+
+
+// One thread group per texture in the atlas
+[numthreads(ATLAS_OPACITY_THREADS, ATLAS_OPACITY_THREADS, 1)]
+void MeasureCoreOpacity( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID )
+{
+	if ( localIdx.x == 0 && localIdx.y == 0 )
+	{
+		g_ldsMinAlpha = asuint( 1.0 );
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	uint width, height;
+	g_ParticleTexture.GetDimensions( width, height );
+
+	// The textures sit side by side in the atlas
+	float2 slotSize = float2( width / NUM_ATLAS_SLOTS, height );
+	float2 centre = float2( groupIdx.x + 0.5, 0.5 ) * slotSize;
+	float2 radius = 0.5 * OPACITY_CULL_CORE_RADIUS * slotSize + 1;
+
+	int2 minTexel = max( (int2)floor( centre - radius ), 0 );
+	int2 maxTexel = min( (int2)ceil( centre + radius ), int2( width, height ) );
+
+	// Once saturated the alpha is never negative, and abs turns a negative zero positive, so the float compares the same as its bits
+	for ( int y = minTexel.y + localIdx.y; y < maxTexel.y; y += ATLAS_OPACITY_THREADS )
+	{
+		for ( int x = minTexel.x + localIdx.x; x < maxTexel.x; x += ATLAS_OPACITY_THREADS )
+		{
+			float alpha = saturate( g_ParticleTexture.Load( int3( x, y, 0 ) ).a );
+			InterlockedMin( g_ldsMinAlpha, asuint( abs( alpha ) ) );
+		}
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( localIdx.x == 0 && localIdx.y == 0 )
+	{
+		g_AtlasCoreOpacity[ groupIdx.x ] = asfloat( g_ldsMinAlpha );
+	}
+}
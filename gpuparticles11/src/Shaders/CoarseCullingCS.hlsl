@@ -21,6 +21,7 @@
 //
 #include "ShaderConstants.h"
 #include "Globals.h"
+#include "SortKeys.h"
 
 // Shader inputs
 // =============
@@ -28,27 +29,54 @@
 // View space positions of the particles
 StructuredBuffer<float4>			g_ViewSpacePositions				: register( t0 );
 
-// The maximum radius in X & Y of each particle
-StructuredBuffer<float>				g_MaxRadiusBuffer					: register( t1 );
+// The maximum radius in X & Y of each particle. The second component is only used by the opacity culling
+StructuredBuffer<float2>			g_MaxRadiusBuffer					: register( t1 );
 
-// The alive particle list. X is the unused distance to the camera, Y stores the global particle index
-StructuredBuffer<float2>			g_AliveIndexBuffer					: register( t2 );
+// The alive particle list. Only the global particle index is used
+StructuredBuffer<SortItem>			g_AliveIndexBuffer					: register( t2 );
+
+// The nearest and furthest view space depth of the opaque scene in each bin, see DepthBoundsCS.hlsl
+StructuredBuffer<float2>			g_CoarseBinDepthBounds				: register( t3 );
 
 
 // Shader outputs
 // ==============
 
-// The index buffer for each bin. This is allocated as NumBins * MaxParticles
+// The index buffer for all the bins. Each bin's particles are stored contiguously from the bin's offset, so the buffer only has 
+// to hold the particles that were actually binned. Entries past g_CoarseBinCapacity are dropped
 RWBuffer<uint>						g_CoarseTiledIndexBuffer			: register( u0 );
 
 // The per-bin counters of how many particles are in each bin
 RWBuffer<uint>						g_CoarseTiledIndexBufferCounters	: register( u1 );
 
+// Each thread group's count of particles per bin, turned into the group's offset into each bin by CoarseBinScan
+RWBuffer<uint>						g_GroupBinCounts					: register( u2 );
+
+// The offset of each bin in the index buffer. The element after the last bin holds the total number of entries
+RWBuffer<uint>						g_CoarseTiledIndexBufferOffsets		: register( u3 );
+
+
+// Bins are filled in three passes so there are no global atomics and the bins can be packed together. CoarseBinCount counts the 
+// particles per bin in each thread group, CoarseBinScan turns those counts into each group's offset in each bin, and CoarseBinScatter 
+// lays the bins out one after the other and writes the particles out at their group's offsets.
+//
+// Without SCREEN_RECT_BINNING each particle is tested against every bin's frustum planes. With it, each particle's bounding sphere 
+// is projected to a screen rectangle once and the particle goes in the bins that rectangle overlaps
+
+#if NUM_COARSE_TILES > COARSE_CULLING_THREADS || NUM_COARSE_TILES > COARSE_BINNING_SCAN_THREADS
+#error The bin offsets are scanned in LDS with one thread per bin
+#endif
 
 
 // LDS to store the frustum data per bin
 groupshared float3 g_FrustumData[ NUM_COARSE_CULLING_TILES_X ][ NUM_COARSE_CULLING_TILES_Y ][ 4 ];
 
+// LDS per-bin counts for CoarseBinCount, then per-bin write positions for CoarseBinScatter
+groupshared uint g_ldsBinCounts[ NUM_COARSE_TILES ];
+
+// LDS for the scan of one bin's group counts, or of the bin sizes
+groupshared uint g_ldsScan[ COARSE_BINNING_SCAN_THREADS ];
+
 
 // Initialize the LDS
 // Calculate the per-bin frusta using one thread to calc one bin's set of frustum planes.
@@ -59,8 +87,8 @@ void initLDS( uint localIdx )
 	if ( localIdx < NUM_COARSE_TILES )
 	{
 		// Calculate the coarse tile dimensions to be a multiple of the fine-grained tile size
-		uint coarseTileWidth = g_NumCullingTilesPerCoarseTileX * TILE_RES_X;
-		uint coarseTileHeight = g_NumCullingTilesPerCoarseTileY * TILE_RES_Y;
+		uint coarseTileWidth = g_NumCullingTilesPerCoarseTileX * g_TileResX;
+		uint coarseTileHeight = g_NumCullingTilesPerCoarseTileY * g_TileResY;
 
 		// Get the coarse tile index
 		uint tileX = localIdx % NUM_COARSE_CULLING_TILES_X;
@@ -86,70 +114,231 @@ void initLDS( uint localIdx )
 }
 
 
-// Add a global particle index to a bin
-void addToBuffer( uint bufferIndex, uint particleGlobalIndex )
+// Project a bounding sphere to a conservative screen rectangle and find the bins it overlaps, as xy = first bin and zw = last bin.
+// Returns false if the sphere is behind the eye or off screen. Mirrored by GetCoarseBinRange in CoarseBinning.cpp
+bool GetCoarseBinRange( float3 center, float r, out int4 binRange )
+{
+	binRange = 0;
+
+	float2 pixelMin, pixelMax;
+	if ( !GetSphereScreenBounds( center, r, pixelMin, pixelMax ) )
+		return false;
+
+	// The bins are whole numbers of culling tiles so the last row and column can hang off the screen
+	float2 binSize = float2( g_NumCullingTilesPerCoarseTileX * g_TileResX, g_NumCullingTilesPerCoarseTileY * g_TileResY );
+	float2 maxBin = float2( NUM_COARSE_CULLING_TILES_X - 1, NUM_COARSE_CULLING_TILES_Y - 1 );
+
+	binRange.xy = (int2)clamp( floor( pixelMin / binSize ), 0.0, maxBin );
+	binRange.zw = (int2)clamp( floor( pixelMax / binSize ), 0.0, maxBin );
+	return true;
+}
+
+
+// Find the particle a thread bins and the range of bins it may go in. Returns false for threads past the end of the alive list and 
+// particles that can't be visible
+bool GetParticleBins( uint aliveIndex, out uint index, out float3 center, out float r, out int4 binRange )
 {
-	// Atomically increment the bin's counter
-	uint dstIdx = 0;
-	InterlockedAdd( g_CoarseTiledIndexBufferCounters[ bufferIndex ], 1, dstIdx );
+	index = 0;
+	center = 0;
+	r = 0;
+	binRange = 0;
+
+	if ( aliveIndex >= g_NumActiveParticles )
+		return false;
 
-	// The stride into this particular bin is not MaxParticles, but the current frame's number of alive particles. This *might* improve locallity of data
-	dstIdx += bufferIndex * g_NumActiveParticles;
+	index = SortItemIndex( g_AliveIndexBuffer[ aliveIndex ] );
+	center = g_ViewSpacePositions[ index ].xyz;
+	r = g_MaxRadiusBuffer[ index ].x;
 
-	// Write the global index to the bin
-	g_CoarseTiledIndexBuffer[ dstIdx ] = particleGlobalIndex;
+#if defined (SCREEN_RECT_BINNING)
+	return GetCoarseBinRange( center, r, binRange );
+#else
+	// Near plane test. Every bin is then tested by IsInBin
+	binRange = int4( 0, 0, NUM_COARSE_CULLING_TILES_X - 1, NUM_COARSE_CULLING_TILES_Y - 1 );
+	return -center.z < r;
+#endif
 }
 
 
-// Just work through the list of alive particles linearly. Each thread analyzes one particle to see which bins it should go into. ie n threads for n particles.
-// An alternative strategy could be to use one thread to see if a particle lives in ONE bin. Therefore dispatch n * numBins threads for n particles.
+// Test a particle against one of the bins in its range
+bool IsInBin( int tileX, int tileY, float3 center, float r )
+{
+	// Optionally drop particles that are entirely behind the bin's furthest opaque pixel
+	if ( g_CullMaxZ && center.z - g_CoarseBinDepthBounds[ tileY * NUM_COARSE_CULLING_TILES_X + tileX ].y >= r )
+		return false;
+
+#if defined (SCREEN_RECT_BINNING)
+	// The screen rect already picked out the bins
+	return true;
+#else
+	// Do frustum plane tests
+	return ( GetSignedDistanceFromPlane( center, g_FrustumData[ tileX ][ tileY ][0] ) < r ) &&
+		   ( GetSignedDistanceFromPlane( center, g_FrustumData[ tileX ][ tileY ][1] ) < r ) &&
+		   ( GetSignedDistanceFromPlane( center, g_FrustumData[ tileX ][ tileY ][2] ) < r ) &&
+		   ( GetSignedDistanceFromPlane( center, g_FrustumData[ tileX ][ tileY ][3] ) < r );
+#endif
+}
+
+
+// One thread per alive particle. Count this group's particles in each bin
 [numthreads(COARSE_CULLING_THREADS, 1, 1)]
-void CoarseCulling( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID, uint3 globalIdx : SV_DispatchThreadID )
+void CoarseBinCount( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID, uint3 globalIdx : SV_DispatchThreadID )
 {
+#if !defined (SCREEN_RECT_BINNING)
 	// Pre-compute the per-bin frusta
 	initLDS( localIdx.x );
+#endif
 
-	// Initialize the per-bin counters to zero
-	if ( globalIdx.x < NUM_COARSE_TILES )
+	if ( localIdx.x < NUM_COARSE_TILES )
 	{
-		g_CoarseTiledIndexBufferCounters[ globalIdx.x ] = 0;
+		g_ldsBinCounts[ localIdx.x ] = 0;
 	}
 
-	// Sync to this point so we know the counters are all set to zero
 	GroupMemoryBarrierWithGroupSync();
 
-	// Since the global thread id maps to the particle index into the alive list, make sure we don't read past the end of the list
-	if ( globalIdx.x < g_NumActiveParticles )
+	uint index;
+	float3 center;
+	float r;
+	int4 binRange;
+	if ( GetParticleBins( globalIdx.x, index, center, r, binRange ) )
 	{
-		// Get the global particle index
-		uint index = (uint)g_AliveIndexBuffer[ globalIdx.x ].y;
-			
-		// Get the view space position of the particle
-		float4 vsPosition = g_ViewSpacePositions[ index ];
-		float3 center = vsPosition.xyz;
-
-		// Get the maximum radius of the particle
-		float r = g_MaxRadiusBuffer[ index ];
-		
-		// Near plane test
-		if ( -center.z < r )
+		for ( int tileY = binRange.y; tileY <= binRange.w; tileY++ )
 		{
-			// For each bin in X and Y. Note that the particle could end up in multiple bins
-			for ( int tileX = 0; tileX < NUM_COARSE_CULLING_TILES_X; tileX++ )
+			for ( int tileX = binRange.x; tileX <= binRange.z; tileX++ )
 			{
-				for ( int tileY = 0; tileY < NUM_COARSE_CULLING_TILES_Y; tileY++ )
+				if ( IsInBin( tileX, tileY, center, r ) )
 				{
-					// Do frustum plane tests
-					if ( ( GetSignedDistanceFromPlane( center, g_FrustumData[ tileX ][ tileY ][0] ) < r ) &&
-						 ( GetSignedDistanceFromPlane( center, g_FrustumData[ tileX ][ tileY ][1] ) < r ) &&
-						 ( GetSignedDistanceFromPlane( center, g_FrustumData[ tileX ][ tileY ][2] ) < r ) &&
-						 ( GetSignedDistanceFromPlane( center, g_FrustumData[ tileX ][ tileY ][3] ) < r ) )
+					InterlockedAdd( g_ldsBinCounts[ tileY * NUM_COARSE_CULLING_TILES_X + tileX ], 1 );
+				}
+			}
+		}
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( localIdx.x < NUM_COARSE_TILES )
+	{
+		g_GroupBinCounts[ groupIdx.x * NUM_COARSE_TILES + localIdx.x ] = g_ldsBinCounts[ localIdx.x ];
+	}
+}
+
+
+// Inclusive scan of the first numValues elements of g_ldsScan. Every thread in the group must call this
+void ScanLDS( uint localIdx, uint numValues )
+{
+	for ( uint stride = 1; stride < numValues; stride <<= 1 )
+	{
+		uint value = ( localIdx < numValues && localIdx >= stride ) ? g_ldsScan[ localIdx - stride ] : 0;
+		GroupMemoryBarrierWithGroupSync();
+		if ( localIdx < numValues )
+		{
+			g_ldsScan[ localIdx ] += value;
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+}
+
+
+// One thread group per bin. Exclusive prefix sum of the bin's counts over the CoarseBinCount groups, in group order. Each thread 
+// sums a run of groups, the runs are scanned in LDS, then each thread writes out the offsets for its run
+[numthreads(COARSE_BINNING_SCAN_THREADS, 1, 1)]
+void CoarseBinScan( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID )
+{
+	uint bin = groupIdx.x;
+	uint numGroups = ( g_NumActiveParticles + COARSE_CULLING_THREADS - 1 ) / COARSE_CULLING_THREADS;
+	uint groupsPerThread = ( numGroups + COARSE_BINNING_SCAN_THREADS - 1 ) / COARSE_BINNING_SCAN_THREADS;
+	uint firstGroup = localIdx.x * groupsPerThread;
+	uint lastGroup = min( firstGroup + groupsPerThread, numGroups );
+
+	uint group;
+	uint sum = 0;
+	for ( group = firstGroup; group < lastGroup; group++ )
+	{
+		sum += g_GroupBinCounts[ group * NUM_COARSE_TILES + bin ];
+	}
+
+	g_ldsScan[ localIdx.x ] = sum;
+	GroupMemoryBarrierWithGroupSync();
+
+	ScanLDS( localIdx.x, COARSE_BINNING_SCAN_THREADS );
+
+	uint offset = g_ldsScan[ localIdx.x ] - sum;
+	for ( group = firstGroup; group < lastGroup; group++ )
+	{
+		uint slot = group * NUM_COARSE_TILES + bin;
+		uint count = g_GroupBinCounts[ slot ];
+		g_GroupBinCounts[ slot ] = offset;
+		offset += count;
+	}
+
+	if ( localIdx.x == COARSE_BINNING_SCAN_THREADS - 1 )
+	{
+		g_CoarseTiledIndexBufferCounters[ bin ] = g_ldsScan[ localIdx.x ];
+	}
+}
+
+
+// One thread per alive particle, with the same grouping as CoarseBinCount. Lay the bins out one after the other, then write each 
+// particle to its bins starting from the group's offsets. The first group also writes out the bin offsets for the fine culling
+[numthreads(COARSE_CULLING_THREADS, 1, 1)]
+void CoarseBinScatter( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID, uint3 globalIdx : SV_DispatchThreadID )
+{
+#if !defined (SCREEN_RECT_BINNING)
+	// Pre-compute the per-bin frusta
+	initLDS( localIdx.x );
+#endif
+
+	// Every group scans the bin sizes itself. There are few enough bins that this is cheaper than another pass
+	uint binSize = 0;
+	if ( localIdx.x < NUM_COARSE_TILES )
+	{
+		binSize = g_CoarseTiledIndexBufferCounters[ localIdx.x ];
+		g_ldsScan[ localIdx.x ] = binSize;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	ScanLDS( localIdx.x, NUM_COARSE_TILES );
+
+	if ( localIdx.x < NUM_COARSE_TILES )
+	{
+		uint binOffset = g_ldsScan[ localIdx.x ] - binSize;
+		g_ldsBinCounts[ localIdx.x ] = binOffset + g_GroupBinCounts[ groupIdx.x * NUM_COARSE_TILES + localIdx.x ];
+
+		if ( groupIdx.x == 0 )
+		{
+			g_CoarseTiledIndexBufferOffsets[ localIdx.x ] = binOffset;
+			if ( localIdx.x == NUM_COARSE_TILES - 1 )
+			{
+				g_CoarseTiledIndexBufferOffsets[ NUM_COARSE_TILES ] = g_ldsScan[ localIdx.x ];
+			}
+		}
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	uint index;
+	float3 center;
+	float r;
+	int4 binRange;
+	if ( GetParticleBins( globalIdx.x, index, center, r, binRange ) )
+	{
+		for ( int tileY = binRange.y; tileY <= binRange.w; tileY++ )
+		{
+			for ( int tileX = binRange.x; tileX <= binRange.z; tileX++ )
+			{
+				if ( IsInBin( tileX, tileY, center, r ) )
+				{
+					uint dstIdx = 0;
+					InterlockedAdd( g_ldsBinCounts[ tileY * NUM_COARSE_CULLING_TILES_X + tileX ], 1, dstIdx );
+
+					// The index buffer is sized from the totals of earlier frames so it can be too small for this one
+					if ( dstIdx < g_CoarseBinCapacity )
 					{
-						// Add to the bin
-						addToBuffer( tileY * NUM_COARSE_CULLING_TILES_X + tileX, index );
+						g_CoarseTiledIndexBuffer[ dstIdx ] = index;
 					}
 				}
 			}
 		}
 	}
-}
\ No newline at end of file
+}
@@ -21,6 +21,7 @@
 //
 #include "ShaderConstants.h"
 #include "Globals.h"
+#include "SortKeys.h"
 
 
 // Shader inputs
@@ -29,65 +30,79 @@
 // View space positions of the particles
 StructuredBuffer<float4>			g_ViewSpacePositions			: register( t0 );
 
-// The maximum radius in X & Y of each particle
-StructuredBuffer<float>				g_MaxRadiusBuffer				: register( t1 );
+// The maximum radius in X & Y of each particle, and the lowest opacity of its core for the opacity culling
+StructuredBuffer<float2>			g_MaxRadiusBuffer				: register( t1 );
 
-// The alive particle list. X is the distance to the camera, Y stores the global particle index. Only used for the non-coarse culling path
-StructuredBuffer<float2>			g_AliveIndexBuffer				: register( t2 );
+// The alive particle list of distances to the camera and global particle indices. Only used for the non-coarse culling path
+StructuredBuffer<SortItem>			g_AliveIndexBuffer				: register( t2 );
 
-// The depth of the opaque scene
-Texture2D<float>					g_DepthTexture					: register( t3 );
+// The nearest and furthest view space depth of the opaque scene in each tile, see DepthBoundsCS.hlsl
+StructuredBuffer<float2>			g_TileDepthBounds				: register( t3 );
 
-// The coarse culling buffer
+// The coarse culling buffer. Each bin's particles are stored contiguously from the bin's offset
 Buffer<uint>						g_CoarseBuffer					: register( t4 );
 Buffer<uint>						g_CoarseBufferCounters			: register( t5 );
+Buffer<uint>						g_CoarseBufferOffsets			: register( t6 );
 
 
 // Shader outputs
 // =============
 
-// The tiled buffer containing the indices of the particles in that tile. The particles are written out in sorted front to back order.
-// The stride between tiles is PARTICLES_TILE_BUFFER_SIZE elements
+// The tiled buffer containing the indices of the particles in each tile. The tiles' lists are stored back to back, each starting at 
+// the tile's offset. The particles are written out in sorted front to back order
 RWBuffer<uint>						g_TiledIndexBuffer				: register( u0 );
 
+// The number of particles in each tile's list
+RWBuffer<uint>						g_TileListCounts				: register( u1 );
 
+// The start of each tile's list in the tiled buffer, followed by the total length of all the lists
+RWBuffer<uint>						g_TileListOffsets				: register( u2 );
 
-// Helper functions for calculating the far Z plane value of this tile from the depth buffer texture
-#if defined (CULLMAXZ)
-groupshared uint				g_ldsZMax;
+// Histogram of the number of particles in each tile, read back to pick the tile size for later frames
+RWBuffer<uint>						g_TileDensityHistogram			: register( u3 );
 
-float ConvertProjDepthToView( float z )
-{
-	z = 1.f / (z*g_mProjectionInv._34 + g_mProjectionInv._44);
-	return z;
-}
+// The shading rate each tile is rendered at, see SelectShadingRate
+RWBuffer<uint>						g_TileShadingRates				: register( u4 );
 
+// Somewhere for TileListMerge to put each round of merging. It has the same layout as the tiled buffer
+RWBuffer<uint>						g_TileListScratch				: register( u5 );
 
-void CalculateMinMaxDepthInLds( uint3 globalIdx )
-{
-	float opaqueDepth = g_DepthTexture.Load( uint3(globalIdx.x,globalIdx.y,0) ).x;
-	float opaqueViewPosZ = ConvertProjDepthToView( opaqueDepth );
-	uint opaqueZ = asuint( opaqueViewPosZ );
 
-	if( opaqueDepth != 0.f )
-	{
-		InterlockedMax( g_ldsZMax, opaqueZ );
-	}	
-}
-#endif
 
+// The maximum number of particles we want to hold in LDS during the culling phase. Tiles with more visible particles than this are 
+// sorted and written out in runs. Each thread of the bitonic sort handles a pair of elements so this is twice the thread count
+#define	MAX_PARTICLES_PER_TILE_FOR_SORTING			(2*TILE_RES_X*TILE_RES_Y)
 
-// The maximum number of particles we want to hold in LDS during the culling phase.
-// Ideally it should be all the particles visible in the tile, however in reality we must cap this limit.
-// The limit could be much higher than the number we write out to memory since they are sorted front to back so we might
-// get away with leaving out the backmost particles
-#define	MAX_PARTICLES_PER_TILE_FOR_SORTING			2*NUM_PARTICLES_PER_TILE
+// The length of every run but the last in a list that doesn't fit in LDS. Each run is written once LDS has this many particles, which 
+// leaves room for another block, and the rest are carried over to the next run. TileListMerge relies on the runs being this long
+#define	TILE_LIST_RUN_LENGTH						(MAX_PARTICLES_PER_TILE_FOR_SORTING - TILE_RES_X*TILE_RES_Y)
 
 // The LDS members for storing the particles that we want to sort and write back out to a UAV
 groupshared uint				g_ldsParticleIdx[ MAX_PARTICLES_PER_TILE_FOR_SORTING ];
-groupshared float				g_ldsParticleDistances[ MAX_PARTICLES_PER_TILE_FOR_SORTING ];
+groupshared uint				g_ldsParticleDistances[ MAX_PARTICLES_PER_TILE_FOR_SORTING ];	// The bits of the view space depth. Reused by the opacity culling once the run is sorted
 groupshared uint				g_ldsNumParticles;
 
+// The particles the tile culls, and where its list goes in the tiled buffer
+groupshared uint				g_ldsNumInputParticles;
+groupshared uint				g_ldsCoarseTileIdx;
+groupshared uint				g_ldsListOffset;
+groupshared uint				g_ldsListSize;
+
+// How much of the tile its particles cover, for picking the tile's shading rate. The coverage mask has a bit for each cell of an 
+// 8x8 grid over the tile
+groupshared uint				g_ldsCoveredArea;
+groupshared uint				g_ldsParticleSizeSum;
+groupshared uint				g_ldsCoverageMask[ 2 ];
+
+// The opacity culling. Each coverage cell keeps the most light that can still be getting through it. Once that is below the alpha 
+// threshold in every cell nothing further down the list can be seen. The particles' occluders are packed into g_ldsParticleDistances
+groupshared float				g_ldsCellTransmittance[ 64 ];
+groupshared uint				g_ldsRunLength;
+
+// LDS for the scan of the tile counts
+groupshared uint				g_ldsScan[ TILE_LIST_SCAN_THREADS ];
+groupshared uint				g_ldsDensityHistogram[ NUM_TILE_DENSITY_BUCKETS ];
+
 
 #if defined (USE_VIEW_FRUSTUM_PLANES)
 // Function to generate the frustum planes
@@ -121,7 +136,7 @@ void CalcFrustumPlanes( in uint2 groupIdx, out float3 frustumEqn[ 4 ] )
 // Bitonic sort function that runs on our LDS buffers
 void BitonicSort( in uint localIdxFlattened )
 {
-	uint numParticles = g_ldsNumParticles;
+	uint numParticles = min( g_ldsNumParticles, MAX_PARTICLES_PER_TILE_FOR_SORTING );
 	
 	// Round the number of particles up to the nearest power of two
 	uint numParticlesPowerOfTwo = 1;
@@ -143,10 +158,10 @@ void BitonicSort( in uint localIdxFlattened )
 			uint nSwapElem = nMergeSubSize==nMergeSize>>1 ? index_high + (2*nMergeSubSize-1) - index_low : index_high + nMergeSubSize + index_low;
 			if ( nSwapElem < numParticles && index < numParticles )
 			{
-				if ( g_ldsParticleDistances[ index ] > g_ldsParticleDistances[ nSwapElem ] )
+				if ( asfloat( g_ldsParticleDistances[ index ] ) > asfloat( g_ldsParticleDistances[ nSwapElem ] ) )
 				{ 
 					uint uTemp = g_ldsParticleIdx[ index ];
-					float vTemp = g_ldsParticleDistances[ index ];
+					uint vTemp = g_ldsParticleDistances[ index ];
 
 					g_ldsParticleIdx[ index ] = g_ldsParticleIdx[ nSwapElem ];
 					g_ldsParticleDistances[ index ] = g_ldsParticleDistances[ nSwapElem ];
@@ -166,13 +181,15 @@ void BitonicSort( in uint localIdxFlattened )
 // Get the number of particles in this coarse bin
 uint GetNumParticlesInCoarseTile( uint tile )
 {
-	return g_CoarseBufferCounters[ tile ];
+	// The coarse culling drops anything past the end of the buffer until it is resized, so don't read those entries
+	uint offset = min( g_CoarseBufferOffsets[ tile ], g_CoarseBinCapacity );
+	return min( g_CoarseBufferCounters[ tile ], g_CoarseBinCapacity - offset );
 }
 
 // Get the global particle index from this bin
 uint getParticleIndexFromCoarseBuffer( uint binIndex, uint listIndex )
 {
-	uint offset = binIndex * g_NumActiveParticles;
+	uint offset = g_CoarseBufferOffsets[ binIndex ];
 	return g_CoarseBuffer[ offset + listIndex ];
 }
 #endif
@@ -189,156 +206,642 @@ void AddParticleToVisibleList( uint index, float distance )
 	if ( dstIdx < MAX_PARTICLES_PER_TILE_FOR_SORTING )
 	{
 		g_ldsParticleIdx[ dstIdx ] = index;
-		g_ldsParticleDistances[ dstIdx ] = distance;
+		g_ldsParticleDistances[ dstIdx ] = asuint( distance );
 	}
 }
 
 
-[numthreads(TILE_RES_X, TILE_RES_Y, 1)]
-void Culling( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID, uint3 globalIdx : SV_DispatchThreadID )
+// The bounds a tile culls its particles against
+struct TileBounds
 {
-	uint localIdxFlattened = localIdx.x + (localIdx.y*TILE_RES_X);
+#if defined (USE_VIEW_FRUSTUM_PLANES)
+	float3	frustumEqn[ 4 ];
+#else
+	int2	tileP0;
+	int2	tileP1;
+#endif
+#if defined (CULLMAXZ)
+	float	maxZ;
+#endif
+};
 
-	uint i;
 
+// Set up the tile's bounds and the range of the input it culls. Every thread in the group must call this
+TileBounds InitTile( uint localIdxFlattened, uint3 groupIdx )
+{
 	// Initialize our LDS values
 	if( localIdxFlattened == 0 )
 	{
 		g_ldsNumParticles = 0;
-#if defined (CULLMAXZ)
-		g_ldsZMax = 0;
+
+		// For coarse culling, retreive the bin index and get the number of particles in that bin
+#if defined (COARSE_CULLING_ENABLED)
+		uint tileX = groupIdx.x / g_NumCullingTilesPerCoarseTileX;
+		uint tileY = groupIdx.y / g_NumCullingTilesPerCoarseTileY;
+
+		g_ldsCoarseTileIdx = tileX + tileY * g_NumCoarseCullingTilesX;
+	
+		// Get the number of particles in the bin this tile lives in
+		g_ldsNumInputParticles = GetNumParticlesInCoarseTile( g_ldsCoarseTileIdx );
+#else
+		// No coarse culling, so just loop through ALL the alive particles
+		g_ldsNumInputParticles = g_NumActiveParticles;
 #endif
 	} 
 	
 	GroupMemoryBarrierWithGroupSync();
 	
-	// Calculate the maxZ value of the tile if required
-#if defined (CULLMAXZ)
-	CalculateMinMaxDepthInLds( globalIdx );
+	TileBounds bounds;
 
-	GroupMemoryBarrierWithGroupSync();
-	float maxZ = asfloat( g_ldsZMax );
+	// Fetch the tile's far plane if required
+#if defined (CULLMAXZ)
+	bounds.maxZ = g_TileDepthBounds[ groupIdx.x + groupIdx.y * g_NumTilesX ].y;
 #endif
 	
 #if defined (USE_VIEW_FRUSTUM_PLANES)
 	// Generate the side frustum planes
-	float3 frustumEqn[4];
-	CalcFrustumPlanes( groupIdx.xy, frustumEqn );
+	CalcFrustumPlanes( groupIdx.xy, bounds.frustumEqn );
 #else
 	// Generate the tile extents in screen space
 	int2 tileSize = int2( TILE_RES_X, TILE_RES_Y );
 
-	int2 tileP0 = groupIdx.xy * tileSize;
-	int2 tileP1 = (groupIdx.xy + int2( 1, 1 )) * tileSize;
+	bounds.tileP0 = groupIdx.xy * tileSize;
+	bounds.tileP1 = (groupIdx.xy + int2( 1, 1 )) * tileSize;
 #endif
 
-	// For coarse culling, retreive the bin index and get the number of particles in that bin
-#if defined (COARSE_CULLING_ENABLED)
-	uint tileX = groupIdx.x / g_NumCullingTilesPerCoarseTileX;
-	uint tileY = groupIdx.y / g_NumCullingTilesPerCoarseTileY;
-
-	uint coarseTileIdx = tileX + tileY * g_NumCoarseCullingTilesX;
-	
-	// Get the number of particles in the bin this tile lives in
-    uint uNumParticles = GetNumParticlesInCoarseTile( coarseTileIdx );
-#else
+	return bounds;
+}
 
-	// No coarse culling, so just loop through ALL the alive particles
-	uint uNumParticles = g_NumActiveParticles;
-#endif
 
-	// Each thread needs to look at a particle and determine whether it is visible in this tile
-	// In the thread group TILE_RES_X * TILE_RES_Y particles are processed in parallel
-	for ( i = localIdxFlattened; i < uNumParticles; i += TILE_RES_X*TILE_RES_Y )
-	{
-		// Fetch the global particle index
+// Fetch the global index of one of the particles this tile culls
+uint GetInputParticle( uint i )
+{
 #if defined (COARSE_CULLING_ENABLED)
-		uint index = getParticleIndexFromCoarseBuffer( coarseTileIdx, i );
+	return getParticleIndexFromCoarseBuffer( g_ldsCoarseTileIdx, i );
 #else
-		uint index = (uint)g_AliveIndexBuffer[ i ].y;
+	return SortItemIndex( g_AliveIndexBuffer[ i ] );
 #endif
-		
-		// Fetch the maximum radius of the particle
-		float r = g_MaxRadiusBuffer[ index ];
+}
 
-		// Fetch the view space position of the particle
-		float4 vsPosition = g_ViewSpacePositions[ index ];
-		float3 center = vsPosition.xyz;
+
+// Project the top left and bottom right points on the view space AABB of a particle to get its screen rect in pixels
+void GetParticleScreenRect( float3 center, float r, out int2 pos0, out int2 pos1 )
+{
+	float2 screenDimensions = float2( g_ScreenWidth, g_ScreenHeight );
+
+	float4 screenSpacePosition0 = mul( float4( center + float3( -r, r, 0.0 ), 1.0 ), g_mProjection );
+	screenSpacePosition0.xy /= screenSpacePosition0.w;
+
+	float4 screenSpacePosition1 = mul( float4( center + float3( r, -r, 0.0 ), 1.0 ), g_mProjection );
+	screenSpacePosition1.xy /= screenSpacePosition1.w;
+
+	screenSpacePosition0 = screenSpacePosition0 * 0.5 + 0.5;
+	screenSpacePosition0.y = 1 - screenSpacePosition0.y;
+
+	screenSpacePosition1 = screenSpacePosition1 * 0.5 + 0.5;
+	screenSpacePosition1.y = 1 - screenSpacePosition1.y;
+				
+	pos0 = (int2)( screenSpacePosition0.xy * screenDimensions );
+	pos1 = (int2)( screenSpacePosition1.xy * screenDimensions );
+}
+
+
+// Test whether a particle is visible in the tile
+bool IsParticleVisibleInTile( uint index, TileBounds bounds, out float viewSpaceDepth )
+{
+	// Fetch the maximum radius of the particle
+	float r = g_MaxRadiusBuffer[ index ].x;
+
+	// Fetch the view space position of the particle
+	float4 vsPosition = g_ViewSpacePositions[ index ];
+	float3 center = vsPosition.xyz;
+	viewSpaceDepth = vsPosition.z;
 		
-		// Optionally cull using the tile's far plane
+	// Optionally cull using the tile's far plane
 #if defined (CULLMAXZ)
-		if ( center.z - maxZ < r )
+	if ( center.z - bounds.maxZ >= r )
+		return false;
 #endif
-		{
-			// Cull against near plane if we aren't doing coarse culling. The coarse culling stage has done this already
+
+	// Cull against near plane if we aren't doing coarse culling. The coarse culling stage has done this already
 #if !defined (COARSE_CULLING_ENABLED)
-			if ( -center.z < r )
+	if ( -center.z >= r )
+		return false;
 #endif
-			{
+
 #if defined (USE_VIEW_FRUSTUM_PLANES)
-				// Cull against the side frustum planes
-				if( ( GetSignedDistanceFromPlane( center, frustumEqn[0] ) < r ) &&
-					( GetSignedDistanceFromPlane( center, frustumEqn[1] ) < r ) &&
-					( GetSignedDistanceFromPlane( center, frustumEqn[2] ) < r ) &&
-					( GetSignedDistanceFromPlane( center, frustumEqn[3] ) < r ) )
-				{
-					AddParticleToVisibleList( index, vsPosition.z );
-				}
+	// Cull against the side frustum planes
+	return ( GetSignedDistanceFromPlane( center, bounds.frustumEqn[0] ) < r ) &&
+		   ( GetSignedDistanceFromPlane( center, bounds.frustumEqn[1] ) < r ) &&
+		   ( GetSignedDistanceFromPlane( center, bounds.frustumEqn[2] ) < r ) &&
+		   ( GetSignedDistanceFromPlane( center, bounds.frustumEqn[3] ) < r );
 #else
-				// Cull the particle in screen space by projecting the top left and bottom right points on the view space AABB of the particle
-				float2 screenDimensions = float2( g_ScreenWidth, g_ScreenHeight );
+	// Cull the particle in screen space
+	int2 pos0, pos1;
+	GetParticleScreenRect( center, r, pos0, pos1 );
+				
+	return pos1.x > bounds.tileP0.x && pos0.x < bounds.tileP1.x && pos1.y > bounds.tileP0.y && pos0.y < bounds.tileP1.y;
+#endif
+}
 
-				float4 screenSpacePosition0 = mul( float4( center + float3( -r, r, 0.0 ), 1.0 ), g_mProjection );
-				screenSpacePosition0.xy /= screenSpacePosition0.w;
 
-				float4 screenSpacePosition1 = mul( float4( center + float3( r, -r, 0.0 ), 1.0 ), g_mProjection );
-				screenSpacePosition1.xy /= screenSpacePosition1.w;
+// Pick the rate the tile is shaded at. Tiles that are mostly covered by many layers of reasonably large particles can be shaded at 
+// half or quarter resolution and upsampled without visibly losing detail. Sparse tiles and small particles stay at full resolution
+uint SelectShadingRate( uint numParticles, uint tileArea )
+{
+	uint numCoveredCells = countbits( g_ldsCoverageMask[ 0 ] ) + countbits( g_ldsCoverageMask[ 1 ] );
+	if ( numParticles == 0 || numCoveredCells < LOW_RES_MIN_COVERED_CELLS )
+		return 0;
 
-				screenSpacePosition0 = screenSpacePosition0 * 0.5 + 0.5;
-				screenSpacePosition0.y = 1 - screenSpacePosition0.y;
+	uint meanParticleSize = g_ldsParticleSizeSum / numParticles;
 
-				screenSpacePosition1 = screenSpacePosition1 * 0.5 + 0.5;
-				screenSpacePosition1.y = 1 - screenSpacePosition1.y;
-				
-				int2 pos0 = (int2)( screenSpacePosition0 * screenDimensions );
-				int2 pos1 = (int2)( screenSpacePosition1 * screenDimensions );
-				
-				if ( pos1.x > tileP0.x && pos0.x < tileP1.x && pos1.y > tileP0.y && pos0.y < tileP1.y )
-				{
-					AddParticleToVisibleList( index, vsPosition.z );
-				}
-#endif
+	uint rate = 0;
+	if ( g_ldsCoveredArea >= LOW_RES_HALF_RATE_OVERDRAW * tileArea && meanParticleSize >= 2 * LOW_RES_MIN_PARTICLE_TEXELS )
+		rate = 1;
+	if ( g_ldsCoveredArea >= LOW_RES_QUARTER_RATE_OVERDRAW * tileArea && meanParticleSize >= 4 * LOW_RES_MIN_PARTICLE_TEXELS )
+		rate = 2;
+
+	return min( rate, g_MaxShadingRate );
+}
+
+
+// Add a visible particle's footprint to the tile's coverage
+void AddParticleCoverage( uint index, int2 tileP0, int2 tileP1, uint tileArea )
+{
+	int2 pos0, pos1;
+	GetParticleScreenRect( g_ViewSpacePositions[ index ].xyz, g_MaxRadiusBuffer[ index ].x, pos0, pos1 );
+
+	// The size of the particle, capped so the sum can't overflow
+	int2 size = pos1 - pos0;
+	InterlockedAdd( g_ldsParticleSizeSum, (uint)clamp( min( size.x, size.y ), 0, 1024 ) );
+
+	int2 clipped0 = clamp( pos0, tileP0, tileP1 );
+	int2 clipped1 = clamp( pos1, tileP0, tileP1 );
+	if ( any( clipped1 <= clipped0 ) )
+		return;
+
+	// Past the quarter rate threshold the exact area doesn't matter, so stop adding before it can overflow
+	if ( g_ldsCoveredArea < LOW_RES_QUARTER_RATE_OVERDRAW * tileArea )
+	{
+		int2 clippedSize = clipped1 - clipped0;
+		InterlockedAdd( g_ldsCoveredArea, (uint)( clippedSize.x * clippedSize.y ) );
+	}
+
+	// Mark the coverage cells the rect touches
+	int2 tileSize = tileP1 - tileP0;
+	uint2 cell0 = (uint2)( ( clipped0 - tileP0 ) * 8 / tileSize );
+	uint2 cell1 = (uint2)( ( clipped1 - tileP0 - 1 ) * 8 / tileSize );
+
+	uint rowMask = ( ( 2u << cell1.x ) - 1 ) & ~( ( 1u << cell0.x ) - 1 );
+	for ( uint y = cell0.y; y <= cell1.y; y++ )
+	{
+		InterlockedOr( g_ldsCoverageMask[ y / 4 ], rowMask << ( ( y % 4 ) * 8 ) );
+	}
+}
+
+
+// Tile lists are built in four passes. CullingCount counts the visible particles in each tile, TileListScan turns the counts into 
+// each tile's offset in the tiled index buffer, Culling writes each tile's list out at its offset in sorted runs, and TileListMerge 
+// merges the runs of the lists too long to sort in LDS. As the lists are packed together there is no per-tile limit on the number of 
+// particles
+
+
+// One thread group per tile. Count the particles visible in the tile
+[numthreads(TILE_RES_X, TILE_RES_Y, 1)]
+void CullingCount( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID )
+{
+	uint localIdxFlattened = localIdx.x + (localIdx.y*TILE_RES_X);
+
+	if ( localIdxFlattened == 0 )
+	{
+		g_ldsCoveredArea = 0;
+		g_ldsParticleSizeSum = 0;
+		g_ldsCoverageMask[ 0 ] = 0;
+		g_ldsCoverageMask[ 1 ] = 0;
+	}
+
+	TileBounds bounds = InitTile( localIdxFlattened, groupIdx );
+
+	int2 tileP0 = groupIdx.xy * int2( TILE_RES_X, TILE_RES_Y );
+	int2 tileP1 = tileP0 + int2( TILE_RES_X, TILE_RES_Y );
+	uint tileArea = TILE_RES_X*TILE_RES_Y;
+
+	// Each thread needs to look at a particle and determine whether it is visible in this tile
+	// In the thread group TILE_RES_X * TILE_RES_Y particles are processed in parallel
+	uint numInputParticles = g_ldsNumInputParticles;
+	for ( uint i = localIdxFlattened; i < numInputParticles; i += TILE_RES_X*TILE_RES_Y )
+	{
+		uint index = GetInputParticle( i );
+
+		float viewSpaceDepth;
+		if ( IsParticleVisibleInTile( index, bounds, viewSpaceDepth ) )
+		{
+			InterlockedAdd( g_ldsNumParticles, 1 );
+
+			// Only needed to pick the shading rate
+			if ( g_MaxShadingRate > 0 )
+			{
+				AddParticleCoverage( index, tileP0, tileP1, tileArea );
 			}
 		}
 	}
-	
-	// Wait for all particles to be added to the lists
+
 	GroupMemoryBarrierWithGroupSync();
-	
+
+	if( localIdxFlattened == 0 )
+	{
+		uint tileIdxFlattened = groupIdx.x + groupIdx.y * g_NumTilesX;
+		g_TileListCounts[ tileIdxFlattened ] = g_ldsNumParticles;
+		g_TileShadingRates[ tileIdxFlattened ] = SelectShadingRate( g_ldsNumParticles, tileArea );
+	}
+}
+
+
+// A single thread group. Exclusive prefix sum of the tile counts. Each thread sums a run of tiles, the runs are scanned in LDS, then 
+// each thread writes out the offsets for its run. The total goes in the element after the last tile. As it reads every tile's count 
+// anyway this pass also builds the tile density histogram
+[numthreads(TILE_LIST_SCAN_THREADS, 1, 1)]
+void TileListScan( uint3 localIdx : SV_GroupThreadID )
+{
+	if ( localIdx.x < NUM_TILE_DENSITY_BUCKETS )
+	{
+		g_ldsDensityHistogram[ localIdx.x ] = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	uint numTiles = g_NumTilesX * g_NumTilesY;
+	uint tilesPerThread = ( numTiles + TILE_LIST_SCAN_THREADS - 1 ) / TILE_LIST_SCAN_THREADS;
+	uint firstTile = localIdx.x * tilesPerThread;
+	uint lastTile = min( firstTile + tilesPerThread, numTiles );
+
+	uint tile;
+	uint sum = 0;
+	for ( tile = firstTile; tile < lastTile; tile++ )
+	{
+		uint count = g_TileListCounts[ tile ];
+		sum += count;
+
+		uint bucket = count == 0 ? 0 : min( firstbithigh( count ) + 1, NUM_TILE_DENSITY_BUCKETS - 1 );
+		InterlockedAdd( g_ldsDensityHistogram[ bucket ], 1 );
+	}
+
+	g_ldsScan[ localIdx.x ] = sum;
+	GroupMemoryBarrierWithGroupSync();
+
+	// Inclusive scan of the runs
+	for ( uint stride = 1; stride < TILE_LIST_SCAN_THREADS; stride <<= 1 )
+	{
+		uint value = localIdx.x >= stride ? g_ldsScan[ localIdx.x - stride ] : 0;
+		GroupMemoryBarrierWithGroupSync();
+		g_ldsScan[ localIdx.x ] += value;
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	uint offset = g_ldsScan[ localIdx.x ] - sum;
+	for ( tile = firstTile; tile < lastTile; tile++ )
+	{
+		g_TileListOffsets[ tile ] = offset;
+		offset += g_TileListCounts[ tile ];
+	}
+
+	if ( localIdx.x == TILE_LIST_SCAN_THREADS - 1 )
+	{
+		g_TileListOffsets[ numTiles ] = g_ldsScan[ localIdx.x ];
+	}
+
+	// The scan's barriers have made sure the histogram is complete
+	if ( localIdx.x < NUM_TILE_DENSITY_BUCKETS )
+	{
+		g_TileDensityHistogram[ localIdx.x ] = g_ldsDensityHistogram[ localIdx.x ];
+	}
+}
+
+
+// The pixel rect of one of the tile's 8x8 coverage cells, relative to the tile and clipped to the screen
+void GetCoverageCellRect( uint cell, int2 tileP0, out uint2 cellP0, out uint2 cellP1 )
+{
+	uint2 tileSize = uint2( TILE_RES_X, TILE_RES_Y );
+	uint2 cellCoords = uint2( cell % 8, cell / 8 );
+
+	cellP0 = cellCoords * tileSize / 8;
+	cellP1 = min( ( cellCoords + 1 ) * tileSize / 8, uint2( g_ScreenWidth, g_ScreenHeight ) - (uint2)tileP0 );
+}
+
+
+// Set up the opacity culling. Every thread in the group must call this
+void InitOpacityCulling( uint localIdxFlattened, int2 tileP0 )
+{
+	// Cells that are entirely off the screen don't need covering so they start out opaque
+	if ( localIdxFlattened < 64 )
+	{
+		uint2 cellP0, cellP1;
+		GetCoverageCellRect( localIdxFlattened, tileP0, cellP0, cellP1 );
+		g_ldsCellTransmittance[ localIdxFlattened ] = all( cellP0 < cellP1 ) ? 1 : 0;
+	}
+}
+
+
+// Work out how much of a sorted run the renderer can actually see. The renderer stops blending a pixel once it passes the alpha 
+// threshold, so once every coverage cell of the tile is certain to have done so the rest of the list is wasted. A particle only 
+// makes a cell more opaque if the largest square inside its core covers all of the cell, and then by no less than its core's 
+// opacity faded by the nearest opaque pixel in the tile. This needs the whole list in front to back order, so it only works on a list 
+// sorted in a single run. Returns the number of particles at the start of the run to keep. Every thread in the group must call this
+uint CullOccludedParticles( uint localIdxFlattened, uint numParticles, int2 tileP0 )
+{
+	// The depth fade is lowest in front of the nearest opaque pixel
+	uint2 tile = (uint2)tileP0 / uint2( TILE_RES_X, TILE_RES_Y );
+	float opaqueZMin = g_TileDepthBounds[ tile.x + tile.y * g_NumTilesX ].x;
+
+	for ( uint i = localIdxFlattened; i < numParticles; i += TILE_RES_X*TILE_RES_Y )
+	{
+		uint index = g_ldsParticleIdx[ i ];
+		float4 vsPosition = g_ViewSpacePositions[ index ];
+
+		// Shrink the square by a pixel to allow for the rounding of its corners to pixels
+		int2 pos0, pos1;
+		GetParticleScreenRect( vsPosition.xyz, OPACITY_CULL_CORE_RADIUS * 0.7071 * vsPosition.w, pos0, pos1 );
+		pos0 = clamp( pos0 + 1 - tileP0, 0, 63 );
+		pos1 = clamp( pos1 - 1 - tileP0, 0, 63 );
+
+		float depthFade = saturate( ( opaqueZMin - vsPosition.z ) / vsPosition.w );
+		float alpha = vsPosition.z > 0 ? g_MaxRadiusBuffer[ index ].y * depthFade : 0;
+
+		// The sort is done with the distances so pack the occluder in their place. Six bits for each edge and the opacity rounded down 
+		// to eight bits
+		g_ldsParticleDistances[ i ] = pos0.x | ( pos0.y << 6 ) | ( pos1.x << 12 ) | ( pos1.y << 18 ) | ( (uint)( saturate( alpha ) * 255 ) << 24 );
+	}
+
+	if ( localIdxFlattened == 0 )
+	{
+		g_ldsRunLength = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	// A thread per cell walks the run front to back until the cell is opaque
+	if ( localIdxFlattened < 64 )
+	{
+		uint2 cellP0, cellP1;
+		GetCoverageCellRect( localIdxFlattened, tileP0, cellP0, cellP1 );
+
+		float maxTransmittance = 1 - g_AlphaThreshold;
+		float transmittance = g_ldsCellTransmittance[ localIdxFlattened ];
+		uint runLength = numParticles;
+
+		for ( uint i = 0; i < numParticles; i++ )
+		{
+			if ( transmittance < maxTransmittance )
+			{
+				runLength = i;
+				break;
+			}
+
+			uint occluder = g_ldsParticleDistances[ i ];
+			uint2 rectP0 = uint2( occluder & 0x3f, ( occluder >> 6 ) & 0x3f );
+			uint2 rectP1 = uint2( ( occluder >> 12 ) & 0x3f, ( occluder >> 18 ) & 0x3f );
+
+			if ( all( rectP0 <= cellP0 ) && all( rectP1 >= cellP1 ) )
+			{
+				transmittance *= 1 - ( occluder >> 24 ) / 255.0;
+			}
+		}
+
+		InterlockedMax( g_ldsRunLength, runLength );
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	return g_ldsRunLength;
+}
+
+
+// Sort the particles collected in LDS and append up to maxRunLength of them to the tile's list, then move the rest to the start of 
+// LDS for the next run. cullOccluded drops the end of a list sorted in a single run if it can't be seen. Returns the new length of the 
+// list. Every thread in the group must call this
+uint FlushVisibleList( uint localIdxFlattened, uint listLength, uint maxRunLength, bool cullOccluded, int2 tileP0 )
+{
 	// Perform the Bitonic sort
 	BitonicSort( localIdxFlattened );
-	
-	// Clamp the number of particles fit into the UAV storage. As particles are now sorted front to back, this will cull the most occluded particles.
+
+	uint numSorted = min( g_ldsNumParticles, MAX_PARTICLES_PER_TILE_FOR_SORTING );
+	uint runLength = min( numSorted, maxRunLength );
+
+	// The count pass sized the list so this should never clamp, but make sure a mismatch can't write into the next tile's list
+	uint numParticles = min( runLength, g_ldsListSize - listLength );
+
+	// Drop the end of the run if it is hidden behind the particles in front
+	if ( cullOccluded )
+	{
+		numParticles = CullOccludedParticles( localIdxFlattened, numParticles, tileP0 );
+	}
+
+	uint listStart = g_ldsListOffset + listLength;
+
+	// Write the sorted particles from LDS to main memory, dropping anything that doesn't fit until the buffer has grown
+	for ( uint i = localIdxFlattened; i < numParticles; i += TILE_RES_X*TILE_RES_Y )
+	{
+		if ( listStart + i < g_TileListCapacity )
+		{
+			g_TiledIndexBuffer[ listStart + i ] = g_ldsParticleIdx[ i ];
+		}
+	}
+
+	// Wait until everyone has read the LDS before reusing it
+	GroupMemoryBarrierWithGroupSync();
+
+	// Carry the particles that didn't go in the run over to the next one. There are never more of them than the run length so they 
+	// don't overlap where they are moved to
+	uint numCarried = numSorted - runLength;
+	for ( uint j = localIdxFlattened; j < numCarried; j += TILE_RES_X*TILE_RES_Y )
+	{
+		g_ldsParticleIdx[ j ] = g_ldsParticleIdx[ runLength + j ];
+		g_ldsParticleDistances[ j ] = g_ldsParticleDistances[ runLength + j ];
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
 	if( localIdxFlattened == 0 )
 	{
-		g_ldsNumParticles = min( g_ldsNumParticles, NUM_PARTICLES_PER_TILE );
-		
+		g_ldsNumParticles = numCarried;
 	}
+
 	GroupMemoryBarrierWithGroupSync();
-	
-	// Write the sorted particles from LDS to main memory
+
+	return listLength + numParticles;
+}
+
+
+// One thread group per tile. Write the tile's visible particles out to its list in front to back order. The particles are sorted in 
+// LDS, so a tile with more visible particles than fit in LDS is sorted and written out in runs of TILE_LIST_RUN_LENGTH, and 
+// TileListMerge merges them afterwards. The runs are only sorted within themselves, so nothing here can assume a run is in front 
+// of the ones after it
+[numthreads(TILE_RES_X, TILE_RES_Y, 1)]
+void Culling( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID )
+{
+	uint localIdxFlattened = localIdx.x + (localIdx.y*TILE_RES_X);
+
 	uint tileIdxFlattened = groupIdx.x + groupIdx.y * g_NumTilesX;
-	uint tiledBufferStartOffset = PARTICLES_TILE_BUFFER_SIZE * tileIdxFlattened;
+	int2 tileP0 = groupIdx.xy * int2( TILE_RES_X, TILE_RES_Y );
 
-	uint numLDSParticleToCache = g_ldsNumParticles;
-	
-	for ( i = localIdxFlattened; i < numLDSParticleToCache; i += TILE_RES_X*TILE_RES_Y )
+	if( localIdxFlattened == 0 )
 	{
-		g_TiledIndexBuffer[ tiledBufferStartOffset + 1 + i ] = g_ldsParticleIdx[ i ];
+		g_ldsListOffset = g_TileListOffsets[ tileIdxFlattened ];
+		g_ldsListSize = g_TileListCounts[ tileIdxFlattened ];
 	}
 
-	if( localIdxFlattened == 0 )
+	TileBounds bounds = InitTile( localIdxFlattened, groupIdx );
+
+	// A list that fits in LDS is sorted in one go. InitTile has synced so everyone sees the list size
+	bool singleRun = g_ldsListSize <= MAX_PARTICLES_PER_TILE_FOR_SORTING;
+
+	// The runs of a longer list are only in front to back order once TileListMerge has merged them, so only a single run can be 
+	// cut short where the tile goes opaque. The sort syncs before the run is written out
+	bool cullOccluded = singleRun && g_OpacityCulling;
+	if ( cullOccluded )
+	{
+		InitOpacityCulling( localIdxFlattened, tileP0 );
+	}
+
+	// Work through the input a block of TILE_RES_X * TILE_RES_Y particles at a time
+	uint numInputParticles = g_ldsNumInputParticles;
+	uint listLength = 0;
+	for ( uint blockStart = 0; blockStart < numInputParticles; blockStart += TILE_RES_X*TILE_RES_Y )
+	{
+		uint i = blockStart + localIdxFlattened;
+		if ( i < numInputParticles )
+		{
+			uint index = GetInputParticle( i );
+
+			float viewSpaceDepth;
+			if ( IsParticleVisibleInTile( index, bounds, viewSpaceDepth ) )
+			{
+				AddParticleToVisibleList( index, viewSpaceDepth );
+			}
+		}
+
+		// Wait for all particles to be added to the lists
+		GroupMemoryBarrierWithGroupSync();
+
+		// Write out a run once there is a run's worth, which always leaves room for another block. Everyone has to make the decision 
+		// before anyone moves on and adds more particles
+		bool flush = !singleRun && g_ldsNumParticles >= TILE_LIST_RUN_LENGTH;
+		GroupMemoryBarrierWithGroupSync();
+
+		if ( flush )
+		{
+			listLength = FlushVisibleList( localIdxFlattened, listLength, TILE_LIST_RUN_LENGTH, false, tileP0 );
+		}
+	}
+
+	// Write out the last run
+	listLength = FlushVisibleList( localIdxFlattened, listLength, MAX_PARTICLES_PER_TILE_FOR_SORTING, cullOccluded, tileP0 );
+
+	// The opacity culling can stop the list short of what the count pass found
+	if ( cullOccluded && localIdxFlattened == 0 )
+	{
+		g_TileListCounts[ tileIdxFlattened ] = listLength;
+	}
+}
+
+
+// Read an element of a tile list from the tiled buffer or the merge's scratch copy of it
+uint ReadTileList( bool fromScratch, uint i )
+{
+	return fromScratch ? g_TileListScratch[ i ] : g_TiledIndexBuffer[ i ];
+}
+
+
+// The sort key of an element of a tile list. It is the view space depth the runs were sorted by in LDS
+float GetTileListKey( bool fromScratch, uint i )
+{
+	return g_ViewSpacePositions[ ReadTileList( fromScratch, i ) ].z;
+}
+
+
+// The number of elements of the sorted range [first, first+count) whose keys are less than the key, or no greater than it if 
+// inclusive is set
+uint CountSmallerKeys( bool fromScratch, uint first, uint count, float key, bool inclusive )
+{
+	uint lo = 0;
+	uint hi = count;
+	while ( lo < hi )
 	{
-		g_TiledIndexBuffer[ tiledBufferStartOffset ] = numLDSParticleToCache;
+		uint mid = ( lo + hi ) / 2;
+		float midKey = GetTileListKey( fromScratch, first + mid );
+		if ( midKey < key || ( inclusive && midKey == key ) )
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-}
\ No newline at end of file
+
+	return lo;
+}
+
+
+// One thread group per tile. Merge the sorted runs Culling wrote out for a list that didn't fit in LDS into a single front to back 
+// list. Pairs of runs are merged bottom up, with the run length doubling each round, going back and forth between the tiled buffer 
+// and the scratch buffer. Every element works out where it goes in its merged pair from how many elements of the other run come 
+// before it, with ties going to the earlier run to keep the merge stable
+[numthreads(TILE_RES_X, TILE_RES_Y, 1)]
+void TileListMerge( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID )
+{
+	uint localIdxFlattened = localIdx.x + (localIdx.y*TILE_RES_X);
+	uint tileIdxFlattened = groupIdx.x + groupIdx.y * g_NumTilesX;
+
+	// A list that fits in LDS was sorted in a single run. This goes by the full count, as Culling does, since a list that was written 
+	// as several runs can still be cut down to a single run's length at the end of the buffer
+	uint listSize = g_TileListCounts[ tileIdxFlattened ];
+	if ( listSize <= MAX_PARTICLES_PER_TILE_FOR_SORTING )
+		return;
+
+	// Only merge what Culling could write before the end of the buffer
+	uint listOffset = min( g_TileListOffsets[ tileIdxFlattened ], g_TileListCapacity );
+	uint numParticles = min( listSize, g_TileListCapacity - listOffset );
+
+	bool fromScratch = false;
+	for ( uint runLength = TILE_LIST_RUN_LENGTH; runLength < numParticles; runLength *= 2 )
+	{
+		for ( uint i = localIdxFlattened; i < numParticles; i += TILE_RES_X*TILE_RES_Y )
+		{
+			uint pairStart = i - ( i % ( 2 * runLength ) );
+			uint otherStart = 0;
+			uint otherCount = 0;
+			uint dst = i;
+
+			if ( pairStart + runLength < numParticles )
+			{
+				bool firstRun = i < pairStart + runLength;
+				otherStart = firstRun ? pairStart + runLength : pairStart;
+				otherCount = firstRun ? min( runLength, numParticles - otherStart ) : runLength;
+
+				uint rank = CountSmallerKeys( fromScratch, listOffset + otherStart, otherCount, GetTileListKey( fromScratch, listOffset + i ), !firstRun );
+				dst = firstRun ? i + rank : i - runLength + rank;
+			}
+
+			uint index = ReadTileList( fromScratch, listOffset + i );
+			if ( fromScratch )
+			{
+				g_TiledIndexBuffer[ listOffset + dst ] = index;
+			}
+			else
+			{
+				g_TileListScratch[ listOffset + dst ] = index;
+			}
+		}
+
+		// Make the round's writes visible to the whole group before the next round reads them
+		DeviceMemoryBarrierWithGroupSync();
+
+		fromScratch = !fromScratch;
+	}
+
+	// The renderer reads the tiled buffer so copy the list back if the last round left it in the scratch buffer
+	if ( fromScratch )
+	{
+		for ( uint j = localIdxFlattened; j < numParticles; j += TILE_RES_X*TILE_RES_Y )
+		{
+			g_TiledIndexBuffer[ listOffset + j ] = g_TileListScratch[ listOffset + j ];
+		}
+	}
+}
@@ -0,0 +1,127 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+//
+// Reduces the opaque scene's depth to the range of view space depths in each fine-grained culling tile, and then in each coarse 
+// bin. It is built once a frame so the simulation's collisions, the coarse binning and the tile culling can all reject particles 
+// by depth without each reading the whole depth buffer
+//
+
+#include "ShaderConstants.h"
+#include "Globals.h"
+
+
+// The depth of the opaque scene
+Texture2D<float>					g_DepthTexture					: register( t0 );
+
+// The nearest and furthest view space depth in each culling tile, and in each coarse bin. The bins are reduced from the tiles
+RWStructuredBuffer<float2>			g_TileDepthBounds				: register( u0 );
+RWStructuredBuffer<float2>			g_CoarseBinDepthBounds			: register( u1 );
+
+
+// The bounds are reduced in LDS as the bits of positive floats, which order the same way as the floats
+groupshared uint					g_ldsZMin;
+groupshared uint					g_ldsZMax;
+
+
+void InitLDS( uint localIdxFlattened )
+{
+	if ( localIdxFlattened == 0 )
+	{
+		g_ldsZMin = 0x7f7fffff;
+		g_ldsZMax = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+}
+
+
+// One thread group per culling tile. Pixels past the edge of the screen are left out
+[numthreads(TILE_DEPTH_BOUNDS_THREADS, TILE_DEPTH_BOUNDS_THREADS, 1)]
+void TileDepthBounds( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID )
+{
+	InitLDS( localIdx.x + localIdx.y * TILE_DEPTH_BOUNDS_THREADS );
+
+	uint2 tileSize = uint2( g_TileResX, g_TileResY );
+	uint2 screenSize = uint2( g_ScreenWidth, g_ScreenHeight );
+
+	uint2 tileP0 = groupIdx.xy * tileSize;
+	uint2 tileP1 = min( tileP0 + tileSize, screenSize );
+
+	float zMin = asfloat( 0x7f7fffff );
+	float zMax = 0;
+	for ( uint y = tileP0.y + localIdx.y; y < tileP1.y; y += TILE_DEPTH_BOUNDS_THREADS )
+	{
+		for ( uint x = tileP0.x + localIdx.x; x < tileP1.x; x += TILE_DEPTH_BOUNDS_THREADS )
+		{
+			float viewZ = max( ConvertProjDepthToView( g_DepthTexture.Load( uint3( x, y, 0 ) ).x ), 0 );
+			zMin = min( zMin, viewZ );
+			zMax = max( zMax, viewZ );
+		}
+	}
+
+	InterlockedMin( g_ldsZMin, asuint( zMin ) );
+	InterlockedMax( g_ldsZMax, asuint( zMax ) );
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( all( localIdx.xy == 0 ) )
+	{
+		g_TileDepthBounds[ groupIdx.x + groupIdx.y * g_NumTilesX ] = float2( asfloat( g_ldsZMin ), asfloat( g_ldsZMax ) );
+	}
+}
+
+
+// One thread group per coarse bin. The bins are whole numbers of culling tiles so the last row and column can hang off the screen, 
+// and a bin with no tiles on the screen at all ends up with an empty range
+[numthreads(BIN_DEPTH_BOUNDS_THREADS, 1, 1)]
+void CoarseBinDepthBounds( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID )
+{
+	InitLDS( localIdx.x );
+
+	uint2 binSize = uint2( g_NumCullingTilesPerCoarseTileX, g_NumCullingTilesPerCoarseTileY );
+	uint2 bin = uint2( groupIdx.x % g_NumCoarseCullingTilesX, groupIdx.x / g_NumCoarseCullingTilesX );
+
+	uint2 binP0 = bin * binSize;
+	uint2 binP1 = min( binP0 + binSize, uint2( g_NumTilesX, g_NumTilesY ) );
+	uint2 binTiles = binP1 - min( binP0, binP1 );
+
+	float zMin = asfloat( 0x7f7fffff );
+	float zMax = 0;
+	for ( uint i = localIdx.x; i < binTiles.x * binTiles.y; i += BIN_DEPTH_BOUNDS_THREADS )
+	{
+		uint2 tile = binP0 + uint2( i % binTiles.x, i / binTiles.x );
+		float2 tileBounds = g_TileDepthBounds[ tile.x + tile.y * g_NumTilesX ];
+		zMin = min( zMin, tileBounds.x );
+		zMax = max( zMax, tileBounds.y );
+	}
+
+	InterlockedMin( g_ldsZMin, asuint( zMin ) );
+	InterlockedMax( g_ldsZMax, asuint( zMax ) );
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( localIdx.x == 0 )
+	{
+		g_CoarseBinDepthBounds[ groupIdx.x ] = float2( asfloat( g_ldsZMin ), asfloat( g_ldsZMax ) );
+	}
+}
@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+//
+// Downsamples the opaque scene's depth to half and quarter resolution for the tiles that are shaded at those rates. Each texel takes 
+// the furthest depth in its block so the particles in front of any of the block's pixels are shaded. The Hi-Z pyramid the rasterized 
+// particles are occlusion culled against is built the same way, one level at a time
+//
+
+#include "ShaderConstants.h"
+#include "Globals.h"
+
+
+// The depth of the opaque scene
+Texture2D<float>					g_DepthTexture					: register( t0 );
+
+// The downsampled depth
+RWTexture2D<float>					g_HalfResDepth					: register( u0 );
+RWTexture2D<float>					g_QuarterResDepth				: register( u1 );
+
+
+// One thread per quarter resolution texel. Each thread writes the four half resolution texels in its block
+[numthreads(LOW_RES_DEPTH_THREADS, LOW_RES_DEPTH_THREADS, 1)]
+void DownsampleMaxDepth( uint3 globalIdx : SV_DispatchThreadID )
+{
+	uint2 quarterResSize = ( uint2( g_ScreenWidth, g_ScreenHeight ) + 3 ) / 4;
+	if ( any( globalIdx.xy >= quarterResSize ) )
+		return;
+
+	float quarterResDepth = 0;
+
+	[unroll]
+	for ( uint i = 0; i < 4; i++ )
+	{
+		uint2 halfResCoord = globalIdx.xy * 2 + uint2( i & 1, i >> 1 );
+		uint2 coord = halfResCoord * 2;
+
+		// Loads past the edge of the screen return zero so don't affect the max
+		float depth = g_DepthTexture.Load( uint3( coord, 0 ) ).x;
+		depth = max( depth, g_DepthTexture.Load( uint3( coord + uint2( 1, 0 ), 0 ) ).x );
+		depth = max( depth, g_DepthTexture.Load( uint3( coord + uint2( 0, 1 ), 0 ) ).x );
+		depth = max( depth, g_DepthTexture.Load( uint3( coord + uint2( 1, 1 ), 0 ) ).x );
+
+		g_HalfResDepth[ halfResCoord ] = depth;
+		quarterResDepth = max( quarterResDepth, depth );
+	}
+
+	g_QuarterResDepth[ globalIdx.xy ] = quarterResDepth;
+}
+
+
+// The depth buffer for the first level of the Hi-Z pyramid, and the level before for the rest
+Texture2D<float>					g_HiZInput						: register( t1 );
+
+// The level being built
+RWTexture2D<float>					g_HiZOutput						: register( u2 );
+
+
+// One thread per texel of the level being built. The first level is half the screen's size rounded up to a power of two, so every 
+// level is exactly half the one before and its texels cover 2x2 of them
+[numthreads(HIZ_THREADS, HIZ_THREADS, 1)]
+void DownsampleHiZ( uint3 globalIdx : SV_DispatchThreadID )
+{
+	uint width, height;
+	g_HiZOutput.GetDimensions( width, height );
+	if ( any( globalIdx.xy >= uint2( width, height ) ) )
+		return;
+
+	// Loads past the edge of the input return zero so don't affect the max. They only ever cover pixels off the screen
+	uint2 coord = globalIdx.xy * 2;
+	float depth = g_HiZInput.Load( uint3( coord, 0 ) ).x;
+	depth = max( depth, g_HiZInput.Load( uint3( coord + uint2( 1, 0 ), 0 ) ).x );
+	depth = max( depth, g_HiZInput.Load( uint3( coord + uint2( 0, 1 ), 0 ) ).x );
+	depth = max( depth, g_HiZInput.Load( uint3( coord + uint2( 1, 1 ), 0 ) ).x );
+
+	g_HiZOutput[ globalIdx.xy ] = depth;
+}
@@ -25,11 +25,6 @@
 // Per-frame constant buffer
 cbuffer PerFrameConstantBuffer : register( b0 )
 {
-	float4	g_StartColor[ NUM_EMITTERS ];
-	float4	g_EndColor[ NUM_EMITTERS ];
-
-	float4	g_EmitterLightingCenter[ NUM_EMITTERS ];
-
 	matrix	g_mViewProjection;
 	matrix	g_mViewProjInv;
 	matrix	g_mView;
@@ -77,6 +72,23 @@ cbuffer ActiveListCount : register( b3 )
 };
 
 
+// The number of particles on the simulation list, ie last frame's survivors plus this frame's newly emitted particles
+cbuffer SimulationListCount : register( b6 )
+{
+	uint	g_NumParticlesToSimulate;
+	uint3	SimulationListCount_pad;
+};
+
+
+// The capacity of the particle pool. Passes that run over the whole pool need it as the dispatches are rounded up, and the 
+// SoA layout needs it to locate the start of each stream
+cbuffer ParticleStorageConstants : register( b4 )
+{
+	uint	g_MaxParticles;
+	uint3	ParticleStorageConstants_pad;
+};
+
+
 // Tiling constants that are dependant on the screen resolution
 cbuffer TilingConstantBuffer : register( b5 )
 {
@@ -87,7 +99,16 @@ cbuffer TilingConstantBuffer : register( b5 )
 
 	uint g_NumCullingTilesPerCoarseTileX;
 	uint g_NumCullingTilesPerCoarseTileY;
-	uint g_TilingCBPads[ 2 ];
+	uint g_CoarseBinCapacity;			// The number of entries the coarse culling index buffer can hold
+	uint g_TileListCapacity;			// The number of entries the tiled index buffer can hold
+
+	uint g_TileResX;					// The fine-grained tile size this frame
+	uint g_TileResY;
+	uint g_MaxShadingRate;				// The lowest shading rate a tile may pick, 0 to shade every tile at full resolution
+	uint g_OpacityCulling;				// Whether to stop the tile lists once the tiles are opaque
+
+	uint g_CullMaxZ;					// Whether the coarse bins drop particles behind everything opaque in the bin
+	uint3 TilingConstantBuffer_pad;
 };
 
 
@@ -194,6 +215,50 @@ float3 ConvertProjToView( float4 p )
 }
 
 
+// Convert a depth buffer value to view space Z
+float ConvertProjDepthToView( float z )
+{
+	z = 1.f / (z*g_mProjectionInv._34 + g_mProjectionInv._44);
+	return z;
+}
+
+
+// Project a view space bounding sphere to a conservative screen rectangle in pixels. Returns false if the sphere is behind the eye 
+// or off screen. Mirrored by GetSphereScreenBounds in CoarseBinning.cpp
+bool GetSphereScreenBounds( float3 center, float r, out float2 pixelMin, out float2 pixelMax )
+{
+	pixelMin = 0;
+	pixelMax = 0;
+
+	// Spheres entirely behind the eye can't be seen
+	if ( -center.z >= r )
+		return false;
+
+	// Spheres reaching behind the eye don't have a finite projection so they cover the whole screen
+	float2 ndcMin = -1.0;
+	float2 ndcMax = 1.0;
+	if ( center.z - r > COARSE_BINNING_MIN_Z )
+	{
+		// At a given depth the projection grows with x and y, and for a given x or y it is monotonic in depth. So the extents of 
+		// the sphere's view space bounding box are the projections of the corners of its front and back faces
+		float4 p0 = mul( float4( center + float3( -r, -r, -r ), 1.0 ), g_mProjection );
+		float4 p1 = mul( float4( center + float3(  r,  r, -r ), 1.0 ), g_mProjection );
+		float4 p2 = mul( float4( center + float3( -r, -r,  r ), 1.0 ), g_mProjection );
+		float4 p3 = mul( float4( center + float3(  r,  r,  r ), 1.0 ), g_mProjection );
+
+		ndcMin = min( p0.xy / p0.w, p2.xy / p2.w );
+		ndcMax = max( p1.xy / p1.w, p3.xy / p3.w );
+	}
+
+	// Convert to pixels. Screen space Y runs down
+	float2 screenSize = float2( g_ScreenWidth, g_ScreenHeight );
+	pixelMin = float2( ndcMin.x * 0.5 + 0.5, 0.5 - ndcMax.y * 0.5 ) * screenSize;
+	pixelMax = float2( ndcMax.x * 0.5 + 0.5, 0.5 - ndcMin.y * 0.5 ) * screenSize;
+
+	return !any( pixelMax < 0.0 ) && !any( pixelMin >= screenSize );
+}
+
+
 // Declare the global samplers
 SamplerState g_samWrapLinear		: register( s0 );
 SamplerState g_samClampLinear		: register( s1 );
@@ -22,10 +22,16 @@
 
 // A simple compute shader that adds each particle to the dead list UAV
 
+#include "Globals.h"
+
 AppendStructuredBuffer<uint>	g_DeadListToAddTo		: register( u0 );
 
 [numthreads(256,1,1)]
 void CS_InitDeadList( uint3 id : SV_DispatchThreadID )
 {
-	g_DeadListToAddTo.Append( id.x );
+	// The dispatch is rounded up to a whole number of thread groups
+	if ( id.x < g_MaxParticles )
+	{
+		g_DeadListToAddTo.Append( id.x );
+	}
 }
\ No newline at end of file
@@ -0,0 +1,70 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "Globals.h"
+
+
+// The args for the DispatchIndirect call that runs CS_Simulate
+RWBuffer<uint>							g_SimulateDispatchArgs	: register( u0 );
+
+// The draw args for the DrawInstancedIndirect call. CS_Simulate only adds to these so they are reset here
+RWBuffer<uint>							g_DrawArgs				: register( u1 );
+
+
+// Size the simulation dispatch to the number of particles on the simulation list
+[numthreads(1,1,1)]
+void CS_InitSimulateArgs( uint3 id : SV_DispatchThreadID )
+{
+	g_SimulateDispatchArgs[ 0 ] = ( g_NumParticlesToSimulate + 255 ) / 256;
+	g_SimulateDispatchArgs[ 1 ] = 1;
+	g_SimulateDispatchArgs[ 2 ] = 1;
+
+	g_DrawArgs[ 0 ] = 0;	// Number of primitives reset to zero
+	g_DrawArgs[ 1 ] = 1;	// Number of instances is always 1
+	g_DrawArgs[ 2 ] = 0;
+	g_DrawArgs[ 3 ] = 0;
+	g_DrawArgs[ 4 ] = 0;
+}
+
+
+// The args for the DispatchIndirect calls that run over the alive list
+RWBuffer<uint>							g_AliveDispatchArgs		: register( u2 );
+
+
+// Size the passes that run one thread per alive particle to this frame's alive count rather than the whole pool
+[numthreads(1,1,1)]
+void CS_InitAliveArgs( uint3 id : SV_DispatchThreadID )
+{
+	// Coarse culling always needs a thread group as the first group of its scatter pass writes out the bin offsets
+	g_AliveDispatchArgs[ ALIVE_ARGS_COARSE_CULLING + 0 ] = max( 1, ( g_NumActiveParticles + COARSE_CULLING_THREADS - 1 ) / COARSE_CULLING_THREADS );
+	g_AliveDispatchArgs[ ALIVE_ARGS_COARSE_CULLING + 1 ] = 1;
+	g_AliveDispatchArgs[ ALIVE_ARGS_COARSE_CULLING + 2 ] = 1;
+
+	// Gathering the alive particles out of the pool when it is resized
+	g_AliveDispatchArgs[ ALIVE_ARGS_GATHER + 0 ] = ( g_NumActiveParticles + 255 ) / 256;
+	g_AliveDispatchArgs[ ALIVE_ARGS_GATHER + 1 ] = 1;
+	g_AliveDispatchArgs[ ALIVE_ARGS_GATHER + 2 ] = 1;
+
+	// Occlusion culling before the rasterized draw
+	g_AliveDispatchArgs[ ALIVE_ARGS_OCCLUSION_CULLING + 0 ] = ( g_NumActiveParticles + OCCLUSION_CULLING_THREADS - 1 ) / OCCLUSION_CULLING_THREADS;
+	g_AliveDispatchArgs[ ALIVE_ARGS_OCCLUSION_CULLING + 1 ] = 1;
+	g_AliveDispatchArgs[ ALIVE_ARGS_OCCLUSION_CULLING + 2 ] = 1;
+}
@@ -27,6 +27,11 @@ cbuffer NumElementsCB : register( b0 )
 	int4 g_NumElements;
 };
 
+cbuffer SortConstants : register( b1 )
+{
+	int4 job_params;
+};
+
 
 [numthreads(1, 1, 1)]
 void InitDispatchArgs( uint3 id : SV_DispatchThreadID )
@@ -35,4 +40,28 @@ void InitDispatchArgs( uint3 id : SV_DispatchThreadID )
 	g_DispatchArgs[ 1 ] = 1;
 	g_DispatchArgs[ 2 ] = 1;
 	g_DispatchArgs[ 3 ] = 0;
+}
+
+
+#ifdef RADIX_ITEMS_PER_GROUP
+// One group per block of items for the radix sort passes
+[numthreads(1, 1, 1)]
+void InitRadixDispatchArgs( uint3 id : SV_DispatchThreadID )
+{
+	g_DispatchArgs[ 0 ] = ( (uint)g_NumElements.x + RADIX_ITEMS_PER_GROUP - 1 ) / RADIX_ITEMS_PER_GROUP;
+	g_DispatchArgs[ 1 ] = 1;
+	g_DispatchArgs[ 2 ] = 1;
+	g_DispatchArgs[ 3 ] = 0;
+}
+#endif
+
+
+// Write the args for one group per job_params.y items to the args starting at element job_params.x
+[numthreads(1, 1, 1)]
+void InitGroupDispatchArgs( uint3 id : SV_DispatchThreadID )
+{
+	uint offset = (uint)job_params.x;
+	g_DispatchArgs[ offset + 0 ] = ( (uint)g_NumElements.x + job_params.y - 1 ) / job_params.y;
+	g_DispatchArgs[ offset + 1 ] = 1;
+	g_DispatchArgs[ offset + 2 ] = 1;
 }
\ No newline at end of file
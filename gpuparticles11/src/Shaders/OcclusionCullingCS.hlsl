@@ -0,0 +1,224 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+//
+// Hi-Z occlusion culling of the rasterized particles. Each alive particle's bounding sphere is projected to a screen rectangle and 
+// tested against the level of the Hi-Z pyramid where that rectangle spans at most 2x2 texels. The particle is culled when the front 
+// of the sphere is behind the furthest opaque depth under it. The survivors are then compacted into the visible list in the same 
+// order they have on the sorted alive list, and the draw args are rewritten to match
+//
+
+#include "ShaderConstants.h"
+#include "Globals.h"
+#include "SortKeys.h"
+
+// Shader inputs
+// =============
+
+// View space positions of the particles
+StructuredBuffer<float4>			g_ViewSpacePositions				: register( t0 );
+
+// The maximum radius in X & Y of each particle
+StructuredBuffer<float2>			g_MaxRadiusBuffer					: register( t1 );
+
+// The sorted alive particle list
+StructuredBuffer<SortItem>			g_AliveIndexBuffer					: register( t2 );
+
+// The furthest opaque depth of each texel's 2x2 block in the level below, see DownsampleHiZ. Level n texels cover 2^(n+1) pixels
+Texture2D<float>					g_HiZ								: register( t3 );
+
+
+// Shader outputs
+// ==============
+
+// One bit per alive list entry, set when the particle survives
+RWBuffer<uint>						g_VisibilityMasks					: register( u0 );
+
+// Each thread group's offset into the survivors. The element after the last group holds the total number of survivors
+RWBuffer<uint>						g_VisibleGroupOffsets				: register( u1 );
+
+// The survivors. The list is packed against the end of the buffer, as the vertex shader reads the last of this frame's alive count 
+// first and works back, so it can draw from this the same way it draws from the alive list
+RWStructuredBuffer<SortItem>		g_VisibleIndexBuffer				: register( u2 );
+
+// The args for the DrawInstancedIndirect call
+RWBuffer<uint>						g_DrawArgs							: register( u3 );
+
+
+groupshared uint					g_ldsVisibilityMask[ OCCLUSION_CULLING_MASK_WORDS ];
+groupshared uint					g_ldsScan[ OCCLUSION_CULLING_SCAN_THREADS ];
+
+
+// Test a particle's bounding sphere against the Hi-Z pyramid. Mirrored by IsParticleOccluded in OcclusionCulling.cpp
+bool IsParticleVisible( uint index )
+{
+	float3 center = g_ViewSpacePositions[ index ].xyz;
+	float r = g_MaxRadiusBuffer[ index ].x;
+
+	float2 pixelMin, pixelMax;
+	if ( !GetSphereScreenBounds( center, r, pixelMin, pixelMax ) )
+		return false;
+
+	// Spheres reaching too close to the eye cover the whole screen so there is little to gain from testing them
+	if ( center.z - r <= COARSE_BINNING_MIN_Z )
+		return true;
+
+	// Clip the rectangle to the screen and pick the level where it spans at most two texels each way
+	uint2 p0 = (uint2)max( pixelMin, 0.0 );
+	uint2 p1 = (uint2)min( pixelMax, float2( g_ScreenWidth, g_ScreenHeight ) - 1.0 );
+	uint size = max( p1.x - p0.x, p1.y - p0.y ) + 1;
+
+	uint width, height, numLevels;
+	g_HiZ.GetDimensions( 0, width, height, numLevels );
+	uint level = min( size > 2 ? firstbithigh( size - 1 ) : 0, numLevels - 1 );
+
+	uint2 t0 = p0 >> ( level + 1 );
+	uint2 t1 = p1 >> ( level + 1 );
+
+	float depth = max( max( g_HiZ.Load( uint3( t0.x, t0.y, level ) ).x, g_HiZ.Load( uint3( t1.x, t0.y, level ) ).x ),
+					   max( g_HiZ.Load( uint3( t0.x, t1.y, level ) ).x, g_HiZ.Load( uint3( t1.x, t1.y, level ) ).x ) );
+
+	// Visible unless the whole sphere is behind the furthest opaque pixel under it
+	return center.z - r <= ConvertProjDepthToView( depth );
+}
+
+
+// The number of survivors in a culling thread group
+uint CountVisible( uint group )
+{
+	uint count = 0;
+
+	[unroll]
+	for ( uint i = 0; i < OCCLUSION_CULLING_MASK_WORDS; i++ )
+	{
+		count += countbits( g_VisibilityMasks[ group * OCCLUSION_CULLING_MASK_WORDS + i ] );
+	}
+
+	return count;
+}
+
+
+// The culling runs in three passes so the survivors keep their sort order without any global atomics. OcclusionCull tests each 
+// alive list entry and writes a bit mask per group, OcclusionCullScan turns the masks' counts into each group's offset and 
+// OcclusionCullCompact writes the survivors out
+
+
+// One thread per alive list entry
+[numthreads(OCCLUSION_CULLING_THREADS, 1, 1)]
+void OcclusionCull( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID, uint3 globalIdx : SV_DispatchThreadID )
+{
+	if ( localIdx.x < OCCLUSION_CULLING_MASK_WORDS )
+	{
+		g_ldsVisibilityMask[ localIdx.x ] = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( globalIdx.x < g_NumActiveParticles )
+	{
+		if ( IsParticleVisible( SortItemIndex( g_AliveIndexBuffer[ globalIdx.x ] ) ) )
+		{
+			InterlockedOr( g_ldsVisibilityMask[ localIdx.x / 32 ], 1u << ( localIdx.x % 32 ) );
+		}
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( localIdx.x < OCCLUSION_CULLING_MASK_WORDS )
+	{
+		g_VisibilityMasks[ groupIdx.x * OCCLUSION_CULLING_MASK_WORDS + localIdx.x ] = g_ldsVisibilityMask[ localIdx.x ];
+	}
+}
+
+
+// A single thread group. Each thread sums a run of the culling groups' counts, the sums are scanned in LDS and each thread then 
+// writes its run's offsets
+[numthreads(OCCLUSION_CULLING_SCAN_THREADS, 1, 1)]
+void OcclusionCullScan( uint3 localIdx : SV_GroupThreadID )
+{
+	uint numGroups = ( g_NumActiveParticles + OCCLUSION_CULLING_THREADS - 1 ) / OCCLUSION_CULLING_THREADS;
+	uint groupsPerThread = ( numGroups + OCCLUSION_CULLING_SCAN_THREADS - 1 ) / OCCLUSION_CULLING_SCAN_THREADS;
+	uint firstGroup = min( localIdx.x * groupsPerThread, numGroups );
+	uint lastGroup = min( firstGroup + groupsPerThread, numGroups );
+
+	uint group;
+	uint sum = 0;
+	for ( group = firstGroup; group < lastGroup; group++ )
+	{
+		sum += CountVisible( group );
+	}
+
+	g_ldsScan[ localIdx.x ] = sum;
+	GroupMemoryBarrierWithGroupSync();
+
+	// Inclusive scan of the per-thread sums
+	[unroll]
+	for ( uint offset = 1; offset < OCCLUSION_CULLING_SCAN_THREADS; offset *= 2 )
+	{
+		uint value = localIdx.x >= offset ? g_ldsScan[ localIdx.x - offset ] : 0;
+		GroupMemoryBarrierWithGroupSync();
+		g_ldsScan[ localIdx.x ] += value;
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	uint groupOffset = g_ldsScan[ localIdx.x ] - sum;
+	for ( group = firstGroup; group < lastGroup; group++ )
+	{
+		g_VisibleGroupOffsets[ group ] = groupOffset;
+		groupOffset += CountVisible( group );
+	}
+
+	if ( localIdx.x == OCCLUSION_CULLING_SCAN_THREADS - 1 )
+	{
+		uint numVisible = g_ldsScan[ localIdx.x ];
+		g_VisibleGroupOffsets[ numGroups ] = numVisible;
+
+#if defined (USE_GEOMETRY_SHADER)
+		g_DrawArgs[ 0 ] = numVisible;
+#else
+		g_DrawArgs[ 0 ] = numVisible * 6;
+#endif
+	}
+}
+
+
+// One thread per alive list entry. Each survivor is written after the survivors ahead of it in its group
+[numthreads(OCCLUSION_CULLING_THREADS, 1, 1)]
+void OcclusionCullCompact( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID, uint3 globalIdx : SV_DispatchThreadID )
+{
+	uint word = localIdx.x / 32;
+	uint bit = 1u << ( localIdx.x % 32 );
+	uint mask = g_VisibilityMasks[ groupIdx.x * OCCLUSION_CULLING_MASK_WORDS + word ];
+
+	if ( mask & bit )
+	{
+		uint rank = countbits( mask & ( bit - 1 ) );
+		for ( uint i = 0; i < word; i++ )
+		{
+			rank += countbits( g_VisibilityMasks[ groupIdx.x * OCCLUSION_CULLING_MASK_WORDS + i ] );
+		}
+
+		uint numGroups = ( g_NumActiveParticles + OCCLUSION_CULLING_THREADS - 1 ) / OCCLUSION_CULLING_THREADS;
+		uint numVisible = g_VisibleGroupOffsets[ numGroups ];
+
+		g_VisibleIndexBuffer[ g_NumActiveParticles - numVisible + g_VisibleGroupOffsets[ groupIdx.x ] + rank ] = g_AliveIndexBuffer[ globalIdx.x ];
+	}
+}
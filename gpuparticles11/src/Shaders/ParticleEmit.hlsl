@@ -20,80 +20,126 @@
 // THE SOFTWARE.
 //
 #include "Globals.h"
+#include "Random.h"
 
 
-// A texture filled with random values for generating some variance in our particles when we spawn them
-Texture2D								g_RandomBuffer			: register( t0 );
-
 // The particle buffers to fill with new particles
-RWStructuredBuffer<GPUParticlePartA>	g_ParticleBufferA		: register( u0 );
-RWStructuredBuffer<GPUParticlePartB>	g_ParticleBufferB		: register( u1 );
+#define PARTICLE_STORAGE_WRITE
+#include "ParticleStorage.h"
 
 // The dead list interpretted as a consume buffer. So every time we consume an index from this list, it automatically decrements the atomic counter (ie the number of dead particles)
 ConsumeStructuredBuffer<uint>			g_DeadListToAllocFrom	: register( u2 );
 
+// The list of particles to simulate this frame. New particles are added to it so they get picked up by the simulation
+AppendStructuredBuffer<uint>			g_SimulationList		: register( u3 );
 
-cbuffer EmitterConstantBuffer : register( b1 )
+
+// An emitter that emits this frame
+struct Emitter
 {
-	float4	g_vEmitterPosition;
-	float4	g_vEmitterVelocity;
-	float4	g_PositionVariance;
+	float4	m_vEmitterPosition;
+	float4	m_vEmitterVelocity;
+	float4	m_PositionVariance;
 	
-	int		g_MaxParticlesThisFrame;
-	float	g_ParticleLifeSpan;	
-	float	g_StartSize;
-	float	g_EndSize;
-	
-	float	g_VelocityVariance;
-	float	g_Mass;
-	uint	g_EmitterIndex;
-	uint	g_EmitterStreaks;
+	uint	m_FirstParticle;		// The number of particles emitted by the previous emitters in the buffer
+	uint	m_NumToEmit;
+	float	m_ParticleLifeSpan;	
+	float	m_StartSize;
+
+	float	m_EndSize;
+	float	m_VelocityVariance;
+	float	m_Mass;
+	uint	m_EmitterIndex;
+
+	uint	m_EmitterStreaks;
+	uint	m_TextureIndex;
+	uint	m_pads[ 2 ];
+};
 
-	uint	g_TextureIndex;
-	uint	g_pads[ 3 ];
+// All the emitters that emit this frame, in order of m_FirstParticle
+StructuredBuffer<Emitter>				g_Emitters				: register( t0 );
+
+
+cbuffer EmitterConstantBuffer : register( b1 )
+{
+	uint	g_NumEmitters;
+	uint	g_NumToEmit;			// The total number of particles requested by all the emitters
+	uint	g_EmitFrame;			// Counts the frames since the system was reset. Part of the random number key
+	uint	g_pads;
 };
 
 
-// Emit particles, one per thread, in blocks of 1024 at a time
+// Find the emitter whose range of particles contains the given one. The ranges are a prefix sum of each emitter's particle 
+// count so this is a binary search for the last emitter starting at or before the particle
+uint FindEmitter( uint particle )
+{
+	uint first = 0;
+	uint last = g_NumEmitters - 1;
+
+	while ( first < last )
+	{
+		uint middle = ( first + last + 1 ) / 2;
+		if ( g_Emitters[ middle ].m_FirstParticle <= particle )
+		{
+			first = middle;
+		}
+		else
+		{
+			last = middle - 1;
+		}
+	}
+
+	return first;
+}
+
+
+// Emit particles for every emitter in a single dispatch, one particle per thread, in blocks of 1024 at a time. Like emitting each 
+// emitter in turn, the earlier emitters get their particles first when there aren't enough dead particles to go round
 [numthreads(1024,1,1)]
 void CS_Emit( uint3 id : SV_DispatchThreadID )
 {
 	// Check to make sure we don't emit more particles than we specified
-	if ( id.x < g_NumDeadParticles && id.x < g_MaxParticlesThisFrame )
+	if ( id.x < g_NumDeadParticles && id.x < g_NumToEmit )
 	{
+		Emitter emitter = g_Emitters[ FindEmitter( id.x ) ];
+
+		// The index of the particle within its emitter
+		uint emitterParticle = id.x - emitter.m_FirstParticle;
+
 		// Initialize the particle data to zero to avoid any unexpected results
 		GPUParticlePartA pa = (GPUParticlePartA)0;
 		GPUParticlePartB pb = (GPUParticlePartB)0;
 		
-		// Generate some random numbers from reading the random texture
-		float2 uv = float2( id.x / 1024.0, g_ElapsedTime );
-		float3 randomValues0 = g_RandomBuffer.SampleLevel( g_samWrapLinear, uv, 0 ).xyz;
+		// Generate some random numbers keyed on the emitter, frame and particle. CPUParticleSimulation generates the same values
+		uint3 random0 = RandomPCG3D( RandomEmissionKey( emitter.m_EmitterIndex, g_EmitFrame, emitterParticle, 0 ) );
+		uint3 random1 = RandomPCG3D( RandomEmissionKey( emitter.m_EmitterIndex, g_EmitFrame, emitterParticle, 1 ) );
 
-		float2 uv2 = float2( (id.x + 1) / 1024.0, g_ElapsedTime );
-		float3 randomValues1 = g_RandomBuffer.SampleLevel( g_samWrapLinear, uv2, 0 ).xyz;
+		float3 randomValues0 = float3( RandomToSignedFloat( random0.x ), RandomToSignedFloat( random0.y ), RandomToSignedFloat( random0.z ) );
+		float3 randomValues1 = float3( RandomToSignedFloat( random1.x ), RandomToSignedFloat( random1.y ), RandomToSignedFloat( random1.z ) );
 
-		float velocityMagnitude = length( g_vEmitterVelocity.xyz );
+		float velocityMagnitude = length( emitter.m_vEmitterVelocity.xyz );
 
-		pb.m_Position = g_vEmitterPosition.xyz + ( randomValues0.xyz * g_PositionVariance.xyz );
+		pb.m_Position = emitter.m_vEmitterPosition.xyz + ( randomValues0.xyz * emitter.m_PositionVariance.xyz );
 
-		pa.m_EmitterProperties = WriteEmitterProperties( g_EmitterIndex, g_TextureIndex, g_EmitterStreaks ? true : false );
+		pa.m_EmitterProperties = WriteEmitterProperties( emitter.m_EmitterIndex, emitter.m_TextureIndex, emitter.m_EmitterStreaks ? true : false );
 		pa.m_Rotation = 0;
 		pa.m_IsSleeping = 0;
 		pa.m_CollisionCount = 0;
 
-		pb.m_Mass = g_Mass;
-		pb.m_Velocity = g_vEmitterVelocity.xyz + ( randomValues1.xyz * velocityMagnitude * g_VelocityVariance );
-		pb.m_Lifespan = g_ParticleLifeSpan;
+		pb.m_Mass = emitter.m_Mass;
+		pb.m_Velocity = emitter.m_vEmitterVelocity.xyz + ( randomValues1.xyz * velocityMagnitude * emitter.m_VelocityVariance );
+		pb.m_Lifespan = emitter.m_ParticleLifeSpan;
 		pb.m_Age = pb.m_Lifespan;
-		pb.m_StartSize = g_StartSize;
-		pb.m_EndSize = g_EndSize;
+		pb.m_StartSize = emitter.m_StartSize;
+		pb.m_EndSize = emitter.m_EndSize;
 
 		// The index into the global particle list obtained from the dead list. 
 		// Calling consume will decrement the counter in this buffer.
 		uint index = g_DeadListToAllocFrom.Consume();
 
 		// Write the new particle state into the global particle buffer
-		g_ParticleBufferA[ index ] = pa;
-		g_ParticleBufferB[ index ] = pb;
+		StoreParticle( index, pa, pb );
+
+		g_SimulationList.Append( index );
 	}
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "Globals.h"
+#include "SortKeys.h"
+
+
+// Moves the alive particles into a resized particle pool. The alive particles are first gathered out of the old pool into
+// a temporary uncompressed array, then the pools are swapped and the particles are scattered into the front of the new pool.
+// Every other slot in the new pool is reset and added to the dead list, and the alive list is rebuilt to match so a second resize
+// before the next simulation step gathers from the new pool. The two passes use distinct registers so the declarations don't 
+// overlap.
+
+
+// The particle pool being gathered from or scattered to, in whichever layout the system uses. g_MaxParticles is the capacity
+// of the pool that is currently bound
+#define PARTICLE_STORAGE_WRITE
+#include "ParticleStorage.h"
+
+
+cbuffer MigrationConstants : register( b1 )
+{
+	uint	g_NewMaxParticles;		// The capacity of the new pool
+	uint3	MigrationConstants_pad;
+};
+
+
+// The number of particles that survive the migration. When shrinking the pool any alive particles that don't fit are discarded
+uint GetNumParticlesToMigrate()
+{
+	return min( g_NumActiveParticles, g_NewMaxParticles );
+}
+
+
+// The alive list from the last simulation step
+StructuredBuffer<SortItem>					g_AliveIndexBuffer		: register( t2 );
+
+// The gathered particles
+RWStructuredBuffer<GPUParticlePartA>		g_MigratedParticlesA	: register( u2 );
+RWStructuredBuffer<GPUParticlePartB>		g_MigratedParticlesB	: register( u3 );
+
+
+// Copy the alive particles out of the old pool, one thread per particle
+[numthreads(256,1,1)]
+void CS_GatherParticles( uint3 id : SV_DispatchThreadID )
+{
+	if ( id.x < GetNumParticlesToMigrate() )
+	{
+		uint index = SortItemIndex( g_AliveIndexBuffer[ id.x ] );
+
+		g_MigratedParticlesA[ id.x ] = LoadParticlePartA( index );
+		g_MigratedParticlesB[ id.x ] = LoadParticlePartB( index );
+	}
+}
+
+
+// The gathered particles read back in the scatter pass
+StructuredBuffer<GPUParticlePartA>			g_GatheredParticlesA	: register( t0 );
+StructuredBuffer<GPUParticlePartB>			g_GatheredParticlesB	: register( t1 );
+
+// The dead list of the new pool
+AppendStructuredBuffer<uint>				g_DeadListToAddTo		: register( u4 );
+
+// The migrated particles make up the simulation list of the new pool
+AppendStructuredBuffer<uint>				g_SimulationList		: register( u5 );
+
+// The alive list of the new pool. Its count is copied back into the alive count constants once the scatter is done
+RWStructuredBuffer<SortItem>				g_NewAliveIndexBuffer	: register( u6 );
+
+
+// Fill the new pool, one thread per particle. The migrated particles are packed at the start and the rest are dead
+[numthreads(256,1,1)]
+void CS_ScatterParticles( uint3 id : SV_DispatchThreadID )
+{
+	if ( id.x < GetNumParticlesToMigrate() )
+	{
+		StoreParticle( id.x, g_GatheredParticlesA[ id.x ], g_GatheredParticlesB[ id.x ] );
+		g_SimulationList.Append( id.x );
+
+		uint aliveIndex = g_NewAliveIndexBuffer.IncrementCounter();
+		g_NewAliveIndexBuffer[ aliveIndex ] = MakeSortItem( g_GatheredParticlesB[ id.x ].m_DistanceToEye, id.x );
+	}
+	else if ( id.x < g_MaxParticles )
+	{
+		StoreParticle( id.x, (GPUParticlePartA)0, (GPUParticlePartB)0 );
+		g_DeadListToAddTo.Append( id.x );
+	}
+}
@@ -26,6 +26,7 @@
 //
 
 #include "Globals.h"
+#include "SortKeys.h"
 
 
 struct VS_OUTPUT
@@ -49,13 +50,13 @@ struct PS_INPUT
 
 
 // The particle buffer data. Note this is only one half of the particle data - the data that is relevant to rendering as opposed to simulation
-StructuredBuffer<GPUParticlePartA>	g_ParticleBufferA		: register( t0 );
+#include "ParticleStorage.h"
 
 // A buffer containing the pre-computed view space positions of the particles
 StructuredBuffer<float4>			g_ViewSpacePositions	: register( t1 );
 
 // The sorted index list of particles
-StructuredBuffer<float2>			g_SortedIndexBuffer		: register( t2 );
+StructuredBuffer<SortItem>			g_SortedIndexBuffer		: register( t2 );
 
 
 // The geometry shader path for rendering particles. 
@@ -68,10 +69,10 @@ VS_OUTPUT VS_StructuredBuffer( uint VertexId : SV_VertexID )
 	uint particleIndex = VertexId;
 
 	// Get the global particle index
-	uint index = (uint)g_SortedIndexBuffer[ g_NumActiveParticles - particleIndex - 1 ].y;
+	uint index = SortItemIndex( g_SortedIndexBuffer[ g_NumActiveParticles - particleIndex - 1 ] );
 
 	// Retreive the particle data
-	GPUParticlePartA pa = g_ParticleBufferA[ index ];
+	GPUParticlePartA pa = LoadParticlePartA( index );
 		
 	// Pack the particle data into our interpolators
 	Output.ViewSpaceCentreAndRadius = g_ViewSpacePositions[ index ];
@@ -182,8 +183,8 @@ PS_INPUT VS_StructuredBuffer( uint VertexId : SV_VertexID )
 		float2(  1, -1 ),
 	};
 
-	uint index = (uint)g_SortedIndexBuffer[ g_NumActiveParticles - particleIndex - 1 ].y;
-	GPUParticlePartA pa = g_ParticleBufferA[ index ];
+	uint index = SortItemIndex( g_SortedIndexBuffer[ g_NumActiveParticles - particleIndex - 1 ] );
+	GPUParticlePartA pa = LoadParticlePartA( index );
 		
 	float4 ViewSpaceCentreAndRadius = g_ViewSpacePositions[ index ];
 	float3 VelocityXYEmitterNdotL = float3( pa.m_VelocityXY.x, pa.m_VelocityXY.y, pa.m_EmitterNdotL );
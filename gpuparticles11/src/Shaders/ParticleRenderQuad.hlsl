@@ -27,8 +27,14 @@ struct VS_OUTPUT
 	float4 	Position : SV_POSITION;
 };
 
-// The UAV for tiled rendering
-Buffer<float4>				g_RenderBuffer		: register( t0 );
+// The output of the tiled renderer, one texel per screen pixel
+Texture2D<float4>			g_RenderBuffer		: register( t0 );
+
+// The rate each tile was shaded at, and the depths the low resolution tiles are upsampled with
+Buffer<uint>				g_TileShadingRates	: register( t1 );
+Texture2D<float>			g_DepthTexture		: register( t2 );
+Texture2D<float>			g_HalfResDepth		: register( t3 );
+Texture2D<float>			g_QuarterResDepth	: register( t4 );
 
 
 VS_OUTPUT QuadVS( uint VertexId : SV_VertexID )
@@ -42,21 +48,91 @@ VS_OUTPUT QuadVS( uint VertexId : SV_VertexID )
 }
 
 
+// The depth a pixel shaded at the given rate was shaded with, see FrontToBack in TiledRendering.hlsl
+float LoadShadedDepth( uint2 pixel, uint rate )
+{
+	if ( rate == 0 )
+		return g_DepthTexture.Load( uint3( pixel, 0 ) ).x;
+	else if ( rate == 1 )
+		return g_HalfResDepth.Load( uint3( pixel >> 1, 0 ) ).x;
+	else
+		return g_QuarterResDepth.Load( uint3( pixel >> 2, 0 ) ).x;
+}
+
+
+// Upsample a pixel of a tile that was shaded at half or quarter rate. The four nearest shaded blocks are blended bilinearly, with each 
+// weighted down by how far its depth is from the pixel's so particles don't bleed across depth edges. The blocks can be in the 
+// neighbouring tiles so there are no seams at the tile edges. A neighbour shaded at a coarser rate only wrote every other block, so 
+// its tap moves to the block it did write
+float4 UpsampleLowResPixel( uint2 pixel, uint rate )
+{
+	uint blockSize = 1 << rate;
+
+	// The range of blocks on the screen
+	int2 maxBlock = (int2)( ( uint2( g_ScreenWidth, g_ScreenHeight ) + blockSize - 1 ) >> rate ) - 1;
+
+	// The position in blocks, with the shaded points at the block centres
+	float2 blockPos = ( (float2)pixel + 0.5 ) / blockSize - 0.5;
+	int2 baseBlock = (int2)floor( blockPos );
+	float2 f = blockPos - baseBlock;
+
+	float pixelViewZ = ConvertProjDepthToView( g_DepthTexture.Load( uint3( pixel, 0 ) ).x );
+
+	float4 colour = 0;
+	float totalWeight = 0;
+
+	[unroll]
+	for ( uint i = 0; i < 4; i++ )
+	{
+		int2 offset = int2( i & 1, i >> 1 );
+		int2 block = clamp( baseBlock + offset, 0, maxBlock );
+		uint2 blockPixel = (uint2)block * blockSize;
+
+		// Tiles are a multiple of the largest block size, so rounding down to the neighbour's block stays in its tile
+		uint2 blockTile = blockPixel / uint2( g_TileResX, g_TileResY );
+		uint blockRate = max( rate, g_TileShadingRates[ blockTile.x + blockTile.y * g_NumTilesX ] );
+		blockPixel = ( blockPixel >> blockRate ) << blockRate;
+
+		float blockDepth = LoadShadedDepth( blockPixel, blockRate );
+		float depthDifference = abs( ConvertProjDepthToView( blockDepth ) - pixelViewZ ) / pixelViewZ;
+
+		float2 bilinear = lerp( 1 - f, f, (float2)offset );
+		float weight = bilinear.x * bilinear.y / ( LOW_RES_UPSAMPLE_DEPTH_TOLERANCE + depthDifference );
+
+		colour += weight * g_RenderBuffer.Load( uint3( blockPixel, 0 ) );
+		totalWeight += weight;
+	}
+
+	return colour / max( totalWeight, 1e-6 );
+}
+
+
 float4 QuadPS( float4 Position : SV_POSITION ) : SV_Target
 {
 	float4 colour = 1;
 
-	// Get XY coordinates for pixel
-	float x = Position.x - (g_ScreenWidth / 2);
-	float y = Position.y;
+	// Tiles shaded at a lower rate are upsampled
+	uint2 pixel = (uint2)Position.xy;
+	uint2 tile = pixel / uint2( g_TileResX, g_TileResY );
+	uint rate = g_TileShadingRates[ tile.x + tile.y * g_NumTilesX ];
 
-	// Get the pixel index into the UAV
-	uint pixelIndex = x + (y * g_ScreenWidth);
+	[branch]
+	if ( rate > 0 )
+	{
+		return UpsampleLowResPixel( pixel, rate );
+	}
 
-	// Load the pixel value from the UAV
-	float4 particleValue = g_RenderBuffer.Load( pixelIndex );
+	// Load the pixel value from the render buffer
+	float4 particleValue = g_RenderBuffer.Load( uint3( pixel, 0 ) );
 	
 	colour = particleValue;
 
 	return colour;
+}
+
+
+// Composite a render buffer that is all full resolution, like the CPU system's tiled rasterizer output
+float4 CopyPS( float4 Position : SV_POSITION ) : SV_Target
+{
+	return g_RenderBuffer.Load( uint3( (uint2)Position.xy, 0 ) );
 }
\ No newline at end of file
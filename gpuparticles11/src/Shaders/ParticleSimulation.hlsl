@@ -20,30 +20,55 @@
 // THE SOFTWARE.
 //
 #include "Globals.h"
+#include "SortKeys.h"
 
 
-// Particle buffer in two parts
-RWStructuredBuffer<GPUParticlePartA>	g_ParticleBufferA		: register( u0 );
-RWStructuredBuffer<GPUParticlePartB>	g_ParticleBufferB		: register( u1 );
+// Particle buffer, either in two parts or as a structure of arrays
+#define PARTICLE_STORAGE_WRITE
+#include "ParticleStorage.h"
 
 // The dead list, so any particles that are retired this frame can be added to this list
 AppendStructuredBuffer<uint>			g_DeadListToAddTo		: register( u2 );
 
 // The alive list which gets built using this shader
-RWStructuredBuffer<float2>				g_IndexBuffer			: register( u3 );
+RWStructuredBuffer<SortItem>			g_IndexBuffer			: register( u3 );
 
 // Viewspace particle positions are calculated here and stored
 RWStructuredBuffer<float4>				g_ViewSpacePositions	: register( u4 );
 
-// The maximum radius in XY is calculated here and stored
-RWStructuredBuffer<float>				g_MaxRadiusBuffer		: register( u5 );
+// The maximum radius in XY is calculated here and stored, along with the lowest opacity of the particle's core for the opacity culling
+RWStructuredBuffer<float2>				g_MaxRadiusBuffer		: register( u5 );
 
 // The draw args for the DrawInstancedIndirect call needs to be filled in before the rasterization path is called, so do it here
 RWBuffer<uint>							g_DrawArgs				: register( u6 );
 
+// The survivors are added to next frame's simulation list
+AppendStructuredBuffer<uint>			g_NextSimulationList	: register( u7 );
+
 // The opaque scene's depth buffer read as a texture
 Texture2D								g_DepthBuffer			: register( t0 );
 
+// The indices of the particles to simulate. Only alive particles are on this list so the dispatch scales with the number of alive 
+// particles rather than the capacity of the pool
+StructuredBuffer<uint>					g_SimulationList		: register( t1 );
+
+// Per-emitter properties. Mirrors IParticleSystem::EmitterProperties
+struct EmitterProperties
+{
+	float4	startColor;
+	float4	endColor;
+	float4	lightingCenter;
+};
+
+// The emitter property table, indexed by the emitter index stored in each particle. Entries past the end of the table read as zero
+StructuredBuffer<EmitterProperties>		g_EmitterTable			: register( t2 );
+
+// The lowest alpha in the core of each texture in the particle atlas, see AtlasOpacityCS.hlsl
+Buffer<float>							g_AtlasCoreOpacity		: register( t3 );
+
+// The nearest and furthest view space depth of the opaque scene in each culling tile, see DepthBoundsCS.hlsl
+StructuredBuffer<float2>				g_TileDepthBounds		: register( t4 );
+
 
 // Calculate the view space position given a point in screen space and a texel offset
 float3 calcViewSpacePositionFromDepth( float2 normalizedScreenPosition, int2 texelOffset )
@@ -75,32 +100,35 @@ float3 calcViewSpacePositionFromDepth( float2 normalizedScreenPosition, int2 tex
 }
 
 
-// Simulate 256 particles per thread group, one thread per particle
-[numthreads(256,1,1)]
-void CS_Simulate( uint3 id : SV_DispatchThreadID )
+// Check whether anything opaque in the culling tile under a point on the screen is close enough in front of the particle for it to 
+// have collided. Most particles are nowhere near the scene, so this saves them reading the full resolution depth buffer
+bool mayCollideInTile( float2 normalizedScreenPosition, float viewSpaceZ )
 {
-	// Initialize the draw args using the first thread in the Dispatch call
-	if ( id.x == 0 )
-	{
-		g_DrawArgs[ 0 ] = 0;	// Number of primitives reset to zero
-		g_DrawArgs[ 1 ] = 1;	// Number of instances is always 1
-		g_DrawArgs[ 2 ] = 0;
-		g_DrawArgs[ 3 ] = 0;
-		g_DrawArgs[ 4 ] = 0;
-	}
+	uint2 pixel = (uint2)( float2( 0.5 + normalizedScreenPosition.x * 0.5, 0.5 - normalizedScreenPosition.y * 0.5 ) * float2( g_ScreenWidth, g_ScreenHeight ) );
+	uint2 tile = min( pixel / uint2( g_TileResX, g_TileResY ), uint2( g_NumTilesX, g_NumTilesY ) - 1 );
+
+	float2 depthBounds = g_TileDepthBounds[ tile.x + tile.y * g_NumTilesX ];
+	return ( viewSpaceZ > depthBounds.x ) && ( viewSpaceZ < depthBounds.y + g_CollisionThickness );
+}
 
-	// Wait after draw args are written so no other threads can write to them before they are initialized
-	GroupMemoryBarrierWithGroupSync();
 
+// Simulate 256 particles per thread group, one thread per entry in the simulation list. Dispatched indirectly with the args from
+// CS_InitSimulateArgs, which also resets the draw args
+[numthreads(256,1,1)]
+void CS_Simulate( uint3 id : SV_DispatchThreadID )
+{
 	const float3 vGravity = float3( 0.0, -9.81, 0.0 );
 
-	// Fetch the particle from the global buffer
-	GPUParticlePartA pa = g_ParticleBufferA[ id.x ];
-	GPUParticlePartB pb = g_ParticleBufferB[ id.x ];
-	
-	// If the partile is alive
-	if ( pb.m_Age > 0.0f )
+	// The last thread group is only partially filled
+	if ( id.x < g_NumParticlesToSimulate )
 	{
+		// The index of the particle in the pool
+		uint particleIndex = g_SimulationList[ id.x ];
+
+		// Fetch the particle from the global buffer
+		GPUParticlePartA pa = LoadParticlePartA( particleIndex );
+		GPUParticlePartB pb = LoadParticlePartB( particleIndex );
+
 		// Extract the individual emitter properties from the particle
 		uint emitterIndex = GetEmitterIndex( pa.m_EmitterProperties );
 		bool streaks = IsStreakEmitter( pa.m_EmitterProperties );
@@ -147,7 +175,8 @@ void CS_Simulate( uint3 id : SV_DispatchThreadID )
 			screenSpaceParticlePosition.xyz /= screenSpaceParticlePosition.w;
 
 			// Only do depth buffer collisions if the particle is onscreen, otherwise assume no collisions
-			if ( pa.m_IsSleeping == 0 && screenSpaceParticlePosition.x > -1 && screenSpaceParticlePosition.x < 1 && screenSpaceParticlePosition.y > -1 && screenSpaceParticlePosition.y < 1 )
+			if ( pa.m_IsSleeping == 0 && screenSpaceParticlePosition.x > -1 && screenSpaceParticlePosition.x < 1 && screenSpaceParticlePosition.y > -1 && screenSpaceParticlePosition.y < 1 && 
+				 mayCollideInTile( screenSpaceParticlePosition.xy, viewSpaceParticlePosition.z ) )
 			{
 				// Get the view space position of the depth buffer
 				float3 viewSpacePosOfDepthBuffer = calcViewSpacePositionFromDepth( screenSpaceParticlePosition.xy, int2( 0, 0 ) );
@@ -207,8 +236,9 @@ void CS_Simulate( uint3 id : SV_DispatchThreadID )
 		pa.m_TintAndAlpha.a = pb.m_Age <= 0 ? 0 : alpha;
 
 		// Lerp the color based on the age
-		float4 color0 = g_StartColor[ emitterIndex ];
-		float4 color1 = g_EndColor[ emitterIndex ];
+		EmitterProperties emitterProperties = g_EmitterTable[ emitterIndex ];
+		float4 color0 = emitterProperties.startColor;
+		float4 color1 = emitterProperties.endColor;
 	
 		pa.m_TintAndAlpha.rgb = lerp( color0, color1, saturate(5*fScaledLife) ).rgb;
 
@@ -218,7 +248,7 @@ void CS_Simulate( uint3 id : SV_DispatchThreadID )
 		}
 		
 		// The emitter-based lighting models the emitter as a vertical cylinder
-		float2 emitterNormal = normalize( vNewPosition.xz - g_EmitterLightingCenter[ emitterIndex ].xz );
+		float2 emitterNormal = normalize( vNewPosition.xz - emitterProperties.lightingCenter.xz );
 
 		// Generate the lighting term for the emitter
 		float emitterNdotL = saturate( dot( g_SunDirection.xz, emitterNormal ) + 0.5 );
@@ -235,31 +265,36 @@ void CS_Simulate( uint3 id : SV_DispatchThreadID )
 		viewSpacePositionAndRadius.xyz = mul( float4( vNewPosition, 1 ), g_mView ).xyz;
 		viewSpacePositionAndRadius.w = radius;
 
-		g_ViewSpacePositions[ id.x ] = viewSpacePositionAndRadius;
+		g_ViewSpacePositions[ particleIndex ] = viewSpacePositionAndRadius;
+
+		// The core of the billboard is at least as opaque as the particle times the least opaque part of the texture's core
+		uint atlasSlot = (uint)( GetTextureOffset( pa.m_EmitterProperties ) * NUM_ATLAS_SLOTS );
+		float coreAlpha = atlasSlot < NUM_ATLAS_SLOTS ? pa.m_TintAndAlpha.a * g_AtlasCoreOpacity[ atlasSlot ] * OPACITY_CULL_ALPHA_SCALE : 0;
 
 		// For streaked particles (the sparks), calculate the the max radius in XY and store in a buffer
 		if ( streaks )
 		{
 			float2 r2 = calcEllipsoidRadius( radius, pa.m_VelocityXY );
-			g_MaxRadiusBuffer[ id.x ] = max( r2.x, r2.y );
+			g_MaxRadiusBuffer[ particleIndex ] = float2( max( r2.x, r2.y ), coreAlpha );
 		}
 		else
 		{
 			// Not a streaked particle so will have rotation. When rotating, the particle has a max radius of the centre to the corner = sqrt( r^2 + r^2 )
-			g_MaxRadiusBuffer[ id.x ] = 1.41 * radius;
+			g_MaxRadiusBuffer[ particleIndex ] = float2( 1.41 * radius, coreAlpha );
 		}
 
 		// Dead particles are added to the dead list for recycling
 		if ( pb.m_Age <= 0.0f || killParticle )
 		{
 			pb.m_Age = -1;
-			g_DeadListToAddTo.Append( id.x );
+			g_DeadListToAddTo.Append( particleIndex );
 		}
 		else
 		{
-			// Alive particles are added to the alive list
+			// Alive particles are added to the alive list, and are simulated again next frame
 			uint index = g_IndexBuffer.IncrementCounter();
-			g_IndexBuffer[ index ] = float2( pb.m_DistanceToEye, (float)id.x );
+			g_IndexBuffer[ index ] = MakeSortItem( pb.m_DistanceToEye, particleIndex );
+			g_NextSimulationList.Append( particleIndex );
 			
 			uint dstIdx = 0;
 #if defined (USE_GEOMETRY_SHADER)
@@ -270,11 +305,10 @@ void CS_Simulate( uint3 id : SV_DispatchThreadID )
 			InterlockedAdd( g_DrawArgs[ 0 ], 6, dstIdx );
 #endif
 		}
-	}
 
-	// Write the particle data back to the global particle buffer
-	g_ParticleBufferA[ id.x ] = pa;
-	g_ParticleBufferB[ id.x ] = pb;
+		// Write the particle data back to the global particle buffer. Dead particles are left untouched
+		StoreSimulatedParticle( particleIndex, pa, pb );
+	}
 }
 
 
@@ -282,6 +316,8 @@ void CS_Simulate( uint3 id : SV_DispatchThreadID )
 [numthreads(256,1,1)]
 void CS_Reset( uint3 id : SV_DispatchThreadID )
 {
-	g_ParticleBufferA[ id.x ] = (GPUParticlePartA)0;
-	g_ParticleBufferB[ id.x ] = (GPUParticlePartB)0;
+	if ( id.x < g_MaxParticles )
+	{
+		StoreParticle( id.x, (GPUParticlePartA)0, (GPUParticlePartB)0 );
+	}
 }
\ No newline at end of file
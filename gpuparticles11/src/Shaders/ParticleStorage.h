@@ -0,0 +1,303 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+
+// Particle storage
+// ================
+// By default the particles are stored as two arrays of structures, GPUParticlePartA and GPUParticlePartB. When SOA_LAYOUT is defined 
+// the particles are stored as a structure of arrays in a single raw buffer instead, with one tightly packed stream per attribute group 
+// (see the SOA_STREAM offsets in ShaderConstants.h). A pass then only fetches the streams it actually uses. When COMPACT_LAYOUT is 
+// defined the two arrays of structures hold quantized particles instead, which are unpacked on load and packed again on store. 
+// The C++ equivalent of the packing is in ParticleFormat.cpp.
+//
+// Define PARTICLE_STORAGE_WRITE before including this file to get read-write access to the particles.
+
+
+#if defined (SOA_LAYOUT)
+
+#if defined (PARTICLE_STORAGE_WRITE)
+RWByteAddressBuffer						g_ParticleData			: register( u0 );
+#else
+ByteAddressBuffer						g_ParticleData			: register( t0 );
+#endif
+
+
+// Byte address of a particle's element in a stream
+uint GetStreamAddress( uint stream, uint elementSize, uint index )
+{
+	return g_MaxParticles * stream + index * elementSize;
+}
+
+
+// Only the data needed to render the particle
+GPUParticlePartA LoadParticlePartA( uint index )
+{
+	GPUParticlePartA pa = (GPUParticlePartA)0;
+
+	pa.m_TintAndAlpha = asfloat( g_ParticleData.Load4( GetStreamAddress( SOA_STREAM_TINT, 16, index ) ) );
+
+	float4 renderParams = asfloat( g_ParticleData.Load4( GetStreamAddress( SOA_STREAM_RENDER, 16, index ) ) );
+	pa.m_VelocityXY = renderParams.xy;
+	pa.m_EmitterNdotL = renderParams.z;
+	pa.m_Rotation = renderParams.w;
+
+	pa.m_EmitterProperties = g_ParticleData.Load( GetStreamAddress( SOA_STREAM_PROPERTIES, 4, index ) );
+
+	uint2 collision = g_ParticleData.Load2( GetStreamAddress( SOA_STREAM_COLLISION, 8, index ) );
+	pa.m_IsSleeping = collision.x;
+	pa.m_CollisionCount = collision.y;
+
+	return pa;
+}
+
+
+#if defined (PARTICLE_STORAGE_WRITE)
+
+GPUParticlePartB LoadParticlePartB( uint index )
+{
+	GPUParticlePartB pb = (GPUParticlePartB)0;
+
+	float4 positionAndMass = asfloat( g_ParticleData.Load4( GetStreamAddress( SOA_STREAM_POSITION, 16, index ) ) );
+	pb.m_Position = positionAndMass.xyz;
+	pb.m_Mass = positionAndMass.w;
+
+	float4 velocityAndLifespan = asfloat( g_ParticleData.Load4( GetStreamAddress( SOA_STREAM_VELOCITY, 16, index ) ) );
+	pb.m_Velocity = velocityAndLifespan.xyz;
+	pb.m_Lifespan = velocityAndLifespan.w;
+
+	float2 age = asfloat( g_ParticleData.Load2( GetStreamAddress( SOA_STREAM_AGE, 8, index ) ) );
+	pb.m_Age = age.x;
+	pb.m_DistanceToEye = age.y;
+
+	float2 size = asfloat( g_ParticleData.Load2( GetStreamAddress( SOA_STREAM_SIZE, 8, index ) ) );
+	pb.m_StartSize = size.x;
+	pb.m_EndSize = size.y;
+
+	return pb;
+}
+
+
+// Write every stream. Used when a particle is spawned or reset
+void StoreParticle( uint index, GPUParticlePartA pa, GPUParticlePartB pb )
+{
+	g_ParticleData.Store4( GetStreamAddress( SOA_STREAM_POSITION, 16, index ), asuint( float4( pb.m_Position, pb.m_Mass ) ) );
+	g_ParticleData.Store4( GetStreamAddress( SOA_STREAM_VELOCITY, 16, index ), asuint( float4( pb.m_Velocity, pb.m_Lifespan ) ) );
+	g_ParticleData.Store2( GetStreamAddress( SOA_STREAM_AGE, 8, index ), asuint( float2( pb.m_Age, pb.m_DistanceToEye ) ) );
+	g_ParticleData.Store2( GetStreamAddress( SOA_STREAM_SIZE, 8, index ), asuint( float2( pb.m_StartSize, pb.m_EndSize ) ) );
+	g_ParticleData.Store4( GetStreamAddress( SOA_STREAM_TINT, 16, index ), asuint( pa.m_TintAndAlpha ) );
+	g_ParticleData.Store4( GetStreamAddress( SOA_STREAM_RENDER, 16, index ), asuint( float4( pa.m_VelocityXY, pa.m_EmitterNdotL, pa.m_Rotation ) ) );
+	g_ParticleData.Store( GetStreamAddress( SOA_STREAM_PROPERTIES, 4, index ), pa.m_EmitterProperties );
+	g_ParticleData.Store2( GetStreamAddress( SOA_STREAM_COLLISION, 8, index ), uint2( pa.m_IsSleeping, pa.m_CollisionCount ) );
+}
+
+
+// Only write the attributes that the simulation changes. The mass, lifespan, sizes and emitter properties are constant after emission
+void StoreSimulatedParticle( uint index, GPUParticlePartA pa, GPUParticlePartB pb )
+{
+	g_ParticleData.Store3( GetStreamAddress( SOA_STREAM_POSITION, 16, index ), asuint( pb.m_Position ) );
+	g_ParticleData.Store3( GetStreamAddress( SOA_STREAM_VELOCITY, 16, index ), asuint( pb.m_Velocity ) );
+	g_ParticleData.Store2( GetStreamAddress( SOA_STREAM_AGE, 8, index ), asuint( float2( pb.m_Age, pb.m_DistanceToEye ) ) );
+	g_ParticleData.Store4( GetStreamAddress( SOA_STREAM_TINT, 16, index ), asuint( pa.m_TintAndAlpha ) );
+	g_ParticleData.Store4( GetStreamAddress( SOA_STREAM_RENDER, 16, index ), asuint( float4( pa.m_VelocityXY, pa.m_EmitterNdotL, pa.m_Rotation ) ) );
+	g_ParticleData.Store2( GetStreamAddress( SOA_STREAM_COLLISION, 8, index ), uint2( pa.m_IsSleeping, pa.m_CollisionCount ) );
+}
+
+#endif
+
+
+#elif defined (COMPACT_LAYOUT)
+
+
+// Color, view space velocity, rotation, lighting and the packed emitter properties, sleeping flag and collision count. 20 bytes
+struct GPUCompactParticlePartA
+{
+	uint2	m_TintAndAlpha;			// fp16 RGBA
+	uint	m_VelocityXY;			// fp16 XY
+	uint	m_RotationAndNdotL;		// Rotation as a fraction of a turn in 0-15 bits, emitter N.L in 16-31 bits
+	uint	m_Properties;			// Emitter properties plus the COMPACT_SLEEPING_BIT and the collision count
+};
+
+// The simulation state. The distance to the eye isn't stored as it is recomputed every frame. 36 bytes
+struct GPUCompactParticlePartB
+{
+	float3	m_Position;
+	float	m_Age;
+	float3	m_Velocity;
+	uint	m_MassAndLifespan;		// fp16 mass and lifespan
+	uint	m_StartAndEndSize;		// fp16 start and end size
+};
+
+
+#if defined (PARTICLE_STORAGE_WRITE)
+RWStructuredBuffer<GPUCompactParticlePartA>	g_ParticleBufferA	: register( u0 );
+RWStructuredBuffer<GPUCompactParticlePartB>	g_ParticleBufferB	: register( u1 );
+#else
+StructuredBuffer<GPUCompactParticlePartA>	g_ParticleBufferA	: register( t0 );
+#endif
+
+
+uint PackHalf2( float2 value )
+{
+	return f32tof16( value.x ) | ( f32tof16( value.y ) << 16 );
+}
+
+
+float2 UnpackHalf2( uint packed )
+{
+	return float2( f16tof32( packed ), f16tof32( packed >> 16 ) );
+}
+
+
+GPUParticlePartA DecodeParticlePartA( GPUCompactParticlePartA compactA )
+{
+	GPUParticlePartA pa = (GPUParticlePartA)0;
+
+	pa.m_TintAndAlpha = float4( UnpackHalf2( compactA.m_TintAndAlpha.x ), UnpackHalf2( compactA.m_TintAndAlpha.y ) );
+	pa.m_VelocityXY = UnpackHalf2( compactA.m_VelocityXY );
+	pa.m_Rotation = (float)( compactA.m_RotationAndNdotL & 0xffff ) * ( 6.283185307179586 / 65536.0 );
+	pa.m_EmitterNdotL = (float)( compactA.m_RotationAndNdotL >> 16 ) / 65535.0;
+
+	pa.m_EmitterProperties = compactA.m_Properties & COMPACT_PROPERTIES_MASK;
+	pa.m_IsSleeping = ( compactA.m_Properties >> COMPACT_SLEEPING_BIT ) & 1;
+	pa.m_CollisionCount = compactA.m_Properties >> COMPACT_COLLISION_COUNT_SHIFT;
+
+	return pa;
+}
+
+
+GPUCompactParticlePartA EncodeParticlePartA( GPUParticlePartA pa )
+{
+	GPUCompactParticlePartA compactA;
+
+	compactA.m_TintAndAlpha = uint2( PackHalf2( pa.m_TintAndAlpha.xy ), PackHalf2( pa.m_TintAndAlpha.zw ) );
+	compactA.m_VelocityXY = PackHalf2( pa.m_VelocityXY );
+
+	// The rotation only ever increases so store it as a fraction of a turn rather than a half, which would lose precision as it grows
+	uint rotation = (uint)( frac( pa.m_Rotation / 6.283185307179586 ) * 65536.0 + 0.5 ) & 0xffff;
+	uint ndotl = (uint)( saturate( pa.m_EmitterNdotL ) * 65535.0 + 0.5 );
+	compactA.m_RotationAndNdotL = rotation | ( ndotl << 16 );
+
+	compactA.m_Properties = pa.m_EmitterProperties & COMPACT_PROPERTIES_MASK;
+	compactA.m_Properties |= ( pa.m_IsSleeping ? 1 : 0 ) << COMPACT_SLEEPING_BIT;
+	compactA.m_Properties |= min( pa.m_CollisionCount, (uint)COMPACT_MAX_COLLISION_COUNT ) << COMPACT_COLLISION_COUNT_SHIFT;
+
+	return compactA;
+}
+
+
+GPUParticlePartA LoadParticlePartA( uint index )
+{
+	return DecodeParticlePartA( g_ParticleBufferA[ index ] );
+}
+
+
+#if defined (PARTICLE_STORAGE_WRITE)
+
+GPUParticlePartB LoadParticlePartB( uint index )
+{
+	GPUCompactParticlePartB compactB = g_ParticleBufferB[ index ];
+
+	GPUParticlePartB pb = (GPUParticlePartB)0;
+	pb.m_Position = compactB.m_Position;
+	pb.m_Age = compactB.m_Age;
+	pb.m_Velocity = compactB.m_Velocity;
+
+	float2 massAndLifespan = UnpackHalf2( compactB.m_MassAndLifespan );
+	pb.m_Mass = massAndLifespan.x;
+	pb.m_Lifespan = massAndLifespan.y;
+
+	float2 size = UnpackHalf2( compactB.m_StartAndEndSize );
+	pb.m_StartSize = size.x;
+	pb.m_EndSize = size.y;
+
+	return pb;
+}
+
+
+void StoreParticle( uint index, GPUParticlePartA pa, GPUParticlePartB pb )
+{
+	GPUCompactParticlePartB compactB;
+	compactB.m_Position = pb.m_Position;
+	compactB.m_Age = pb.m_Age;
+	compactB.m_Velocity = pb.m_Velocity;
+	compactB.m_MassAndLifespan = PackHalf2( float2( pb.m_Mass, pb.m_Lifespan ) );
+	compactB.m_StartAndEndSize = PackHalf2( float2( pb.m_StartSize, pb.m_EndSize ) );
+
+	g_ParticleBufferA[ index ] = EncodeParticlePartA( pa );
+	g_ParticleBufferB[ index ] = compactB;
+}
+
+
+// The mass, lifespan and sizes are constant after emission so don't need re-encoding
+void StoreSimulatedParticle( uint index, GPUParticlePartA pa, GPUParticlePartB pb )
+{
+	g_ParticleBufferA[ index ] = EncodeParticlePartA( pa );
+	g_ParticleBufferB[ index ].m_Position = pb.m_Position;
+	g_ParticleBufferB[ index ].m_Age = pb.m_Age;
+	g_ParticleBufferB[ index ].m_Velocity = pb.m_Velocity;
+}
+
+#endif
+
+
+#else
+
+
+#if defined (PARTICLE_STORAGE_WRITE)
+RWStructuredBuffer<GPUParticlePartA>	g_ParticleBufferA		: register( u0 );
+RWStructuredBuffer<GPUParticlePartB>	g_ParticleBufferB		: register( u1 );
+#else
+StructuredBuffer<GPUParticlePartA>		g_ParticleBufferA		: register( t0 );
+#endif
+
+
+GPUParticlePartA LoadParticlePartA( uint index )
+{
+	return g_ParticleBufferA[ index ];
+}
+
+
+#if defined (PARTICLE_STORAGE_WRITE)
+
+GPUParticlePartB LoadParticlePartB( uint index )
+{
+	return g_ParticleBufferB[ index ];
+}
+
+
+void StoreParticle( uint index, GPUParticlePartA pa, GPUParticlePartB pb )
+{
+	g_ParticleBufferA[ index ] = pa;
+	g_ParticleBufferB[ index ] = pb;
+}
+
+
+void StoreSimulatedParticle( uint index, GPUParticlePartA pa, GPUParticlePartB pb )
+{
+	g_ParticleBufferA[ index ] = pa;
+	g_ParticleBufferB[ index ] = pb;
+}
+
+#endif
+
+
+#endif
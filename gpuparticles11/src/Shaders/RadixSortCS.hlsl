@@ -0,0 +1,247 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+// Least significant digit radix sort of the alive list (see SortKeys.h) on distance, in the reduce-then-scan style. Each 
+// pass sorts on RADIX_BITS bits of the key using three dispatches:
+//
+//   RadixCount   - every group builds a histogram of the digits in its block of items
+//   RadixScan    - a single group turns the histograms into the offset each block writes each digit to
+//   RadixScatter - every group ranks its items by digit and writes them to their sorted position
+//
+// Items keep their relative order within a digit so after the passes have covered all 32 bits the list is fully sorted. With packed 
+// keys SortLib can skip the passes that only cover the index bits.
+// SortLib passes in RADIX_BITS, RADIX_THREADS, RADIX_ITEMS_PER_THREAD and RADIX_SCAN_THREADS, and RADIX_COMPACT for the compaction 
+// pass of the temporal sort
+
+#include "SortKeys.h"
+
+#define RADIX_DIGITS			( 1 << RADIX_BITS )
+#define RADIX_ITEMS_PER_GROUP	( RADIX_THREADS * RADIX_ITEMS_PER_THREAD )
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffers
+//--------------------------------------------------------------------------------------
+cbuffer NumElementsCB : register( b0 )
+{
+	int4 g_NumElements;
+};
+
+cbuffer RadixPassCB : register( b1 )
+{
+	int4 g_RadixPass;		// x is the shift of this pass's digit
+};
+
+//--------------------------------------------------------------------------------------
+// Structured Buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<SortItem>	g_Source		: register( u0 );
+RWStructuredBuffer<SortItem>	g_Destination	: register( u1 );
+RWStructuredBuffer<uint>	g_Histograms	: register( u2 );		// The count of each digit in each block, stored digit by digit
+
+
+uint NumBlocks()
+{
+	return ( (uint)g_NumElements.x + RADIX_ITEMS_PER_GROUP - 1 ) / RADIX_ITEMS_PER_GROUP;
+}
+
+
+#ifdef RADIX_COMPACT
+// Compaction is a single pass that moves the holes in a sparse list to the end, keeping everything else in order
+uint Digit( SortItem item )
+{
+	return SortItemIsHole( item ) ? 1 : 0;
+}
+#else
+uint Digit( SortItem item )
+{
+	return ( SortItemKey( item ) >> g_RadixPass.x ) & ( RADIX_DIGITS - 1 );
+}
+#endif
+
+
+//--------------------------------------------------------------------------------------
+// Count the digits in each block
+//--------------------------------------------------------------------------------------
+groupshared uint g_LDSHistogram[ RADIX_DIGITS ];
+
+[numthreads( RADIX_THREADS, 1, 1 )]
+void RadixCount( uint3 Gid : SV_GroupID, uint GI : SV_GroupIndex )
+{
+	if ( GI < RADIX_DIGITS )
+		g_LDSHistogram[ GI ] = 0;
+
+	GroupMemoryBarrierWithGroupSync();
+
+	uint base = Gid.x * RADIX_ITEMS_PER_GROUP;
+
+	[unroll]
+	for ( uint i = 0; i < RADIX_ITEMS_PER_THREAD; i++ )
+	{
+		uint index = base + i * RADIX_THREADS + GI;
+		if ( index < (uint)g_NumElements.x )
+		{
+			InterlockedAdd( g_LDSHistogram[ Digit( g_Source[ index ] ) ], 1 );
+		}
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if ( GI < RADIX_DIGITS )
+		g_Histograms[ GI * NumBlocks() + Gid.x ] = g_LDSHistogram[ GI ];
+}
+
+
+//--------------------------------------------------------------------------------------
+// Exclusive prefix sum over all the histograms. As they are stored digit by digit this gives each block the position in the 
+// sorted list of its first item with each digit
+//--------------------------------------------------------------------------------------
+groupshared uint g_LDSScan[ RADIX_SCAN_THREADS ];
+
+[numthreads( RADIX_SCAN_THREADS, 1, 1 )]
+void RadixScan( uint GI : SV_GroupIndex )
+{
+	// Each thread sums a run of consecutive entries
+	uint numEntries = RADIX_DIGITS * NumBlocks();
+	uint entriesPerThread = ( numEntries + RADIX_SCAN_THREADS - 1 ) / RADIX_SCAN_THREADS;
+	uint first = min( GI * entriesPerThread, numEntries );
+	uint last = min( first + entriesPerThread, numEntries );
+
+	uint sum = 0;
+	for ( uint i = first; i < last; i++ )
+	{
+		sum += g_Histograms[ i ];
+	}
+	g_LDSScan[ GI ] = sum;
+
+	GroupMemoryBarrierWithGroupSync();
+
+	// Inclusive scan of the per-thread sums
+	for ( uint offset = 1; offset < RADIX_SCAN_THREADS; offset *= 2 )
+	{
+		uint value = GI >= offset ? g_LDSScan[ GI - offset ] : 0;
+		GroupMemoryBarrierWithGroupSync();
+		g_LDSScan[ GI ] += value;
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	// Write the run back out as an exclusive scan
+	uint running = g_LDSScan[ GI ] - sum;
+	for ( uint j = first; j < last; j++ )
+	{
+		uint count = g_Histograms[ j ];
+		g_Histograms[ j ] = running;
+		running += count;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Write each item to its sorted position for this pass
+//--------------------------------------------------------------------------------------
+groupshared uint g_LDSOffsets[ RADIX_DIGITS * RADIX_THREADS ];		// Per digit, then per thread
+groupshared uint g_LDSPartials[ RADIX_THREADS ];
+groupshared uint g_LDSDigitBase[ RADIX_DIGITS ];
+
+[numthreads( RADIX_THREADS, 1, 1 )]
+void RadixScatter( uint3 Gid : SV_GroupID, uint GI : SV_GroupIndex )
+{
+	// Each thread takes a run of consecutive items so ranking the items in thread order keeps the sort stable
+	uint base = Gid.x * RADIX_ITEMS_PER_GROUP + GI * RADIX_ITEMS_PER_THREAD;
+
+	SortItem items[ RADIX_ITEMS_PER_THREAD ];
+	uint digits[ RADIX_ITEMS_PER_THREAD ];
+
+	[unroll]
+	for ( uint d = 0; d < RADIX_DIGITS; d++ )
+	{
+		g_LDSOffsets[ d * RADIX_THREADS + GI ] = 0;
+	}
+
+	[unroll]
+	for ( uint i = 0; i < RADIX_ITEMS_PER_THREAD; i++ )
+	{
+		items[ i ] = 0;
+		digits[ i ] = RADIX_DIGITS;
+
+		if ( base + i < (uint)g_NumElements.x )
+		{
+			items[ i ] = g_Source[ base + i ];
+			digits[ i ] = Digit( items[ i ] );
+			g_LDSOffsets[ digits[ i ] * RADIX_THREADS + GI ]++;
+		}
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	// Exclusive scan of the counts in digit then thread order. Each thread handles RADIX_DIGITS consecutive entries
+	uint first = GI * RADIX_DIGITS;
+	uint sum = 0;
+
+	[unroll]
+	for ( uint j = 0; j < RADIX_DIGITS; j++ )
+	{
+		sum += g_LDSOffsets[ first + j ];
+	}
+	g_LDSPartials[ GI ] = sum;
+
+	GroupMemoryBarrierWithGroupSync();
+
+	for ( uint offset = 1; offset < RADIX_THREADS; offset *= 2 )
+	{
+		uint value = GI >= offset ? g_LDSPartials[ GI - offset ] : 0;
+		GroupMemoryBarrierWithGroupSync();
+		g_LDSPartials[ GI ] += value;
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	uint running = g_LDSPartials[ GI ] - sum;
+
+	[unroll]
+	for ( uint k = 0; k < RADIX_DIGITS; k++ )
+	{
+		uint count = g_LDSOffsets[ first + k ];
+		g_LDSOffsets[ first + k ] = running;
+		running += count;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	// Where this block's items with each digit go in the output, less where they start within the block
+	if ( GI < RADIX_DIGITS )
+	{
+		g_LDSDigitBase[ GI ] = g_Histograms[ GI * NumBlocks() + Gid.x ] - g_LDSOffsets[ GI * RADIX_THREADS ];
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	[unroll]
+	for ( uint n = 0; n < RADIX_ITEMS_PER_THREAD; n++ )
+	{
+		uint digit = digits[ n ];
+		if ( digit < RADIX_DIGITS )
+		{
+			uint rank = g_LDSOffsets[ digit * RADIX_THREADS + GI ]++;
+			g_Destination[ g_LDSDigitBase[ digit ] + rank ] = items[ n ];
+		}
+	}
+}
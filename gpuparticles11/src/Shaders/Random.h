@@ -0,0 +1,91 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+// This file is shared between the HLSL and C++ code so the GPU and CPU particle systems emit identical particles
+
+#ifndef __RANDOM_H__
+#define __RANDOM_H__
+
+
+// A stateless counter-based random number generator. The values are a pure function of the key so any thread can generate 
+// the numbers for any particle, and the same key always gives the same numbers. The key is the emitter index, the emission 
+// frame and the index of the particle within the emitter
+#ifdef __cplusplus
+
+typedef unsigned int RandomUInt;
+struct RandomUInt3 { RandomUInt x, y, z; };
+
+#define RANDOM_FUNCTION static inline
+
+RANDOM_FUNCTION RandomUInt3 MakeRandomUInt3( RandomUInt x, RandomUInt y, RandomUInt z ) { RandomUInt3 v = { x, y, z }; return v; }
+
+#else
+
+typedef uint RandomUInt;
+typedef uint3 RandomUInt3;
+
+#define RANDOM_FUNCTION
+
+RANDOM_FUNCTION RandomUInt3 MakeRandomUInt3( RandomUInt x, RandomUInt y, RandomUInt z ) { return uint3( x, y, z ); }
+
+#endif
+
+
+// PCG3D from "Hash Functions for GPU Rendering", Jarzynski and Olano 2020. One LCG step followed by two rounds of mixing the 
+// components together so every output bit depends on every input bit. Written out per component so it is valid C++ and HLSL
+RANDOM_FUNCTION RandomUInt3 RandomPCG3D( RandomUInt3 v )
+{
+	v.x = v.x * 1664525u + 1013904223u;
+	v.y = v.y * 1664525u + 1013904223u;
+	v.z = v.z * 1664525u + 1013904223u;
+
+	v.x += v.y * v.z;
+	v.y += v.z * v.x;
+	v.z += v.x * v.y;
+
+	v.x ^= v.x >> 16u;
+	v.y ^= v.y >> 16u;
+	v.z ^= v.z >> 16u;
+
+	v.x += v.y * v.z;
+	v.y += v.z * v.x;
+	v.z += v.x * v.y;
+
+	return v;
+}
+
+
+// Map the top 24 bits to [-1, 1). The integer subtract and the power of two scale are both exact so the C++ and HLSL results are bit identical
+RANDOM_FUNCTION float RandomToSignedFloat( RandomUInt x )
+{
+	return (float)( (int)( x >> 8u ) - 8388608 ) * ( 1.0f / 8388608.0f );
+}
+
+
+// Each particle uses two keys, one for the position variance and one for the velocity variance
+RANDOM_FUNCTION RandomUInt3 RandomEmissionKey( RandomUInt emitterIndex, RandomUInt emitFrame, RandomUInt particle, RandomUInt stream )
+{
+	return MakeRandomUInt3( emitterIndex, emitFrame, particle * 2u + stream );
+}
+
+
+#endif
@@ -22,18 +22,87 @@
 
 // This file is shared between the HLSL and C++ code for convenience
 
-// Fine-grained culling and rendering tile size
+// Fine-grained culling and rendering tile size. The culling and tiled rendering shaders are compiled for each tile size the system 
+// picks between, so these are only the defaults. Passes that run at any tile size read it from the tiling constants instead
+#ifndef TILE_RES_X
 #define TILE_RES_X						32
+#endif
+#ifndef TILE_RES_Y
 #define TILE_RES_Y						32
+#endif
 
-// Maximum number of emitters supported
-#define NUM_EMITTERS					4
+// Maximum number of emitters supported. The emitter index is packed into 16 bits of each particle's emitter properties
+#define MAX_EMITTERS					65536
 
-// Maximum number of particles that can be stored per tile. Storing more will increase the amount of LDS and thus potentially reduce the number of waves in flight
-#define NUM_PARTICLES_PER_TILE			1023
+// The tile lists are packed back to back in one buffer. The number of threads in the pass that turns the per-tile counts into offsets
+#define TILE_LIST_SCAN_THREADS			256
 
-// The per-tile buffer size is the maximum number of particles that can be stored, plus another UINT to store the number of particles in that tile
-#define PARTICLES_TILE_BUFFER_SIZE		(NUM_PARTICLES_PER_TILE+1)
+// Histogram of the number of particles per tile, used to pick the tile size. Bucket 0 counts the empty tiles and bucket n the tiles 
+// with between 2^(n-1) and 2^n-1 particles. The last bucket takes everything above that
+#define NUM_TILE_DENSITY_BUCKETS		16
+
+// Low resolution shading of dense tiles. Rate n shades one pixel in each 2^n x 2^n block. A tile drops to half or quarter rate 
+// when its particles cover at least the given multiple of its area, at least the given share of the 8x8 coverage cells are touched 
+// and the particles average at least the given number of low resolution texels across
+#define NUM_SHADING_RATES				3
+#define LOW_RES_HALF_RATE_OVERDRAW		4
+#define LOW_RES_QUARTER_RATE_OVERDRAW	12
+#define LOW_RES_MIN_COVERED_CELLS		48	// Out of 64
+#define LOW_RES_MIN_PARTICLE_TEXELS		6
+#define LOW_RES_DEPTH_THREADS			8	// Thread group width and height of the depth downsample
+#define LOW_RES_UPSAMPLE_DEPTH_TOLERANCE	0.05f	// Relative view depth difference at which an upsampling tap's weight is halved
+
+// Opacity culling. The tile lists stop once every one of a tile's 8x8 coverage cells is certain to have passed the alpha threshold. 
+// A particle only counts towards a cell when the core of its billboard, the disc of the given fraction of its radius, covers the 
+// whole cell. The core's opacity is the lowest alpha the atlas has there times the particle's opacity, scaled down a touch to leave 
+// room for the renderer reading a rounded copy of the particle's tint
+#define NUM_ATLAS_SLOTS					2	// The atlas holds two textures side by side, see GetTextureOffset
+#define OPACITY_CULL_CORE_RADIUS		0.5f
+#define OPACITY_CULL_ALPHA_SCALE		0.99f
+#define ATLAS_OPACITY_THREADS			16	// Thread group width and height of the atlas measurement
+
+// The per-tile and per-bin depth bounds, see DepthBoundsCS.hlsl
+#define TILE_DEPTH_BOUNDS_THREADS		16	// Thread group width and height of the tile pass. Each thread covers a few of the tile's pixels
+#define BIN_DEPTH_BOUNDS_THREADS		64	// Threads per bin in the bin pass. Each thread covers a few of the bin's tiles
+
+// Hi-Z occlusion culling of the rasterized particles, see OcclusionCullingCS.hlsl. Each culling group keeps its survivors as a bit mask
+#define HIZ_THREADS						8	// Thread group width and height of the Hi-Z downsample
+#define MAX_HIZ_LEVELS					16
+#define OCCLUSION_CULLING_THREADS		256
+#define OCCLUSION_CULLING_MASK_WORDS	( OCCLUSION_CULLING_THREADS / 32 )
+#define OCCLUSION_CULLING_SCAN_THREADS	256	// Threads in the pass that turns the per-group survivor counts into offsets
+
+// Packed sort keys, see SortKeys.h. The distance to the eye is quantized on a log scale into the bits above the particle index
+#define SORT_KEY_INDEX_BITS				21		// Particle pools must be smaller than 2M
+#define SORT_KEY_MAX_DISTANCE			1024	// Particles further away than this all sort as if they were at this distance
 
 // The number of threads in the coarse culling thread group
-#define COARSE_CULLING_THREADS			256	// 512 and 1024 are fractionally slower
\ No newline at end of file
+#define COARSE_CULLING_THREADS			256	// 512 and 1024 are fractionally slower
+
+// Screen rect coarse binning. Particles that reach closer to the eye than the min Z can't be projected so are put in every bin, and 
+// are never occlusion culled
+#define COARSE_BINNING_MIN_Z			0.001f
+#define COARSE_BINNING_SCAN_THREADS		256	// Threads per bin in the pass that turns the per-group bin counts into offsets
+
+// Offsets in UINTs into the DispatchIndirect args of the passes that run one thread per alive particle, see CS_InitAliveArgs
+#define ALIVE_ARGS_COARSE_CULLING		0
+#define ALIVE_ARGS_GATHER				3
+#define ALIVE_ARGS_OCCLUSION_CULLING	6
+#define ALIVE_ARGS_SIZE					9
+
+// Structure of arrays particle layout. Every stream is tightly packed in one raw buffer and starts at its offset below multiplied by the maximum number of particles
+#define SOA_STREAM_POSITION				0	// float4: world space position and mass
+#define SOA_STREAM_VELOCITY				16	// float4: world space velocity and lifespan
+#define SOA_STREAM_AGE					32	// float2: age and distance to the eye
+#define SOA_STREAM_SIZE					40	// float2: start and end size
+#define SOA_STREAM_TINT					48	// float4: color and opacity
+#define SOA_STREAM_RENDER				64	// float4: view space velocity XY, emitter N.L and rotation
+#define SOA_STREAM_PROPERTIES			80	// uint: emitter properties
+#define SOA_STREAM_COLLISION			84	// uint2: sleeping flag and collision count
+#define SOA_PARTICLE_SIZE				92	// Total bytes per particle across all streams
+
+// Compact particle layout. The sleeping flag and collision count are packed into the unused top bits of the emitter properties
+#define COMPACT_PROPERTIES_MASK			0x01ffffff
+#define COMPACT_SLEEPING_BIT			25
+#define COMPACT_COLLISION_COUNT_SHIFT	26
+#define COMPACT_MAX_COLLISION_COUNT		63	// The collision count saturates at this value
\ No newline at end of file
@@ -20,6 +20,8 @@
 // THE SOFTWARE.
 //
 
+#include "SortKeys.h"
+
 #if( SORT_SIZE>4096 )
 	// won't work for arrays>4096
 	#error due to LDS size SORT_SIZE must be 4096 or smaller
@@ -43,13 +45,13 @@ cbuffer NumElementsCB : register( b0 )
 //--------------------------------------------------------------------------------------
 // Structured Buffers
 //--------------------------------------------------------------------------------------
-RWStructuredBuffer<float2> Data : register( u0 );
+RWStructuredBuffer<SortItem> Data : register( u0 );
 
 
 //--------------------------------------------------------------------------------------
 // Bitonic Sort Compute Shader
 //--------------------------------------------------------------------------------------
-groupshared float2	g_LDS[SORT_SIZE];
+groupshared SortItem	g_LDS[SORT_SIZE];
 
 
 [numthreads(NUM_THREADS, 1, 1)]
@@ -87,10 +89,10 @@ void BitonicSortLDS( uint3 Gid	: SV_GroupID,
 				unsigned int nSwapElem = nMergeSubSize==nMergeSize>>1 ? index_high + (2*nMergeSubSize-1) - index_low : index_high + nMergeSubSize + index_low;
 				if( nSwapElem<numElementsInThreadGroup )
 				{
-					float2 a = g_LDS[index];
-					float2 b = g_LDS[nSwapElem];
+					SortItem a = g_LDS[index];
+					SortItem b = g_LDS[nSwapElem];
 
-					if( a.x > b.x )
+					if( SortItemGreater( a, b ) )
 					{ 
 						g_LDS[index] = b;
 						g_LDS[nSwapElem] = a;
@@ -20,6 +20,8 @@
 // THE SOFTWARE.
 //
 
+#include "SortKeys.h"
+
 #if( SORT_SIZE>2048 )
 	#error
 #endif
@@ -38,13 +40,13 @@ cbuffer NumElementsCB : register( b0 )
 //--------------------------------------------------------------------------------------
 // Structured Buffers
 //--------------------------------------------------------------------------------------
-RWStructuredBuffer<float2> Data : register( u0 );
+RWStructuredBuffer<SortItem> Data : register( u0 );
 
 
 //--------------------------------------------------------------------------------------
 // Bitonic Sort Compute Shader
 //--------------------------------------------------------------------------------------
-groupshared float2	g_LDS[SORT_SIZE];
+groupshared SortItem	g_LDS[SORT_SIZE];
 
 
 [numthreads(NUM_THREADS, 1, 1)]
@@ -84,10 +86,10 @@ void BitonicInnerSort(	uint3 Gid	: SV_GroupID,
 
 		if( nSwapElem<tgp.w )
 		{
-			float2 a = g_LDS[index];
-			float2 b = g_LDS[nSwapElem];
+			SortItem a = g_LDS[index];
+			SortItem b = g_LDS[nSwapElem];
 
-			if (a.x > b.x)
+			if ( SortItemGreater( a, b ) )
 			{ 
 				g_LDS[index] = b;
 				g_LDS[nSwapElem] = a;
@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+// The element type of the alive list that SortLib sorts. By default each element is a float2 of the distance to the eye and the
+// particle index. When PACKED_SORT_KEYS is defined each element is a single uint with the quantized distance in the high bits and
+// the particle index in the low SORT_KEY_INDEX_BITS bits, so the list is half the size and sorting it moves half the data. Ties 
+// between particles at the same quantized distance are broken by the index.
+
+#ifdef PACKED_SORT_KEYS
+
+typedef uint SortItem;
+
+// A value that no particle can produce, used to mark empty slots
+#define SORT_ITEM_HOLE		0xffffffff
+
+uint SortItemIndex( SortItem item )
+{
+	return item & ( ( 1u << SORT_KEY_INDEX_BITS ) - 1 );
+}
+
+// The items ordered as uints
+uint SortItemKey( SortItem item )
+{
+	return item;
+}
+
+bool SortItemGreater( SortItem a, SortItem b )
+{
+	return a > b;
+}
+
+bool SortItemIsHole( SortItem item )
+{
+	return item == SORT_ITEM_HOLE;
+}
+
+SortItem SortItemHole()
+{
+	return SORT_ITEM_HOLE;
+}
+
+// Build a particle's entry in the alive list. A log scale keeps the relative precision roughly constant with distance, which is 
+// what matters for the blending order
+SortItem MakeSortItem( float distance, uint index )
+{
+	const uint maxDepth = ( 1u << ( 32 - SORT_KEY_INDEX_BITS ) ) - 1;
+	float scaledDistance = saturate( log2( 1.0 + distance ) / log2( 1.0 + SORT_KEY_MAX_DISTANCE ) );
+	uint depth = (uint)( scaledDistance * maxDepth );
+	return ( depth << SORT_KEY_INDEX_BITS ) | index;
+}
+
+#else
+
+typedef float2 SortItem;
+
+uint SortItemIndex( SortItem item )
+{
+	return (uint)item.y;
+}
+
+// Flip the float's bits so that its ordering as a uint matches its ordering as a float
+uint SortItemKey( SortItem item )
+{
+	uint bits = asuint( item.x );
+	uint mask = ( bits & 0x80000000 ) ? 0xffffffff : 0x80000000;
+	return bits ^ mask;
+}
+
+bool SortItemGreater( SortItem a, SortItem b )
+{
+	return a.x > b.x;
+}
+
+bool SortItemIsHole( SortItem item )
+{
+	return asuint( item.y ) == 0xffffffff;
+}
+
+SortItem SortItemHole()
+{
+	return asfloat( uint2( 0xffffffff, 0xffffffff ) );
+}
+
+// Build a particle's entry in the alive list
+SortItem MakeSortItem( float distance, uint index )
+{
+	return float2( distance, (float)index );
+}
+
+#endif
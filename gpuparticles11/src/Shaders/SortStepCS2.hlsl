@@ -20,10 +20,12 @@
 // THE SOFTWARE.
 //
 
+#include "SortKeys.h"
+
 //--------------------------------------------------------------------------------------
 // Structured Buffers
 //--------------------------------------------------------------------------------------
-RWStructuredBuffer<float2> Data : register( u0 );
+RWStructuredBuffer<SortItem> Data : register( u0 );
 
 //--------------------------------------------------------------------------------------
 // Bitonic Sort Compute Shader
@@ -59,10 +61,10 @@ void BitonicSortStep(	uint3 Gid	: SV_GroupID,
 
 	if( nSwapElem<tgp.y+tgp.z )
 	{
-		float2 a = Data[index];
-		float2 b = Data[nSwapElem];
+		SortItem a = Data[index];
+		SortItem b = Data[nSwapElem];
 
-		if (a.x > b.x)
+		if ( SortItemGreater( a, b ) )
 		{ 
 			Data[index] = b;
 			Data[nSwapElem] = a;
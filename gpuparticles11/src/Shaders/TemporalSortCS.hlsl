@@ -0,0 +1,223 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+
+// Kernels for SortLib's temporal sort, which reuses the previous frame's sorted order rather than sorting from scratch. Each particle
+// remembers where it ended up in the last sort. The items that were in the last sort are put back in that order, the new items are 
+// sorted on their own, and the two lists are merged. The survivors will have moved a little since the last frame so a few odd-even 
+// transposition passes tidy up their order first. If that leaves any inversions behind then the merge is skipped in favour of a 
+// full radix sort. SortLib passes in TEMPORAL_THREADS, TEMPORAL_MAX_DISORDER and TEMPORAL_KEY_SHIFT, the lowest key bit its radix
+// sort looks at
+
+#include "SortKeys.h"
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffers
+//--------------------------------------------------------------------------------------
+cbuffer NumElementsCB : register( b0 )
+{
+	int4 g_NumElements;
+};
+
+cbuffer SortConstants : register( b1 )
+{
+	int4 job_params;
+};
+
+cbuffer SecondCountCB : register( b2 )
+{
+	int4 g_SecondCount;
+};
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<SortItem>	g_Items			: register( u0 );		// The list being sorted
+RWStructuredBuffer<SortItem>	g_Sparse		: register( u1 );		// The survivors at their position in the previous sort, holes elsewhere
+RWStructuredBuffer<SortItem>	g_New			: register( u2 );		// Items that weren't in the previous sort
+RWStructuredBuffer<uint2>	g_Ranks			: register( u3 );		// Per particle, its position in a sort and the generation of that sort
+RWStructuredBuffer<SortItem>	g_Survivors		: register( u4 );		// The survivors compacted, in their previous order
+RWBuffer<uint>				g_Disorder		: register( u5 );		// Inversions left among the survivors after the odd-even passes
+RWBuffer<uint>				g_MergeArgs		: register( u6 );
+RWBuffer<uint>				g_RadixArgs		: register( u7 );
+
+
+// Only the bits the radix sort looks at, so both sorts agree on the order
+uint SortKey( SortItem item )
+{
+	return SortItemKey( item ) >> TEMPORAL_KEY_SHIFT;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Mark the sparse list as empty
+//--------------------------------------------------------------------------------------
+[numthreads( TEMPORAL_THREADS, 1, 1 )]
+void ClearSparse( uint3 DTid : SV_DispatchThreadID )
+{
+	if ( DTid.x < (uint)g_NumElements.x )
+		g_Sparse[ DTid.x ] = SortItemHole();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Put each item that was in the previous sort back at its position from that sort. The counter of the sparse list counts them.
+// job_params.x is the generation of this sort and g_SecondCount.x the number of items in the previous one
+//--------------------------------------------------------------------------------------
+[numthreads( TEMPORAL_THREADS, 1, 1 )]
+void Classify( uint3 DTid : SV_DispatchThreadID )
+{
+	if ( DTid.x >= (uint)g_NumElements.x )
+		return;
+
+	SortItem item = g_Items[ DTid.x ];
+	uint2 rank = g_Ranks[ SortItemIndex( item ) ];
+
+	if ( rank.y == (uint)job_params.x - 1 && rank.x < (uint)g_SecondCount.x )
+	{
+		g_Sparse[ rank.x ] = item;
+		g_Sparse.IncrementCounter();
+	}
+	else
+	{
+		g_New[ g_New.IncrementCounter() ] = item;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// One odd-even transposition pass over the survivors. job_params.x is 0 for the even pass and 1 for the odd one
+//--------------------------------------------------------------------------------------
+[numthreads( TEMPORAL_THREADS, 1, 1 )]
+void OddEvenStep( uint3 DTid : SV_DispatchThreadID )
+{
+	uint index = DTid.x * 2 + (uint)job_params.x;
+	if ( index + 1 >= (uint)g_NumElements.x )
+		return;
+
+	SortItem a = g_Survivors[ index ];
+	SortItem b = g_Survivors[ index + 1 ];
+	if ( SortKey( a ) > SortKey( b ) )
+	{
+		g_Survivors[ index ] = b;
+		g_Survivors[ index + 1 ] = a;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Count the survivors that are still out of order
+//--------------------------------------------------------------------------------------
+[numthreads( TEMPORAL_THREADS, 1, 1 )]
+void CountInversions( uint3 DTid : SV_DispatchThreadID )
+{
+	uint index = DTid.x;
+	if ( index + 1 < (uint)g_NumElements.x && SortKey( g_Survivors[ index ] ) > SortKey( g_Survivors[ index + 1 ] ) )
+	{
+		InterlockedAdd( g_Disorder[ 0 ], 1 );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Choose between the merge and a full sort by zeroing the group count of the one we don't want. job_params.x is the offset of 
+// the merge args
+//--------------------------------------------------------------------------------------
+[numthreads( 1, 1, 1 )]
+void ChooseSort( uint3 DTid : SV_DispatchThreadID )
+{
+	if ( g_Disorder[ 0 ] > TEMPORAL_MAX_DISORDER )
+		g_MergeArgs[ job_params.x ] = 0;
+	else
+		g_RadixArgs[ 0 ] = 0;
+}
+
+
+// The number of new items that sort before key
+uint CountNewBefore( uint key, uint count )
+{
+	uint low = 0;
+	uint high = count;
+	while ( low < high )
+	{
+		uint middle = ( low + high ) / 2;
+		if ( SortKey( g_New[ middle ] ) < key )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+
+// The number of survivors that sort before key or equal to it
+uint CountSurvivorsBefore( uint key, uint count )
+{
+	uint low = 0;
+	uint high = count;
+	while ( low < high )
+	{
+		uint middle = ( low + high ) / 2;
+		if ( SortKey( g_Survivors[ middle ] ) <= key )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Merge the sorted survivors and new items back into the list. Every item finds its place by searching the other list, with
+// survivors going first when distances are equal. g_NumElements.x is the number of survivors and g_SecondCount.x the new items
+//--------------------------------------------------------------------------------------
+[numthreads( TEMPORAL_THREADS, 1, 1 )]
+void Merge( uint3 DTid : SV_DispatchThreadID )
+{
+	uint numSurvivors = (uint)g_NumElements.x;
+	uint numNew = (uint)g_SecondCount.x;
+
+	if ( DTid.x < numSurvivors )
+	{
+		SortItem item = g_Survivors[ DTid.x ];
+		g_Items[ DTid.x + CountNewBefore( SortKey( item ), numNew ) ] = item;
+	}
+	else if ( DTid.x - numSurvivors < numNew )
+	{
+		uint index = DTid.x - numSurvivors;
+		SortItem item = g_New[ index ];
+		g_Items[ index + CountSurvivorsBefore( SortKey( item ), numSurvivors ) ] = item;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Remember where each item ended up for the next sort. job_params.x is the generation of this sort
+//--------------------------------------------------------------------------------------
+[numthreads( TEMPORAL_THREADS, 1, 1 )]
+void RecordRanks( uint3 DTid : SV_DispatchThreadID )
+{
+	if ( DTid.x < (uint)g_NumElements.x )
+	{
+		g_Ranks[ SortItemIndex( g_Items[ DTid.x ] ) ] = uint2( DTid.x, (uint)job_params.x );
+	}
+}
@@ -28,7 +28,7 @@
 #include "Globals.h"
 
 // The particle buffer (at least part of it)
-StructuredBuffer<GPUParticlePartA>	g_ParticleBuffer				: register( t0 );
+#include "ParticleStorage.h"
 
 // The pre-computed viewspace positions of the particles
 StructuredBuffer<float4>			g_ViewSpacePositions			: register( t1 );
@@ -36,8 +36,10 @@ StructuredBuffer<float4>			g_ViewSpacePositions			: register( t1 );
 // The depth buffer
 Texture2D<float>					g_DepthTexture					: register( t2 );
 
-// The fine-grained per-tile particle lists
+// The fine-grained per-tile particle lists. The lists are stored back to back, see CullingCS.hlsl
 Buffer<uint>						g_TiledIndexBuffer				: register( t3 );
+Buffer<uint>						g_TileListCounts				: register( t5 );
+Buffer<uint>						g_TileListOffsets				: register( t7 );
 
 // The number of particles in the coarse culling bins. Only used for debug visualization
 Buffer<uint>						g_CoarseBufferCounters			: register( t4 );
@@ -45,19 +47,21 @@ Buffer<uint>						g_CoarseBufferCounters			: register( t4 );
 // The particle texture atlas
 Texture2D 							g_ParticleTexture				: register( t6 );
 
+// The rate each tile is shaded at, and the opaque scene's max depth at half and quarter resolution for the tiles that use them
+Buffer<uint>						g_TileShadingRates				: register( t8 );
+Texture2D<float>					g_HalfResDepth					: register( t9 );
+Texture2D<float>					g_QuarterResDepth				: register( t10 );
+
 // The screen space out UAV
-RWBuffer<float4>					g_OutputBuffer					: register( u0 );
+RWTexture2D<float4>					g_OutputBuffer					: register( u0 );
 
 
 #define NUM_THREADS_X TILE_RES_X
 #define NUM_THREADS_Y TILE_RES_Y
 #define NUM_THREADS_PER_TILE (NUM_THREADS_X*NUM_THREADS_Y)
 
-// The number of particles we render can be less than the number of particles stored in the tile after culling. 
-// As the particles are cached to LDS for efficiency we want to strike a balance between not using too much LDS and 
-// making sure we render enough particles to the tile without causing visual artefacts caused by omitting particles
-// from the render. The particles are already sorted front-to-back so we are only losing particles that are most likely 
-// occluded by particles nearer to the camera.
+// The particles are cached to LDS for efficiency, this many at a time. Tiles with more particles than this are rendered 
+// in chunks so we want to strike a balance between not using too much LDS and not syncing the thread group too often
 #define	MAX_PARTICLES_PER_TILE_FOR_RENDERING		500
 
 // Cached values for the particles
@@ -75,10 +79,18 @@ groupshared float				g_ParticleRadius[ MAX_PARTICLES_PER_TILE_FOR_RENDERING ];
 
 groupshared float				g_ParticleRotation[ MAX_PARTICLES_PER_TILE_FOR_RENDERING ];
 
-groupshared uint				g_ldsNumParticles;
+// Where the tile's list starts in the tiled index buffer and how many particles it holds
+groupshared uint				g_ldsListOffset;
+groupshared uint				g_ldsListSize;
+
+// The tile's shading rate. Rate n shades one pixel in each 2^n x 2^n block
+groupshared uint				g_ldsShadingRate;
 
+// The number of the tile's pixels that have yet to pass the alpha threshold. The group stops once there are none left
+groupshared uint				g_ldsNumUnsaturatedPixels;
 
-// Initialize the LDS to store the particles we want to render in the tile
+
+// Initialize the LDS with the location of the tile's particle list
 void InitLDS( uint3 localIdx, uint3 globalIdx )
 {
 	uint localIdxFlattened = localIdx.x + ( localIdx.y * NUM_THREADS_X );
@@ -88,36 +100,45 @@ void InitLDS( uint3 localIdx, uint3 globalIdx )
 	uint2 cullingTileId =  screenCoords / uint2( TILE_RES_X, TILE_RES_Y );
 
 	uint tileIdxFlattened = cullingTileId.x + cullingTileId.y * g_NumTilesX;
-	uint tiledStartOffset = PARTICLES_TILE_BUFFER_SIZE * tileIdxFlattened;
 	
-	// Clamp the number of particles to the number we can store in LDS. Backmost particles will get chopped off the list
 	if ( localIdxFlattened == 0 )
 	{
-		// The first element in the index list is the number of particles in that list
-		g_ldsNumParticles = min( MAX_PARTICLES_PER_TILE_FOR_RENDERING, g_TiledIndexBuffer[ tiledStartOffset ] );
+		// The culling drops anything past the end of the tiled index buffer until it is resized, so don't read those entries
+		g_ldsListOffset = min( g_TileListOffsets[ tileIdxFlattened ], g_TileListCapacity );
+		g_ldsListSize = min( g_TileListCounts[ tileIdxFlattened ], g_TileListCapacity - g_ldsListOffset );
+		g_ldsShadingRate = g_TileShadingRates[ tileIdxFlattened ];
+		g_ldsNumUnsaturatedPixels = 0;
 	}
 
 	GroupMemoryBarrierWithGroupSync();
-	
+}
+
+
+// Load a chunk of the tile's particles into LDS. Every thread in the group must call this, and only once everyone has finished with 
+// the previous chunk
+void LoadParticleChunk( uint localIdxFlattened, uint chunkStart, uint chunkSize )
+{
 	// Each thread in the thread group will load some particles from the buffer into LDS
-	uint numParticlesToCache = g_ldsNumParticles;
-	for ( uint i = localIdxFlattened; i < numParticlesToCache; i += NUM_THREADS_PER_TILE )
+	uint listStart = g_ldsListOffset + chunkStart;
+	for ( uint i = localIdxFlattened; i < chunkSize; i += NUM_THREADS_PER_TILE )
 	{
-		uint globalParticleIndex = g_TiledIndexBuffer[ tiledStartOffset + 1 + i ]; // skip past the first element which is the number of particles
+		uint globalParticleIndex = g_TiledIndexBuffer[ listStart + i ];
 		
+		GPUParticlePartA pa = LoadParticlePartA( globalParticleIndex );
+
 		// Load the particle data into LDS
-		g_ParticleTint[ i ] = g_ParticleBuffer[ globalParticleIndex ].m_TintAndAlpha;
-		g_ParticleEmitterProperties[ i ] = g_ParticleBuffer[ globalParticleIndex ].m_EmitterProperties;
-		g_ParticleEmitterNdotL[ i ] = g_ParticleBuffer[ globalParticleIndex ].m_EmitterNdotL;
+		g_ParticleTint[ i ] = pa.m_TintAndAlpha;
+		g_ParticleEmitterProperties[ i ] = pa.m_EmitterProperties;
+		g_ParticleEmitterNdotL[ i ] = pa.m_EmitterNdotL;
 
 		g_ParticlePosition[ i ].xyz = g_ViewSpacePositions[ globalParticleIndex ].xyz;
 		g_ParticleRadius[ i ] = g_ViewSpacePositions[ globalParticleIndex ].w;
 
-		g_ParticleRotation[ i ] = g_ParticleBuffer[ globalParticleIndex ].m_Rotation;
+		g_ParticleRotation[ i ] = pa.m_Rotation;
 		
 #if defined (STREAKS)
-		g_ParticleVelocity[ i ] = normalize( g_ParticleBuffer[ globalParticleIndex ].m_VelocityXY );
-		g_ParticleStreakLength[ i ] = calcEllipsoidRadius( g_ViewSpacePositions[ globalParticleIndex ].w, g_ParticleBuffer[ globalParticleIndex ].m_VelocityXY ).y;
+		g_ParticleVelocity[ i ] = normalize( pa.m_VelocityXY );
+		g_ParticleStreakLength[ i ] = calcEllipsoidRadius( g_ViewSpacePositions[ globalParticleIndex ].w, pa.m_VelocityXY ).y;
 #endif
 	}
 
@@ -265,14 +286,12 @@ float4 calcBillboardParticleColor( uint particleIndex, float3 rayDir, float view
 }
 
 
-// Blend all the particles together from front to back for this pixel
-float4 blendParticlesFrontToBack( float3 viewRay, float viewSpaceDepth )
+// Blend the particles in LDS into the accumulation color from front to back for this pixel
+void blendParticlesFrontToBack( float3 viewRay, float viewSpaceDepth, uint numParticles, inout float4 fcolor )
 {
-	// Fetch the number of particles to consider for rendering
-	uint numParticles = g_ldsNumParticles;
-	
-	// Initialize the accumulation color to zero
-	float4 fcolor = float4(0,0,0,0);
+	// Nothing to do if an earlier chunk has already made the pixel opaque
+	if ( fcolor.w == 1 )
+		return;
 	
 	// Loop through all the particles from front to back
 	for ( uint i = 0; i < numParticles; i++ )
@@ -292,13 +311,11 @@ float4 blendParticlesFrontToBack( float3 viewRay, float viewSpaceDepth )
 			break;
 		}
 	}
-
-	return fcolor;
 }
 
 
 // Debug visualization to display how populated each fine-grained tile is
-float4 displayTileSortComplexity()
+float4 displayTileSortComplexity( uint numParticles )
 {
 	static const float4 kRadarColors[14] = 
 	{
@@ -320,8 +337,6 @@ float4 displayTileSortComplexity()
 
 	bool useRadarColors = true;
 
-	uint numParticles = g_ldsNumParticles;
-	
 	float4 fcolor = float4(0,0,0,0.2);
 
 	if ( numParticles > 0 )
@@ -383,15 +398,11 @@ float4 displayCoarseTileComplexity( uint2 screenCoords )
 }
 
 
-// Given a pixel in screen space, evaluate the pixel color by walking through all the pixels in the tile
-// and blending their contributions together
-void EvaluateColorAtScreenCoord( uint2 screenSpaceCoord )
+// Given a point in screen space, evaluate its color by walking through all the particles in the tile and blending their 
+// contributions together. Every thread in the group must call this, but only the active threads do the blending
+float4 EvaluateColorAtScreenCoord( uint3 localIdx, float2 screenCoord, float depth, bool active )
 {
-	// Load the depth of the opaque scene at this point in screen space
-	float depth = g_DepthTexture.Load( uint3( screenSpaceCoord.x, screenSpaceCoord.y, 0 ) ).x;
-
-	float2 screenCoord = (float2)screenSpaceCoord;
-	screenCoord += 0.5;
+	uint localIdxFlattened = localIdx.x + ( localIdx.y * NUM_THREADS_X );
 
 	// Generate the view space position
 	float4 viewSpacePos;
@@ -408,30 +419,88 @@ void EvaluateColorAtScreenCoord( uint2 screenSpaceCoord )
 	// Generate a view ray into the screen
 	float3 viewRay = normalize( viewSpacePos.xyz );
 	
-	// Evaluate the pixel color
-	float4 color = blendParticlesFrontToBack( viewRay, viewSpaceDepth );
-	
-	// Clamp the screen coords when the screen width is not a multiple of the tile size
-	if ( screenSpaceCoord.x > g_ScreenWidth )
-		screenSpaceCoord.x = g_ScreenWidth;
+	// Initialize the accumulation color to zero
+	float4 color = float4(0,0,0,0);
 
-	// Calculate the index into the UAV of this screen space pixel
-	uint pixelLocation = screenSpaceCoord.x + (screenSpaceCoord.y * g_ScreenWidth);
-	
-	// Write the color out to the UAV
-	g_OutputBuffer[ pixelLocation ] = color;
+	if ( active )
+	{
+		InterlockedAdd( g_ldsNumUnsaturatedPixels, 1 );
+	}
+
+	// Evaluate the pixel color a chunk of particles at a time. The chunks are in front to back order
+	uint numParticles = g_ldsListSize;
+	for ( uint chunkStart = 0; chunkStart < numParticles; chunkStart += MAX_PARTICLES_PER_TILE_FOR_RENDERING )
+	{
+		// Make sure everyone has finished with the previous chunk and has counted their pixel out if it went opaque. Nothing changes 
+		// the count between here and the next chunk's blending so everyone agrees on whether to stop
+		GroupMemoryBarrierWithGroupSync();
+
+		if ( g_ldsNumUnsaturatedPixels == 0 )
+			break;
+
+		uint chunkSize = min( numParticles - chunkStart, MAX_PARTICLES_PER_TILE_FOR_RENDERING );
+
+		LoadParticleChunk( localIdxFlattened, chunkStart, chunkSize );
+
+		if ( active && color.w < 1 )
+		{
+			blendParticlesFrontToBack( viewRay, viewSpaceDepth, chunkSize, color );
+
+			if ( color.w == 1 )
+			{
+				InterlockedAdd( g_ldsNumUnsaturatedPixels, -1 );
+			}
+		}
+	}
+
+	return color;
 }
 
 
-// Entry point for tiled rendering. Each thread maps to a pixel in screen space
+// Write a pixel's color out to the UAV. The UAV is the size of the screen, so the pixels of tiles that hang off the edge of the 
+// screen are dropped by the hardware's bounds checking. The store converts to the render buffer's format
+void WriteColorAtScreenCoord( uint2 screenSpaceCoord, float4 color )
+{
+	g_OutputBuffer[ screenSpaceCoord ] = color;
+}
+
+
+// Entry point for tiled rendering. At full rate each thread maps to a pixel in screen space. At lower rates the first threads in the 
+// group each shade a block of pixels against the block's max depth and the rest only help load the particles, so whole waves skip 
+// the blending. The block's color is written to its top left pixel and the composite upsamples it
 [numthreads(NUM_THREADS_X, NUM_THREADS_Y, 1)]
 void FrontToBack( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID, uint3 globalIdx : SV_DispatchThreadID )
 {
-	// Load the particle data into LDS
+	// Find the tile's particle list
 	InitLDS( localIdx, globalIdx );
 
-	// Evaluate the pixel
-	EvaluateColorAtScreenCoord( globalIdx.xy );
+	uint localIdxFlattened = localIdx.x + ( localIdx.y * NUM_THREADS_X );
+	uint rate = g_ldsShadingRate;
+	uint blockSize = 1 << rate;
+	uint lowResTileWidth = NUM_THREADS_X >> rate;
+	uint numShadingThreads = NUM_THREADS_PER_TILE >> ( 2 * rate );
+
+	uint2 blockIdx = uint2( localIdxFlattened % lowResTileWidth, localIdxFlattened / lowResTileWidth );
+	uint2 screenSpaceCoord = groupIdx.xy * uint2( TILE_RES_X, TILE_RES_Y ) + blockIdx * blockSize;
+	bool active = localIdxFlattened < numShadingThreads && screenSpaceCoord.x < (uint)g_ScreenWidth && screenSpaceCoord.y < (uint)g_ScreenHeight;
+
+	// Load the depth of the opaque scene for the block
+	float depth;
+	[branch]
+	if ( rate == 0 )
+		depth = g_DepthTexture.Load( uint3( screenSpaceCoord, 0 ) ).x;
+	else if ( rate == 1 )
+		depth = g_HalfResDepth.Load( uint3( screenSpaceCoord >> 1, 0 ) ).x;
+	else
+		depth = g_QuarterResDepth.Load( uint3( screenSpaceCoord >> 2, 0 ) ).x;
+
+	// Evaluate the pixel at the centre of the block
+	float4 color = EvaluateColorAtScreenCoord( localIdx, (float2)screenSpaceCoord + 0.5 * blockSize, depth, active );
+
+	if ( active )
+	{
+		WriteColorAtScreenCoord( screenSpaceCoord, color );
+	}
 }
 
 /*
@@ -542,20 +611,20 @@ void Overdraw( uint3 localIdx : SV_GroupThreadID, uint3 groupIdx : SV_GroupID, u
 
 	float4 color = displayCoarseTileComplexity( globalIdx.xy );
 	
-	uint pixelLocation = coarseTileCoords.x + (coarseTileCoords.y * g_ScreenWidth ); 
-	g_OutputBuffer[ pixelLocation ] = color;
+	g_OutputBuffer[ coarseTileCoords ] = color;
 	
 	screenSpaceCoord.x += g_ScreenWidth / 2;
-	if ( screenSpaceCoord.x > g_ScreenWidth )
-		screenSpaceCoord.x = g_ScreenWidth;
-	color = displayTileSortComplexity();
+	color = displayTileSortComplexity( g_ldsListSize );
 	
-	pixelLocation = screenSpaceCoord.x + (screenSpaceCoord.y * g_ScreenWidth); 
-	g_OutputBuffer[ pixelLocation ] = color;
+	g_OutputBuffer[ screenSpaceCoord ] = color;
 	
+	// The evaluation syncs the thread group so all threads run it
+	float depth = g_DepthTexture.Load( uint3( globalIdx.xy, 0 ) ).x;
+	color = EvaluateColorAtScreenCoord( localIdx, (float2)globalIdx.xy + 0.5, depth, true );
+
 	if ( globalIdx.y >= g_ScreenHeight / 2 )
 	{
-		EvaluateColorAtScreenCoord( globalIdx.xy );
+		WriteColorAtScreenCoord( globalIdx.xy, color );
 	}
 }
 
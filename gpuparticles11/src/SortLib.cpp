@@ -23,6 +23,8 @@
 #include "SortLib.h"
 #include <d3dcompiler.h>
 #include <assert.h>
+#include <stdio.h>
+#include <algorithm>
 
 
 #ifndef SAFE_RELEASE
@@ -30,12 +32,71 @@
 #endif
 
 
-const int MAX_NUM_TG = 1024;//128; // max 128 * 512 elements = 64k elements
+const int MAX_NUM_TG = 2048;//128; // max 128 * 512 elements = 64k elements
 typedef struct SortConstants
 {
     int x,y,z,w;
 }int4;
 
+// Radix sort configuration, passed on to RadixSortCS.hlsl
+#define RADIX_BITS				4
+#define RADIX_DIGITS			( 1 << RADIX_BITS )
+#define RADIX_THREADS			256
+#define RADIX_ITEMS_PER_THREAD	4
+#define RADIX_ITEMS_PER_GROUP	1024		// RADIX_THREADS * RADIX_ITEMS_PER_THREAD
+#define RADIX_SCAN_THREADS		1024
+
+// Temporal sort configuration, passed on to TemporalSortCS.hlsl
+#define TEMPORAL_THREADS		256
+#define TEMPORAL_MAX_DISORDER	0			// The merge needs the survivors fully sorted so any inversion left means a full sort
+#define TEMPORAL_FIX_PASSES		8			// Odd-even transposition passes over the survivors. Each moves an item at most one place
+
+// Slots in the temporal args buffer, each 4 UINTs
+#define TEMPORAL_ARGS_SPARSE	0			// One thread per item of the previous sort
+#define TEMPORAL_ARGS_ITEMS		1			// One thread per item
+#define TEMPORAL_ARGS_MERGE		2			// One thread per item, zeroed when the merge is skipped
+#define TEMPORAL_ARGS_PAIRS		3			// One thread per pair of survivors
+#define TEMPORAL_ARGS_SURVIVORS	4			// One thread per survivor
+#define TEMPORAL_ARGS_SLOTS		5
+
+#define SORTLIB_STRINGIZE2( x )	#x
+#define SORTLIB_STRINGIZE( x )	SORTLIB_STRINGIZE2( x )
+
+#ifdef _DEBUG
+// Set to true to check every radix or temporal sort against referenceSort. Stalls on two readbacks each time
+static const bool g_validateSort = false;
+#endif
+
+
+static HRESULT createComputeShader( ID3D11Device* device, LPCWSTR file, LPCSTR entryPoint, const D3D10_SHADER_MACRO* defines, ID3D11ComputeShader** shader )
+{
+	ID3DBlob* pBlob = nullptr;
+	ID3DBlob* pErrorBlob = nullptr;
+	HRESULT hr = D3DCompileFromFile( file, defines, D3D_COMPILE_STANDARD_FILE_INCLUDE, entryPoint, "cs_5_0", 0, 0, &pBlob, &pErrorBlob );
+	if( FAILED(hr) )
+	{
+		if( pErrorBlob != nullptr )
+			OutputDebugStringA( (char*)pErrorBlob->GetBufferPointer() );
+		SAFE_RELEASE( pErrorBlob );
+		return hr;
+	}
+	SAFE_RELEASE( pErrorBlob );
+
+	hr = device->CreateComputeShader( pBlob->GetBufferPointer(), pBlob->GetBufferSize(), nullptr, shader );
+	SAFE_RELEASE( pBlob );
+	return hr;
+}
+
+
+// Flip the float's bits so that its ordering as an unsigned int matches its ordering as a float. Matches SortKey in RadixSortCS.hlsl
+static unsigned int radixKey( float distance )
+{
+	unsigned int bits;
+	memcpy( &bits, &distance, sizeof( bits ) );
+	unsigned int mask = ( bits & 0x80000000 ) ? 0xffffffff : 0x80000000;
+	return bits ^ mask;
+}
+
 
 SortLib::SortLib() :
 	m_device( nullptr ),
@@ -46,7 +107,47 @@ SortLib::SortLib() :
 	m_pCSSortInner512( nullptr ),
 	m_pCSInitArgs( nullptr ),
 	m_pIndirectSortArgsBuffer( nullptr ),
-	m_pIndirectSortArgsBufferUAV( nullptr )
+	m_pIndirectSortArgsBufferUAV( nullptr ),
+	m_algorithm( Algorithm_Bitonic ),
+	m_packedIndexBits( 0 ),
+	m_itemSize( sizeof( Item ) ),
+	m_radixFirstShift( 0 ),
+	m_pCSRadixInitArgs( nullptr ),
+	m_pCSRadixCount( nullptr ),
+	m_pCSRadixScan( nullptr ),
+	m_pCSRadixScatter( nullptr ),
+	m_radixCapacity( 0 ),
+	m_pRadixTempBuffer( nullptr ),
+	m_pRadixTempBufferUAV( nullptr ),
+	m_pRadixHistogramBuffer( nullptr ),
+	m_pRadixHistogramBufferUAV( nullptr ),
+	m_pCSRadixCompactCount( nullptr ),
+	m_pCSRadixCompactScatter( nullptr ),
+	m_pCSGroupInitArgs( nullptr ),
+	m_pCSTemporalClearSparse( nullptr ),
+	m_pCSTemporalClassify( nullptr ),
+	m_pCSTemporalOddEvenStep( nullptr ),
+	m_pCSTemporalCountInversions( nullptr ),
+	m_pCSTemporalChooseSort( nullptr ),
+	m_pCSTemporalMerge( nullptr ),
+	m_pCSTemporalRecordRanks( nullptr ),
+	m_temporalCapacity( 0 ),
+	m_generation( 2 ),
+	m_pSparseBuffer( nullptr ),
+	m_pSparseBufferUAV( nullptr ),
+	m_pSurvivorBuffer( nullptr ),
+	m_pSurvivorBufferUAV( nullptr ),
+	m_pNewBuffer( nullptr ),
+	m_pNewBufferUAV( nullptr ),
+	m_pRankBuffer( nullptr ),
+	m_pRankBufferUAV( nullptr ),
+	m_pDisorderBuffer( nullptr ),
+	m_pDisorderBufferUAV( nullptr ),
+	m_pTemporalArgsBuffer( nullptr ),
+	m_pTemporalArgsBufferUAV( nullptr ),
+	m_pPrevCountCB( nullptr ),
+	m_pSurvivorCountCB( nullptr ),
+	m_pNewCountCB( nullptr )
 {
 }
 
@@ -55,10 +156,25 @@ SortLib::~SortLib()
 	release();
 }
 
-HRESULT	SortLib::init( ID3D11Device* device, ID3D11DeviceContext* context )
+HRESULT	SortLib::init( ID3D11Device* device, ID3D11DeviceContext* context, Algorithm algorithm, unsigned int packedIndexBits )
 {
 	m_device = device;
 	m_context = context;
+	m_algorithm = algorithm;
+	m_packedIndexBits = packedIndexBits;
+	m_itemSize = (unsigned int)( packedIndexBits ? sizeof( UINT ) : sizeof( Item ) );
+
+	// The index bits only break ties between equal distances so the radix sort can skip them, as long as it still does an even 
+	// number of passes to end up back in the sort buffer
+	m_radixFirstShift = 0;
+	if ( packedIndexBits )
+	{
+		int numPasses = ( 32 - (int)packedIndexBits + RADIX_BITS - 1 ) / RADIX_BITS;
+		numPasses += numPasses & 1;
+		m_radixFirstShift = std::max( 32 - numPasses * RADIX_BITS, 0 );
+	}
+	sprintf_s( m_indexBitsString, "%u", packedIndexBits );
+	sprintf_s( m_firstShiftString, "%d", m_radixFirstShift );
 
 	// Create constant buffer
     D3D11_BUFFER_DESC cbDesc;
@@ -74,7 +190,7 @@ HRESULT	SortLib::init( ID3D11Device* device, ID3D11DeviceContext* context )
 	// create shaders
 	
 	// Step sort shader
-	HRESULT hr = D3DCompileFromFile( L"..\\src\\Shaders\\SortStepCS2.hlsl", nullptr, nullptr, "BitonicSortStep", "cs_5_0", 0, 0, &pBlob, &pErrorBlob );
+	HRESULT hr = D3DCompileFromFile( L"..\\src\\Shaders\\SortStepCS2.hlsl", &keyDefines( nullptr )[ 0 ], D3D_COMPILE_STANDARD_FILE_INCLUDE, "BitonicSortStep", "cs_5_0", 0, 0, &pBlob, &pErrorBlob );
 	if( FAILED(hr) )
     {
         if( pErrorBlob != nullptr )
@@ -87,7 +203,7 @@ HRESULT	SortLib::init( ID3D11Device* device, ID3D11DeviceContext* context )
 	
 	// Create inner sort shader
 	const D3D10_SHADER_MACRO innerDefines[2] = {{"SORT_SIZE", "512"}, {nullptr,0}};
-	hr = D3DCompileFromFile( L"..\\src\\Shaders\\SortInnerCS.hlsl", innerDefines, nullptr, "BitonicInnerSort", "cs_5_0", 0, 0, &pBlob, &pErrorBlob );
+	hr = D3DCompileFromFile( L"..\\src\\Shaders\\SortInnerCS.hlsl", &keyDefines( innerDefines )[ 0 ], D3D_COMPILE_STANDARD_FILE_INCLUDE, "BitonicInnerSort", "cs_5_0", 0, 0, &pBlob, &pErrorBlob );
 	if( FAILED(hr) )
     {
         if( pErrorBlob != NULL )
@@ -100,7 +216,7 @@ HRESULT	SortLib::init( ID3D11Device* device, ID3D11DeviceContext* context )
 
 	// create 
 	const D3D10_SHADER_MACRO cs512Defines[2] = {{"SORT_SIZE", "512"}, {nullptr,0}};
-	hr = D3DCompileFromFile( L"..\\src\\Shaders\\SortCS.hlsl", cs512Defines, nullptr, "BitonicSortLDS", "cs_5_0", 0, 0, &pBlob, &pErrorBlob );
+	hr = D3DCompileFromFile( L"..\\src\\Shaders\\SortCS.hlsl", &keyDefines( cs512Defines )[ 0 ], D3D_COMPILE_STANDARD_FILE_INCLUDE, "BitonicSortLDS", "cs_5_0", 0, 0, &pBlob, &pErrorBlob );
 	if( FAILED(hr) )
     {
         if( pErrorBlob != nullptr )
@@ -140,6 +256,72 @@ HRESULT	SortLib::init( ID3D11Device* device, ID3D11DeviceContext* context )
 	uav.Buffer.Flags = 0;
 	device->CreateUnorderedAccessView( m_pIndirectSortArgsBuffer, &uav, &m_pIndirectSortArgsBufferUAV );
 
+	// The temporal sort falls back to the radix sort so it needs those shaders too
+	if ( algorithm == Algorithm_Radix || algorithm == Algorithm_Temporal )
+	{
+		const D3D10_SHADER_MACRO radixDefines[] = 
+		{
+			{ "RADIX_BITS", SORTLIB_STRINGIZE( RADIX_BITS ) },
+			{ "RADIX_THREADS", SORTLIB_STRINGIZE( RADIX_THREADS ) },
+			{ "RADIX_ITEMS_PER_THREAD", SORTLIB_STRINGIZE( RADIX_ITEMS_PER_THREAD ) },
+			{ "RADIX_SCAN_THREADS", SORTLIB_STRINGIZE( RADIX_SCAN_THREADS ) },
+			{ nullptr, 0 }
+		};
+		const D3D10_SHADER_MACRO argsDefines[] = { { "RADIX_ITEMS_PER_GROUP", SORTLIB_STRINGIZE( RADIX_ITEMS_PER_GROUP ) }, { nullptr, 0 } };
+
+		std::vector<D3D10_SHADER_MACRO> radixKeyDefines = keyDefines( radixDefines );
+
+		hr = createComputeShader( device, L"..\\src\\Shaders\\InitSortArgsCS.hlsl", "InitRadixDispatchArgs", argsDefines, &m_pCSRadixInitArgs );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\RadixSortCS.hlsl", "RadixCount", &radixKeyDefines[ 0 ], &m_pCSRadixCount );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\RadixSortCS.hlsl", "RadixScan", &radixKeyDefines[ 0 ], &m_pCSRadixScan );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\RadixSortCS.hlsl", "RadixScatter", &radixKeyDefines[ 0 ], &m_pCSRadixScatter );
+	}
+
+	if ( SUCCEEDED( hr ) && algorithm == Algorithm_Temporal )
+	{
+		const D3D10_SHADER_MACRO compactDefines[] = 
+		{
+			{ "RADIX_BITS", SORTLIB_STRINGIZE( RADIX_BITS ) },
+			{ "RADIX_THREADS", SORTLIB_STRINGIZE( RADIX_THREADS ) },
+			{ "RADIX_ITEMS_PER_THREAD", SORTLIB_STRINGIZE( RADIX_ITEMS_PER_THREAD ) },
+			{ "RADIX_SCAN_THREADS", SORTLIB_STRINGIZE( RADIX_SCAN_THREADS ) },
+			{ "RADIX_COMPACT", "1" },
+			{ nullptr, 0 }
+		};
+		const D3D10_SHADER_MACRO temporalDefines[] = 
+		{
+			{ "TEMPORAL_THREADS", SORTLIB_STRINGIZE( TEMPORAL_THREADS ) },
+			{ "TEMPORAL_MAX_DISORDER", SORTLIB_STRINGIZE( TEMPORAL_MAX_DISORDER ) },
+			{ "TEMPORAL_KEY_SHIFT", m_firstShiftString },
+			{ nullptr, 0 }
+		};
+		std::vector<D3D10_SHADER_MACRO> compactKeyDefines = keyDefines( compactDefines );
+		std::vector<D3D10_SHADER_MACRO> temporalKeyDefines = keyDefines( temporalDefines );
+
+		hr = createComputeShader( device, L"..\\src\\Shaders\\RadixSortCS.hlsl", "RadixCount", &compactKeyDefines[ 0 ], &m_pCSRadixCompactCount );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\RadixSortCS.hlsl", "RadixScatter", &compactKeyDefines[ 0 ], &m_pCSRadixCompactScatter );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\InitSortArgsCS.hlsl", "InitGroupDispatchArgs", nullptr, &m_pCSGroupInitArgs );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\TemporalSortCS.hlsl", "ClearSparse", &temporalKeyDefines[ 0 ], &m_pCSTemporalClearSparse );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\TemporalSortCS.hlsl", "Classify", &temporalKeyDefines[ 0 ], &m_pCSTemporalClassify );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\TemporalSortCS.hlsl", "OddEvenStep", &temporalKeyDefines[ 0 ], &m_pCSTemporalOddEvenStep );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\TemporalSortCS.hlsl", "CountInversions", &temporalKeyDefines[ 0 ], &m_pCSTemporalCountInversions );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\TemporalSortCS.hlsl", "ChooseSort", &temporalKeyDefines[ 0 ], &m_pCSTemporalChooseSort );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\TemporalSortCS.hlsl", "Merge", &temporalKeyDefines[ 0 ], &m_pCSTemporalMerge );
+		if ( SUCCEEDED( hr ) )
+			hr = createComputeShader( device, L"..\\src\\Shaders\\TemporalSortCS.hlsl", "RecordRanks", &temporalKeyDefines[ 0 ], &m_pCSTemporalRecordRanks );
+	}
+
 	return hr;
 }
 
@@ -149,28 +331,49 @@ void SortLib::run( unsigned int maxSize, ID3D11UnorderedAccessView* sortBufferUA
 	ID3D11UnorderedAccessView* prevUAV = nullptr;
 	m_context->CSGetUnorderedAccessViews( 0, 1, &prevUAV );
 
-	ID3D11Buffer* prevCBs[] = { nullptr, nullptr };
+	ID3D11Buffer* prevCBs[] = { nullptr, nullptr, nullptr };
 	m_context->CSGetConstantBuffers( 0, ARRAYSIZE( prevCBs ), prevCBs );
 
 	ID3D11Buffer* cbs[] = { itemCountBuffer, m_pcbDispatchInfo };
 	m_context->CSSetConstantBuffers( 0, ARRAYSIZE( cbs ), cbs );
 	
-	// Write the indirect args to a UAV
-	m_context->CSSetUnorderedAccessViews( 0, 1, &m_pIndirectSortArgsBufferUAV, nullptr );
+	if ( m_algorithm == Algorithm_Radix || m_algorithm == Algorithm_Temporal )
+	{
+#ifdef _DEBUG
+		std::vector<Item> unsorted;
+		if ( g_validateSort )
+			readBack( sortBufferUAV, itemCountBuffer, unsorted );
+#endif
 
-	m_context->CSSetShader( m_pCSInitArgs, nullptr, 0 );
-	m_context->Dispatch( 1, 1, 1 );
-	
-	
-	m_context->CSSetUnorderedAccessViews( 0, 1, &sortBufferUAV, nullptr );
-	
-	bool bDone = sortInitial( maxSize );
-	
-	int presorted = 512;
-	while (!bDone) 
+		if ( m_algorithm == Algorithm_Temporal )
+			sortTemporal( maxSize, sortBufferUAV, itemCountBuffer );
+		else
+			sortRadix( maxSize, sortBufferUAV );
+
+#ifdef _DEBUG
+		if ( g_validateSort )
+			validateSort( unsorted, sortBufferUAV, itemCountBuffer );
+#endif
+	}
+	else
 	{
-		bDone = sortIncremental( presorted, maxSize );
-		presorted *= 2;
+		// Write the indirect args to a UAV
+		m_context->CSSetUnorderedAccessViews( 0, 1, &m_pIndirectSortArgsBufferUAV, nullptr );
+
+		m_context->CSSetShader( m_pCSInitArgs, nullptr, 0 );
+		m_context->Dispatch( 1, 1, 1 );
+		
+		
+		m_context->CSSetUnorderedAccessViews( 0, 1, &sortBufferUAV, nullptr );
+		
+		bool bDone = sortInitial( maxSize );
+		
+		int presorted = 512;
+		while (!bDone) 
+		{
+			bDone = sortIncremental( presorted, maxSize );
+			presorted *= 2;
+		}
 	}
 
 #ifdef _DEBUG
@@ -200,6 +403,45 @@ void SortLib::release()
 
 	SAFE_RELEASE( m_pIndirectSortArgsBufferUAV );
 	SAFE_RELEASE( m_pIndirectSortArgsBuffer );
+
+	SAFE_RELEASE( m_pCSRadixInitArgs );
+	SAFE_RELEASE( m_pCSRadixCount );
+	SAFE_RELEASE( m_pCSRadixScan );
+	SAFE_RELEASE( m_pCSRadixScatter );
+
+	SAFE_RELEASE( m_pRadixTempBufferUAV );
+	SAFE_RELEASE( m_pRadixTempBuffer );
+	SAFE_RELEASE( m_pRadixHistogramBufferUAV );
+	SAFE_RELEASE( m_pRadixHistogramBuffer );
+	m_radixCapacity = 0;
+
+	SAFE_RELEASE( m_pCSRadixCompactCount );
+	SAFE_RELEASE( m_pCSRadixCompactScatter );
+	SAFE_RELEASE( m_pCSGroupInitArgs );
+	SAFE_RELEASE( m_pCSTemporalClearSparse );
+	SAFE_RELEASE( m_pCSTemporalClassify );
+	SAFE_RELEASE( m_pCSTemporalOddEvenStep );
+	SAFE_RELEASE( m_pCSTemporalCountInversions );
+	SAFE_RELEASE( m_pCSTemporalChooseSort );
+	SAFE_RELEASE( m_pCSTemporalMerge );
+	SAFE_RELEASE( m_pCSTemporalRecordRanks );
+
+	SAFE_RELEASE( m_pSparseBufferUAV );
+	SAFE_RELEASE( m_pSparseBuffer );
+	SAFE_RELEASE( m_pSurvivorBufferUAV );
+	SAFE_RELEASE( m_pSurvivorBuffer );
+	SAFE_RELEASE( m_pNewBufferUAV );
+	SAFE_RELEASE( m_pNewBuffer );
+	SAFE_RELEASE( m_pRankBufferUAV );
+	SAFE_RELEASE( m_pRankBuffer );
+	SAFE_RELEASE( m_pDisorderBufferUAV );
+	SAFE_RELEASE( m_pDisorderBuffer );
+	SAFE_RELEASE( m_pTemporalArgsBufferUAV );
+	SAFE_RELEASE( m_pTemporalArgsBuffer );
+	SAFE_RELEASE( m_pPrevCountCB );
+	SAFE_RELEASE( m_pSurvivorCountCB );
+	SAFE_RELEASE( m_pNewCountCB );
+	m_temporalCapacity = 0;
 }
 
 bool SortLib::sortInitial( unsigned int maxSize )
@@ -275,6 +517,378 @@ bool SortLib::sortIncremental( unsigned int presorted, unsigned int maxSize )
 	return bDone;
 }
 
+void SortLib::sortRadix( unsigned int maxSize, ID3D11UnorderedAccessView* sortBufferUAV )
+{
+	if ( maxSize > m_radixCapacity )
+		createRadixBuffers( maxSize );
+
+	initRadixArgs();
+	runRadixPasses( sortBufferUAV );
+}
+
+// One group per block of the items in the count buffer bound to b0, for the count and scatter passes
+void SortLib::initRadixArgs()
+{
+	m_context->CSSetUnorderedAccessViews( 0, 1, &m_pIndirectSortArgsBufferUAV, nullptr );
+	m_context->CSSetShader( m_pCSRadixInitArgs, nullptr, 0 );
+	m_context->Dispatch( 1, 1, 1 );
+}
+
+// Sort the items using the args from the last initRadixArgs. Nothing happens if those args have been zeroed
+void SortLib::runRadixPasses( ID3D11UnorderedAccessView* sortBufferUAV )
+{
+	// Ping-pong between the sort buffer and the temp buffer. There are an even number of passes so the result ends up in the sort buffer
+	ID3D11UnorderedAccessView* buffers[] = { sortBufferUAV, m_pRadixTempBufferUAV };
+	for ( int shift = m_radixFirstShift; shift < 32; shift += RADIX_BITS )
+	{
+		int pass = ( shift - m_radixFirstShift ) / RADIX_BITS;
+
+		setDispatchInfo( shift, 0, 0, 0 );
+
+		ID3D11UnorderedAccessView* uavs[] = { buffers[ pass & 1 ], buffers[ ( pass & 1 ) ^ 1 ], m_pRadixHistogramBufferUAV };
+		m_context->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
+
+		m_context->CSSetShader( m_pCSRadixCount, nullptr, 0 );
+		m_context->DispatchIndirect( m_pIndirectSortArgsBuffer, 0 );
+
+		m_context->CSSetShader( m_pCSRadixScan, nullptr, 0 );
+		m_context->Dispatch( 1, 1, 1 );
+
+		m_context->CSSetShader( m_pCSRadixScatter, nullptr, 0 );
+		m_context->DispatchIndirect( m_pIndirectSortArgsBuffer, 0 );
+	}
+
+	// Only slot 0 is restored by run() so unbind the others
+	ID3D11UnorderedAccessView* nullUAVs[] = { nullptr, nullptr };
+	m_context->CSSetUnorderedAccessViews( 1, ARRAYSIZE( nullUAVs ), nullUAVs, nullptr );
+}
+
+// A single stable pass on whether each item is a hole, using the args from the last initRadixArgs
+void SortLib::runRadixCompaction( ID3D11UnorderedAccessView* sourceUAV, ID3D11UnorderedAccessView* destinationUAV )
+{
+	ID3D11UnorderedAccessView* uavs[] = { sourceUAV, destinationUAV, m_pRadixHistogramBufferUAV };
+	m_context->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, nullptr );
+
+	m_context->CSSetShader( m_pCSRadixCompactCount, nullptr, 0 );
+	m_context->DispatchIndirect( m_pIndirectSortArgsBuffer, 0 );
+
+	m_context->CSSetShader( m_pCSRadixScan, nullptr, 0 );
+	m_context->Dispatch( 1, 1, 1 );
+
+	m_context->CSSetShader( m_pCSRadixCompactScatter, nullptr, 0 );
+	m_context->DispatchIndirect( m_pIndirectSortArgsBuffer, 0 );
+
+	ID3D11UnorderedAccessView* nullUAVs[] = { nullptr, nullptr, nullptr };
+	m_context->CSSetUnorderedAccessViews( 0, ARRAYSIZE( nullUAVs ), nullUAVs, nullptr );
+}
+
+void SortLib::createRadixBuffers( unsigned int maxSize )
+{
+	SAFE_RELEASE( m_pRadixTempBufferUAV );
+	SAFE_RELEASE( m_pRadixTempBuffer );
+	SAFE_RELEASE( m_pRadixHistogramBufferUAV );
+	SAFE_RELEASE( m_pRadixHistogramBuffer );
+
+	m_radixCapacity = maxSize;
+	unsigned int numBlocks = ( maxSize + RADIX_ITEMS_PER_GROUP - 1 ) / RADIX_ITEMS_PER_GROUP;
+
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uav;
+	ZeroMemory( &uav, sizeof( uav ) );
+	uav.Format = DXGI_FORMAT_UNKNOWN;
+	uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+
+	desc.ByteWidth = m_itemSize * maxSize;
+	desc.StructureByteStride = m_itemSize;
+	m_device->CreateBuffer( &desc, nullptr, &m_pRadixTempBuffer );
+
+	uav.Buffer.NumElements = maxSize;
+	m_device->CreateUnorderedAccessView( m_pRadixTempBuffer, &uav, &m_pRadixTempBufferUAV );
+
+	desc.ByteWidth = sizeof( UINT ) * RADIX_DIGITS * numBlocks;
+	desc.StructureByteStride = sizeof( UINT );
+	m_device->CreateBuffer( &desc, nullptr, &m_pRadixHistogramBuffer );
+
+	uav.Buffer.NumElements = RADIX_DIGITS * numBlocks;
+	m_device->CreateUnorderedAccessView( m_pRadixHistogramBuffer, &uav, &m_pRadixHistogramBufferUAV );
+}
+
+// Sort using the order from the previous sort. The items that were in it are put back in that order and any that have drifted a 
+// little out of place are fixed up. The new items are radix sorted and merged with them. If the survivors are still out of order
+// then the merge is skipped in favour of a radix sort of the whole list
+void SortLib::sortTemporal( unsigned int maxSize, ID3D11UnorderedAccessView* sortBufferUAV, ID3D11Buffer* itemCountBuffer )
+{
+	if ( maxSize > m_radixCapacity )
+		createRadixBuffers( maxSize );
+	if ( maxSize > m_temporalCapacity )
+		createTemporalBuffers( maxSize, itemCountBuffer );
+
+	const UINT argsStride = 4 * sizeof( UINT );
+
+	// Mark every position of the previous sort as a hole
+	m_context->CSSetConstantBuffers( 0, 1, &m_pPrevCountCB );
+	initGroupArgs( TEMPORAL_ARGS_SPARSE, TEMPORAL_THREADS );
+
+	bindTemporalUAVs( sortBufferUAV, false );
+	m_context->CSSetShader( m_pCSTemporalClearSparse, nullptr, 0 );
+	m_context->DispatchIndirect( m_pTemporalArgsBuffer, TEMPORAL_ARGS_SPARSE * argsStride );
+	unbindTemporalUAVs();
+
+	// Split the items into survivors, at their previous position, and new items
+	m_context->CSSetConstantBuffers( 0, 1, &itemCountBuffer );
+	initGroupArgs( TEMPORAL_ARGS_ITEMS, TEMPORAL_THREADS );
+	initGroupArgs( TEMPORAL_ARGS_MERGE, TEMPORAL_THREADS );
+
+	setDispatchInfo( (int)m_generation, 0, 0, 0 );
+	m_context->CSSetConstantBuffers( 2, 1, &m_pPrevCountCB );
+	bindTemporalUAVs( sortBufferUAV, true );
+	m_context->CSSetShader( m_pCSTemporalClassify, nullptr, 0 );
+	m_context->DispatchIndirect( m_pTemporalArgsBuffer, TEMPORAL_ARGS_ITEMS * argsStride );
+	unbindTemporalUAVs();
+
+	m_context->CopyStructureCount( m_pSurvivorCountCB, 0, m_pSparseBufferUAV );
+	m_context->CopyStructureCount( m_pNewCountCB, 0, m_pNewBufferUAV );
+
+	// Squeeze the holes out of the survivors
+	m_context->CSSetConstantBuffers( 0, 1, &m_pPrevCountCB );
+	initRadixArgs();
+	runRadixCompaction( m_pSparseBufferUAV, m_pSurvivorBufferUAV );
+
+	// Sort the new items
+	m_context->CSSetConstantBuffers( 0, 1, &m_pNewCountCB );
+	initRadixArgs();
+	runRadixPasses( m_pNewBufferUAV );
+
+	// Fix up survivors that have swapped places with a neighbour since the last sort, then see if any are still out of order
+	m_context->CSSetConstantBuffers( 0, 1, &m_pSurvivorCountCB );
+	initGroupArgs( TEMPORAL_ARGS_PAIRS, TEMPORAL_THREADS * 2 );
+	initGroupArgs( TEMPORAL_ARGS_SURVIVORS, TEMPORAL_THREADS );
+
+	bindTemporalUAVs( sortBufferUAV, false );
+	UINT zeros[] = { 0, 0, 0, 0 };
+	m_context->ClearUnorderedAccessViewUint( m_pDisorderBufferUAV, zeros );
+
+	m_context->CSSetShader( m_pCSTemporalOddEvenStep, nullptr, 0 );
+	for ( int pass = 0; pass < TEMPORAL_FIX_PASSES; pass++ )
+	{
+		setDispatchInfo( pass & 1, 0, 0, 0 );
+		m_context->DispatchIndirect( m_pTemporalArgsBuffer, TEMPORAL_ARGS_PAIRS * argsStride );
+	}
+
+	m_context->CSSetShader( m_pCSTemporalCountInversions, nullptr, 0 );
+	m_context->DispatchIndirect( m_pTemporalArgsBuffer, TEMPORAL_ARGS_SURVIVORS * argsStride );
+	unbindTemporalUAVs();
+
+	// Set up the full sort, then zero the group count of whichever of it and the merge isn't needed
+	m_context->CSSetConstantBuffers( 0, 1, &itemCountBuffer );
+	initRadixArgs();
+
+	ID3D11UnorderedAccessView* chooseUAVs[] = { m_pDisorderBufferUAV, m_pTemporalArgsBufferUAV, m_pIndirectSortArgsBufferUAV };
+	m_context->CSSetUnorderedAccessViews( 5, ARRAYSIZE( chooseUAVs ), chooseUAVs, nullptr );
+	setDispatchInfo( TEMPORAL_ARGS_MERGE * 4, 0, 0, 0 );
+	m_context->CSSetShader( m_pCSTemporalChooseSort, nullptr, 0 );
+	m_context->Dispatch( 1, 1, 1 );
+	unbindTemporalUAVs();
+
+	// Merge the survivors and the new items back into the sort buffer
+	m_context->CSSetConstantBuffers( 0, 1, &m_pSurvivorCountCB );
+	m_context->CSSetConstantBuffers( 2, 1, &m_pNewCountCB );
+	bindTemporalUAVs( sortBufferUAV, false );
+	m_context->CSSetShader( m_pCSTemporalMerge, nullptr, 0 );
+	m_context->DispatchIndirect( m_pTemporalArgsBuffer, TEMPORAL_ARGS_MERGE * argsStride );
+	unbindTemporalUAVs();
+
+	// Or sort the whole list
+	m_context->CSSetConstantBuffers( 0, 1, &itemCountBuffer );
+	runRadixPasses( sortBufferUAV );
+
+	// Remember the order for next time
+	setDispatchInfo( (int)m_generation, 0, 0, 0 );
+	bindTemporalUAVs( sortBufferUAV, false );
+	m_context->CSSetShader( m_pCSTemporalRecordRanks, nullptr, 0 );
+	m_context->DispatchIndirect( m_pTemporalArgsBuffer, TEMPORAL_ARGS_ITEMS * argsStride );
+	unbindTemporalUAVs();
+
+	m_context->CopyResource( m_pPrevCountCB, itemCountBuffer );
+	m_generation++;
+}
+
+// Write the args for one group per itemsPerGroup of the items in the count buffer bound to b0
+void SortLib::initGroupArgs( int slot, int itemsPerGroup )
+{
+	setDispatchInfo( slot * 4, itemsPerGroup, 0, 0 );
+
+	m_context->CSSetUnorderedAccessViews( 0, 1, &m_pTemporalArgsBufferUAV, nullptr );
+	m_context->CSSetShader( m_pCSGroupInitArgs, nullptr, 0 );
+	m_context->Dispatch( 1, 1, 1 );
+}
+
+// Bind the buffers used by the temporal kernels. The indirect args are left unbound as they are only written by ChooseSort
+void SortLib::bindTemporalUAVs( ID3D11UnorderedAccessView* sortBufferUAV, bool resetCounters )
+{
+	ID3D11UnorderedAccessView* uavs[] = { sortBufferUAV, m_pSparseBufferUAV, m_pNewBufferUAV, m_pRankBufferUAV, m_pSurvivorBufferUAV, m_pDisorderBufferUAV };
+	UINT initialCounts[] = { (UINT)-1, 0, 0, (UINT)-1, (UINT)-1, (UINT)-1 };
+	m_context->CSSetUnorderedAccessViews( 0, ARRAYSIZE( uavs ), uavs, resetCounters ? initialCounts : nullptr );
+}
+
+void SortLib::unbindTemporalUAVs()
+{
+	ID3D11UnorderedAccessView* nullUAVs[] = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+	m_context->CSSetUnorderedAccessViews( 0, ARRAYSIZE( nullUAVs ), nullUAVs, nullptr );
+}
+
+void SortLib::createTemporalBuffers( unsigned int maxSize, ID3D11Buffer* itemCountBuffer )
+{
+	SAFE_RELEASE( m_pSparseBufferUAV );
+	SAFE_RELEASE( m_pSparseBuffer );
+	SAFE_RELEASE( m_pSurvivorBufferUAV );
+	SAFE_RELEASE( m_pSurvivorBuffer );
+	SAFE_RELEASE( m_pNewBufferUAV );
+	SAFE_RELEASE( m_pNewBuffer );
+	SAFE_RELEASE( m_pRankBufferUAV );
+	SAFE_RELEASE( m_pRankBuffer );
+	SAFE_RELEASE( m_pDisorderBufferUAV );
+	SAFE_RELEASE( m_pDisorderBuffer );
+	SAFE_RELEASE( m_pTemporalArgsBufferUAV );
+	SAFE_RELEASE( m_pTemporalArgsBuffer );
+	SAFE_RELEASE( m_pPrevCountCB );
+	SAFE_RELEASE( m_pSurvivorCountCB );
+	SAFE_RELEASE( m_pNewCountCB );
+
+	m_temporalCapacity = maxSize;
+
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory( &desc, sizeof( desc ) );
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.ByteWidth = m_itemSize * maxSize;
+	desc.StructureByteStride = m_itemSize;
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uav;
+	ZeroMemory( &uav, sizeof( uav ) );
+	uav.Format = DXGI_FORMAT_UNKNOWN;
+	uav.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	uav.Buffer.NumElements = maxSize;
+
+	m_device->CreateBuffer( &desc, nullptr, &m_pSurvivorBuffer );
+	m_device->CreateUnorderedAccessView( m_pSurvivorBuffer, &uav, &m_pSurvivorBufferUAV );
+
+	uav.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_COUNTER;
+	m_device->CreateBuffer( &desc, nullptr, &m_pSparseBuffer );
+	m_device->CreateUnorderedAccessView( m_pSparseBuffer, &uav, &m_pSparseBufferUAV );
+	m_device->CreateBuffer( &desc, nullptr, &m_pNewBuffer );
+	m_device->CreateUnorderedAccessView( m_pNewBuffer, &uav, &m_pNewBufferUAV );
+
+	// Indexed by particle index, which SortLib assumes is less than maxSize
+	uav.Buffer.Flags = 0;
+	desc.ByteWidth = 2 * sizeof( UINT ) * maxSize;
+	desc.StructureByteStride = 2 * sizeof( UINT );
+	m_device->CreateBuffer( &desc, nullptr, &m_pRankBuffer );
+	m_device->CreateUnorderedAccessView( m_pRankBuffer, &uav, &m_pRankBufferUAV );
+
+	// Generation zero is never used so nothing matches until the first sort has recorded its ranks
+	UINT zeros[] = { 0, 0, 0, 0 };
+	m_context->ClearUnorderedAccessViewUint( m_pRankBufferUAV, zeros );
+
+	desc.ByteWidth = sizeof( UINT );
+	desc.StructureByteStride = 0;
+	desc.MiscFlags = 0;
+	m_device->CreateBuffer( &desc, nullptr, &m_pDisorderBuffer );
+
+	uav.Format = DXGI_FORMAT_R32_UINT;
+	uav.Buffer.NumElements = 1;
+	m_device->CreateUnorderedAccessView( m_pDisorderBuffer, &uav, &m_pDisorderBufferUAV );
+
+	desc.ByteWidth = TEMPORAL_ARGS_SLOTS * 4 * sizeof( UINT );
+	desc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
+	m_device->CreateBuffer( &desc, nullptr, &m_pTemporalArgsBuffer );
+
+	uav.Buffer.NumElements = TEMPORAL_ARGS_SLOTS * 4;
+	m_device->CreateUnorderedAccessView( m_pTemporalArgsBuffer, &uav, &m_pTemporalArgsBufferUAV );
+
+	// The counts are copied around on the GPU so they match the layout of the item count buffer. The previous sort starts out empty
+	D3D11_BUFFER_DESC countDesc;
+	itemCountBuffer->GetDesc( &countDesc );
+
+	std::vector<char> emptyCount( countDesc.ByteWidth, 0 );
+	D3D11_SUBRESOURCE_DATA data;
+	ZeroMemory( &data, sizeof( data ) );
+	data.pSysMem = emptyCount.data();
+	m_device->CreateBuffer( &countDesc, &data, &m_pPrevCountCB );
+	m_device->CreateBuffer( &countDesc, nullptr, &m_pSurvivorCountCB );
+	m_device->CreateBuffer( &countDesc, nullptr, &m_pNewCountCB );
+}
+
+void SortLib::setDispatchInfo( int x, int y, int z, int w )
+{
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	m_context->Map( m_pcbDispatchInfo, 0, D3D11_MAP_WRITE_DISCARD, 0, &MappedResource );
+	SortConstants* sc = (SortConstants*)MappedResource.pData;
+	sc->x = x;
+	sc->y = y;
+	sc->z = z;
+	sc->w = w;
+	m_context->Unmap( m_pcbDispatchInfo, 0 );
+}
+
+// The defines followed by the ones that select the key format in Shaders/SortKeys.h, null terminated
+std::vector<D3D10_SHADER_MACRO> SortLib::keyDefines( const D3D10_SHADER_MACRO* defines ) const
+{
+	std::vector<D3D10_SHADER_MACRO> result;
+	for ( ; defines && defines->Name; defines++ )
+		result.push_back( *defines );
+
+	if ( m_packedIndexBits )
+	{
+		D3D10_SHADER_MACRO packed[] = { { "PACKED_SORT_KEYS", "1" }, { "SORT_KEY_INDEX_BITS", m_indexBitsString } };
+		result.insert( result.end(), packed, packed + ARRAYSIZE( packed ) );
+	}
+
+	D3D10_SHADER_MACRO terminator = { nullptr, nullptr };
+	result.push_back( terminator );
+	return result;
+}
+
+// A counting sort on each digit in turn, exactly as the GPU passes do it
+void SortLib::referenceSort( Item* items, unsigned int count )
+{
+	std::vector<Item> temp( count );
+	Item* source = items;
+	Item* destination = temp.data();
+
+	for ( int shift = 0; shift < 32; shift += RADIX_BITS )
+	{
+		unsigned int offsets[ RADIX_DIGITS ] = {};
+		for ( unsigned int i = 0; i < count; i++ )
+		{
+			offsets[ ( radixKey( source[ i ].distance ) >> shift ) & ( RADIX_DIGITS - 1 ) ]++;
+		}
+
+		unsigned int running = 0;
+		for ( int d = 0; d < RADIX_DIGITS; d++ )
+		{
+			unsigned int digitCount = offsets[ d ];
+			offsets[ d ] = running;
+			running += digitCount;
+		}
+
+		for ( unsigned int i = 0; i < count; i++ )
+		{
+			destination[ offsets[ ( radixKey( source[ i ].distance ) >> shift ) & ( RADIX_DIGITS - 1 ) ]++ ] = source[ i ];
+		}
+
+		std::swap( source, destination );
+	}
+
+	// As on the GPU the even number of passes leaves the result back in items
+}
+
 #ifdef _DEBUG
 
 #pragma pack(push,1)
@@ -327,4 +941,101 @@ void SortLib::manualValidate( unsigned int size, ID3D11UnorderedAccessView* pUAV
     srcResource->Release();
     readBackBuffer->Release();
 }
+// Copy the first itemCount items of a sort buffer back to the CPU
+void SortLib::readBack( ID3D11UnorderedAccessView* pUAV, ID3D11Buffer* itemCountBuffer, std::vector<Item>& items )
+{
+	ID3D11Resource* srcResource;
+	pUAV->GetResource( &srcResource );
+	ID3D11Buffer* srcBuffer;
+	srcResource->QueryInterface( IID_ID3D11Buffer, (void**)&srcBuffer );
+
+	D3D11_BUFFER_DESC bDesc;
+	srcBuffer->GetDesc( &bDesc );
+	bDesc.Usage = D3D11_USAGE_STAGING;
+	bDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	bDesc.BindFlags = 0;
+	bDesc.MiscFlags = 0;
+	ID3D11Buffer* readBackBuffer = nullptr;
+	m_device->CreateBuffer( &bDesc, nullptr, &readBackBuffer );
+	m_context->CopyResource( readBackBuffer, srcBuffer );
+
+	D3D11_BUFFER_DESC countDesc;
+	itemCountBuffer->GetDesc( &countDesc );
+	countDesc.Usage = D3D11_USAGE_STAGING;
+	countDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	countDesc.BindFlags = 0;
+	ID3D11Buffer* countReadBackBuffer = nullptr;
+	m_device->CreateBuffer( &countDesc, nullptr, &countReadBackBuffer );
+	m_context->CopyResource( countReadBackBuffer, itemCountBuffer );
+
+	D3D11_MAPPED_SUBRESOURCE MappedResource = {0};
+	m_context->Map( countReadBackBuffer, 0, D3D11_MAP_READ, 0, &MappedResource );
+	unsigned int count = std::min( *(unsigned int*)MappedResource.pData, bDesc.ByteWidth / m_itemSize );
+	m_context->Unmap( countReadBackBuffer, 0 );
+
+	m_context->Map( readBackBuffer, 0, D3D11_MAP_READ, 0, &MappedResource );
+	if ( m_packedIndexBits )
+	{
+		// Unpack each key into an Item that referenceSort puts in the same place as the GPU does. The distance gets the key bits the 
+		// radix sort looks at, flipped back into a float
+		const unsigned int* keys = (const unsigned int*)MappedResource.pData;
+		unsigned int sortedBits = 0xffffffff << m_radixFirstShift;
+		items.resize( count );
+		for ( unsigned int i = 0; i < count; i++ )
+		{
+			unsigned int key = keys[ i ] & sortedBits;
+			unsigned int bits = ( key & 0x80000000 ) ? key ^ 0x80000000 : ~key;
+			memcpy( &items[ i ].distance, &bits, sizeof( bits ) );
+			items[ i ].index = (float)( keys[ i ] & ( ( 1u << m_packedIndexBits ) - 1 ) );
+		}
+	}
+	else
+	{
+		const Item* data = (const Item*)MappedResource.pData;
+		items.assign( data, data + count );
+	}
+	m_context->Unmap( readBackBuffer, 0 );
+
+	SAFE_RELEASE( countReadBackBuffer );
+	SAFE_RELEASE( readBackBuffer );
+	SAFE_RELEASE( srcBuffer );
+	SAFE_RELEASE( srcResource );
+}
+
+// Check the GPU sort against the reference. The radix sort must match exactly, including the order of equal distances. The temporal 
+// sort orders equal distances by their previous order so only the distances and the set of indices have to match
+void SortLib::validateSort( const std::vector<Item>& unsorted, ID3D11UnorderedAccessView* pUAV, ID3D11Buffer* itemCountBuffer )
+{
+	std::vector<Item> expected( unsorted );
+	if ( !expected.empty() )
+		referenceSort( &expected[ 0 ], (unsigned int)expected.size() );
+
+	std::vector<Item> sorted;
+	readBack( pUAV, itemCountBuffer, sorted );
+
+	bool correct = sorted.size() == expected.size();
+	if ( correct && m_algorithm == Algorithm_Temporal )
+	{
+		std::vector<float> sortedIndices, expectedIndices;
+		for ( size_t i = 0; i < sorted.size(); i++ )
+		{
+			correct &= radixKey( sorted[ i ].distance ) == radixKey( expected[ i ].distance );
+			sortedIndices.push_back( sorted[ i ].index );
+			expectedIndices.push_back( expected[ i ].index );
+		}
+		std::sort( sortedIndices.begin(), sortedIndices.end() );
+		std::sort( expectedIndices.begin(), expectedIndices.end() );
+		correct &= sortedIndices == expectedIndices;
+	}
+	else if ( correct && !sorted.empty() )
+	{
+		correct = memcmp( &sorted[ 0 ], &expected[ 0 ], sorted.size() * sizeof( Item ) ) == 0;
+	}
+
+	if ( !correct )
+	{
+		OutputDebugStringA( "SortLib: GPU sort does not match the reference sort\n" );
+	}
+	assert( correct );
+}
 #endif
@@ -21,22 +21,62 @@
 //
 #pragma once
 
+#include <vector>
+
 class SortLib
 {
 public:
+	// The algorithm a SortLib instance uses, chosen at init
+	enum Algorithm
+	{
+		Algorithm_Bitonic,		// Bitonic merge sort. Pads to a power of two and handles at most MAX_NUM_TG * 512 items
+		Algorithm_Radix,		// Stable LSD radix sort. O(n) work and no size limit beyond memory
+		Algorithm_Temporal		// Reuses the previous frame's order, only sorting the new items and merging them in. Falls back to 
+								// the radix sort when the old order has changed too much. Expects the same list to be sorted each frame
+	};
+
+	// An entry in the buffer being sorted. Items are sorted on distance, smallest first. With packed keys each entry is instead a 
+	// single uint, see Shaders/SortKeys.h
+	struct Item
+	{
+		float	distance;
+		float	index;
+	};
+
 	SortLib();
 	virtual ~SortLib();
 
-	HRESULT init( ID3D11Device* device, ID3D11DeviceContext* context );
+	// A non-zero packedIndexBits sorts packed uint keys with the index in that many low bits instead of Items
+	HRESULT init( ID3D11Device* device, ID3D11DeviceContext* context, Algorithm algorithm = Algorithm_Bitonic, unsigned int packedIndexBits = 0 );
 	void run( unsigned int maxSize, ID3D11UnorderedAccessView* sortBufferUAV, ID3D11Buffer* itemCountBuffer );
 	void release();
 
+	// C++ version of the radix sort that produces exactly the same output as the GPU one, for validation
+	static void referenceSort( Item* items, unsigned int count );
+
 private:
 	bool sortInitial		( unsigned int maxSize );
 	bool sortIncremental	( unsigned int presorted, unsigned int maxSize );
 
+	void sortRadix			( unsigned int maxSize, ID3D11UnorderedAccessView* sortBufferUAV );
+	void initRadixArgs		();
+	void runRadixPasses		( ID3D11UnorderedAccessView* sortBufferUAV );
+	void runRadixCompaction	( ID3D11UnorderedAccessView* sourceUAV, ID3D11UnorderedAccessView* destinationUAV );
+	void createRadixBuffers	( unsigned int maxSize );
+
+	void sortTemporal			( unsigned int maxSize, ID3D11UnorderedAccessView* sortBufferUAV, ID3D11Buffer* itemCountBuffer );
+	void initGroupArgs			( int slot, int itemsPerGroup );
+	void bindTemporalUAVs		( ID3D11UnorderedAccessView* sortBufferUAV, bool resetCounters );
+	void unbindTemporalUAVs		();
+	void createTemporalBuffers	( unsigned int maxSize, ID3D11Buffer* itemCountBuffer );
+
+	void setDispatchInfo	( int x, int y, int z, int w );
+	std::vector<D3D10_SHADER_MACRO> keyDefines( const D3D10_SHADER_MACRO* defines ) const;
+
 #ifdef _DEBUG
     void manualValidate     ( unsigned int maxSize, ID3D11UnorderedAccessView* pUAV );
+	void readBack			( ID3D11UnorderedAccessView* pUAV, ID3D11Buffer* itemCountBuffer, std::vector<Item>& items );
+	void validateSort		( const std::vector<Item>& unsorted, ID3D11UnorderedAccessView* pUAV, ID3D11Buffer* itemCountBuffer );
 #endif
 
 private:
@@ -52,4 +92,51 @@ private:
 
 	ID3D11Buffer*					m_pIndirectSortArgsBuffer;
 	ID3D11UnorderedAccessView*		m_pIndirectSortArgsBufferUAV;
+
+	Algorithm						m_algorithm;
+	unsigned int					m_packedIndexBits;		// Zero when sorting Items
+	unsigned int					m_itemSize;				// Bytes per entry in the buffer being sorted
+	int								m_radixFirstShift;		// The lowest key bit the radix passes sort on. Packed keys skip most of the index bits
+	char							m_indexBitsString[ 8 ];	// m_packedIndexBits and m_radixFirstShift as shader defines
+	char							m_firstShiftString[ 8 ];
+
+	ID3D11ComputeShader*			m_pCSRadixInitArgs;		// CS to write the indirect args for the radix count and scatter passes
+	ID3D11ComputeShader*			m_pCSRadixCount;		// CS to build the digit histogram of each block
+	ID3D11ComputeShader*			m_pCSRadixScan;			// CS to prefix sum the histograms into output offsets
+	ID3D11ComputeShader*			m_pCSRadixScatter;		// CS to write each block's items to their sorted position
+
+	unsigned int					m_radixCapacity;		// Number of items the radix buffers are sized for
+	ID3D11Buffer*					m_pRadixTempBuffer;		// Ping-pong buffer for the radix passes
+	ID3D11UnorderedAccessView*		m_pRadixTempBufferUAV;
+	ID3D11Buffer*					m_pRadixHistogramBuffer;
+	ID3D11UnorderedAccessView*		m_pRadixHistogramBufferUAV;
+
+	ID3D11ComputeShader*			m_pCSRadixCompactCount;		// Radix count and scatter variants that move the holes in a sparse list to the end
+	ID3D11ComputeShader*			m_pCSRadixCompactScatter;
+	ID3D11ComputeShader*			m_pCSGroupInitArgs;			// CS to write the indirect args for one group per N items
+	ID3D11ComputeShader*			m_pCSTemporalClearSparse;
+	ID3D11ComputeShader*			m_pCSTemporalClassify;
+	ID3D11ComputeShader*			m_pCSTemporalOddEvenStep;
+	ID3D11ComputeShader*			m_pCSTemporalCountInversions;
+	ID3D11ComputeShader*			m_pCSTemporalChooseSort;
+	ID3D11ComputeShader*			m_pCSTemporalMerge;
+	ID3D11ComputeShader*			m_pCSTemporalRecordRanks;
+
+	unsigned int					m_temporalCapacity;			// Number of items the temporal buffers are sized for
+	unsigned int					m_generation;				// Incremented every temporal sort so stale ranks are ignored
+	ID3D11Buffer*					m_pSparseBuffer;			// Survivors at their previous position, with a counter of how many there are
+	ID3D11UnorderedAccessView*		m_pSparseBufferUAV;
+	ID3D11Buffer*					m_pSurvivorBuffer;			// Survivors compacted, in their previous order
+	ID3D11UnorderedAccessView*		m_pSurvivorBufferUAV;
+	ID3D11Buffer*					m_pNewBuffer;				// Items that weren't in the previous sort, with a counter
+	ID3D11UnorderedAccessView*		m_pNewBufferUAV;
+	ID3D11Buffer*					m_pRankBuffer;				// Per particle index, its position in the last sort and that sort's generation
+	ID3D11UnorderedAccessView*		m_pRankBufferUAV;
+	ID3D11Buffer*					m_pDisorderBuffer;			// Inversions left among the survivors after the odd-even passes
+	ID3D11UnorderedAccessView*		m_pDisorderBufferUAV;
+	ID3D11Buffer*					m_pTemporalArgsBuffer;		// Indirect args for the temporal kernels, see the TEMPORAL_ARGS_ slots
+	ID3D11UnorderedAccessView*		m_pTemporalArgsBufferUAV;
+	ID3D11Buffer*					m_pPrevCountCB;				// Item counts in the same layout as the item count buffer
+	ID3D11Buffer*					m_pSurvivorCountCB;
+	ID3D11Buffer*					m_pNewCountCB;
 };
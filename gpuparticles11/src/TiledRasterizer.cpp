@@ -0,0 +1,557 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#include "TiledRasterizer.h"
+#include "CPUParticleSimulation.h"
+#include "RenderBufferFormat.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <math.h>
+
+
+// The particle data each tile needs, gathered once per tile like the LDS cache in TiledRendering.hlsl
+struct TileParticle
+{
+	DirectX::XMFLOAT4	m_TintAndAlpha;
+	DirectX::XMFLOAT3	m_Position;
+	float				m_Radius;
+	float				m_EmitterNdotL;
+	float				m_TextureOffset;
+	bool				m_UsesStreaks;
+	DirectX::XMFLOAT2	m_Velocity;			// Normalized
+	float				m_StreakLength;
+	float				m_Sin;
+	float				m_Cos;
+};
+
+
+// Convert to int the way the GPU does, saturating out of range values and turning NaNs into zero
+static inline int FloatToInt( float f )
+{
+	if ( f != f )
+		return 0;
+	return (int)std::min( std::max( f, -1073741824.0f ), 1073741824.0f );
+}
+
+
+// Integer division that rounds towards negative infinity
+static inline int FloorDiv( int a, int b )
+{
+	return a >= 0 ? a / b : -( ( b - 1 - a ) / b );
+}
+
+
+static inline float Saturate( float f )
+{
+	return std::min( std::max( f, 0.0f ), 1.0f );
+}
+
+
+// Project a view space point with the transposed projection matrix from the constant buffer and return its pixel position the way 
+// IsParticleVisibleInTile in CullingCS.hlsl does
+static inline void ProjectToPixel( DirectX::FXMMATRIX projection, const PER_FRAME_CONSTANT_BUFFER& constants, float x, float y, float z, int& pixelX, int& pixelY )
+{
+	DirectX::XMFLOAT4 p;
+	DirectX::XMStoreFloat4( &p, DirectX::XMVector4Transform( DirectX::XMVectorSet( x, y, z, 1.0f ), projection ) );
+
+	float screenX = ( p.x / p.w ) * 0.5f + 0.5f;
+	float screenY = 1.0f - ( ( p.y / p.w ) * 0.5f + 0.5f );
+
+	pixelX = FloatToInt( screenX * (float)constants.m_ScreenWidth );
+	pixelY = FloatToInt( screenY * (float)constants.m_ScreenHeight );
+}
+
+
+// Bilinear sample at the top mip with clamp addressing
+static DirectX::XMFLOAT4 SampleTexture( const TiledRasterizerTexture& texture, float u, float v )
+{
+	if ( !texture.m_pTexels || texture.m_Width <= 0 || texture.m_Height <= 0 )
+		return DirectX::XMFLOAT4( 1.0f, 1.0f, 1.0f, 1.0f );
+
+	float x = u * (float)texture.m_Width - 0.5f;
+	float y = v * (float)texture.m_Height - 0.5f;
+	float fx = floorf( x );
+	float fy = floorf( y );
+	float wx = x - fx;
+	float wy = y - fy;
+
+	int x0 = std::min( std::max( (int)fx, 0 ), texture.m_Width - 1 );
+	int y0 = std::min( std::max( (int)fy, 0 ), texture.m_Height - 1 );
+	int x1 = std::min( std::max( (int)fx + 1, 0 ), texture.m_Width - 1 );
+	int y1 = std::min( std::max( (int)fy + 1, 0 ), texture.m_Height - 1 );
+
+	const DirectX::XMFLOAT4& t00 = texture.m_pTexels[ y0 * texture.m_Width + x0 ];
+	const DirectX::XMFLOAT4& t10 = texture.m_pTexels[ y0 * texture.m_Width + x1 ];
+	const DirectX::XMFLOAT4& t01 = texture.m_pTexels[ y1 * texture.m_Width + x0 ];
+	const DirectX::XMFLOAT4& t11 = texture.m_pTexels[ y1 * texture.m_Width + x1 ];
+
+	float w00 = ( 1.0f - wx ) * ( 1.0f - wy );
+	float w10 = wx * ( 1.0f - wy );
+	float w01 = ( 1.0f - wx ) * wy;
+	float w11 = wx * wy;
+
+	return DirectX::XMFLOAT4( t00.x * w00 + t10.x * w10 + t01.x * w01 + t11.x * w11,
+							  t00.y * w00 + t10.y * w10 + t01.y * w01 + t11.y * w11,
+							  t00.z * w00 + t10.z * w10 + t01.z * w01 + t11.z * w11,
+							  t00.w * w00 + t10.w * w10 + t01.w * w01 + t11.w * w11 );
+}
+
+
+// The particle's contribution to a pixel, see calcBillboardParticleColor in TiledRendering.hlsl
+static DirectX::XMFLOAT4 CalcBillboardParticleColor( const PER_FRAME_CONSTANT_BUFFER& constants, int flags, const TiledRasterizerTexture& texture, const TileParticle& particle, const DirectX::XMFLOAT3& rayDir, float viewSpaceDepth )
+{
+	const DirectX::XMFLOAT3& center = particle.m_Position;
+
+	// No contribution if it is behind the opaque scene
+	if ( center.z > viewSpaceDepth )
+		return DirectX::XMFLOAT4( 0.0f, 0.0f, 0.0f, 0.0f );
+
+	// Soft particle fade and the tint
+	float depthFade = Saturate( ( viewSpaceDepth - center.z ) / particle.m_Radius );
+	DirectX::XMFLOAT4 color = particle.m_TintAndAlpha;
+	color.w *= depthFade;
+
+	// The point on the billboard's plane for this pixel
+	float t = center.z / rayDir.z;
+	float pointX = t * rayDir.x;
+	float pointY = t * rayDir.y;
+
+	float vecToSurfaceX, vecToSurfaceY;
+	float rotatedX, rotatedY;
+	if ( ( flags & IParticleSystem::PF_Streaks ) && particle.m_UsesStreaks )
+	{
+		float extrusionX = particle.m_Velocity.x;
+		float extrusionY = particle.m_Velocity.y;
+		float tangentX = extrusionY;
+		float tangentY = -extrusionX;
+
+		float toCentreX = pointX - center.x;
+		float toCentreY = pointY - center.y;
+
+		vecToSurfaceX = ( tangentX * toCentreX + tangentY * toCentreY ) / particle.m_Radius;
+		vecToSurfaceY = ( extrusionX * toCentreX + extrusionY * toCentreY ) / particle.m_StreakLength;
+
+		rotatedX = vecToSurfaceX;
+		rotatedY = vecToSurfaceY;
+	}
+	else
+	{
+		vecToSurfaceX = ( pointX - center.x ) / particle.m_Radius;
+		vecToSurfaceY = ( pointY - center.y ) / particle.m_Radius;
+
+		float s = particle.m_Sin;
+		float c = particle.m_Cos;
+		rotatedX = vecToSurfaceX * c - vecToSurfaceY * s;
+		rotatedY = vecToSurfaceX * s + vecToSurfaceY * c;
+	}
+
+	float rotatedU = 0.5f * rotatedX + 0.5f;
+	float rotatedV = 0.5f * rotatedY + 0.5f;
+	if ( rotatedU < 0.0f || rotatedV < 0.0f || rotatedU > 1.0f || rotatedV > 1.0f )
+		return DirectX::XMFLOAT4( 0.0f, 0.0f, 0.0f, 0.0f );
+
+	// Shift into the atlas and apply the texture
+	DirectX::XMFLOAT4 texel = SampleTexture( texture, rotatedU * 0.5f + particle.m_TextureOffset, rotatedV );
+	color.x *= texel.x;
+	color.y *= texel.y;
+	color.z *= texel.z;
+	color.w *= texel.w;
+
+	if ( flags & IParticleSystem::PF_NoLighting )
+		return color;
+
+	float ndotl = 0.7f;
+	if ( !( flags & IParticleSystem::PF_CheapLighting ) )
+	{
+		// Model the particle as a sphere using the unrotated vector to the surface
+		const float pi = 3.1415926535897932384626433832795f;
+		float u = 0.5f * vecToSurfaceX + 0.5f;
+		float v = 0.5f * vecToSurfaceY + 0.5f;
+
+		DirectX::XMVECTOR n = DirectX::XMVector3Normalize( DirectX::XMVectorSet( -cosf( pi * u ), -cosf( pi * v ), sinf( pi * sqrtf( u * u + v * v ) ), 0.0f ) );
+		ndotl = Saturate( DirectX::XMVectorGetX( DirectX::XMVector3Dot( constants.m_SunDirectionVS, n ) ) );
+	}
+
+	// Mix with the per-emitter term then light with ambient plus directional
+	ndotl = ndotl + ( particle.m_EmitterNdotL - ndotl ) * 0.5f;
+
+	DirectX::XMFLOAT4 ambient, sun;
+	DirectX::XMStoreFloat4( &ambient, constants.m_AmbientColor );
+	DirectX::XMStoreFloat4( &sun, constants.m_SunColor );
+
+	color.x *= ambient.x + ndotl * sun.x;
+	color.y *= ambient.y + ndotl * sun.y;
+	color.z *= ambient.z + ndotl * sun.z;
+	return color;
+}
+
+
+void BuildTileLists( const PER_FRAME_CONSTANT_BUFFER& constants, int tileSize, const DirectX::XMFLOAT4* viewSpacePositions, const float* maxRadii, const UINT* aliveIndices, int numAlive, TiledRasterizerTileLists& lists, JobSystem* pJobSystem )
+{
+	lists.m_TileSize = tileSize;
+	lists.m_NumTilesX = ( constants.m_ScreenWidth + tileSize - 1 ) / tileSize;
+	lists.m_NumTilesY = ( constants.m_ScreenHeight + tileSize - 1 ) / tileSize;
+
+	const int numTiles = lists.m_NumTilesX * lists.m_NumTilesY;
+	const int numTilesX = lists.m_NumTilesX;
+	const int numTilesY = lists.m_NumTilesY;
+
+	// The inclusive range of tiles each particle overlaps. Empty ranges have min > max
+	std::vector<int> ranges( numAlive * 4 );
+
+	DirectX::XMMATRIX projection = DirectX::XMMatrixTranspose( constants.m_Projection );
+
+	JobSystem::RangeFunction findRanges = [&]( int begin, int end )
+	{
+		for ( int i = begin; i < end; i++ )
+		{
+			UINT index = aliveIndices[ i ];
+			const DirectX::XMFLOAT4& center = viewSpacePositions[ index ];
+			float r = maxRadii[ index ];
+
+			int* range = &ranges[ i * 4 ];
+			range[ 0 ] = range[ 1 ] = 0;
+			range[ 2 ] = range[ 3 ] = -1;
+
+			// Near plane
+			if ( -center.z >= r )
+				continue;
+
+			// The top left and bottom right of the view space bounding box
+			int pos0X, pos0Y, pos1X, pos1Y;
+			ProjectToPixel( projection, constants, center.x - r, center.y + r, center.z, pos0X, pos0Y );
+			ProjectToPixel( projection, constants, center.x + r, center.y - r, center.z, pos1X, pos1Y );
+
+			// A tile is overlapped if pos1 > tile * tileSize && pos0 < ( tile + 1 ) * tileSize
+			range[ 0 ] = std::max( FloorDiv( pos0X, tileSize ), 0 );
+			range[ 1 ] = std::max( FloorDiv( pos0Y, tileSize ), 0 );
+			range[ 2 ] = std::min( FloorDiv( pos1X - 1, tileSize ), numTilesX - 1 );
+			range[ 3 ] = std::min( FloorDiv( pos1Y - 1, tileSize ), numTilesY - 1 );
+		}
+	};
+
+	if ( pJobSystem )
+		pJobSystem->ParallelFor( numAlive, 1024, findRanges );
+	else
+		findRanges( 0, numAlive );
+
+	// Count, scan and scatter in alive list order like the GPU passes
+	lists.m_Counts.assign( numTiles, 0 );
+	for ( int i = 0; i < numAlive; i++ )
+	{
+		const int* range = &ranges[ i * 4 ];
+		for ( int tileY = range[ 1 ]; tileY <= range[ 3 ]; tileY++ )
+		{
+			for ( int tileX = range[ 0 ]; tileX <= range[ 2 ]; tileX++ )
+			{
+				lists.m_Counts[ tileY * numTilesX + tileX ]++;
+			}
+		}
+	}
+
+	lists.m_Offsets.resize( numTiles + 1 );
+	UINT total = 0;
+	for ( int i = 0; i < numTiles; i++ )
+	{
+		lists.m_Offsets[ i ] = total;
+		total += lists.m_Counts[ i ];
+	}
+	lists.m_Offsets[ numTiles ] = total;
+
+	lists.m_Indices.resize( total );
+	std::vector<UINT> cursors( lists.m_Offsets.begin(), lists.m_Offsets.end() - 1 );
+	for ( int i = 0; i < numAlive; i++ )
+	{
+		const int* range = &ranges[ i * 4 ];
+		for ( int tileY = range[ 1 ]; tileY <= range[ 3 ]; tileY++ )
+		{
+			for ( int tileX = range[ 0 ]; tileX <= range[ 2 ]; tileX++ )
+			{
+				lists.m_Indices[ cursors[ tileY * numTilesX + tileX ]++ ] = aliveIndices[ i ];
+			}
+		}
+	}
+
+	// Sort each list front to back. The sort is stable so equal depths keep their alive list order
+	JobSystem::RangeFunction sortTiles = [&]( int begin, int end )
+	{
+		for ( int tile = begin; tile < end; tile++ )
+		{
+			UINT* first = lists.m_Indices.data() + lists.m_Offsets[ tile ];
+			UINT* last = first + lists.m_Counts[ tile ];
+			std::stable_sort( first, last, [&]( UINT a, UINT b ) { return viewSpacePositions[ a ].z < viewSpacePositions[ b ].z; } );
+		}
+	};
+
+	if ( pJobSystem )
+		pJobSystem->ParallelFor( numTiles, 16, sortTiles );
+	else
+		sortTiles( 0, numTiles );
+}
+
+
+void RasterizeTiles( const PER_FRAME_CONSTANT_BUFFER& constants, int flags, const TiledRasterizerTileLists& lists, const CPUParticlePartA* particles, const DirectX::XMFLOAT4* viewSpacePositions, const float* depth, const TiledRasterizerTexture& texture, DirectX::XMFLOAT4* output, JobSystem* pJobSystem )
+{
+	const int screenWidth = constants.m_ScreenWidth;
+	const int screenHeight = constants.m_ScreenHeight;
+	const int numTiles = lists.m_NumTilesX * lists.m_NumTilesY;
+
+	DirectX::XMMATRIX projectionInv = DirectX::XMMatrixTranspose( constants.m_ProjectionInv );
+
+	JobSystem::RangeFunction renderTiles = [&]( int begin, int end )
+	{
+		std::vector<TileParticle> tileParticles;
+
+		for ( int tile = begin; tile < end; tile++ )
+		{
+			// Gather the tile's particles
+			const UINT* list = lists.m_Indices.data() + lists.m_Offsets[ tile ];
+			const int numParticles = (int)lists.m_Counts[ tile ];
+
+			tileParticles.resize( numParticles );
+			for ( int i = 0; i < numParticles; i++ )
+			{
+				UINT index = list[ i ];
+				const CPUParticlePartA& pa = particles[ index ];
+				const DirectX::XMFLOAT4& position = viewSpacePositions[ index ];
+				TileParticle& p = tileParticles[ i ];
+
+				p.m_TintAndAlpha = pa.m_TintAndAlpha;
+				p.m_Position = DirectX::XMFLOAT3( position.x, position.y, position.z );
+				p.m_Radius = position.w;
+				p.m_EmitterNdotL = pa.m_EmitterNdotL;
+				p.m_TextureOffset = (float)( ( pa.m_EmitterProperties & 0x000f0000 ) >> 16 ) / 2.0f;
+				p.m_UsesStreaks = ( ( pa.m_EmitterProperties >> 24 ) & 0x01 ) != 0;
+
+				float speed = sqrtf( pa.m_VelocityXY.x * pa.m_VelocityXY.x + pa.m_VelocityXY.y * pa.m_VelocityXY.y );
+				p.m_Velocity = speed > 0.0f ? DirectX::XMFLOAT2( pa.m_VelocityXY.x / speed, pa.m_VelocityXY.y / speed ) : DirectX::XMFLOAT2( 0.0f, 0.0f );
+				p.m_StreakLength = position.w * std::max( 1.0f, 0.1f * speed );
+
+				p.m_Sin = sinf( pa.m_Rotation );
+				p.m_Cos = cosf( pa.m_Rotation );
+			}
+
+			const int tileX = tile % lists.m_NumTilesX;
+			const int tileY = tile / lists.m_NumTilesX;
+			const int startX = tileX * lists.m_TileSize;
+			const int startY = tileY * lists.m_TileSize;
+			const int endX = std::min( startX + lists.m_TileSize, screenWidth );
+			const int endY = std::min( startY + lists.m_TileSize, screenHeight );
+
+			for ( int y = startY; y < endY; y++ )
+			{
+				for ( int x = startX; x < endX; x++ )
+				{
+					// Unproject the pixel centre at the opaque scene's depth
+					float pixelDepth = depth ? depth[ y * screenWidth + x ] : 1.0f;
+					float ndcX = 2.0f * ( ( (float)x + 0.5f ) / (float)screenWidth ) - 1.0f;
+					float ndcY = 2.0f * ( 1.0f - ( (float)y + 0.5f ) / (float)screenHeight ) - 1.0f;
+
+					DirectX::XMFLOAT4 viewSpacePos;
+					DirectX::XMStoreFloat4( &viewSpacePos, DirectX::XMVector4Transform( DirectX::XMVectorSet( ndcX, ndcY, pixelDepth, 1.0f ), projectionInv ) );
+					viewSpacePos.x /= viewSpacePos.w;
+					viewSpacePos.y /= viewSpacePos.w;
+					viewSpacePos.z /= viewSpacePos.w;
+
+					float viewSpaceDepth = viewSpacePos.z;
+
+					DirectX::XMFLOAT3 viewRay;
+					DirectX::XMStoreFloat3( &viewRay, DirectX::XMVector3Normalize( DirectX::XMVectorSet( viewSpacePos.x, viewSpacePos.y, viewSpacePos.z, 0.0f ) ) );
+
+					// Blend front to back, bailing out once the pixel is close enough to opaque
+					DirectX::XMFLOAT4 fcolor( 0.0f, 0.0f, 0.0f, 0.0f );
+					for ( int i = 0; i < numParticles; i++ )
+					{
+						DirectX::XMFLOAT4 color = CalcBillboardParticleColor( constants, flags, texture, tileParticles[ i ], viewRay, viewSpaceDepth );
+
+						float transmittance = 1.0f - fcolor.w;
+						fcolor.x += transmittance * ( color.w * color.x );
+						fcolor.y += transmittance * ( color.w * color.y );
+						fcolor.z += transmittance * ( color.w * color.z );
+						fcolor.w = color.w + ( 1.0f - color.w ) * fcolor.w;
+
+						if ( fcolor.w > constants.m_AlphaThreshold )
+						{
+							fcolor.w = 1.0f;
+							break;
+						}
+					}
+
+					output[ y * screenWidth + x ] = fcolor;
+				}
+			}
+		}
+	};
+
+	if ( pJobSystem )
+		pJobSystem->ParallelFor( numTiles, 1, renderTiles );
+	else
+		renderTiles( 0, numTiles );
+}
+
+
+void LoadRenderParticles( IParticleSystem::Layout layout, const void* data, int maxParticles, const UINT* indices, int numIndices, CPUParticlePartA* particles, JobSystem* pJobSystem )
+{
+	JobSystem::RangeFunction loadParticles = [&]( int begin, int end )
+	{
+		// Only the rendering half is read, so the compact layout's second array doesn't need to be there
+		CPUParticlePartB pb;
+		for ( int i = begin; i < end; i++ )
+		{
+			int index = (int)indices[ i ];
+			switch ( layout )
+			{
+				case IParticleSystem::Layout_SoA:		SoAParticleStorage( const_cast<void*>( data ), maxParticles ).Load( index, particles[ i ], pb ); break;
+				case IParticleSystem::Layout_Compact:	DecodeCompactParticlePartA( ( (const CompactParticlePartA*)data )[ index ], particles[ i ] ); break;
+				default:								particles[ i ] = ( (const CPUParticlePartA*)data )[ index ]; break;
+			}
+		}
+	};
+
+	if ( pJobSystem )
+		pJobSystem->ParallelFor( numIndices, 16384, loadParticles );
+	else
+		loadParticles( 0, numIndices );
+}
+
+
+// Multisampled textures can't be copied to a staging texture
+bool ReadBackTexture( ID3D11DeviceContext* pContext, ID3D11ShaderResourceView* srv, int bytesPerTexel, std::vector<BYTE>& texels, D3D11_TEXTURE2D_DESC& desc )
+{
+	ID3D11Resource* resource = nullptr;
+	srv->GetResource( &resource );
+
+	ID3D11Texture2D* texture = nullptr;
+	resource->QueryInterface( __uuidof( ID3D11Texture2D ), (void**)&texture );
+	SAFE_RELEASE( resource );
+	if ( !texture )
+		return false;
+
+	texture->GetDesc( &desc );
+	if ( desc.SampleDesc.Count > 1 )
+	{
+		SAFE_RELEASE( texture );
+		return false;
+	}
+
+	D3D11_TEXTURE2D_DESC stagingDesc = desc;
+	stagingDesc.MipLevels = 1;
+	stagingDesc.ArraySize = 1;
+	stagingDesc.Usage = D3D11_USAGE_STAGING;
+	stagingDesc.BindFlags = 0;
+	stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	stagingDesc.MiscFlags = 0;
+
+	ID3D11Device* pDevice = nullptr;
+	pContext->GetDevice( &pDevice );
+
+	ID3D11Texture2D* stagingTexture = nullptr;
+	pDevice->CreateTexture2D( &stagingDesc, nullptr, &stagingTexture );
+	SAFE_RELEASE( pDevice );
+
+	if ( !stagingTexture )
+	{
+		SAFE_RELEASE( texture );
+		return false;
+	}
+
+	pContext->CopySubresourceRegion( stagingTexture, 0, 0, 0, 0, texture, 0, nullptr );
+	SAFE_RELEASE( texture );
+
+	UINT rowSize = desc.Width * bytesPerTexel;
+	texels.resize( rowSize * desc.Height );
+
+	D3D11_MAPPED_SUBRESOURCE MappedResource;
+	pContext->Map( stagingTexture, 0, D3D11_MAP_READ, 0, &MappedResource );
+	for ( UINT y = 0; y < desc.Height; y++ )
+	{
+		memcpy( &texels[ y * rowSize ], (const BYTE*)MappedResource.pData + y * MappedResource.RowPitch, rowSize );
+	}
+	pContext->Unmap( stagingTexture, 0 );
+
+	SAFE_RELEASE( stagingTexture );
+	return true;
+}
+
+
+void ReadBackTiledRasterizerTexture( ID3D11DeviceContext* pContext, ID3D11ShaderResourceView* srv, std::vector<DirectX::XMFLOAT4>& texels, TiledRasterizerTexture& texture )
+{
+	texture.m_Width = 0;
+	texture.m_Height = 0;
+	texture.m_pTexels = nullptr;
+
+	if ( !srv )
+		return;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+	srv->GetDesc( &srvDesc );
+
+	bool bgra = srvDesc.Format == DXGI_FORMAT_B8G8R8A8_UNORM;
+	if ( !bgra && srvDesc.Format != DXGI_FORMAT_R8G8B8A8_UNORM )
+		return;
+
+	std::vector<BYTE> data;
+	D3D11_TEXTURE2D_DESC desc;
+	if ( !ReadBackTexture( pContext, srv, 4, data, desc ) )
+		return;
+
+	int numTexels = (int)( desc.Width * desc.Height );
+	texels.resize( numTexels );
+	for ( int i = 0; i < numTexels; i++ )
+	{
+		const BYTE* src = &data[ i * 4 ];
+		float r = UNorm8ToFloat( src[ 0 ] );
+		float b = UNorm8ToFloat( src[ 2 ] );
+		texels[ i ] = DirectX::XMFLOAT4( bgra ? b : r, UNorm8ToFloat( src[ 1 ] ), bgra ? r : b, UNorm8ToFloat( src[ 3 ] ) );
+	}
+
+	texture.m_Width = (int)desc.Width;
+	texture.m_Height = (int)desc.Height;
+	texture.m_pTexels = numTexels ? &texels[ 0 ] : nullptr;
+}
+
+
+bool ReadBackTiledRasterizerDepth( ID3D11DeviceContext* pContext, ID3D11ShaderResourceView* srv, int width, int height, std::vector<float>& depth )
+{
+	if ( !srv )
+		return false;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
+	srv->GetDesc( &srvDesc );
+	if ( srvDesc.Format != DXGI_FORMAT_R32_FLOAT )
+		return false;
+
+	std::vector<BYTE> data;
+	D3D11_TEXTURE2D_DESC desc;
+	if ( !ReadBackTexture( pContext, srv, sizeof( float ), data, desc ) )
+		return false;
+
+	if ( (int)desc.Width < width || (int)desc.Height < height )
+		return false;
+
+	depth.resize( width * height );
+	for ( int y = 0; y < height; y++ )
+	{
+		memcpy( &depth[ y * width ], &data[ y * desc.Width * sizeof( float ) ], width * sizeof( float ) );
+	}
+
+	return true;
+}
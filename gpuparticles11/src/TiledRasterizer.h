@@ -0,0 +1,83 @@
+//
+// Copyright (c) 2016 Advanced Micro Devices, Inc. All rights reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+#ifndef __TILED_RASTERIZER_H__
+#define __TILED_RASTERIZER_H__
+
+
+#include "ParticleSystem.h"
+#include "ParticleFormat.h"
+#include <vector>
+
+
+class JobSystem;
+
+
+// Software reference for the tiled rendering path in CullingCS.hlsl and TiledRendering.hlsl. The tile lists are built and the 
+// particles blended front to back with the same math as the shaders, writing a float RGBA image. Tiles are independent so the work 
+// is split across a JobSystem a tile at a time. It gives a golden image to diff the GPU output against and can stand in for the GPU 
+// when there is no D3D11 device to render with
+
+// The per-tile particle lists, laid out like the GPU's tiled index buffer so lists read back from the GPU can be rendered as well. 
+// Tiles are numbered tileY * m_NumTilesX + tileX and the tiles on the last row and column can hang off the screen
+struct TiledRasterizerTileLists
+{
+	int					m_TileSize;			// Pixels, the same in X and Y
+	int					m_NumTilesX;
+	int					m_NumTilesY;
+
+	std::vector<UINT>	m_Counts;			// The number of particles in each tile's list
+	std::vector<UINT>	m_Offsets;			// Where each tile's list starts in m_Indices. One longer than the tile count, the last is the total
+	std::vector<UINT>	m_Indices;			// The particle indices of every list back to back, each sorted front to back
+};
+
+// The particle texture atlas as linear float RGBA texels, row by row. Sampled bilinearly with clamping at the top mip like 
+// g_samClampLinear. A null texel pointer samples as opaque white
+struct TiledRasterizerTexture
+{
+	int							m_Width;
+	int							m_Height;
+	const DirectX::XMFLOAT4*	m_pTexels;
+};
+
+// Cull the particles on the alive list into tiles of tileSize pixels with the screen space test from CullingCS.hlsl, then sort each 
+// list front to back by view space depth. The GPU's lists come out in the same depth order, but its bitonic sort isn't stable so 
+// particles at exactly the same depth can be the other way round
+void BuildTileLists( const PER_FRAME_CONSTANT_BUFFER& constants, int tileSize, const DirectX::XMFLOAT4* viewSpacePositions, const float* maxRadii, const UINT* aliveIndices, int numAlive, TiledRasterizerTileLists& lists, JobSystem* pJobSystem );
+
+// Render the tile lists into output, which holds m_ScreenWidth * m_ScreenHeight pixels. Flags takes the IParticleSystem lighting and 
+// streak flags. depth is the opaque scene's device depth buffer at screen resolution, or null for an empty scene. Passing a null job 
+// system renders on the calling thread
+void RasterizeTiles( const PER_FRAME_CONSTANT_BUFFER& constants, int flags, const TiledRasterizerTileLists& lists, const CPUParticlePartA* particles, const DirectX::XMFLOAT4* viewSpacePositions, const float* depth, const TiledRasterizerTexture& texture, DirectX::XMFLOAT4* output, JobSystem* pJobSystem );
+
+// Gather the rendering half of the particles at indices from a pool in layout, so particles[ i ] is the particle at indices[ i ]. Data 
+// is either the CPU simulation's pool or the GPU's particle buffer A, which start the same way in every layout
+void LoadRenderParticles( IParticleSystem::Layout layout, const void* data, int maxParticles, const UINT* indices, int numIndices, CPUParticlePartA* particles, JobSystem* pJobSystem );
+
+// Read back the inputs the rasterizer needs from the GPU. These stall until the GPU has caught up. ReadBackTexture copies the top mip 
+// of the texture behind a view packed row by row, and fails for multisampled textures. The atlas is converted from 8 bit RGBA or 
+// BGRA, and any other format samples as opaque white. The depth needs to be a single sampled R32_FLOAT view and fails otherwise
+bool ReadBackTexture( ID3D11DeviceContext* pContext, ID3D11ShaderResourceView* srv, int bytesPerTexel, std::vector<BYTE>& texels, D3D11_TEXTURE2D_DESC& desc );
+void ReadBackTiledRasterizerTexture( ID3D11DeviceContext* pContext, ID3D11ShaderResourceView* srv, std::vector<DirectX::XMFLOAT4>& texels, TiledRasterizerTexture& texture );
+bool ReadBackTiledRasterizerDepth( ID3D11DeviceContext* pContext, ID3D11ShaderResourceView* srv, int width, int height, std::vector<float>& depth );
+
+
+#endif